@@ -0,0 +1,919 @@
+/*
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+/*
+   vmapbench
+
+   generates a synthetic map from a handful of parameters and runs the
+   -bsp, -vis and -light stages of vmap on it, reading the -profile reports
+   and logs back to print throughput. the map only depends on the parameters
+   and the seed, so runs of different vmap builds can be compared line by line
+
+   usage: vmapbench [options]
+   -vmap <path>        vmap binary (default: vmap next to vmapbench)
+   -dir <path>         work directory (default: vmapbench.tmp)
+   -rooms <N>          rooms on a square-ish grid (default: 16)
+   -detail <N>         detail brushes per room (default: 8)
+   -patches <N>        patches per room (default: 1)
+   -models <N>         misc_models per room (default: 2)
+   -lights <N>         point lights in the whole map (default: one per room)
+   -seed <N>           random seed (default: 1)
+   -threads <N>        vmap -threads, 0 lets vmap decide (default: 1)
+   -lightargs "<args>" extra -light arguments (default: "-bounce 1")
+   -shards <N>         also light the map in N -shard runs and a -merge, and fail
+                       unless that bsp matches a single -light run; both use the
+                       default light flags (default: 0, no check)
+
+   the report is one key=value per line:
+   brushes/s is over the whole -bsp run, portals/s over the whole -vis run,
+   luxels/s over the IlluminateRawLightmap passes and rays/s comes from
+   -light -tracebenchmark; <stage>.<name>.seconds lines list every profiled
+   stage so regressions can be pinned down
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define BENCH_VERSION       1
+#define BENCH_GAME          "platform"  /* base game directory vmap looks in */
+
+#define ROOM_SIZE           512
+#define ROOM_HEIGHT         256
+#define WALL_THICKNESS      16
+#define DOOR_WIDTH          128
+#define DOOR_HEIGHT         128
+
+#define DETAIL_FLAG         134217728   /* content flag of detail brushes in the map format */
+
+#define MAX_BENCH_STAGES    64
+#define MAX_SHARD_PASSES    64          /* the light bounces a -shards check follows */
+
+typedef struct benchParams_s
+{
+	const char  *vmap;
+	const char  *dir;
+	int rooms, detail, patches, models, lights;
+	unsigned int seed;
+	int threads;
+	const char  *lightArgs;
+	int shards;
+}
+benchParams_t;
+
+typedef struct benchMap_s
+{
+	int cols, rows;
+	int brushes, detailBrushes, patches, models, lights;
+	unsigned int checksum;
+}
+benchMap_t;
+
+typedef struct benchStage_s
+{
+	char name[ 64 ];
+	double seconds;
+	double work;
+}
+benchStage_t;
+
+static unsigned int randomSeed;
+
+
+
+/*
+   BenchRandom()
+   deterministic lcg, returns an integer in [lo, hi]
+ */
+
+static int BenchRandom( int lo, int hi ){
+	randomSeed = randomSeed * 1103515245u + 12345u;
+	return lo + (int) ( ( randomSeed >> 16 ) & 0x7FFF ) % ( hi - lo + 1 );
+}
+
+
+
+/*
+   MakeDir()
+   mkdir that does not mind existing directories
+ */
+
+static void MakeDir( const char *path ){
+	if ( mkdir( path, 0755 ) != 0 && errno != EEXIST ) {
+		fprintf( stderr, "vmapbench: can't create %s: %s\n", path, strerror( errno ) );
+		exit( 1 );
+	}
+}
+
+
+
+/*
+   OpenWrite()
+   fopen for writing or die
+ */
+
+static FILE *OpenWrite( const char *path, const char *mode ){
+	FILE    *file;
+
+
+	file = fopen( path, mode );
+	if ( file == NULL ) {
+		fprintf( stderr, "vmapbench: can't write %s: %s\n", path, strerror( errno ) );
+		exit( 1 );
+	}
+	return file;
+}
+
+
+
+/*
+   CopyFile()
+   copies a file byte for byte or dies
+ */
+
+static void CopyFile( const char *from, const char *to ){
+	int c;
+	FILE    *in, *out;
+
+
+	in = fopen( from, "rb" );
+	if ( in == NULL ) {
+		fprintf( stderr, "vmapbench: can't read %s: %s\n", from, strerror( errno ) );
+		exit( 1 );
+	}
+	out = OpenWrite( to, "wb" );
+	while ( ( c = fgetc( in ) ) != EOF )
+		fputc( c, out );
+	fclose( in );
+	fclose( out );
+}
+
+
+
+/*
+   WriteBox()
+   writes an axial brush in the q3 map format
+ */
+
+static void WriteBox( FILE *file, int x0, int y0, int z0, int x1, int y1, int z1, const char *shader, int detail ){
+	int flags = detail ? DETAIL_FLAG : 0;
+
+
+	fprintf( file, "{\n" );
+	fprintf( file, "( %d 0 0 ) ( %d 1 0 ) ( %d 0 1 ) %s 0 0 0 0.5 0.5 %d 0 0\n", x0, x0, x0, shader, flags );
+	fprintf( file, "( %d 0 0 ) ( %d 0 1 ) ( %d 1 0 ) %s 0 0 0 0.5 0.5 %d 0 0\n", x1, x1, x1, shader, flags );
+	fprintf( file, "( 0 %d 0 ) ( 0 %d 1 ) ( 1 %d 0 ) %s 0 0 0 0.5 0.5 %d 0 0\n", y0, y0, y0, shader, flags );
+	fprintf( file, "( 0 %d 0 ) ( 1 %d 0 ) ( 0 %d 1 ) %s 0 0 0 0.5 0.5 %d 0 0\n", y1, y1, y1, shader, flags );
+	fprintf( file, "( 0 0 %d ) ( 1 0 %d ) ( 0 1 %d ) %s 0 0 0 0.5 0.5 %d 0 0\n", z0, z0, z0, shader, flags );
+	fprintf( file, "( 0 0 %d ) ( 0 1 %d ) ( 1 0 %d ) %s 0 0 0 0.5 0.5 %d 0 0\n", z1, z1, z1, shader, flags );
+	fprintf( file, "}\n" );
+}
+
+
+
+/*
+   WriteDoorWall()
+   writes a wall with a doorway between two rooms, axis 0 walls lie at x = pos
+   and run from lo to hi along y, axis 1 walls the other way round
+ */
+
+static void WriteDoorWall( FILE *file, int axis, int pos, int lo, int hi ){
+	int a0, a1, mid;
+
+
+	a0 = pos - WALL_THICKNESS / 2;
+	a1 = pos + WALL_THICKNESS / 2;
+	mid = ( lo + hi ) / 2;
+	if ( axis == 0 ) {
+		WriteBox( file, a0, lo, 0, a1, mid - DOOR_WIDTH / 2, ROOM_HEIGHT, "base/wall", 0 );
+		WriteBox( file, a0, mid + DOOR_WIDTH / 2, 0, a1, hi, ROOM_HEIGHT, "base/wall", 0 );
+		WriteBox( file, a0, mid - DOOR_WIDTH / 2, DOOR_HEIGHT, a1, mid + DOOR_WIDTH / 2, ROOM_HEIGHT, "base/wall", 0 );
+	}
+	else
+	{
+		WriteBox( file, lo, a0, 0, mid - DOOR_WIDTH / 2, a1, ROOM_HEIGHT, "base/wall", 0 );
+		WriteBox( file, mid + DOOR_WIDTH / 2, a0, 0, hi, a1, ROOM_HEIGHT, "base/wall", 0 );
+		WriteBox( file, mid - DOOR_WIDTH / 2, a0, DOOR_HEIGHT, mid + DOOR_WIDTH / 2, a1, ROOM_HEIGHT, "base/wall", 0 );
+	}
+}
+
+
+
+/*
+   WritePatch()
+   writes a 3x3 patch arching over the floor
+ */
+
+static void WritePatch( FILE *file, int x, int y ){
+	int i, j;
+
+
+	fprintf( file, "{\npatchDef2\n{\nbase/patch\n( 3 3 0 0 0 )\n(\n" );
+	for ( i = 0; i < 3; i++ )
+	{
+		fprintf( file, "( " );
+		for ( j = 0; j < 3; j++ )
+			fprintf( file, "( %d %d %d %g %g ) ", x + i * 64, y + j * 64, i == 1 ? 72 : 8, i * 0.5, j * 0.5 );
+		fprintf( file, ")\n" );
+	}
+	fprintf( file, ")\n}\n}\n" );
+}
+
+
+
+/*
+   IsRoom()
+   grid cells past the room count are filled in solid
+ */
+
+static int IsRoom( const benchParams_t *params, const benchMap_t *map, int col, int row ){
+	return row * map->cols + col < params->rooms;
+}
+
+
+
+/*
+   GenerateMap()
+   writes the synthetic map, rooms sit on a grid and are connected by doorways
+ */
+
+static void GenerateMap( const benchParams_t *params, benchMap_t *map, const char *path ){
+	int i, c, r, x, y, z, w, d, width, depth;
+	FILE    *file;
+
+
+	memset( map, 0, sizeof( *map ) );
+	for ( map->cols = 1; map->cols * map->cols < params->rooms; map->cols++ ) ;
+	map->rows = ( params->rooms + map->cols - 1 ) / map->cols;
+	width = map->cols * ROOM_SIZE;
+	depth = map->rows * ROOM_SIZE;
+	randomSeed = params->seed;
+
+	file = OpenWrite( path, "w" );
+	fprintf( file, "{\n\"classname\" \"worldspawn\"\n" );
+
+	/* hull */
+	WriteBox( file, -WALL_THICKNESS, -WALL_THICKNESS, -WALL_THICKNESS, width + WALL_THICKNESS, depth + WALL_THICKNESS, 0, "base/wall", 0 );
+	WriteBox( file, -WALL_THICKNESS, -WALL_THICKNESS, ROOM_HEIGHT, width + WALL_THICKNESS, depth + WALL_THICKNESS, ROOM_HEIGHT + WALL_THICKNESS, "base/wall", 0 );
+	WriteBox( file, -WALL_THICKNESS, -WALL_THICKNESS, 0, 0, depth + WALL_THICKNESS, ROOM_HEIGHT, "base/wall", 0 );
+	WriteBox( file, width, -WALL_THICKNESS, 0, width + WALL_THICKNESS, depth + WALL_THICKNESS, ROOM_HEIGHT, "base/wall", 0 );
+	WriteBox( file, 0, -WALL_THICKNESS, 0, width, 0, ROOM_HEIGHT, "base/wall", 0 );
+	WriteBox( file, 0, depth, 0, width, depth + WALL_THICKNESS, ROOM_HEIGHT, "base/wall", 0 );
+	map->brushes += 6;
+
+	/* walls between rooms, unused cells are solid */
+	for ( r = 0; r < map->rows; r++ )
+	{
+		for ( c = 0; c < map->cols; c++ )
+		{
+			if ( !IsRoom( params, map, c, r ) ) {
+				WriteBox( file, c * ROOM_SIZE, r * ROOM_SIZE, 0, ( c + 1 ) * ROOM_SIZE, ( r + 1 ) * ROOM_SIZE, ROOM_HEIGHT, "base/wall", 0 );
+				map->brushes++;
+				continue;
+			}
+			if ( c > 0 && IsRoom( params, map, c - 1, r ) ) {
+				WriteDoorWall( file, 0, c * ROOM_SIZE, r * ROOM_SIZE, ( r + 1 ) * ROOM_SIZE );
+				map->brushes += 3;
+			}
+			if ( r > 0 && IsRoom( params, map, c, r - 1 ) ) {
+				WriteDoorWall( file, 1, r * ROOM_SIZE, c * ROOM_SIZE, ( c + 1 ) * ROOM_SIZE );
+				map->brushes += 3;
+			}
+		}
+	}
+
+	/* room contents */
+	for ( i = 0; i < params->rooms; i++ )
+	{
+		c = i % map->cols;
+		r = i / map->cols;
+		for ( d = 0; d < params->detail; d++ )
+		{
+			x = c * ROOM_SIZE + BenchRandom( 32, ROOM_SIZE - 96 );
+			y = r * ROOM_SIZE + BenchRandom( 32, ROOM_SIZE - 96 );
+			z = BenchRandom( 0, 150 );
+			w = BenchRandom( 8, 64 );
+			WriteBox( file, x, y, z, x + w, y + BenchRandom( 8, 64 ), z + BenchRandom( 8, 64 ), "base/detail", 1 );
+			map->brushes++;
+			map->detailBrushes++;
+		}
+		for ( d = 0; d < params->patches; d++ )
+		{
+			WritePatch( file, c * ROOM_SIZE + BenchRandom( 32, ROOM_SIZE - 160 ), r * ROOM_SIZE + BenchRandom( 32, ROOM_SIZE - 160 ) );
+			map->patches++;
+		}
+	}
+	fprintf( file, "}\n" );
+
+	/* models */
+	for ( i = 0; i < params->rooms; i++ )
+	{
+		c = i % map->cols;
+		r = i / map->cols;
+		for ( d = 0; d < params->models; d++ )
+		{
+			fprintf( file, "{\n\"classname\" \"misc_model\"\n\"model\" \"models/bench/crate.obj\"\n\"generatelightmaps\" \"1\"\n" );
+			fprintf( file, "\"origin\" \"%d %d 0\"\n\"angle\" \"%d\"\n}\n",
+					 c * ROOM_SIZE + BenchRandom( 48, ROOM_SIZE - 48 ), r * ROOM_SIZE + BenchRandom( 48, ROOM_SIZE - 48 ), BenchRandom( 0, 359 ) );
+			map->models++;
+		}
+	}
+
+	/* lights, dealt round the rooms */
+	for ( i = 0; i < params->lights; i++ )
+	{
+		c = ( i % params->rooms ) % map->cols;
+		r = ( i % params->rooms ) / map->cols;
+		fprintf( file, "{\n\"classname\" \"light\"\n\"origin\" \"%d %d %d\"\n\"light\" \"300\"\n}\n",
+				 c * ROOM_SIZE + BenchRandom( 64, ROOM_SIZE - 64 ), r * ROOM_SIZE + BenchRandom( 64, ROOM_SIZE - 64 ), BenchRandom( 96, ROOM_HEIGHT - 32 ) );
+		map->lights++;
+	}
+
+	fprintf( file, "{\n\"classname\" \"info_player_start\"\n\"origin\" \"%d %d 64\"\n}\n", ROOM_SIZE / 2, ROOM_SIZE / 2 );
+	fclose( file );
+}
+
+
+
+/*
+   WriteModel()
+   a 32x32x48 crate for the misc_models
+ */
+
+static void WriteModel( const char *path ){
+	FILE    *file;
+
+
+	file = OpenWrite( path, "w" );
+	fprintf( file,
+			 "v -16 -16 0\nv -16 -16 48\nv -16 16 0\nv -16 16 48\n"
+			 "v 16 -16 0\nv 16 -16 48\nv 16 16 0\nv 16 16 48\n"
+			 "vt 0 0\nvt 1 0\nvt 1 1\nvt 0 1\n"
+			 "vn 0 0 1\n"
+			 "g crate\n"
+			 "usemtl textures/base/crate\n"
+			 "f 1/1/1 3/2/1 4/3/1 2/4/1\n"
+			 "f 5/1/1 6/2/1 8/3/1 7/4/1\n"
+			 "f 1/1/1 2/2/1 6/3/1 5/4/1\n"
+			 "f 3/1/1 7/2/1 8/3/1 4/4/1\n"
+			 "f 1/1/1 5/2/1 7/3/1 3/4/1\n"
+			 "f 2/1/1 4/2/1 8/3/1 6/4/1\n" );
+	fclose( file );
+}
+
+
+
+/*
+   WriteTexture()
+   a 32x32 checkered uncompressed tga
+ */
+
+static void WriteTexture( const char *path, int red, int green, int blue ){
+	int x, y, shade;
+	unsigned char header[ 18 ];
+	FILE    *file;
+
+
+	memset( header, 0, sizeof( header ) );
+	header[ 2 ] = 2;
+	header[ 12 ] = 32;
+	header[ 14 ] = 32;
+	header[ 16 ] = 24;
+
+	file = OpenWrite( path, "wb" );
+	fwrite( header, 1, sizeof( header ), file );
+	for ( y = 0; y < 32; y++ )
+	{
+		for ( x = 0; x < 32; x++ )
+		{
+			shade = ( ( x >> 3 ) ^ ( y >> 3 ) ) & 1 ? 32 : 0;
+			fputc( blue > shade ? blue - shade : 0, file );
+			fputc( green > shade ? green - shade : 0, file );
+			fputc( red > shade ? red - shade : 0, file );
+		}
+	}
+	fclose( file );
+}
+
+
+
+/*
+   FileChecksum()
+   fnv-1a of a file, 0 if it can't be read
+ */
+
+static unsigned int FileChecksum( const char *path ){
+	int c;
+	unsigned int hash;
+	FILE    *file;
+
+
+	file = fopen( path, "rb" );
+	if ( file == NULL ) {
+		return 0;
+	}
+	hash = 2166136261u;
+	while ( ( c = fgetc( file ) ) != EOF )
+		hash = ( hash ^ (unsigned char) c ) * 16777619u;
+	fclose( file );
+	return hash;
+}
+
+
+
+/*
+   LoadText()
+   reads a whole file into a terminated buffer
+ */
+
+static char *LoadText( const char *path ){
+	long size;
+	char    *buffer;
+	FILE    *file;
+
+
+	file = fopen( path, "rb" );
+	if ( file == NULL ) {
+		return NULL;
+	}
+	fseek( file, 0, SEEK_END );
+	size = ftell( file );
+	fseek( file, 0, SEEK_SET );
+	buffer = malloc( size + 1 );
+	if ( buffer == NULL ) {
+		fclose( file );
+		return NULL;
+	}
+	size = fread( buffer, 1, size, file );
+	buffer[ size ] = '\0';
+	fclose( file );
+	return buffer;
+}
+
+
+
+/*
+   ReadProfile()
+   pulls stage names, wall seconds and work items out of a vmap -profile
+   report; stages that show up under several parents are summed
+ */
+
+static int ReadProfile( const char *path, benchStage_t *stages ){
+	int i, numStages, len;
+	char    *text, *s, *end, *next;
+	const char  *key;
+
+
+	text = LoadText( path );
+	if ( text == NULL ) {
+		return 0;
+	}
+
+	numStages = 0;
+	key = "\"name\": \"";
+	for ( s = strstr( text, key ); s != NULL; s = next )
+	{
+		s += strlen( key );
+		end = strchr( s, '"' );
+		if ( end == NULL ) {
+			break;
+		}
+		len = end - s;
+		next = strstr( end, key );
+
+		/* find or add the stage */
+		for ( i = 0; i < numStages; i++ )
+		{
+			if ( (int) strlen( stages[ i ].name ) == len && !strncmp( stages[ i ].name, s, len ) ) {
+				break;
+			}
+		}
+		if ( i == numStages ) {
+			if ( numStages >= MAX_BENCH_STAGES || len >= (int) sizeof( stages[ i ].name ) ) {
+				continue;
+			}
+			memset( &stages[ i ], 0, sizeof( stages[ i ] ) );
+			memcpy( stages[ i ].name, s, len );
+			numStages++;
+		}
+
+		/* its fields come before the next stage */
+		s = strstr( end, "\"wallSeconds\": " );
+		if ( s != NULL && ( next == NULL || s < next ) ) {
+			stages[ i ].seconds += atof( s + strlen( "\"wallSeconds\": " ) );
+		}
+		s = strstr( end, "\"workItems\": " );
+		if ( s != NULL && ( next == NULL || s < next ) ) {
+			stages[ i ].work += atof( s + strlen( "\"workItems\": " ) );
+		}
+	}
+
+	free( text );
+	return numStages;
+}
+
+
+
+/*
+   FindStage()
+   looks a stage up by name
+ */
+
+static benchStage_t *FindStage( benchStage_t *stages, int numStages, const char *name ){
+	int i;
+
+
+	for ( i = 0; i < numStages; i++ )
+	{
+		if ( !strcmp( stages[ i ].name, name ) ) {
+			return &stages[ i ];
+		}
+	}
+	return NULL;
+}
+
+
+
+/*
+   ReadLogNumber()
+   the number leading the last log line that contains key
+ */
+
+static double ReadLogNumber( const char *path, const char *key ){
+	double value;
+	char    *text, *line, *s;
+
+
+	text = LoadText( path );
+	if ( text == NULL ) {
+		return 0.0;
+	}
+
+	value = 0.0;
+	for ( s = strstr( text, key ); s != NULL; s = strstr( s + 1, key ) )
+	{
+		for ( line = s; line > text && line[ -1 ] != '\n'; line-- ) ;
+		value = atof( line );
+	}
+
+	free( text );
+	return value;
+}
+
+
+
+/*
+   RunStage()
+   runs one vmap stage with -profile and reads its report back
+ */
+
+static int RunStage( const benchParams_t *params, const char *dir, const char *map, const char *mode, const char *args, benchStage_t *stages ){
+	char threads[ 32 ], command[ 8192 ];
+
+
+	threads[ 0 ] = '\0';
+	if ( params->threads > 0 ) {
+		sprintf( threads, "-threads %d ", params->threads );
+	}
+	snprintf( command, sizeof( command ), "\"%s\" -fs_basepath \"%s\" -fs_nohomepath %s-profile \"%s/%s.json\" %s \"%s\" > \"%s/%s.log\" 2>&1",
+			  params->vmap, dir, threads, dir, mode, args, map, dir, mode );
+	if ( system( command ) != 0 ) {
+		fprintf( stderr, "vmapbench: %s stage failed, see %s/%s.log\n", mode, dir, mode );
+		exit( 1 );
+	}
+
+	snprintf( command, sizeof( command ), "%s/%s.json", dir, mode );
+	return ReadProfile( command, stages );
+}
+
+
+
+/*
+   CopyBench()
+   copies the map, bsp and surface file of the bench map into another maps dir
+ */
+
+static void CopyBench( const char *dir, const char *sub ){
+	static const char *exts[] = { "map", "bsp", "srf" };
+	char from[ PATH_MAX + 64 ], to[ PATH_MAX + 64 ];
+	int i;
+
+
+	sprintf( to, "%s/" BENCH_GAME "/maps/%s", dir, sub );
+	MakeDir( to );
+	for ( i = 0; i < 3; i++ )
+	{
+		sprintf( from, "%s/" BENCH_GAME "/maps/bench.%s", dir, exts[ i ] );
+		sprintf( to, "%s/" BENCH_GAME "/maps/%s/bench.%s", dir, sub, exts[ i ] );
+		CopyFile( from, to );
+	}
+}
+
+
+
+/*
+   CheckShards()
+   lights the copies CopyBench made once in one process and once in shards
+   plus a merge, returns 1 if the two bsps are the same
+ */
+
+static int CheckShards( const benchParams_t *params, const char *dir, benchStage_t *stages ){
+	int i, pass;
+	char single[ PATH_MAX + 64 ], sharded[ PATH_MAX + 64 ], log[ PATH_MAX + 64 ], mode[ 32 ], args[ 64 ];
+	char    *text;
+	unsigned int checksum;
+
+
+	sprintf( single, "%s/" BENCH_GAME "/maps/single/bench.bsp", dir );
+	sprintf( sharded, "%s/" BENCH_GAME "/maps/sharded/bench.bsp", dir );
+	RunStage( params, dir, single, "single", "-light", stages );
+
+	/* every bounce is a pass of its own, the merge says when there is another one */
+	for ( pass = 0; pass < MAX_SHARD_PASSES; pass++ )
+	{
+		for ( i = 0; i < params->shards; i++ )
+		{
+			sprintf( mode, "shard%d.%d", pass, i );
+			sprintf( args, "-light -shard %d/%d -shardpass %d", i, params->shards, pass );
+			RunStage( params, dir, sharded, mode, args, stages );
+		}
+		sprintf( mode, "merge%d", pass );
+		sprintf( args, "-light -merge -shardpass %d", pass );
+		RunStage( params, dir, sharded, mode, args, stages );
+
+		sprintf( log, "%s/%s.log", dir, mode );
+		text = LoadText( log );
+		i = text != NULL && strstr( text, "Light the next shards" ) != NULL;
+		free( text );
+		if ( !i ) {
+			break;
+		}
+	}
+
+	checksum = FileChecksum( single );
+	return checksum != 0 && checksum == FileChecksum( sharded );
+}
+
+
+
+/*
+   PrintStages()
+   per stage seconds, the stage named after the mode is the whole run
+ */
+
+static void PrintStages( const char *mode, benchStage_t *stages, int numStages ){
+	int i;
+
+
+	for ( i = 0; i < numStages; i++ )
+	{
+		if ( strcmp( stages[ i ].name, mode ) ) {
+			printf( "%s.stage.%s.seconds=%.3f\n", mode, stages[ i ].name, stages[ i ].seconds );
+		}
+	}
+}
+
+
+
+/*
+   Rate()
+   work per second without dividing by zero
+ */
+
+static double Rate( double work, double seconds ){
+	return seconds > 0.0 ? work / seconds : 0.0;
+}
+
+
+
+/*
+   main()
+ */
+
+int main( int argc, char **argv ){
+	int i, numStages, match;
+	char dir[ PATH_MAX ], path[ PATH_MAX + 64 ], map[ PATH_MAX + 64 ], vmap[ PATH_MAX ], lightArgs[ 1024 ];
+	char    *slash;
+	double seconds, luxels;
+	benchParams_t params;
+	benchMap_t benchMap;
+	benchStage_t stages[ MAX_BENCH_STAGES ], *stage;
+
+
+	/* defaults */
+	memset( &params, 0, sizeof( params ) );
+	params.dir = "vmapbench.tmp";
+	params.rooms = 16;
+	params.detail = 8;
+	params.patches = 1;
+	params.models = 2;
+	params.lights = -1;
+	params.seed = 1;
+	params.threads = 1;
+	params.lightArgs = "-bounce 1";
+
+	/* vmap sits next to vmapbench in the build directory */
+	snprintf( vmap, sizeof( vmap ), "%s", argv[ 0 ] );
+	slash = strrchr( vmap, '/' );
+	if ( slash != NULL ) {
+		strcpy( slash + 1, "vmap" );
+	}
+	else{
+		strcpy( vmap, "./vmap" );
+	}
+	params.vmap = vmap;
+
+	/* parse arguments */
+	for ( i = 1; i < argc; i++ )
+	{
+		if ( i + 1 >= argc ) {
+			fprintf( stderr, "vmapbench: %s needs a value\n", argv[ i ] );
+			return 1;
+		}
+		if ( !strcmp( argv[ i ], "-vmap" ) ) {
+			params.vmap = argv[ ++i ];
+		}
+		else if ( !strcmp( argv[ i ], "-dir" ) ) {
+			params.dir = argv[ ++i ];
+		}
+		else if ( !strcmp( argv[ i ], "-rooms" ) ) {
+			params.rooms = atoi( argv[ ++i ] );
+		}
+		else if ( !strcmp( argv[ i ], "-detail" ) ) {
+			params.detail = atoi( argv[ ++i ] );
+		}
+		else if ( !strcmp( argv[ i ], "-patches" ) ) {
+			params.patches = atoi( argv[ ++i ] );
+		}
+		else if ( !strcmp( argv[ i ], "-models" ) ) {
+			params.models = atoi( argv[ ++i ] );
+		}
+		else if ( !strcmp( argv[ i ], "-lights" ) ) {
+			params.lights = atoi( argv[ ++i ] );
+		}
+		else if ( !strcmp( argv[ i ], "-seed" ) ) {
+			params.seed = strtoul( argv[ ++i ], NULL, 10 );
+		}
+		else if ( !strcmp( argv[ i ], "-threads" ) ) {
+			params.threads = atoi( argv[ ++i ] );
+		}
+		else if ( !strcmp( argv[ i ], "-lightargs" ) ) {
+			params.lightArgs = argv[ ++i ];
+		}
+		else if ( !strcmp( argv[ i ], "-shards" ) ) {
+			params.shards = atoi( argv[ ++i ] );
+		}
+		else
+		{
+			fprintf( stderr, "vmapbench: unknown option %s\n", argv[ i ] );
+			return 1;
+		}
+	}
+	if ( params.rooms < 1 ) {
+		params.rooms = 1;
+	}
+	if ( params.lights < 0 ) {
+		params.lights = params.rooms;
+	}
+	if ( params.detail < 0 ) {
+		params.detail = 0;
+	}
+	if ( params.patches < 0 ) {
+		params.patches = 0;
+	}
+	if ( params.models < 0 ) {
+		params.models = 0;
+	}
+
+	/* lay out a game directory */
+	MakeDir( params.dir );
+	if ( realpath( params.dir, dir ) == NULL ) {
+		fprintf( stderr, "vmapbench: can't resolve %s\n", params.dir );
+		return 1;
+	}
+	sprintf( path, "%s/" BENCH_GAME, dir );
+	MakeDir( path );
+	sprintf( path, "%s/" BENCH_GAME "/maps", dir );
+	MakeDir( path );
+	sprintf( path, "%s/" BENCH_GAME "/models", dir );
+	MakeDir( path );
+	sprintf( path, "%s/" BENCH_GAME "/models/bench", dir );
+	MakeDir( path );
+	sprintf( path, "%s/" BENCH_GAME "/textures", dir );
+	MakeDir( path );
+	sprintf( path, "%s/" BENCH_GAME "/textures/base", dir );
+	MakeDir( path );
+
+	sprintf( path, "%s/" BENCH_GAME "/models/bench/crate.obj", dir );
+	WriteModel( path );
+	sprintf( path, "%s/" BENCH_GAME "/textures/base/wall.tga", dir );
+	WriteTexture( path, 160, 150, 140 );
+	sprintf( path, "%s/" BENCH_GAME "/textures/base/detail.tga", dir );
+	WriteTexture( path, 120, 140, 170 );
+	sprintf( path, "%s/" BENCH_GAME "/textures/base/patch.tga", dir );
+	WriteTexture( path, 170, 120, 100 );
+	sprintf( path, "%s/" BENCH_GAME "/textures/base/crate.tga", dir );
+	WriteTexture( path, 150, 110, 60 );
+
+	/* generate the map */
+	sprintf( map, "%s/" BENCH_GAME "/maps/bench.map", dir );
+	GenerateMap( &params, &benchMap, map );
+	benchMap.checksum = FileChecksum( map );
+
+	printf( "vmapbench.version=%d\n", BENCH_VERSION );
+	printf( "params.rooms=%d\n", params.rooms );
+	printf( "params.detail=%d\n", params.detail );
+	printf( "params.patches=%d\n", params.patches );
+	printf( "params.models=%d\n", params.models );
+	printf( "params.lights=%d\n", params.lights );
+	printf( "params.seed=%u\n", params.seed );
+	printf( "params.threads=%d\n", params.threads );
+	printf( "params.lightargs=%s\n", params.lightArgs );
+	printf( "params.shards=%d\n", params.shards );
+	printf( "map.checksum=%08x\n", benchMap.checksum );
+	printf( "map.brushes=%d\n", benchMap.brushes );
+	printf( "map.detailbrushes=%d\n", benchMap.detailBrushes );
+	printf( "map.patches=%d\n", benchMap.patches );
+	printf( "map.models=%d\n", benchMap.models );
+	printf( "map.lights=%d\n", benchMap.lights );
+	fflush( stdout );
+
+	/* bsp */
+	numStages = RunStage( &params, dir, map, "bsp", "", stages );
+	stage = FindStage( stages, numStages, "bsp" );
+	seconds = stage != NULL ? stage->seconds : 0.0;
+	printf( "bsp.seconds=%.3f\n", seconds );
+	printf( "bsp.brushes_per_second=%.0f\n", Rate( benchMap.brushes, seconds ) );
+	PrintStages( "bsp", stages, numStages );
+	fflush( stdout );
+
+	/* vis */
+	numStages = RunStage( &params, dir, map, "vis", "-vis", stages );
+	stage = FindStage( stages, numStages, "vis" );
+	seconds = stage != NULL ? stage->seconds : 0.0;
+	stage = FindStage( stages, numStages, "LoadPortals" );
+	printf( "vis.seconds=%.3f\n", seconds );
+	printf( "vis.portals=%.0f\n", stage != NULL ? stage->work : 0.0 );
+	printf( "vis.portals_per_second=%.0f\n", Rate( stage != NULL ? stage->work : 0.0, seconds ) );
+	PrintStages( "vis", stages, numStages );
+	fflush( stdout );
+
+	/* the shard check starts from the vis output too */
+	if ( params.shards > 0 ) {
+		CopyBench( dir, "single" );
+		CopyBench( dir, "sharded" );
+	}
+
+	/* light */
+	snprintf( lightArgs, sizeof( lightArgs ), "-light -tracebenchmark %s", params.lightArgs );
+	numStages = RunStage( &params, dir, map, "light", lightArgs, stages );
+	stage = FindStage( stages, numStages, "light" );
+	seconds = stage != NULL ? stage->seconds : 0.0;
+	sprintf( path, "%s/light.log", dir );
+	luxels = ReadLogNumber( path, " luxels illuminated" );
+	stage = FindStage( stages, numStages, "IlluminateRawLightmap" );
+	printf( "light.seconds=%.3f\n", seconds );
+	printf( "light.luxels=%.0f\n", luxels );
+	printf( "light.luxels_per_second=%.0f\n", Rate( luxels, stage != NULL ? stage->seconds : 0.0 ) );
+	printf( "light.rays_per_second.nodes=%.0f\n", ReadLogNumber( path, " rays/sec with trace nodes" ) );
+	printf( "light.rays_per_second.bvh=%.0f\n", ReadLogNumber( path, " rays/sec with bvh" ) );
+	PrintStages( "light", stages, numStages );
+	fflush( stdout );
+
+	/* shards */
+	if ( params.shards > 0 ) {
+		match = CheckShards( &params, dir, stages );
+		printf( "light.shards.match=%d\n", match );
+		if ( !match ) {
+			fprintf( stderr, "vmapbench: %d light shards differ from a single process, compare %s/" BENCH_GAME "/maps/single/bench.bsp and %s/" BENCH_GAME "/maps/sharded/bench.bsp\n",
+					 params.shards, dir, dir );
+			return 1;
+		}
+	}
+
+	return 0;
+}
@@ -32,6 +32,7 @@
 #include "globaldefs.h"
 #include "mathlib.h"
 #include "inout.h"
+#include "vfs.h"
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -706,6 +707,9 @@ void    SaveFile( const char *filename, const void *buffer, int count ){
 	f = SafeOpenWrite( filename );
 	SafeWrite( f, buffer, count );
 	fclose( f );
+
+	// so the vfs finds it without probing the disk
+	vfsAddWrittenFile( filename );
 }
 
 
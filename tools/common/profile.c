@@ -0,0 +1,462 @@
+/*
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+#include "globaldefs.h"
+#include <math.h>
+#include "cmdlib.h"
+#include "inout.h"
+#include "qthreads.h"
+#include "profile.h"
+
+#if GDEF_OS_WINDOWS
+#include <windows.h>
+#else
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#define MAX_PROFILE_STAGES  256
+#define MAX_PROFILE_DEPTH   32
+
+typedef struct profileStage_s
+{
+	char name[ 64 ];
+	int parent;                             /* stage index or -1 */
+	int depth;
+	int calls;
+	double wall, cpu;                       /* seconds */
+	long peakRSS;                           /* kilobytes, at the end of the stage */
+	double work;                            /* work items, double so it never overflows */
+	int threadRuns;
+	double                  *busy, *idle;   /* per thread seconds */
+	int                     *items;         /* per thread work items */
+	int histogram[ PROFILE_BUCKETS ];
+
+	double beginWall, beginCPU;
+}
+profileStage_t;
+
+qboolean profiling = qfalse;
+
+static char profilePath[ 1024 ];
+static double profileWall, profileCPU;
+
+static profileStage_t profileStages[ MAX_PROFILE_STAGES ];
+static int numProfileStages;
+static int profileStack[ MAX_PROFILE_DEPTH ];
+static int profileDepth;
+
+static double *runBusy;
+static int *runItems;
+static int runHistogram[ PROFILE_BUCKETS ];
+static int numProfileThreads;
+
+
+
+/*
+   ProfileClock()
+   monotonic wall clock in seconds; I_FloatTime() only has second resolution
+ */
+
+double ProfileClock( void ){
+#if GDEF_OS_WINDOWS
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+
+
+	if ( frequency.QuadPart == 0 ) {
+		QueryPerformanceFrequency( &frequency );
+	}
+	QueryPerformanceCounter( &counter );
+	return (double) counter.QuadPart / (double) frequency.QuadPart;
+#else
+	struct timespec ts;
+
+
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return ts.tv_sec + ts.tv_nsec * 1.0e-9;
+#endif
+}
+
+
+
+/*
+   ProcessCPUTime()
+   user + system time of all threads in seconds
+ */
+
+static double ProcessCPUTime( void ){
+#if GDEF_OS_WINDOWS
+	FILETIME creation, exit, kernel, user;
+	ULARGE_INTEGER k, u;
+
+
+	if ( !GetProcessTimes( GetCurrentProcess(), &creation, &exit, &kernel, &user ) ) {
+		return 0.0;
+	}
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return ( k.QuadPart + u.QuadPart ) * 1.0e-7;
+#else
+	struct rusage usage;
+
+
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 ) {
+		return 0.0;
+	}
+	return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec * 1.0e-6
+		   + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec * 1.0e-6;
+#endif
+}
+
+
+
+/*
+   PeakRSS()
+   peak resident set size of the process in kilobytes (0 where unknown)
+ */
+
+static long PeakRSS( void ){
+#if GDEF_OS_WINDOWS
+	return 0;
+#else
+	struct rusage usage;
+
+
+	if ( getrusage( RUSAGE_SELF, &usage ) != 0 ) {
+		return 0;
+	}
+#if GDEF_OS_MACOS
+	return usage.ru_maxrss / 1024;         /* bytes on darwin */
+#else
+	return usage.ru_maxrss;
+#endif
+#endif
+}
+
+
+
+/*
+   ProfileInit()
+   turns profiling on, the report is written to path by ProfileWrite()
+ */
+
+void ProfileInit( const char *path ){
+	strncpy( profilePath, path, sizeof( profilePath ) - 1 );
+	profiling = qtrue;
+	profileWall = ProfileClock();
+	profileCPU = ProcessCPUTime();
+}
+
+
+
+/*
+   ProfileBegin()
+   opens a stage below the innermost open stage
+ */
+
+void ProfileBegin( const char *name ){
+	int i, parent;
+	profileStage_t  *stage;
+
+
+	if ( !profiling ) {
+		return;
+	}
+	if ( profileDepth >= MAX_PROFILE_DEPTH ) {
+		Error( "ProfileBegin: stages nested too deep (%s)", name );
+	}
+
+	/* find the stage under this parent */
+	parent = profileDepth > 0 ? profileStack[ profileDepth - 1 ] : -1;
+	for ( i = 0; i < numProfileStages; i++ )
+	{
+		if ( profileStages[ i ].parent == parent && !strcmp( profileStages[ i ].name, name ) ) {
+			break;
+		}
+	}
+
+	/* or make a new one */
+	if ( i == numProfileStages ) {
+		if ( numProfileStages >= MAX_PROFILE_STAGES ) {
+			Error( "MAX_PROFILE_STAGES (%d) exceeded", MAX_PROFILE_STAGES );
+		}
+		stage = &profileStages[ numProfileStages++ ];
+		memset( stage, 0, sizeof( *stage ) );
+		strncpy( stage->name, name, sizeof( stage->name ) - 1 );
+		stage->parent = parent;
+		stage->depth = profileDepth;
+	}
+
+	/* open it */
+	stage = &profileStages[ i ];
+	stage->calls++;
+	stage->beginWall = ProfileClock();
+	stage->beginCPU = ProcessCPUTime();
+	profileStack[ profileDepth++ ] = i;
+}
+
+
+
+/*
+   ProfileEnd()
+   closes the innermost open stage
+ */
+
+void ProfileEnd( void ){
+	profileStage_t  *stage;
+
+
+	if ( !profiling ) {
+		return;
+	}
+	if ( profileDepth <= 0 ) {
+		Error( "ProfileEnd without ProfileBegin" );
+	}
+
+	stage = &profileStages[ profileStack[ --profileDepth ] ];
+	stage->wall += ProfileClock() - stage->beginWall;
+	stage->cpu += ProcessCPUTime() - stage->beginCPU;
+	stage->peakRSS = PeakRSS();
+}
+
+
+
+/*
+   ProfileAddWork()
+   counts work items of the innermost open stage
+ */
+
+void ProfileAddWork( int count ){
+	if ( !profiling || profileDepth <= 0 ) {
+		return;
+	}
+	profileStages[ profileStack[ profileDepth - 1 ] ].work += count;
+}
+
+
+
+/*
+   ProfileBucket()
+   histogram bucket for a work item time
+ */
+
+int ProfileBucket( double seconds ){
+	int bucket;
+	double limit;
+
+
+	bucket = 0;
+	for ( limit = 1.0e-6; seconds >= limit && bucket < PROFILE_BUCKETS - 1; limit *= 2.0 )
+		bucket++;
+	return bucket;
+}
+
+
+
+/*
+   ProfileThreadsBegin()
+   called by RunThreadsOnIndividual before the threads start
+ */
+
+void ProfileThreadsBegin( void ){
+	int n;
+
+
+	n = numthreads > 1 ? numthreads : 1;
+	if ( n > numProfileThreads ) {
+		free( runBusy );
+		free( runItems );
+		runBusy = safe_malloc( n * sizeof( *runBusy ) );
+		runItems = safe_malloc( n * sizeof( *runItems ) );
+		numProfileThreads = n;
+	}
+	memset( runBusy, 0, numProfileThreads * sizeof( *runBusy ) );
+	memset( runItems, 0, numProfileThreads * sizeof( *runItems ) );
+	memset( runHistogram, 0, sizeof( runHistogram ) );
+}
+
+
+
+/*
+   ProfileThreadWork()
+   called by each worker thread when it runs out of work
+ */
+
+void ProfileThreadWork( int threadnum, int items, double busy, const int *histogram ){
+	int i;
+
+
+	if ( threadnum < 0 || threadnum >= numProfileThreads ) {
+		return;
+	}
+	runBusy[ threadnum ] += busy;
+	runItems[ threadnum ] += items;
+
+	ThreadLock();
+	for ( i = 0; i < PROFILE_BUCKETS; i++ )
+		runHistogram[ i ] += histogram[ i ];
+	ThreadUnlock();
+}
+
+
+
+/*
+   ProfileThreadsEnd()
+   called by RunThreadsOnIndividual after the threads are joined, folds the
+   run into the innermost open stage
+ */
+
+void ProfileThreadsEnd( int workcnt, double wall ){
+	int i;
+	profileStage_t  *stage;
+
+
+	if ( profileDepth <= 0 ) {
+		return;
+	}
+	stage = &profileStages[ profileStack[ profileDepth - 1 ] ];
+
+	if ( stage->busy == NULL ) {
+		stage->busy = safe_malloc( numProfileThreads * sizeof( *stage->busy ) );
+		stage->idle = safe_malloc( numProfileThreads * sizeof( *stage->idle ) );
+		stage->items = safe_malloc( numProfileThreads * sizeof( *stage->items ) );
+		memset( stage->busy, 0, numProfileThreads * sizeof( *stage->busy ) );
+		memset( stage->idle, 0, numProfileThreads * sizeof( *stage->idle ) );
+		memset( stage->items, 0, numProfileThreads * sizeof( *stage->items ) );
+	}
+
+	stage->work += workcnt;
+	stage->threadRuns++;
+	for ( i = 0; i < numProfileThreads; i++ )
+	{
+		stage->busy[ i ] += runBusy[ i ];
+		stage->idle[ i ] += wall > runBusy[ i ] ? wall - runBusy[ i ] : 0.0;
+		stage->items[ i ] += runItems[ i ];
+	}
+	for ( i = 0; i < PROFILE_BUCKETS; i++ )
+		stage->histogram[ i ] += runHistogram[ i ];
+}
+
+
+
+/*
+   WriteJSONString()
+   writes a quoted and escaped json string
+ */
+
+static void WriteJSONString( FILE *file, const char *s ){
+	fputc( '"', file );
+	for ( ; *s; s++ )
+	{
+		if ( *s == '"' || *s == '\\' ) {
+			fprintf( file, "\\%c", *s );
+		}
+		else if ( (unsigned char) *s < 0x20 ) {
+			fprintf( file, "\\u%04x", (unsigned char) *s );
+		}
+		else{
+			fputc( *s, file );
+		}
+	}
+	fputc( '"', file );
+}
+
+
+
+/*
+   ProfileWrite()
+   closes any open stages and writes the json report
+ */
+
+void ProfileWrite( void ){
+	int i, j, first;
+	FILE            *file;
+	profileStage_t  *stage;
+
+
+	if ( !profiling ) {
+		return;
+	}
+	while ( profileDepth > 0 )
+		ProfileEnd();
+
+	Sys_Printf( "Writing %s\n", profilePath );
+	file = SafeOpenWrite( profilePath );
+
+	fprintf( file, "{\n" );
+	fprintf( file, "\t\"threads\": %d,\n", numthreads > 1 ? numthreads : 1 );
+	fprintf( file, "\t\"wallSeconds\": %.6f,\n", ProfileClock() - profileWall );
+	fprintf( file, "\t\"cpuSeconds\": %.6f,\n", ProcessCPUTime() - profileCPU );
+	fprintf( file, "\t\"peakRssKB\": %ld,\n", PeakRSS() );
+	fprintf( file, "\t\"stages\": [" );
+
+	for ( i = 0; i < numProfileStages; i++ )
+	{
+		stage = &profileStages[ i ];
+
+		fprintf( file, "%s\n\t\t{\n\t\t\t\"name\": ", i ? "," : "" );
+		WriteJSONString( file, stage->name );
+		fprintf( file, ",\n\t\t\t\"parent\": " );
+		if ( stage->parent >= 0 ) {
+			WriteJSONString( file, profileStages[ stage->parent ].name );
+		}
+		else{
+			fprintf( file, "null" );
+		}
+		fprintf( file, ",\n" );
+		fprintf( file, "\t\t\t\"depth\": %d,\n", stage->depth );
+		fprintf( file, "\t\t\t\"calls\": %d,\n", stage->calls );
+		fprintf( file, "\t\t\t\"wallSeconds\": %.6f,\n", stage->wall );
+		fprintf( file, "\t\t\t\"cpuSeconds\": %.6f,\n", stage->cpu );
+		fprintf( file, "\t\t\t\"peakRssKB\": %ld,\n", stage->peakRSS );
+		fprintf( file, "\t\t\t\"workItems\": %.0f,\n", stage->work );
+		fprintf( file, "\t\t\t\"threadRuns\": %d", stage->threadRuns );
+
+		/* per thread and per item timing only exists for threaded stages */
+		if ( stage->busy != NULL ) {
+			fprintf( file, ",\n\t\t\t\"threads\": [" );
+			for ( j = 0; j < numProfileThreads; j++ )
+				fprintf( file, "%s\n\t\t\t\t{ \"busySeconds\": %.6f, \"idleSeconds\": %.6f, \"items\": %d }",
+						 j ? "," : "", stage->busy[ j ], stage->idle[ j ], stage->items[ j ] );
+			fprintf( file, "\n\t\t\t],\n\t\t\t\"itemHistogram\": [" );
+			for ( j = 0, first = 1; j < PROFILE_BUCKETS; j++ )
+			{
+				if ( stage->histogram[ j ] == 0 ) {
+					continue;
+				}
+				fprintf( file, "%s\n\t\t\t\t{ \"underMicroseconds\": %.0f, \"count\": %d }",
+						 first ? "" : ",", ldexp( 1.0, j ), stage->histogram[ j ] );
+				first = 0;
+			}
+			fprintf( file, "\n\t\t\t]" );
+		}
+		fprintf( file, "\n\t\t}" );
+	}
+
+	fprintf( file, "\n\t]\n}\n" );
+	fclose( file );
+}
@@ -0,0 +1,53 @@
+/*
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+
+#ifndef __PROFILE_H__
+#define __PROFILE_H__
+
+/*
+   compile profiler
+
+   stages are opened and closed from the main thread and nest; a stage
+   entered again under the same parent accumulates into the same record.
+   RunThreadsOnIndividual reports work items, per thread busy/idle time
+   and a log2 histogram of item times to the innermost open stage
+ */
+
+#define PROFILE_BUCKETS     32      /* bucket n holds items under 2^n microseconds */
+
+extern qboolean profiling;
+
+double ProfileClock( void );
+
+void ProfileInit( const char *path );
+void ProfileBegin( const char *name );
+void ProfileEnd( void );
+void ProfileAddWork( int count );
+void ProfileWrite( void );
+
+void ProfileThreadsBegin( void );
+void ProfileThreadWork( int threadnum, int items, double busy, const int *histogram );
+void ProfileThreadsEnd( int workcnt, double wall );
+int ProfileBucket( double seconds );
+
+#endif
@@ -24,7 +24,15 @@ extern int numthreads;
 
 void ThreadSetDefault( void );
 int GetThreadWork( void );
+int ThreadNum( void );
+void ThreadSkipWork( const byte *skip );
 void RunThreadsOnIndividual( int workcnt, qboolean showpacifier, void ( *func )( int ) );
+void RunThreadsOnIndividualCost( int workcnt, qboolean showpacifier, void ( *func )( int ), int ( *costfunc )( int ) );
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) );
 void ThreadLock( void );
 void ThreadUnlock( void );
+void ThreadBackground( void ( *func )( void ) );
+void ThreadBackgroundJoin( void );
+qboolean ThreadBackgroundSleep( int msec );
+void ThreadBackgroundLock( void );
+void ThreadBackgroundUnlock( void );
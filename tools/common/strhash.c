@@ -0,0 +1,273 @@
+/*
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#include "cmdlib.h"
+#include "strhash.h"
+
+
+
+/*
+   StrHashKey()
+   case-insensitive fnv-1a hash of a string
+ */
+
+unsigned int StrHashKey( const char *s ){
+	unsigned int hash;
+
+
+	hash = 2166136261u;
+	for ( ; *s; s++ )
+		hash = ( hash ^ (unsigned char) tolower( (unsigned char) *s ) ) * 16777619u;
+	return hash;
+}
+
+
+
+/*
+   StrHashCompare()
+   compares a key against a node in the table's case mode
+ */
+
+static int StrHashCompare( strHash_t *table, const char *key, const strHashNode_t *node ){
+	if ( table->caseSensitive ) {
+		return strcmp( key, node->key );
+	}
+	return Q_stricmp( key, node->key );
+}
+
+
+
+/*
+   StrHashNew()
+   allocates an empty table, numBuckets is rounded up to a power of two
+ */
+
+strHash_t *StrHashNew( int numBuckets, qboolean caseSensitive ){
+	strHash_t   *table;
+
+
+	table = safe_malloc( sizeof( *table ) );
+	table->numBuckets = 16;
+	while ( table->numBuckets < numBuckets )
+		table->numBuckets <<= 1;
+	table->buckets = safe_malloc( table->numBuckets * sizeof( *table->buckets ) );
+	memset( table->buckets, 0, table->numBuckets * sizeof( *table->buckets ) );
+	table->numNodes = 0;
+	table->caseSensitive = caseSensitive;
+	return table;
+}
+
+
+
+/*
+   StrHashClear()
+   removes all nodes, values are not touched
+ */
+
+void StrHashClear( strHash_t *table ){
+	int i;
+	strHashNode_t   *node, *next;
+
+
+	for ( i = 0; i < table->numBuckets; i++ )
+	{
+		for ( node = table->buckets[ i ]; node != NULL; node = next )
+		{
+			next = node->next;
+			free( node );
+		}
+		table->buckets[ i ] = NULL;
+	}
+	table->numNodes = 0;
+}
+
+
+
+/*
+   StrHashFree()
+   frees a table and its nodes
+ */
+
+void StrHashFree( strHash_t *table ){
+	if ( table == NULL ) {
+		return;
+	}
+	StrHashClear( table );
+	free( table->buckets );
+	free( table );
+}
+
+
+
+/*
+   StrHashGrow()
+   doubles the bucket count, preserving node order within each bucket
+ */
+
+static void StrHashGrow( strHash_t *table ){
+	int i, numBuckets;
+	strHashNode_t   **buckets, **tails, *node, *next;
+
+
+	numBuckets = table->numBuckets << 1;
+	buckets = safe_malloc( numBuckets * sizeof( *buckets ) );
+	tails = safe_malloc( numBuckets * sizeof( *tails ) );
+	memset( buckets, 0, numBuckets * sizeof( *buckets ) );
+	memset( tails, 0, numBuckets * sizeof( *tails ) );
+
+	for ( i = 0; i < table->numBuckets; i++ )
+	{
+		for ( node = table->buckets[ i ]; node != NULL; node = next )
+		{
+			next = node->next;
+			node->next = NULL;
+			if ( tails[ node->hash & ( numBuckets - 1 ) ] == NULL ) {
+				buckets[ node->hash & ( numBuckets - 1 ) ] = node;
+			}
+			else{
+				tails[ node->hash & ( numBuckets - 1 ) ]->next = node;
+			}
+			tails[ node->hash & ( numBuckets - 1 ) ] = node;
+		}
+	}
+
+	free( tails );
+	free( table->buckets );
+	table->buckets = buckets;
+	table->numBuckets = numBuckets;
+}
+
+
+
+/*
+   StrHashAdd()
+   adds a copy of key with a value, after any nodes with an equal key
+ */
+
+strHashNode_t *StrHashAdd( strHash_t *table, const char *key, void *value ){
+	strHashNode_t   *node, **prev;
+
+
+	/* keep chains short */
+	if ( table->numNodes >= table->numBuckets * 2 ) {
+		StrHashGrow( table );
+	}
+
+	/* make node */
+	node = safe_malloc( sizeof( *node ) + strlen( key ) );
+	node->next = NULL;
+	node->hash = StrHashKey( key );
+	node->value = value;
+	strcpy( node->key, key );
+
+	/* append it */
+	for ( prev = &table->buckets[ node->hash & ( table->numBuckets - 1 ) ]; *prev != NULL; prev = &( *prev )->next ) ;
+	*prev = node;
+	table->numNodes++;
+	return node;
+}
+
+
+
+/*
+   StrHashRemove()
+   removes the first node matching both key and value
+ */
+
+qboolean StrHashRemove( strHash_t *table, const char *key, void *value ){
+	unsigned int hash;
+	strHashNode_t   *node, **prev;
+
+
+	hash = StrHashKey( key );
+	for ( prev = &table->buckets[ hash & ( table->numBuckets - 1 ) ]; *prev != NULL; prev = &( *prev )->next )
+	{
+		node = *prev;
+		if ( node->hash == hash && node->value == value && !StrHashCompare( table, key, node ) ) {
+			*prev = node->next;
+			free( node );
+			table->numNodes--;
+			return qtrue;
+		}
+	}
+	return qfalse;
+}
+
+
+
+/*
+   StrHashFirst()
+   returns the first (oldest) node matching key or NULL
+ */
+
+strHashNode_t *StrHashFirst( strHash_t *table, const char *key ){
+	unsigned int hash;
+	strHashNode_t   *node;
+
+
+	hash = StrHashKey( key );
+	for ( node = table->buckets[ hash & ( table->numBuckets - 1 ) ]; node != NULL; node = node->next )
+	{
+		if ( node->hash == hash && !StrHashCompare( table, key, node ) ) {
+			return node;
+		}
+	}
+	return NULL;
+}
+
+
+
+/*
+   StrHashNext()
+   returns the next node after node with an equal key or NULL
+ */
+
+strHashNode_t *StrHashNext( strHash_t *table, strHashNode_t *node ){
+	const char  *key;
+	unsigned int hash;
+
+
+	key = node->key;
+	hash = node->hash;
+	for ( node = node->next; node != NULL; node = node->next )
+	{
+		if ( node->hash == hash && !StrHashCompare( table, key, node ) ) {
+			return node;
+		}
+	}
+	return NULL;
+}
+
+
+
+/*
+   StrHashFind()
+   returns the value of the first node matching key or NULL
+ */
+
+void *StrHashFind( strHash_t *table, const char *key ){
+	strHashNode_t   *node;
+
+
+	node = StrHashFirst( table, key );
+	return node != NULL ? node->value : NULL;
+}
@@ -0,0 +1,65 @@
+/*
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+
+#ifndef __STRHASH_H__
+#define __STRHASH_H__
+
+/*
+   string hash tables
+
+   keys are copied into the table and hashed case-insensitively, so a table
+   can be searched either case-sensitively or not; nodes with equal keys are
+   kept in insertion order
+ */
+
+typedef struct strHashNode_s
+{
+	struct strHashNode_s    *next;
+	unsigned int hash;
+	void                    *value;
+	char key[ 1 ];                      /* variable sized */
+}
+strHashNode_t;
+
+typedef struct strHash_s
+{
+	strHashNode_t           **buckets;
+	int numBuckets;                     /* power of two */
+	int numNodes;
+	qboolean caseSensitive;
+}
+strHash_t;
+
+unsigned int StrHashKey( const char *s );
+
+strHash_t *StrHashNew( int numBuckets, qboolean caseSensitive );
+void StrHashClear( strHash_t *table );
+void StrHashFree( strHash_t *table );
+
+strHashNode_t *StrHashAdd( strHash_t *table, const char *key, void *value );
+qboolean StrHashRemove( strHash_t *table, const char *key, void *value );
+
+strHashNode_t *StrHashFirst( strHash_t *table, const char *key );
+strHashNode_t *StrHashNext( strHash_t *table, strHashNode_t *node );
+void *StrHashFind( strHash_t *table, const char *key );
+
+#endif
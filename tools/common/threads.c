@@ -32,8 +32,13 @@
 #include "mathlib.h"
 #include "inout.h"
 #include "qthreads.h"
+#include "profile.h"
 
-#define MAX_THREADS 64
+#if GDEF_OS_WINDOWS
+#include <windows.h>
+#endif
+
+#define MAX_WORK_CHUNK      16      /* most items a thread takes from a queue at once */
 
 int dispatch;
 int workcount;
@@ -42,34 +47,74 @@ qboolean pacifier;
 
 qboolean threaded;
 
+/* index of the worker thread running on this thread, 0 outside of the workers */
+#if GDEF_COMPILER_MSVC
+static __declspec( thread ) int currentthread;
+#else
+static __thread int currentthread;
+#endif
+
 /*
    =============
-   GetThreadWork
+   atomics
 
+   the work queues only need compare-and-swap and add
    =============
  */
-int GetThreadWork( void ){
-	int r;
-	int f;
+#if GDEF_COMPILER_MSVC
+static int AtomicAdd( volatile int *value, int add ){
+	return InterlockedExchangeAdd( (volatile LONG *) value, add ) + add;
+}
 
-	ThreadLock();
+static qboolean AtomicCompareSwap( volatile int *value, int expected, int desired ){
+	return InterlockedCompareExchange( (volatile LONG *) value, desired, expected ) == expected;
+}
 
-	if ( dispatch == workcount ) {
-		ThreadUnlock();
-		return -1;
-	}
+static int64_t AtomicLoad64( volatile int64_t *value ){
+	return InterlockedCompareExchange64( (volatile LONGLONG *) value, 0, 0 );
+}
 
-	f = 40 * dispatch / workcount;
-	if ( f < oldf ) {
-		Sys_Printf( "warning: progress went backwards (should never happen)\n" );
-		oldf = f;
-	}
-	while ( f > oldf )
+static qboolean AtomicCompareSwap64( volatile int64_t *value, int64_t expected, int64_t desired ){
+	return InterlockedCompareExchange64( (volatile LONGLONG *) value, desired, expected ) == expected;
+}
+#else
+static int AtomicAdd( volatile int *value, int add ){
+	return __atomic_add_fetch( value, add, __ATOMIC_SEQ_CST );
+}
+
+static qboolean AtomicCompareSwap( volatile int *value, int expected, int desired ){
+	return __atomic_compare_exchange_n( value, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) ? qtrue : qfalse;
+}
+
+static int64_t AtomicLoad64( volatile int64_t *value ){
+	return __atomic_load_n( value, __ATOMIC_SEQ_CST );
+}
+
+static qboolean AtomicCompareSwap64( volatile int64_t *value, int64_t expected, int64_t desired ){
+	return __atomic_compare_exchange_n( value, &expected, desired, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST ) ? qtrue : qfalse;
+}
+#endif
+
+/*
+   =============
+   WorkProgress
+
+   prints the pacifier up to the given item, the thread that
+   advances oldf prints that step, so no lock is held
+   =============
+ */
+static void WorkProgress( int item ){
+	int f, old;
+
+	f = 40 * (int64_t) item / workcount;
+	while ( ( old = oldf ) < f )
 	{
-		++oldf;
+		if ( !AtomicCompareSwap( &oldf, old, old + 1 ) ) {
+			continue;
+		}
 		if ( pacifier ) {
-			if ( oldf % 4 == 0 ) {
-				Sys_Printf( "%i", f / 4 );
+			if ( ( old + 1 ) % 4 == 0 ) {
+				Sys_Printf( "%i", ( old + 1 ) / 4 );
 			}
 			else{
 				Sys_Printf( "." );
@@ -77,37 +122,290 @@ int GetThreadWork( void ){
 			fflush( stdout );   /* ydnar */
 		}
 	}
+}
 
-	r = dispatch;
-	dispatch++;
-	ThreadUnlock();
+/*
+   =============
+   GetThreadWork
 
+   =============
+ */
+int GetThreadWork( void ){
+	int r;
+
+	r = AtomicAdd( &dispatch, 1 ) - 1;
+	if ( r >= workcount ) {
+		return -1;
+	}
+
+	WorkProgress( r );
 	return r;
 }
 
 
+/*
+   =============
+   work queues
+
+   RunThreadsOnIndividual gives every thread a queue of work items,
+   dealt round robin from the most to the least expensive item when a
+   cost function is given. a queue is a range of workorder, the owner
+   takes chunks from its front, threads that run out steal from the
+   back of the fullest queue. both ends live in one 64 bit word that
+   is only changed with compare-and-swap
+   =============
+ */
+typedef struct workQueue_s
+{
+	volatile int64_t range;                 /* front in the low 32 bits, back in the high 32 bits */
+	int first;                              /* front when the queue was filled */
+	char pad[ 64 - sizeof( int64_t ) - sizeof( int ) ];     /* one queue per cache line */
+}
+workQueue_t;
+
 void ( *workfunction )( int );
+static int ( *workcostfunction )( int );
+static int *workorder;
+static int *workcosts;
+static workQueue_t *workqueues;
+static int numworkqueues;
+static volatile int workdone;
+static const byte *workskip;
+
+#define WORK_RANGE( front, back )   ( (int64_t) ( front ) | ( (int64_t) ( back ) << 32 ) )
+#define WORK_FRONT( range )         ( (int) ( ( range ) & 0xFFFFFFFF ) )
+#define WORK_BACK( range )          ( (int) ( ( range ) >> 32 ) )
+
+static int CompareWorkCost( const void *a, const void *b ){
+	int ia = *( (const int*) a ), ib = *( (const int*) b );
+
+	/* most expensive first, ties in item order */
+	if ( workcosts[ ia ] != workcosts[ ib ] ) {
+		return workcosts[ ia ] > workcosts[ ib ] ? -1 : 1;
+	}
+	return ia - ib;
+}
 
-void ThreadWorkerFunction( int threadnum ){
-	int work;
+static int SetupWorkQueues( int workcnt ){
+	int i, q, n, numsorted, *sorted;
+
+	numworkqueues = numthreads > 1 ? numthreads : 1;
+	workqueues = safe_malloc( numworkqueues * sizeof( *workqueues ) );
+	memset( workqueues, 0, numworkqueues * sizeof( *workqueues ) );
+	workorder = safe_malloc( ( workcnt > 0 ? workcnt : 1 ) * sizeof( *workorder ) );
+
+	/* leave out the skipped items */
+	sorted = safe_malloc( ( workcnt > 0 ? workcnt : 1 ) * sizeof( *sorted ) );
+	for ( i = 0, numsorted = 0; i < workcnt; i++ )
+	{
+		if ( workskip == NULL || !workskip[ i ] ) {
+			sorted[ numsorted++ ] = i;
+		}
+	}
+
+	/* sort by cost (only worth it when there is more than one thread) */
+	if ( workcostfunction != NULL && numworkqueues > 1 ) {
+		workcosts = safe_malloc( ( workcnt > 0 ? workcnt : 1 ) * sizeof( *workcosts ) );
+		for ( i = 0; i < numsorted; i++ )
+			workcosts[ sorted[ i ] ] = workcostfunction( sorted[ i ] );
+		qsort( sorted, numsorted, sizeof( *sorted ), CompareWorkCost );
+		free( workcosts );
+		workcosts = NULL;
+	}
+
+	/* deal the items round robin */
+	for ( q = 0, n = 0; q < numworkqueues; q++ )
+	{
+		workqueues[ q ].first = n;
+		for ( i = q; i < numsorted; i += numworkqueues )
+			workorder[ n++ ] = sorted[ i ];
+		workqueues[ q ].range = WORK_RANGE( workqueues[ q ].first, n );
+	}
+	free( sorted );
+
+	/* skipped items count as done */
+	return workcnt - numsorted;
+}
+
+/*
+   =============
+   TakeWork
+
+   takes a chunk from the front of the queue, items get cheaper
+   towards the back so the chunk grows with the items already taken
+   =============
+ */
+static qboolean TakeWork( workQueue_t *q, int *first, int *last ){
+	int64_t range;
+	int front, back, count;
 
 	while ( 1 )
 	{
-		work = GetThreadWork();
-		if ( work == -1 ) {
-			break;
+		range = AtomicLoad64( &q->range );
+		front = WORK_FRONT( range );
+		back = WORK_BACK( range );
+		if ( front >= back ) {
+			return qfalse;
+		}
+		count = 1 + ( front - q->first ) / 32;
+		if ( count > MAX_WORK_CHUNK ) {
+			count = MAX_WORK_CHUNK;
+		}
+		if ( count > back - front ) {
+			count = back - front;
+		}
+		if ( AtomicCompareSwap64( &q->range, range, WORK_RANGE( front + count, back ) ) ) {
+			*first = front;
+			*last = front + count;
+			return qtrue;
 		}
-//Sys_Printf ("thread %i, work %i\n", threadnum, work);
-		workfunction( work );
 	}
 }
 
-void RunThreadsOnIndividual( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
+/*
+   =============
+   StealWork
+
+   takes up to half of the fullest other queue from its back
+   =============
+ */
+static qboolean StealWork( int self, int *first, int *last ){
+	int i, best, most, left, count;
+	int64_t range;
+
+	while ( 1 )
+	{
+		/* find the fullest queue */
+		best = -1;
+		most = 0;
+		for ( i = 0; i < numworkqueues; i++ )
+		{
+			if ( i == self ) {
+				continue;
+			}
+			range = AtomicLoad64( &workqueues[ i ].range );
+			left = WORK_BACK( range ) - WORK_FRONT( range );
+			if ( left > most ) {
+				best = i;
+				most = left;
+			}
+		}
+		if ( best < 0 ) {
+			return qfalse;
+		}
+
+		/* steal from it */
+		range = AtomicLoad64( &workqueues[ best ].range );
+		left = WORK_BACK( range ) - WORK_FRONT( range );
+		if ( left <= 0 ) {
+			continue;
+		}
+		count = ( left + 1 ) / 2;
+		if ( count > MAX_WORK_CHUNK ) {
+			count = MAX_WORK_CHUNK;
+		}
+		if ( AtomicCompareSwap64( &workqueues[ best ].range, range, WORK_RANGE( WORK_FRONT( range ), WORK_BACK( range ) - count ) ) ) {
+			*first = WORK_BACK( range ) - count;
+			*last = WORK_BACK( range );
+			return qtrue;
+		}
+	}
+}
+
+void ThreadWorkerFunction( int threadnum ){
+	int self, first, last, done;
+	int items, histogram[ PROFILE_BUCKETS ];
+	double busy, t;
+
+	/* profiling times every item, the totals are handed over once at the end */
+	items = 0;
+	busy = 0.0;
+	memset( histogram, 0, sizeof( histogram ) );
+
+	currentthread = threadnum;
+	self = threadnum % numworkqueues;
+	while ( TakeWork( &workqueues[ self ], &first, &last ) || StealWork( self, &first, &last ) )
+	{
+		for ( ; first < last; first++ )
+		{
+//Sys_Printf ("thread %i, work %i\n", threadnum, workorder[ first ]);
+			if ( profiling ) {
+				t = ProfileClock();
+				workfunction( workorder[ first ] );
+				t = ProfileClock() - t;
+				busy += t;
+				items++;
+				histogram[ ProfileBucket( t ) ]++;
+			}
+			else{
+				workfunction( workorder[ first ] );
+			}
+			done = AtomicAdd( &workdone, 1 );
+			WorkProgress( done - 1 );
+		}
+	}
+
+	if ( profiling ) {
+		ProfileThreadWork( threadnum, items, busy, histogram );
+	}
+}
+
+/*
+   =============
+   ThreadNum
+
+   returns the worker index of the calling thread, for per-thread scratch data
+   =============
+ */
+int ThreadNum( void ){
+	return currentthread;
+}
+
+/*
+   =============
+   ThreadSkipWork
+
+   the next RunThreadsOnIndividual leaves out every item whose skip byte
+   is set, such as work a checkpoint already holds
+   =============
+ */
+void ThreadSkipWork( const byte *skip ){
+	workskip = skip;
+}
+
+/*
+   =============
+   RunThreadsOnIndividualCost
+
+   like RunThreadsOnIndividual, expensive items (by costfunc) are handed out first
+   =============
+ */
+void RunThreadsOnIndividualCost( int workcnt, qboolean showpacifier, void ( *func )( int ), int ( *costfunc )( int ) ){
+	double start = 0.0;
+
 	if ( numthreads == -1 ) {
 		ThreadSetDefault();
 	}
 	workfunction = func;
+	workcostfunction = costfunc;
+	workdone = SetupWorkQueues( workcnt );
+	workskip = NULL;
+	if ( profiling ) {
+		ProfileThreadsBegin();
+		start = ProfileClock();
+	}
 	RunThreadsOn( workcnt, showpacifier, ThreadWorkerFunction );
+	if ( profiling ) {
+		ProfileThreadsEnd( workcnt, ProfileClock() - start );
+	}
+	free( workqueues );
+	free( workorder );
+	workqueues = NULL;
+	workorder = NULL;
+}
+
+void RunThreadsOnIndividual( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
+	RunThreadsOnIndividualCost( workcnt, showpacifier, func, NULL );
 }
 
 
@@ -134,7 +432,7 @@ void ThreadSetDefault( void ){
 	if ( numthreads == -1 ) { // not set manually
 		GetSystemInfo( &info );
 		numthreads = info.dwNumberOfProcessors;
-		if ( numthreads < 1 || numthreads > 32 ) {
+		if ( numthreads < 1 ) {
 			numthreads = 1;
 		}
 	}
@@ -171,8 +469,8 @@ void ThreadUnlock( void ){
    =============
  */
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
-	int threadid[MAX_THREADS];
-	HANDLE threadhandle[MAX_THREADS];
+	DWORD *threadid;
+	HANDLE *threadhandle;
 	int i;
 	int start, end;
 
@@ -193,6 +491,8 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	}
 	else
 	{
+		threadid = safe_malloc( numthreads * sizeof( *threadid ) );
+		threadhandle = safe_malloc( numthreads * sizeof( *threadhandle ) );
 		for ( i = 0; i < numthreads; i++ )
 		{
 			threadhandle[i] = CreateThread(
@@ -210,6 +510,8 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 
 		for ( i = 0; i < numthreads; i++ )
 			WaitForSingleObject( threadhandle[i], INFINITE );
+		free( threadhandle );
+		free( threadid );
 	}
 	DeleteCriticalSection( &crit );
 
@@ -267,7 +569,7 @@ void ThreadUnlock( void ){
  */
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	int i;
-	pthread_t work_threads[MAX_THREADS];
+	pthread_t *work_threads;
 	pthread_addr_t status;
 	pthread_attr_t attrib;
 	pthread_mutexattr_t mattrib;
@@ -304,6 +606,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 		Error( "pthread_attr_setstacksize failed" );
 	}
 
+	work_threads = safe_malloc( numthreads * sizeof( *work_threads ) );
 	for ( i = 0; i < numthreads; i++ )
 	{
 		if ( pthread_create( &work_threads[i], attrib
@@ -318,6 +621,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 			Error( "pthread_join failed" );
 		}
 	}
+	free( work_threads );
 
 	threaded = qfalse;
 
@@ -375,7 +679,7 @@ void ThreadUnlock( void ){
  */
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	int i;
-	int pid[MAX_THREADS];
+	int *pid;
 	int start, end;
 
 	start = I_FloatTime();
@@ -391,6 +695,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 
 	init_lock( &lck );
 
+	pid = safe_malloc( numthreads * sizeof( *pid ) );
 	for ( i = 0; i < numthreads - 1; i++ )
 	{
 		pid[i] = sprocsp( ( void ( * )( void *, size_t ) ) func, PR_SALL, (void *)i
@@ -405,6 +710,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 
 	for ( i = 0; i < numthreads - 1; i++ )
 		wait( NULL );
+	free( pid );
 
 	threaded = qfalse;
 
@@ -536,7 +842,7 @@ void recursive_mutex_init( pthread_mutexattr_t attribs ){
 void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 	pthread_mutexattr_t mattrib;
 	pthread_attr_t attr;
-	pthread_t work_threads[MAX_THREADS];
+	pthread_t *work_threads;
 	size_t stacksize;
 
 	int start, end;
@@ -575,6 +881,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 		}
 		recursive_mutex_init( mattrib );
 
+		work_threads = safe_malloc( numthreads * sizeof( *work_threads ) );
 		for ( i = 0; i < numthreads; i++ )
 		{
 			/* Default pthread attributes: joinable & non-realtime scheduling */
@@ -588,6 +895,7 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 				Error( "pthread_join failed" );
 			}
 		}
+		free( work_threads );
 		pthread_mutexattr_destroy( &mattrib );
 		threaded = qfalse;
 	}
@@ -644,3 +952,153 @@ void RunThreadsOn( int workcnt, qboolean showpacifier, void ( *func )( int ) ){
 }
 
 #endif
+
+
+/*
+   =======================================================================
+
+   background thread
+
+   one thread that runs beside the workers, for slow i/o they should not
+   wait on. it has its own lock, as ThreadLock() does nothing unless the
+   workers are threaded
+
+   =======================================================================
+ */
+
+static void ( *backgroundfunction )( void );
+static volatile qboolean backgroundstop;
+
+#if GDEF_OS_WINDOWS
+
+static HANDLE backgroundthread;
+static HANDLE backgroundevent;
+static CRITICAL_SECTION backgroundcrit;
+
+static DWORD WINAPI BackgroundThread( LPVOID arg ){
+	backgroundfunction();
+	return 0;
+}
+
+void ThreadBackground( void ( *func )( void ) ){
+	backgroundfunction = func;
+	backgroundstop = qfalse;
+	InitializeCriticalSection( &backgroundcrit );
+	backgroundevent = CreateEvent( NULL, TRUE, FALSE, NULL );
+	backgroundthread = CreateThread( NULL, 0, BackgroundThread, NULL, 0, NULL );
+	if ( backgroundthread == NULL ) {
+		Error( "CreateThread failed" );
+	}
+}
+
+void ThreadBackgroundJoin( void ){
+	backgroundstop = qtrue;
+	SetEvent( backgroundevent );
+	WaitForSingleObject( backgroundthread, INFINITE );
+	CloseHandle( backgroundthread );
+	CloseHandle( backgroundevent );
+	DeleteCriticalSection( &backgroundcrit );
+}
+
+qboolean ThreadBackgroundSleep( int msec ){
+	if ( !backgroundstop ) {
+		WaitForSingleObject( backgroundevent, msec );
+	}
+	return backgroundstop ? qfalse : qtrue;
+}
+
+void ThreadBackgroundLock( void ){
+	EnterCriticalSection( &backgroundcrit );
+}
+
+void ThreadBackgroundUnlock( void ){
+	LeaveCriticalSection( &backgroundcrit );
+}
+
+#elif GDEF_OS_LINUX || ( GDEF_OS_MACOS && !MAC_STATIC_HACK )
+
+#include <sys/time.h>
+
+static pthread_t backgroundthread;
+static pthread_mutex_t backgroundmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t backgroundsleepmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t backgroundcond = PTHREAD_COND_INITIALIZER;
+
+static void *BackgroundThread( void *arg ){
+	backgroundfunction();
+	return NULL;
+}
+
+void ThreadBackground( void ( *func )( void ) ){
+	backgroundfunction = func;
+	backgroundstop = qfalse;
+	if ( pthread_create( &backgroundthread, NULL, BackgroundThread, NULL ) != 0 ) {
+		Error( "pthread_create failed" );
+	}
+}
+
+void ThreadBackgroundJoin( void ){
+	pthread_mutex_lock( &backgroundsleepmutex );
+	backgroundstop = qtrue;
+	pthread_cond_signal( &backgroundcond );
+	pthread_mutex_unlock( &backgroundsleepmutex );
+	if ( pthread_join( backgroundthread, NULL ) != 0 ) {
+		Error( "pthread_join failed" );
+	}
+}
+
+qboolean ThreadBackgroundSleep( int msec ){
+	struct timeval now;
+	struct timespec until;
+
+	gettimeofday( &now, NULL );
+	until.tv_sec = now.tv_sec + msec / 1000;
+	until.tv_nsec = now.tv_usec * 1000 + ( msec % 1000 ) * 1000000;
+	if ( until.tv_nsec >= 1000000000 ) {
+		until.tv_sec++;
+		until.tv_nsec -= 1000000000;
+	}
+
+	pthread_mutex_lock( &backgroundsleepmutex );
+	while ( !backgroundstop )
+	{
+		if ( pthread_cond_timedwait( &backgroundcond, &backgroundsleepmutex, &until ) != 0 ) {
+			break;
+		}
+	}
+	pthread_mutex_unlock( &backgroundsleepmutex );
+	return backgroundstop ? qfalse : qtrue;
+}
+
+void ThreadBackgroundLock( void ){
+	pthread_mutex_lock( &backgroundmutex );
+}
+
+void ThreadBackgroundUnlock( void ){
+	pthread_mutex_unlock( &backgroundmutex );
+}
+
+#else
+
+/* no threads, the background work runs once when it is joined */
+void ThreadBackground( void ( *func )( void ) ){
+	backgroundfunction = func;
+	backgroundstop = qfalse;
+}
+
+void ThreadBackgroundJoin( void ){
+	backgroundstop = qtrue;
+	backgroundfunction();
+}
+
+qboolean ThreadBackgroundSleep( int msec ){
+	return backgroundstop ? qfalse : qtrue;
+}
+
+void ThreadBackgroundLock( void ){
+}
+
+void ThreadBackgroundUnlock( void ){
+}
+
+#endif
@@ -37,6 +37,13 @@
 // - Pak files are searched first inside the directories.
 // - Case insensitive.
 // - Unix-style slashes (/) (windows is backwards .. everyone knows that)
+// - Every file is looked up in one hashed index, built as the directories
+//   are added. A name can be in several places; directories come first in
+//   the order they were added, then the paks in the order they were found.
+//   Lookups never touch the disk; files the compiler writes are added as it
+//   writes them, and vfsUpdate rescans the dirs whose time changed.
+// - Paks are memory-mapped. Stored files are copied straight out of the
+//   mapping and deflated files are inflated straight into the caller buffer.
 //
 // Leonardo Zide (leo@lokigames.com)
 //
@@ -50,27 +57,93 @@
 #include "mathlib.h"
 #include "inout.h"
 #include "vfs.h"
-#include <minizip/unzip.h>
+#include <zlib.h>
 #include <glib.h>
 
+#if GDEF_OS_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#endif
+
+// a pak mapped into memory
 typedef struct
 {
 	char*   name;
-	unzFile zipfile;
-	unz_file_pos zippos;
+	const byte* data;
 	guint32 size;
-} VFS_PAKFILE;
+	time_t time;
+#if GDEF_OS_WINDOWS
+	HANDLE file;
+	HANDLE mapping;
+#endif
+} VFS_PAK;
+
+// one place a file can be loaded from
+typedef struct VFS_FILE_s
+{
+	struct VFS_FILE_s* next;     // same name, next in search order
+	int order;                  // dirs by number, then paks after VFS_MAXDIRS
+	int dir;                    // -1 for a file in a pak
+	char*   path;               // path under the dir, as it is on disk
+	VFS_PAK* pak;
+	guint32 offset;             // of the local header in the pak
+	guint32 csize, size;
+	int method;
+} VFS_FILE;
+
+#define ZIP_LOCAL_SIGNATURE     0x04034b50
+#define ZIP_CENTRAL_SIGNATURE   0x02014b50
+#define ZIP_END_SIGNATURE       0x06054b50
+#define ZIP64_LOCATOR_SIGNATURE 0x07064b50
+#define ZIP64_LOCATOR_SIZE      20
+#define ZIP_LOCAL_SIZE          30
+#define ZIP_CENTRAL_SIZE        46
+#define ZIP_END_SIZE            22
+#define ZIP_STORED              0
+#define ZIP_DEFLATED            8
+
+#define VFS_MAXDEPTH            32
+
+// a dir or pak as it was when it was indexed
+typedef struct
+{
+	char*   path;
+	time_t time;
+	int dir;                    // -1 for a pak
+	char*   relative;           // of a dir, under g_strDirs[dir]
+	char*   paks;               // of a dir vfsInitDirectory was called with, its paks and pk3dirs
+} VFS_STAMP;
+
+// what vfsDropMissing looks for
+typedef struct
+{
+	int dir;
+	const char* relative;
+	GSList* names;
+} VFS_DROP;
 
 // =============================================================================
 // Global variables
 
-static GSList*  g_unzFiles;
-static GSList*  g_pakFiles;
+static GHashTable* g_fileIndex;
+static VFS_PAK* g_paks[VFS_MAXPAKS];
+static int g_numPaks;
+static int g_numIndexed;
 static char g_strDirs[VFS_MAXDIRS][PATH_MAX + 1];
 static int g_numDirs;
 char g_strForbiddenDirs[VFS_MAXDIRS][PATH_MAX + 1];
 int g_numForbiddenDirs = 0;
 static gboolean g_bUsePak = TRUE;
+static char g_strInitDirs[VFS_MAXDIRS][PATH_MAX + 1];
+static int g_numInitDirs;
+static VFS_STAMP* g_stamps;
+static int g_numStamps, g_maxStamps;
+static gboolean g_bCheckDirs, g_bDirsDiffer;
+static int g_numCheckedDirs;
+static char g_strCheckedForbiddenDirs[VFS_MAXDIRS][PATH_MAX + 1];
+static int g_numCheckedForbiddenDirs;
 
 // =============================================================================
 // Static functions
@@ -101,62 +174,444 @@ static void vfsFixDOSName( char *src ){
 //!\todo Define globally or use heap-allocated string.
 #define NAME_MAX 255
 
-static void vfsInitPakFile( const char *filename ){
-	unz_global_info gi;
-	unzFile uf;
-	guint32 i;
-	int err;
+// little endian fields of a zip header, which may sit at any alignment
+static int vfsZipShort( const byte *p ){
+	return p[0] | ( p[1] << 8 );
+}
+
+static guint32 vfsZipLong( const byte *p ){
+	return (guint32) p[0] | ( (guint32) p[1] << 8 ) | ( (guint32) p[2] << 16 ) | ( (guint32) p[3] << 24 );
+}
+
+// lower case, forward slash key of a file name; g_free it
+static char *vfsIndexName( const char *filename ){
+	char *fixed, *lower;
+
+	fixed = g_strdup( filename );
+	vfsFixDOSName( fixed );
+	lower = g_ascii_strdown( fixed, -1 );
+	g_free( fixed );
+	return lower;
+}
+
+static void vfsFreeFiles( gpointer key, gpointer value, gpointer user_data ){
+	VFS_FILE *file, *next;
+
+	for ( file = (VFS_FILE*)value; file != NULL; file = next )
+	{
+		next = file->next;
+		free( file->path );
+		free( file );
+	}
+}
+
+static time_t vfsFileTime( const char *path ){
+	struct stat st;
+
+	if ( stat( path, &st ) != 0 ) {
+		return -1;
+	}
+	return st.st_mtime;
+}
+
+// remembers the time of a dir or pak, so vfsUpdate can tell what changed since it was indexed
+static time_t vfsStamp( const char *path, int dir, const char *relative ){
+	VFS_STAMP *stamp;
+
+	if ( g_numStamps == g_maxStamps ) {
+		g_maxStamps = g_maxStamps ? g_maxStamps * 2 : 256;
+		g_stamps = (VFS_STAMP*)realloc( g_stamps, g_maxStamps * sizeof( VFS_STAMP ) );
+		if ( g_stamps == NULL ) {
+			Error( "vfsStamp: out of memory" );
+		}
+	}
+	stamp = &g_stamps[g_numStamps++];
+	stamp->path = strdup( path );
+	stamp->time = vfsFileTime( path );
+	stamp->dir = dir;
+	stamp->relative = relative != NULL ? strdup( relative ) : NULL;
+	stamp->paks = NULL;
+	return stamp->time;
+}
+
+static int vfsCompareNames( const void *a, const void *b ){
+	return strcmp( *(char* const*)a, *(char* const*)b );
+}
+
+// the sorted names of the paks and pk3dirs in a dir, to tell when one comes or goes
+static char *vfsPakNames( const char *path ){
+	char *names[VFS_MAXPAKS], *list;
+	const char *name, *ext, *p;
+	int i, j, numNames, size;
+	GDir *dir;
+
+	numNames = 0;
+	size = 1;
+	dir = g_dir_open( path, 0, NULL );
+	while ( dir != NULL && numNames < VFS_MAXPAKS && ( name = g_dir_read_name( dir ) ) != NULL )
+	{
+		ext = strrchr( name, '.' );
+		if ( ext == NULL || ( Q_stricmp( ext, ".pk3" ) && Q_stricmp( ext, ".dpk" ) && Q_stricmp( ext, ".pk3dir" ) && Q_stricmp( ext, ".dpkdir" ) ) ) {
+			continue;
+		}
+		for ( j = 0; j < g_numForbiddenDirs; j++ )
+		{
+			p = strrchr( name, '/' );
+			if ( matchpattern( p ? p + 1 : name, g_strForbiddenDirs[j], TRUE ) ) {
+				break;
+			}
+		}
+		if ( j < g_numForbiddenDirs ) {
+			continue;
+		}
+		names[numNames] = g_strdup( name );
+		size += strlen( name ) + 1;
+		numNames++;
+	}
+	if ( dir != NULL ) {
+		g_dir_close( dir );
+	}
+
+	qsort( names, numNames, sizeof( names[0] ), vfsCompareNames );
+	list = (char*)safe_malloc( size );
+	list[0] = 0;
+	for ( i = 0; i < numNames; i++ )
+	{
+		strcat( list, names[i] );
+		strcat( list, "/" );
+		g_free( names[i] );
+	}
+	return list;
+}
+
+// adds a location of a name, behind the ones searched before it
+static VFS_FILE *vfsIndexFile( const char *name, int order ){
+	VFS_FILE *file, *head, **link;
+	char *lower;
+
+	if ( g_fileIndex == NULL ) {
+		g_fileIndex = g_hash_table_new_full( g_str_hash, g_str_equal, g_free, NULL );
+	}
+
+	file = (VFS_FILE*)safe_malloc( sizeof( VFS_FILE ) );
+	memset( file, 0, sizeof( VFS_FILE ) );
+	file->order = order;
+	file->dir = -1;
+
+	lower = vfsIndexName( name );
+	head = (VFS_FILE*)g_hash_table_lookup( g_fileIndex, lower );
+	for ( link = &head; *link != NULL && ( *link )->order <= order; link = &( *link )->next )
+		;
+	file->next = *link;
+	*link = file;
+
+	// takes the key, or frees it if the name is in already
+	g_hash_table_insert( g_fileIndex, lower, head );
+	g_numIndexed++;
+	return file;
+}
+
+// the index-th place a name loads from
+static VFS_FILE *vfsFindFile( const char *filename, int index ){
+	char *lower;
+	int count;
+	VFS_FILE *file;
+
+	lower = vfsIndexName( filename );
+	file = g_fileIndex != NULL ? (VFS_FILE*)g_hash_table_lookup( g_fileIndex, lower ) : NULL;
+	for ( count = 0; file != NULL && count < index; count++ )
+		file = file->next;
+	g_free( lower );
+	return file;
+}
+
+// adds the files under a dir to the index
+static void vfsIndexDirectory( int dir, const char *relative, int depth ){
+	char path[PATH_MAX + 1], name[PATH_MAX + 1];
+	const char *entry, *ext;
+	struct stat st;
+	VFS_FILE *file;
+	GDir *gdir;
+
+	if ( depth > VFS_MAXDEPTH ) {
+		return;
+	}
 
-	uf = unzOpen( filename );
-	if ( uf == NULL ) {
+	snprintf( path, sizeof( path ), "%s%s", g_strDirs[dir], relative );
+	vfsStamp( path, dir, relative );
+	gdir = g_dir_open( path, 0, NULL );
+	if ( gdir == NULL ) {
 		return;
 	}
 
-	g_unzFiles = g_slist_append( g_unzFiles, uf );
+	while ( ( entry = g_dir_read_name( gdir ) ) != NULL )
+	{
+		snprintf( name, sizeof( name ), "%s%s", relative, entry );
+		snprintf( path, sizeof( path ), "%s%s", g_strDirs[dir], name );
+		if ( stat( path, &st ) != 0 ) {
+			continue;
+		}
 
-	err = unzGetGlobalInfo( uf,&gi );
-	if ( err != UNZ_OK ) {
+		if ( S_ISDIR( st.st_mode ) ) {
+			// pk3dirs are dirs of their own
+			ext = strrchr( entry, '.' );
+			if ( depth == 0 && ext != NULL && ( !Q_stricmp( ext, ".pk3dir" ) || !Q_stricmp( ext, ".dpkdir" ) ) ) {
+				continue;
+			}
+			strcat( name, "/" );
+			vfsIndexDirectory( dir, name, depth + 1 );
+			continue;
+		}
+
+		file = vfsIndexFile( name, dir );
+		file->dir = dir;
+		file->path = strdup( name );
+	}
+	g_dir_close( gdir );
+}
+
+// maps a pak into memory
+static VFS_PAK *vfsMapPak( const char *filename ){
+	VFS_PAK *pak;
+
+	pak = (VFS_PAK*)safe_malloc( sizeof( VFS_PAK ) );
+	memset( pak, 0, sizeof( VFS_PAK ) );
+
+#if GDEF_OS_WINDOWS
+	LARGE_INTEGER size;
+
+	pak->file = CreateFileA( filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL );
+	if ( pak->file == INVALID_HANDLE_VALUE ) {
+		free( pak );
+		return NULL;
+	}
+	if ( !GetFileSizeEx( pak->file, &size ) || size.QuadPart < ZIP_END_SIZE || size.QuadPart > 0xFFFFFFFF ) {
+		CloseHandle( pak->file );
+		free( pak );
+		return NULL;
+	}
+	pak->size = (guint32) size.QuadPart;
+	pak->mapping = CreateFileMappingA( pak->file, NULL, PAGE_READONLY, 0, 0, NULL );
+	if ( pak->mapping == NULL ) {
+		CloseHandle( pak->file );
+		free( pak );
+		return NULL;
+	}
+	pak->data = (const byte*)MapViewOfFile( pak->mapping, FILE_MAP_READ, 0, 0, 0 );
+	if ( pak->data == NULL ) {
+		CloseHandle( pak->mapping );
+		CloseHandle( pak->file );
+		free( pak );
+		return NULL;
+	}
+#else
+	struct stat st;
+	void *data;
+	int fd;
+
+	fd = open( filename, O_RDONLY );
+	if ( fd < 0 ) {
+		free( pak );
+		return NULL;
+	}
+	if ( fstat( fd, &st ) != 0 || st.st_size < ZIP_END_SIZE || st.st_size > 0xFFFFFFFF ) {
+		close( fd );
+		free( pak );
+		return NULL;
+	}
+	pak->size = (guint32) st.st_size;
+	data = mmap( NULL, pak->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+	close( fd );
+	if ( data == MAP_FAILED ) {
+		free( pak );
+		return NULL;
+	}
+	pak->data = (const byte*)data;
+#endif
+
+	pak->name = strdup( filename );
+	pak->time = vfsStamp( filename, -1, NULL );
+	return pak;
+}
+
+static void vfsUnmapPak( VFS_PAK *pak ){
+#if GDEF_OS_WINDOWS
+	UnmapViewOfFile( pak->data );
+	CloseHandle( pak->mapping );
+	CloseHandle( pak->file );
+#else
+	munmap( (void*)pak->data, pak->size );
+#endif
+	free( pak->name );
+	free( pak );
+}
+
+static void vfsInitPakFile( const char *filename ){
+	const byte *end, *entry;
+	char filename_inzip[NAME_MAX + 1];
+	guint32 i, lowest, numEntries, offset, size;
+	int nameLen, extraLen, commentLen;
+	VFS_PAK *pak;
+	VFS_FILE *file;
+
+	if ( g_numPaks == VFS_MAXPAKS ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: more than %d paks, skipping %s\n", VFS_MAXPAKS, filename );
+		return;
+	}
+
+	pak = vfsMapPak( filename );
+	if ( pak == NULL ) {
 		return;
 	}
-	unzGoToFirstFile( uf );
 
-	for ( i = 0; i < gi.number_entry; i++ )
+	// the end record sits behind a comment of up to 64k
+	lowest = pak->size > ZIP_END_SIZE + 0xFFFF ? pak->size - ZIP_END_SIZE - 0xFFFF : 0;
+	for ( i = pak->size - ZIP_END_SIZE; vfsZipLong( pak->data + i ) != ZIP_END_SIGNATURE; i-- )
 	{
-		char filename_inzip[NAME_MAX];
-		char *filename_lower;
-		unz_file_info file_info;
-		VFS_PAKFILE* file;
+		if ( i == lowest ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: %s is not a zip file\n", filename );
+			vfsUnmapPak( pak );
+			return;
+		}
+	}
+	end = pak->data + i;
+	numEntries = vfsZipShort( end + 10 );
+	size = vfsZipLong( end + 12 );
+	offset = vfsZipLong( end + 16 );
+
+	// the 32 bit fields of a zip64 archive don't hold its real layout
+	if ( ( i >= ZIP64_LOCATOR_SIZE && vfsZipLong( end - ZIP64_LOCATOR_SIZE ) == ZIP64_LOCATOR_SIGNATURE )
+		 || numEntries == 0xFFFF || size == 0xFFFFFFFF || offset == 0xFFFFFFFF ) {
+		Error( "%s is a ZIP64 archive, which is not supported, repack it as a plain zip", filename );
+	}
+	if ( offset > pak->size || size > pak->size - offset ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: %s has a broken central directory\n", filename );
+		vfsUnmapPak( pak );
+		return;
+	}
+
+	g_paks[g_numPaks++] = pak;
 
-		err = unzGetCurrentFileInfo( uf, &file_info, filename_inzip, sizeof( filename_inzip ), NULL, 0, NULL, 0 );
-		if ( err != UNZ_OK ) {
+	// index the central directory
+	entry = pak->data + offset;
+	for ( i = 0; i < numEntries; i++ )
+	{
+		if ( entry + ZIP_CENTRAL_SIZE > pak->data + offset + size || vfsZipLong( entry ) != ZIP_CENTRAL_SIGNATURE ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: %s: central directory ends after %u of %u files\n", filename, i, numEntries );
 			break;
 		}
-		unz_file_pos pos;
-		err = unzGetFilePos( uf, &pos );
-		if ( err != UNZ_OK ) {
+		nameLen = vfsZipShort( entry + 28 );
+		extraLen = vfsZipShort( entry + 30 );
+		commentLen = vfsZipShort( entry + 32 );
+		if ( entry + ZIP_CENTRAL_SIZE + nameLen > pak->data + offset + size ) {
 			break;
 		}
 
-		file = (VFS_PAKFILE*)safe_malloc( sizeof( VFS_PAKFILE ) );
-		g_pakFiles = g_slist_append( g_pakFiles, file );
+		// directories and encrypted files are left out
+		if ( nameLen > 0 && nameLen <= NAME_MAX && entry[ZIP_CENTRAL_SIZE + nameLen - 1] != '/' && !( vfsZipShort( entry + 8 ) & 1 ) ) {
+			memcpy( filename_inzip, entry + ZIP_CENTRAL_SIZE, nameLen );
+			filename_inzip[nameLen] = 0;
+
+			file = vfsIndexFile( filename_inzip, VFS_MAXDIRS + g_numPaks - 1 );
+			file->pak = pak;
+			file->method = vfsZipShort( entry + 10 );
+			file->csize = vfsZipLong( entry + 20 );
+			file->size = vfsZipLong( entry + 24 );
+			file->offset = vfsZipLong( entry + 42 );
+			if ( file->csize == 0xFFFFFFFF || file->size == 0xFFFFFFFF || file->offset == 0xFFFFFFFF ) {
+				Error( "%s: %s has ZIP64 sizes, which are not supported, repack it as a plain zip", filename, filename_inzip );
+			}
+		}
 
-		vfsFixDOSName( filename_inzip );
-		//-1 null terminated string
-		filename_lower = g_ascii_strdown( filename_inzip, -1 );
+		entry += ZIP_CENTRAL_SIZE + nameLen + extraLen + commentLen;
+	}
+}
 
-		file->name = strdup( filename_lower );
-		file->size = file_info.uncompressed_size;
-		file->zipfile = uf;
-		file->zippos = pos;
+// reads a whole file from disk
+static int vfsLoadFullPath( const char *filename, void **bufferptr ){
+	long len;
+	FILE *f;
 
-		if ( ( i + 1 ) < gi.number_entry ) {
-			err = unzGoToNextFile( uf );
-			if ( err != UNZ_OK ) {
-				break;
+	f = fopen( filename, "rb" );
+	if ( f == NULL ) {
+		return -1;
+	}
+
+	fseek( f, 0, SEEK_END );
+	len = ftell( f );
+	rewind( f );
+
+	*bufferptr = safe_malloc( len + 1 );
+	if ( *bufferptr == NULL ) {
+		fclose( f );
+		return -1;
+	}
+
+	if ( fread( *bufferptr, 1, len, f ) != (size_t) len ) {
+		fclose( f );
+		return -1;
+	}
+	fclose( f );
+
+	// we need to end the buffer with a 0
+	( (char*) ( *bufferptr ) )[len] = 0;
+
+	return len;
+}
+
+// copies or inflates a file out of its mapped pak
+static int vfsLoadPakFile( VFS_FILE *file, void **bufferptr ){
+	const byte *local, *data;
+	VFS_PAK *pak = file->pak;
+	z_stream stream;
+	int err;
+
+	if ( pak->size < ZIP_LOCAL_SIZE || file->offset > pak->size - ZIP_LOCAL_SIZE ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: %s: bad local header\n", pak->name );
+		return -1;
+	}
+	local = pak->data + file->offset;
+	if ( vfsZipLong( local ) != ZIP_LOCAL_SIGNATURE ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: %s: bad local header\n", pak->name );
+		return -1;
+	}
+	data = local + ZIP_LOCAL_SIZE + vfsZipShort( local + 26 ) + vfsZipShort( local + 28 );
+	if ( data > pak->data + pak->size || file->csize > (guint32) ( pak->data + pak->size - data ) ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: %s: file runs past the end\n", pak->name );
+		return -1;
+	}
+
+	*bufferptr = safe_malloc( file->size + 1 );
+	// we need to end the buffer with a 0
+	( (char*) ( *bufferptr ) )[file->size] = 0;
+
+	if ( file->method == ZIP_STORED && file->csize == file->size ) {
+		memcpy( *bufferptr, data, file->size );
+		return file->size;
+	}
+
+	// raw deflate, zip files carry no zlib header
+	if ( file->method == ZIP_DEFLATED ) {
+		memset( &stream, 0, sizeof( stream ) );
+		if ( inflateInit2( &stream, -MAX_WBITS ) == Z_OK ) {
+			stream.next_in = (Bytef*)data;
+			stream.avail_in = file->csize;
+			stream.next_out = (Bytef*)*bufferptr;
+			stream.avail_out = file->size;
+			err = inflate( &stream, Z_FINISH );
+			inflateEnd( &stream );
+			if ( err == Z_STREAM_END && stream.total_out == file->size ) {
+				return file->size;
 			}
 		}
-		g_free( filename_lower );
 	}
+	else if ( file->method != ZIP_STORED ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: %s: unsupported compression method %d\n", pak->name, file->method );
+	}
+
+	free( *bufferptr );
+	*bufferptr = NULL;
+	return -1;
 }
 
 // =============================================================================
@@ -167,7 +622,22 @@ void vfsInitDirectory( const char *path ){
 	char filename[PATH_MAX];
 	char *dirlist;
 	GDir *dir;
-	int j;
+	int j, first, stamp;
+
+	// a daemon job only checks that it asks for the dirs already indexed
+	if ( g_bCheckDirs ) {
+		if ( g_numCheckedDirs >= g_numInitDirs || strcmp( g_strInitDirs[g_numCheckedDirs], path ) ) {
+			g_bDirsDiffer = TRUE;
+		}
+		g_numCheckedDirs++;
+		return;
+	}
+
+	if ( g_numInitDirs < VFS_MAXDIRS ) {
+		strncpy( g_strInitDirs[g_numInitDirs], path, PATH_MAX );
+		g_strInitDirs[g_numInitDirs][PATH_MAX] = 0;
+		g_numInitDirs++;
+	}
 
 	for ( j = 0; j < g_numForbiddenDirs; ++j )
 	{
@@ -197,6 +667,7 @@ void vfsInitDirectory( const char *path ){
 	g_strDirs[g_numDirs][PATH_MAX] = 0;
 	vfsFixDOSName( g_strDirs[g_numDirs] );
 	vfsAddSlash( g_strDirs[g_numDirs] );
+	first = g_numDirs;
 	g_numDirs++;
 
 	if ( g_bUsePak ) {
@@ -251,175 +722,376 @@ void vfsInitDirectory( const char *path ){
 			g_dir_close( dir );
 		}
 	}
+
+	// index the loose files of the dir and its pk3dirs
+	stamp = g_numStamps;
+	for ( j = first; j < g_numDirs; j++ )
+		vfsIndexDirectory( j, "", 0 );
+	if ( stamp < g_numStamps ) {
+		g_stamps[stamp].paks = vfsPakNames( path );
+	}
+	Sys_FPrintf( SYS_VRB, "VFS: %d files indexed in %d dirs and %d paks\n", g_numIndexed, g_numDirs, g_numPaks );
 }
 
 // frees all memory that we allocated
 void vfsShutdown(){
-	while ( g_unzFiles )
-	{
-		unzClose( (unzFile)g_unzFiles->data );
-		g_unzFiles = g_slist_remove( g_unzFiles, g_unzFiles->data );
+	int i;
+
+	if ( g_fileIndex != NULL ) {
+		g_hash_table_foreach( g_fileIndex, vfsFreeFiles, NULL );
+		g_hash_table_destroy( g_fileIndex );
+		g_fileIndex = NULL;
 	}
+	g_numIndexed = 0;
+
+	for ( i = 0; i < g_numPaks; i++ )
+		vfsUnmapPak( g_paks[i] );
+	g_numPaks = 0;
+	g_numDirs = 0;
+	g_numInitDirs = 0;
 
-	while ( g_pakFiles )
+	for ( i = 0; i < g_numStamps; i++ )
 	{
-		VFS_PAKFILE* file = (VFS_PAKFILE*)g_pakFiles->data;
-		free( file->name );
-		free( file );
-		g_pakFiles = g_slist_remove( g_pakFiles, file );
+		free( g_stamps[i].path );
+		free( g_stamps[i].relative );
+		free( g_stamps[i].paks );
 	}
+	g_numStamps = 0;
 }
 
-// return the number of files that match
-int vfsGetFileCount( const char *filename ){
-	int i, count = 0;
-	char fixed[NAME_MAX], tmp[NAME_MAX];
-	char *lower;
-	GSList *lst;
-
-	strcpy( fixed, filename );
-	vfsFixDOSName( fixed );
-	lower = g_ascii_strdown( fixed, -1 );
+static void vfsFindMissing( gpointer key, gpointer value, gpointer user_data ){
+	VFS_DROP *drop = (VFS_DROP*)user_data;
+	char path[PATH_MAX + 1];
+	VFS_FILE *file;
+	int len;
 
-	for ( lst = g_pakFiles; lst != NULL; lst = g_slist_next( lst ) )
+	len = strlen( drop->relative );
+	for ( file = (VFS_FILE*)value; file != NULL; file = file->next )
 	{
-		VFS_PAKFILE* file = (VFS_PAKFILE*)lst->data;
-
-		if ( strcmp( file->name, lower ) == 0 ) {
-			count++;
+		if ( file->dir != drop->dir || strncmp( file->path, drop->relative, len ) || strchr( file->path + len, '/' ) ) {
+			continue;
+		}
+		snprintf( path, sizeof( path ), "%s%s", g_strDirs[file->dir], file->path );
+		if ( access( path, R_OK ) != 0 ) {
+			drop->names = g_slist_prepend( drop->names, g_strdup( (char*)key ) );
+			return;
 		}
 	}
+}
 
-	for ( i = 0; i < g_numDirs; i++ )
+// drops the files of a dir that are gone from the index
+static void vfsDropMissing( int dir, const char *relative ){
+	char path[PATH_MAX + 1];
+	VFS_DROP drop;
+	VFS_FILE *head, *file, **link;
+	GSList *lst;
+
+	drop.dir = dir;
+	drop.relative = relative;
+	drop.names = NULL;
+	g_hash_table_foreach( g_fileIndex, vfsFindMissing, &drop );
+
+	for ( lst = drop.names; lst != NULL; lst = g_slist_next( lst ) )
 	{
-		strcpy( tmp, g_strDirs[i] );
-		strcat( tmp, lower );
-		if ( access( tmp, R_OK ) == 0 ) {
-			count++;
+		head = (VFS_FILE*)g_hash_table_lookup( g_fileIndex, lst->data );
+		for ( link = &head; *link != NULL; )
+		{
+			file = *link;
+			if ( file->dir == dir ) {
+				snprintf( path, sizeof( path ), "%s%s", g_strDirs[dir], file->path );
+			}
+			if ( file->dir == dir && access( path, R_OK ) != 0 ) {
+				*link = file->next;
+				free( file->path );
+				free( file );
+				g_numIndexed--;
+			}
+			else{
+				link = &file->next;
+			}
+		}
+		if ( head == NULL ) {
+			g_hash_table_remove( g_fileIndex, lst->data );
+			g_free( lst->data );
+		}
+		else{
+			// the table keeps one of the two keys and frees the other
+			g_hash_table_insert( g_fileIndex, lst->data, head );
 		}
 	}
-	g_free( lower );
-	return count;
+	g_slist_free( drop.names );
 }
 
-// NOTE: when loading a file, you have to allocate one extra byte and set it to \0
-int vfsLoadFile( const char *filename, void **bufferptr, int index ){
-	int i, count = 0;
-	char tmp[NAME_MAX], fixed[NAME_MAX];
+// indexes a changed dir again, its subdirs have stamps of their own
+static void vfsRescanDirectory( int dir, const char *relative ){
+	char path[PATH_MAX + 1], name[PATH_MAX + 1];
+	const char *entry, *ext;
+	struct stat st;
+	VFS_FILE *file;
+	GDir *gdir;
 	char *lower;
-	GSList *lst;
+	int i, depth;
 
-	// filename is a full path
-	if ( index == -1 ) {
-		long len;
-		FILE *f;
+	if ( g_fileIndex != NULL ) {
+		vfsDropMissing( dir, relative );
+	}
 
-		f = fopen( filename, "rb" );
-		if ( f == NULL ) {
-			return -1;
+	for ( i = 0, depth = 0; relative[i]; i++ )
+		if ( relative[i] == '/' ) {
+			depth++;
 		}
 
-		fseek( f, 0, SEEK_END );
-		len = ftell( f );
-		rewind( f );
+	snprintf( path, sizeof( path ), "%s%s", g_strDirs[dir], relative );
+	gdir = g_dir_open( path, 0, NULL );
+	if ( gdir == NULL ) {
+		return;
+	}
+
+	while ( ( entry = g_dir_read_name( gdir ) ) != NULL )
+	{
+		snprintf( name, sizeof( name ), "%s%s", relative, entry );
+		snprintf( path, sizeof( path ), "%s%s", g_strDirs[dir], name );
+		if ( stat( path, &st ) != 0 ) {
+			continue;
+		}
 
-		*bufferptr = safe_malloc( len + 1 );
-		if ( *bufferptr == NULL ) {
-			fclose( f );
-			return -1;
+		// new subdirs
+		if ( S_ISDIR( st.st_mode ) ) {
+			ext = strrchr( entry, '.' );
+			if ( depth == 0 && ext != NULL && ( !Q_stricmp( ext, ".pk3dir" ) || !Q_stricmp( ext, ".dpkdir" ) ) ) {
+				continue;
+			}
+			strcat( name, "/" );
+			strcat( path, "/" );
+			for ( i = 0; i < g_numStamps && strcmp( g_stamps[i].path, path ); i++ )
+				;
+			if ( i == g_numStamps ) {
+				vfsIndexDirectory( dir, name, depth + 1 );
+			}
+			continue;
 		}
 
-		if ( fread( *bufferptr, 1, len, f ) != (size_t) len ) {
-			fclose( f );
-			return -1;
+		// new files
+		lower = vfsIndexName( name );
+		file = g_fileIndex != NULL ? (VFS_FILE*)g_hash_table_lookup( g_fileIndex, lower ) : NULL;
+		g_free( lower );
+		for ( ; file != NULL && ( file->dir != dir || strcmp( file->path, name ) ); file = file->next )
+			;
+		if ( file == NULL ) {
+			file = vfsIndexFile( name, dir );
+			file->dir = dir;
+			file->path = strdup( name );
 		}
-		fclose( f );
+	}
+	g_dir_close( gdir );
+}
 
-		// we need to end the buffer with a 0
-		( (char*) ( *bufferptr ) )[len] = 0;
+// brings the index up to date with the dirs that changed since they were indexed,
+// false when a pak came, went or changed, which takes a vfsRefresh
+int vfsUpdate(){
+	int i, numStamps, same;
+	time_t time;
+	char *paks;
 
-		return len;
+	// dirs the rescans find stamp themselves
+	numStamps = g_numStamps;
+	for ( i = 0; i < numStamps; i++ )
+	{
+		time = vfsFileTime( g_stamps[i].path );
+		if ( time == g_stamps[i].time ) {
+			continue;
+		}
+		if ( g_stamps[i].dir < 0 ) {
+			return FALSE;
+		}
+		if ( g_stamps[i].paks != NULL ) {
+			paks = vfsPakNames( g_stamps[i].path );
+			same = !strcmp( paks, g_stamps[i].paks );
+			free( paks );
+			if ( !same ) {
+				return FALSE;
+			}
+		}
+		g_stamps[i].time = time;
+		vfsRescanDirectory( g_stamps[i].dir, g_stamps[i].relative );
 	}
+	return TRUE;
+}
 
-	*bufferptr = NULL;
-	strcpy( fixed, filename );
+// drops the "./" and "dir/../" parts and doubled slashes of a path, like the
+// "maps/../scripts/" of the map shader file
+static void vfsCleanPath( char *path ){
+	char *in, *out, *slash;
+
+	in = out = path;
+	while ( *in )
+	{
+		if ( in[0] == '/' && in[1] == '/' ) {
+			in++;
+		}
+		else if ( in[0] == '/' && in[1] == '.' && ( in[2] == '/' || in[2] == 0 ) ) {
+			in += 2;
+		}
+		else if ( in[0] == '/' && in[1] == '.' && in[2] == '.' && ( in[3] == '/' || in[3] == 0 ) ) {
+			// back up over the last part, unless there is none or it is a ".." itself
+			for ( slash = out; slash > path && slash[-1] != '/'; slash-- )
+				;
+			if ( out == path || ( out - slash == 2 && slash[0] == '.' && slash[1] == '.' ) ) {
+				*out++ = *in++;
+				continue;
+			}
+			in += 3;
+			if ( slash > path ) {
+				out = slash - 1;
+			}
+			else{
+				out = path;
+				if ( *in == '/' ) {
+					in++;
+				}
+			}
+		}
+		else{
+			*out++ = *in++;
+		}
+	}
+	*out = 0;
+}
+
+// adds a file the compiler wrote under one of the dirs to the index, so
+// lookups find it without going to the disk; other new files are picked
+// up by vfsUpdate
+void vfsAddWrittenFile( const char *path ){
+	char fixed[PATH_MAX + 1];
+	const char *name;
+	VFS_FILE *file;
+	char *lower;
+	int i, dir, len, best;
+
+	strncpy( fixed, path, PATH_MAX );
+	fixed[PATH_MAX] = 0;
 	vfsFixDOSName( fixed );
-	lower = g_ascii_strdown( fixed, -1 );
+	vfsCleanPath( fixed );
 
+	// the deepest dir holding it, so a pk3dir wins over the dir it is in
+	dir = -1;
+	best = 0;
 	for ( i = 0; i < g_numDirs; i++ )
 	{
-		strcpy( tmp, g_strDirs[i] );
-		strcat( tmp, filename );
-		if ( access( tmp, R_OK ) == 0 ) {
-			if ( count == index ) {
-				long len;
-				FILE *f;
-
-				f = fopen( tmp, "rb" );
-				if ( f == NULL ) {
-					return -1;
-				}
+		len = strlen( g_strDirs[i] );
+		if ( len > best && !strncmp( fixed, g_strDirs[i], len ) ) {
+			dir = i;
+			best = len;
+		}
+	}
+	if ( dir < 0 ) {
+		return;
+	}
 
-				fseek( f, 0, SEEK_END );
-				len = ftell( f );
-				rewind( f );
+	name = fixed + best;
+	lower = vfsIndexName( name );
+	file = g_fileIndex != NULL ? (VFS_FILE*)g_hash_table_lookup( g_fileIndex, lower ) : NULL;
+	g_free( lower );
+	for ( ; file != NULL && ( file->dir != dir || strcmp( file->path, name ) ); file = file->next )
+		;
+	if ( file == NULL ) {
+		file = vfsIndexFile( name, dir );
+		file->dir = dir;
+		file->path = strdup( name );
+	}
+}
 
-				*bufferptr = safe_malloc( len + 1 );
-				if ( *bufferptr == NULL ) {
-					fclose( f );
-					return -1;
-				}
+// indexes the same dirs again
+void vfsRefresh(){
+	static char paths[VFS_MAXDIRS][PATH_MAX + 1];
+	int i, numPaths;
 
-				if ( fread( *bufferptr, 1, len, f ) != (size_t) len ) {
-					fclose( f );
-					return -1;
-				}
-				fclose( f );
+	numPaths = g_numInitDirs;
+	memcpy( paths, g_strInitDirs, sizeof( paths ) );
+	vfsShutdown();
+	for ( i = 0; i < numPaths; i++ )
+		vfsInitDirectory( paths[i] );
+}
 
-				// we need to end the buffer with a 0
-				( (char*) ( *bufferptr ) )[len] = 0;
+// from here on vfsInitDirectory only compares its paths with the indexed ones
+void vfsCheckDirectories(){
+	g_bCheckDirs = TRUE;
+	g_bDirsDiffer = FALSE;
+	g_numCheckedDirs = 0;
 
-				return len;
-			}
+	// the forbidden dirs are set up again by the caller
+	memcpy( g_strCheckedForbiddenDirs, g_strForbiddenDirs, sizeof( g_strForbiddenDirs ) );
+	g_numCheckedForbiddenDirs = g_numForbiddenDirs;
+	g_numForbiddenDirs = 0;
+}
 
-			count++;
-		}
-	}
+// true when the checked paths were the indexed ones, in the same order
+int vfsDirectoriesMatch(){
+	int i;
 
-	for ( lst = g_pakFiles; lst != NULL; lst = g_slist_next( lst ) )
+	g_bCheckDirs = FALSE;
+	if ( g_bDirsDiffer || g_numCheckedDirs != g_numInitDirs || g_numCheckedForbiddenDirs != g_numForbiddenDirs ) {
+		return FALSE;
+	}
+	for ( i = 0; i < g_numForbiddenDirs; i++ )
 	{
-		VFS_PAKFILE* file = (VFS_PAKFILE*)lst->data;
-
-		if ( strcmp( file->name, lower ) != 0 ) {
-			continue;
+		if ( strcmp( g_strCheckedForbiddenDirs[i], g_strForbiddenDirs[i] ) ) {
+			return FALSE;
 		}
+	}
+	return TRUE;
+}
 
-		if ( count == index ) {
+// the time of the file vfsLoadFile would load, -1 if there is none
+time_t vfsGetFileTime( const char *filename, int index ){
+	char tmp[PATH_MAX + 1];
+	VFS_FILE *file;
 
-			if ( unzGoToFilePos( file->zipfile, &file->zippos ) != UNZ_OK ) {
-				return -1;
-			}
-			if ( unzOpenCurrentFile( file->zipfile ) != UNZ_OK ) {
-				return -1;
-			}
+	file = vfsFindFile( filename, index );
+	if ( file == NULL ) {
+		return -1;
+	}
 
-			*bufferptr = safe_malloc( file->size + 1 );
-			// we need to end the buffer with a 0
-			( (char*) ( *bufferptr ) )[file->size] = 0;
+	if ( file->dir >= 0 ) {
+		snprintf( tmp, sizeof( tmp ), "%s%s", g_strDirs[file->dir], file->path );
+		return vfsFileTime( tmp );
+	}
+	return file->pak->time;
+}
 
-			i = unzReadCurrentFile( file->zipfile, *bufferptr, file->size );
-			unzCloseCurrentFile( file->zipfile );
-			if ( i < 0 ) {
-				return -1;
-			}
-			else{
-				g_free( lower );
-				return file->size;
-			}
-		}
+// return the number of files that match
+int vfsGetFileCount( const char *filename ){
+	int count = 0;
+	char *lower;
+	VFS_FILE *file;
 
+	lower = vfsIndexName( filename );
+	file = g_fileIndex != NULL ? (VFS_FILE*)g_hash_table_lookup( g_fileIndex, lower ) : NULL;
+	for ( ; file != NULL; file = file->next )
 		count++;
-	}
 	g_free( lower );
-	return -1;
+	return count;
+}
+
+// NOTE: when loading a file, you have to allocate one extra byte and set it to \0
+int vfsLoadFile( const char *filename, void **bufferptr, int index ){
+	char tmp[PATH_MAX + 1];
+	VFS_FILE *file;
+
+	// filename is a full path
+	if ( index == -1 ) {
+		return vfsLoadFullPath( filename, bufferptr );
+	}
+
+	*bufferptr = NULL;
+	file = vfsFindFile( filename, index );
+	if ( file == NULL ) {
+		return -1;
+	}
+
+	if ( file->dir >= 0 ) {
+		snprintf( tmp, sizeof( tmp ), "%s%s", g_strDirs[file->dir], file->path );
+		return vfsLoadFullPath( tmp, bufferptr );
+	}
+	return vfsLoadPakFile( file, bufferptr );
 }
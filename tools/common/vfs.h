@@ -32,6 +32,7 @@
 #define _VFS_H_
 
 #include "globaldefs.h"
+#include <time.h>
 
 // to get PATH_MAX
 #include <stdio.h>
@@ -46,11 +47,18 @@
 #endif
 
 #define VFS_MAXDIRS 64
+#define VFS_MAXPAKS 1024
 
 void vfsInitDirectory( const char *path );
 void vfsShutdown();
 int vfsGetFileCount( const char *filename );
 int vfsLoadFile( const char *filename, void **buffer, int index );
+time_t vfsGetFileTime( const char *filename, int index );
+int vfsUpdate();
+void vfsAddWrittenFile( const char *path );
+void vfsRefresh();
+void vfsCheckDirectories();
+int vfsDirectoriesMatch();
 
 extern char g_strForbiddenDirs[VFS_MAXDIRS][PATH_MAX + 1];
 extern int g_numForbiddenDirs;
@@ -790,6 +790,7 @@ void FilterStructuralBrushesIntoTree( entity_t *e, tree_t *tree ) {
 	int i;
 
 	Sys_FPrintf( SYS_VRB, "--- FilterStructuralBrushesIntoTree ---\n" );
+	ProfileBegin( "FilterStructuralBrushesIntoTree" );
 
 	c_unique = 0;
 	c_clusters = 0;
@@ -815,6 +816,8 @@ void FilterStructuralBrushesIntoTree( entity_t *e, tree_t *tree ) {
 	/* emit some statistics */
 	Sys_FPrintf( SYS_VRB, "%9d structural brushes\n", c_unique );
 	Sys_FPrintf( SYS_VRB, "%9d cluster references\n", c_clusters );
+	ProfileAddWork( c_unique );
+	ProfileEnd();
 }
 
 
@@ -497,11 +497,14 @@ void ProcessModels( const char *portalFilePath, const char *lineFilePath ){
 		/* process the model */
 		Sys_FPrintf( SYS_VRB, "############### model %i ###############\n", numBSPModels );
 		if ( mapEntityNum == 0 ) {
+			ProfileBegin( "ProcessWorldModel" );
 			ProcessWorldModel(portalFilePath, lineFilePath);
 		}
 		else{
+			ProfileBegin( "ProcessSubModel" );
 			ProcessSubModel();
 		}
+		ProfileEnd();
 
 		/* potentially turn off the deluge of text */
 		verbose = verboseEntities;
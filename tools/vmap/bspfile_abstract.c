@@ -307,7 +307,12 @@ void BSPX_WriteLumps(FILE *file, bspLump_t *lumps, size_t stdlumps)
 
 	//now write the lumps. hopefully we got the offsets right!...
 	for (l = 0; l < bspx->numlumps; l++)
-		SafeWrite(file, bspx->lumps[l].data, (bspx->lumps[l].lumpsize+3)&~3u);
+	{
+		static const byte pad[4] = {0, 0, 0, 0};
+		SafeWrite(file, bspx->lumps[l].data, bspx->lumps[l].lumpsize);
+		if (bspx->lumps[l].lumpsize & 3)	//zero the padding rather than read past the lump
+			SafeWrite(file, pad, 4 - (bspx->lumps[l].lumpsize & 3));
+	}
 }
 
 
@@ -493,6 +498,7 @@ int CopyLump_Allocate( bspHeader_t *header, int lump, void **dest, int size, int
 
 void AddLump( FILE *file, bspHeader_t *header, int lumpNum, const void *data, int length ){
 	bspLump_t   *lump;
+	static const byte pad[ 4 ] = { 0, 0, 0, 0 };
 
 
 	/* add lump to bsp file header */
@@ -500,8 +506,11 @@ void AddLump( FILE *file, bspHeader_t *header, int lumpNum, const void *data, in
 	lump->offset = LittleLong( ftell( file ) );
 	lump->length = LittleLong( length );
 
-	/* write lump to file */
-	SafeWrite( file, data, ( length + 3 ) & ~3 );
+	/* write lump to file, padded with zeros so identical lumps give identical files */
+	SafeWrite( file, data, length );
+	if ( length & 3 ) {
+		SafeWrite( file, pad, 4 - ( length & 3 ) );
+	}
 }
 
 
@@ -551,6 +560,7 @@ void WriteBSPFile( const char *filename ){
 	/* replace existing bsp file */
 	remove( filename );
 	rename( tempname, filename );
+	vfsAddWrittenFile( filename );
 }
 
 
@@ -0,0 +1,823 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+
+/* marker */
+#define DAEMON_C
+
+
+
+/* struct ucred */
+#if defined( __linux__ ) && !defined( _GNU_SOURCE )
+#define _GNU_SOURCE
+#endif
+
+
+
+/* dependencies */
+#include "vmap.h"
+
+#if !GDEF_OS_WINDOWS
+#include <errno.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#endif
+
+
+
+/*
+   compile daemon
+
+   vmap -daemon indexes the vfs and parses the shader scripts once, then listens
+   on a unix socket only its own user can reach. vmap -client hands its arguments, working dir and stdio to
+   the daemon, which forks a child off its warm state to run them the way a
+   fresh vmap would. the child reports the images and models it loaded, and the
+   daemon loads them as well once the job is done, so the next job finds them
+   resident. before every job the daemon stats everything it keeps and throws
+   out what changed on disk.
+ */
+
+#if GDEF_OS_WINDOWS
+
+int DaemonMain( int argc, char **argv ){
+	Error( "-daemon needs unix sockets and fork(), which this platform does not have" );
+	return 1;
+}
+
+int DaemonClient( int argc, char **argv ){
+	Sys_Printf( "-client is not supported on this platform, compiling here\n" );
+	return -1;
+}
+
+#else
+
+#define DAEMON_IDENT            ( ( 'J' << 24 ) + ( 'D' << 16 ) + ( 'M' << 8 ) + 'V' )
+#define DAEMON_VERSION          1
+#define DAEMON_REFUSED          -1      /* the client compiles on its own */
+#define DAEMON_MAX_ARGS         1024
+#define DAEMON_MAX_REQUEST      ( 1 << 20 )
+
+typedef struct daemonRequest_s
+{
+	int ident;
+	int version;
+	int numArgs;
+	int size;                           /* of the working dir and args that follow */
+}
+daemonRequest_t;
+
+typedef struct residentImage_s
+{
+	image_t             *image;
+	time_t time;
+}
+residentImage_t;
+
+typedef struct residentModel_s
+{
+	picoModel_t         *model;
+	time_t time;
+}
+residentModel_t;
+
+static residentImage_t *residentImages = NULL;
+static int numResidentImages = 0, allocatedResidentImages = 0;
+static residentModel_t *residentModels = NULL;
+static int numResidentModels = 0, allocatedResidentModels = 0;
+
+static struct sockaddr_un daemonAddress;
+static pid_t daemonPid = -1;
+static int reportFd = -1;
+
+
+
+/*
+   DaemonSetAddress()
+   the socket is $VMAP_SOCKET, else vmap.sock in $XDG_RUNTIME_DIR, else vmap.sock in a private
+   /tmp/vmap-<uid> dir, which the daemon creates
+ */
+
+static qboolean DaemonSetAddress( qboolean create ){
+	const char  *env;
+	char dir[ MAX_OS_PATH ], path[ MAX_OS_PATH ];
+	struct stat st;
+
+
+	env = getenv( "VMAP_SOCKET" );
+	if ( env != NULL && env[ 0 ] != '\0' ) {
+		snprintf( path, sizeof( path ), "%s", env );
+	}
+	else if ( ( env = getenv( "XDG_RUNTIME_DIR" ) ) != NULL && env[ 0 ] != '\0' ) {
+		snprintf( path, sizeof( path ), "%s/vmap.sock", env );
+	}
+	else{
+		/* anyone can make dirs in /tmp, so only trust one that is ours and closed to others */
+		snprintf( dir, sizeof( dir ), "/tmp/vmap-%d", (int) getuid() );
+		if ( create && mkdir( dir, 0700 ) != 0 && errno != EEXIST ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: could not create %s: %s\n", dir, strerror( errno ) );
+			return qfalse;
+		}
+		if ( lstat( dir, &st ) == 0 && ( !S_ISDIR( st.st_mode ) || st.st_uid != getuid() || ( st.st_mode & 077 ) != 0 ) ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: %s is not a private dir of this user, not using it\n", dir );
+			return qfalse;
+		}
+		snprintf( path, sizeof( path ), "/tmp/vmap-%d/vmap.sock", (int) getuid() );
+	}
+
+	memset( &daemonAddress, 0, sizeof( daemonAddress ) );
+	daemonAddress.sun_family = AF_UNIX;
+	if ( strlen( path ) >= sizeof( daemonAddress.sun_path ) ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: socket path %s is too long\n", path );
+		return qfalse;
+	}
+	strcpy( daemonAddress.sun_path, path );
+	return qtrue;
+}
+
+
+
+/*
+   DaemonPeerIsUs()
+   tells if the other end of a socket runs as this user, no one else gets to hand us jobs or take them
+ */
+
+static qboolean DaemonPeerIsUs( int fd ){
+#if GDEF_OS_LINUX
+	struct ucred cred;
+	socklen_t size = sizeof( cred );
+
+
+	if ( getsockopt( fd, SOL_SOCKET, SO_PEERCRED, &cred, &size ) != 0 ) {
+		return qfalse;
+	}
+	return cred.uid == getuid();
+#else
+	uid_t uid;
+	gid_t gid;
+
+
+	if ( getpeereid( fd, &uid, &gid ) != 0 ) {
+		return qfalse;
+	}
+	return uid == getuid();
+#endif
+}
+
+
+
+/*
+   DaemonRead() - DaemonWrite()
+   move a whole buffer through a socket or pipe
+ */
+
+static qboolean DaemonRead( int fd, void *buffer, int size ){
+	byte        *p = buffer;
+	ssize_t n;
+
+
+	while ( size > 0 )
+	{
+		n = read( fd, p, size );
+		if ( n < 0 && errno == EINTR ) {
+			continue;
+		}
+		if ( n <= 0 ) {
+			return qfalse;
+		}
+		p += n;
+		size -= n;
+	}
+	return qtrue;
+}
+
+static qboolean DaemonWrite( int fd, const void *buffer, int size ){
+	const byte  *p = buffer;
+	ssize_t n;
+
+
+	while ( size > 0 )
+	{
+		n = write( fd, p, size );
+		if ( n < 0 && errno == EINTR ) {
+			continue;
+		}
+		if ( n <= 0 ) {
+			return qfalse;
+		}
+		p += n;
+		size -= n;
+	}
+	return qtrue;
+}
+
+
+
+/*
+   DaemonClient()
+   hands the compile to a running daemon and returns its exit code,
+   or -1 when the caller has to compile on its own
+ */
+
+int DaemonClient( int argc, char **argv ){
+	int i, fd, size, status, fds[ 3 ] = { 0, 1, 2 };
+	char cwd[ MAX_OS_PATH ];
+	char                *buffer, *p;
+	daemonRequest_t request;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr      *cmsg;
+	union
+	{
+		struct cmsghdr header;
+		char buffer[ CMSG_SPACE( sizeof( fds ) ) ];
+	} control;
+
+
+	/* find the daemon */
+	if ( !DaemonSetAddress( qfalse ) ) {
+		return DAEMON_REFUSED;
+	}
+	fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( fd < 0 || connect( fd, (struct sockaddr*) &daemonAddress, sizeof( daemonAddress ) ) != 0 ) {
+		Sys_Printf( "No vmap daemon listens on %s, compiling here\n", daemonAddress.sun_path );
+		if ( fd >= 0 ) {
+			close( fd );
+		}
+		return DAEMON_REFUSED;
+	}
+	if ( !DaemonPeerIsUs( fd ) ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: the daemon on %s runs as another user, compiling here\n", daemonAddress.sun_path );
+		close( fd );
+		return DAEMON_REFUSED;
+	}
+	if ( getcwd( cwd, sizeof( cwd ) ) == NULL ) {
+		close( fd );
+		return DAEMON_REFUSED;
+	}
+
+	/* pack the working dir and the args */
+	size = strlen( cwd ) + 1;
+	for ( i = 0; i < argc; i++ )
+		size += strlen( argv[ i ] ) + 1;
+	buffer = safe_malloc( size );
+	p = buffer;
+	strcpy( p, cwd );
+	p += strlen( cwd ) + 1;
+	for ( i = 0; i < argc; i++ )
+	{
+		strcpy( p, argv[ i ] );
+		p += strlen( argv[ i ] ) + 1;
+	}
+
+	/* the request carries our stdin, stdout and stderr along */
+	request.ident = DAEMON_IDENT;
+	request.version = DAEMON_VERSION;
+	request.numArgs = argc;
+	request.size = size;
+	iov.iov_base = &request;
+	iov.iov_len = sizeof( request );
+	memset( &msg, 0, sizeof( msg ) );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof( control.buffer );
+	cmsg = CMSG_FIRSTHDR( &msg );
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN( sizeof( fds ) );
+	memcpy( CMSG_DATA( cmsg ), fds, sizeof( fds ) );
+
+	signal( SIGPIPE, SIG_IGN );
+	if ( sendmsg( fd, &msg, 0 ) != sizeof( request ) || !DaemonWrite( fd, buffer, size ) ) {
+		free( buffer );
+		close( fd );
+		Sys_Printf( "Could not reach the vmap daemon, compiling here\n" );
+		return DAEMON_REFUSED;
+	}
+	free( buffer );
+
+	/* the daemon answers with the exit code once the job is done */
+	if ( !DaemonRead( fd, &status, sizeof( status ) ) ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: lost the vmap daemon during the compile\n" );
+		status = 1;
+	}
+	close( fd );
+
+	if ( status == DAEMON_REFUSED ) {
+		Sys_Printf( "The vmap daemon serves other paths, compiling here\n" );
+	}
+	return status;
+}
+
+
+
+/*
+   DaemonRemoveSocket() - DaemonSignal()
+   take the socket away with the daemon, but not with its jobs
+ */
+
+static void DaemonRemoveSocket( void ){
+	if ( getpid() == daemonPid ) {
+		unlink( daemonAddress.sun_path );
+	}
+}
+
+static void DaemonSignal( int sig ){
+	DaemonRemoveSocket();
+	signal( sig, SIG_DFL );
+	raise( sig );
+}
+
+
+
+/*
+   DaemonReport()
+   at the end of a job, tells the daemon which images and models the job loaded
+ */
+
+static void DaemonReport( void ){
+	int i;
+	FILE                *f;
+
+
+	if ( reportFd < 0 ) {
+		return;
+	}
+	f = fdopen( reportFd, "w" );
+	reportFd = -1;
+	if ( f == NULL ) {
+		return;
+	}
+
+	for ( i = 0; i < numImageSlots; i++ )
+	{
+		if ( images[ i ]->name != NULL && strcmp( images[ i ]->name, DEFAULT_IMAGE ) ) {
+			fprintf( f, "image %s\n", images[ i ]->name );
+		}
+	}
+	for ( i = 0; i < numPicoModelSlots; i++ )
+	{
+		if ( picoModels[ i ] != NULL ) {
+			fprintf( f, "model %d %s\n", PicoGetModelFrameNum( picoModels[ i ] ), PicoGetModelName( picoModels[ i ] ) );
+		}
+	}
+	fclose( f );
+}
+
+
+
+/*
+   DaemonRunJob()
+   runs a client's compile in the forked child, from the daemon's warm state
+ */
+
+static void DaemonRunJob( const char *cwd, int argc, char **argv, int *fds, int report ){
+	int i;
+	double start;
+
+
+	/* become the client */
+	start = I_FloatTime();
+	signal( SIGINT, SIG_DFL );
+	signal( SIGTERM, SIG_DFL );
+	signal( SIGHUP, SIG_DFL );
+	signal( SIGPIPE, SIG_DFL );
+	for ( i = 0; i < 3; i++ )
+	{
+		dup2( fds[ i ], i );
+		if ( fds[ i ] > 2 ) {
+			close( fds[ i ] );
+		}
+	}
+	if ( chdir( cwd ) != 0 ) {
+		Error( "Could not change to %s: %s", cwd, strerror( errno ) );
+	}
+	reportFd = report;
+	atexit( DaemonReport );
+	daemonJob = qtrue;
+
+	/* back to the defaults of a fresh vmap */
+	verbose = qfalse;
+	force = qfalse;
+	patchSubdivisions = 8;
+	numthreads = -1;
+	srand( 0 );
+
+	/* general options */
+	if ( !ReadGeneralOptions( argc, argv ) ) {
+		exit( 0 );
+	}
+	ThreadSetDefault();
+
+	/* the paths have to come out as the ones the daemon indexed */
+	vfsCheckDirectories();
+	InitPaths( &argc, argv );
+	if ( !vfsDirectoriesMatch() ) {
+		reportFd = -1;
+		DaemonWrite( report, "refused\n", 8 );
+		_exit( 0 );
+	}
+	if ( argc >= 2 && !strcmp( argv[ 1 ], "-daemon" ) ) {
+		Error( "-daemon can not run as a job of another daemon" );
+	}
+
+	/* run the mode */
+	exit( VMapMain( argc, argv, start ) );
+}
+
+
+
+/*
+   DaemonRefresh()
+   throws out the warm state whose files changed on disk since the last job
+ */
+
+static void DaemonRefresh( void ){
+	int i;
+	char filename[ 1024 ];
+	picoModel_t         *model;
+
+
+	/* index the dirs that changed again, only a pak coming or going takes it all */
+	if ( !vfsUpdate() ) {
+		Sys_Printf( "Paks changed, indexing the VFS again\n" );
+		vfsRefresh();
+	}
+
+	/* shader scripts */
+	if ( ShaderInfoChanged() ) {
+		Sys_Printf( "Shader scripts changed, parsing them again\n" );
+		ClearShaderInfo();
+	}
+	if ( numShaderInfo == 0 ) {
+		LoadShaderInfo();
+	}
+
+	/* images, another extension may win now too */
+	for ( i = 0; i < numResidentImages; i++ )
+	{
+		if ( ImageFileTime( residentImages[ i ].image->name, filename ) != residentImages[ i ].time ||
+			 strcmp( filename, residentImages[ i ].image->filename ) ) {
+			Sys_FPrintf( SYS_VRB, "Image %s changed\n", residentImages[ i ].image->filename );
+			residentImages[ i ].image->refCount = 1;
+			ImageFree( residentImages[ i ].image );
+			residentImages[ i-- ] = residentImages[ --numResidentImages ];
+		}
+	}
+
+	/* models */
+	for ( i = 0; i < numResidentModels; i++ )
+	{
+		model = residentModels[ i ].model;
+		if ( vfsGetFileTime( PicoGetModelName( model ), 0 ) != residentModels[ i ].time ) {
+			Sys_FPrintf( SYS_VRB, "Model %s changed\n", PicoGetModelName( model ) );
+			UnloadModel( model );
+			residentModels[ i-- ] = residentModels[ --numResidentModels ];
+		}
+	}
+}
+
+
+
+/*
+   DaemonWarm()
+   loads the images and models a job reported, so the next job finds them resident
+ */
+
+static void DaemonWarm( char *report ){
+	int frame;
+	char                *line, *next, *name, filename[ 1024 ];
+	image_t             *image;
+	picoModel_t         *model;
+
+
+	for ( line = report; line != NULL && *line != '\0'; line = next )
+	{
+		next = strchr( line, '\n' );
+		if ( next != NULL ) {
+			*next++ = '\0';
+		}
+
+		/* image <name> */
+		if ( !strncmp( line, "image ", 6 ) ) {
+			name = line + 6;
+			if ( ImageFind( name ) != NULL ) {
+				continue;
+			}
+			image = ImageLoad( name );
+			if ( image != NULL ) {
+				AUTOEXPAND_BY_REALLOC( residentImages, numResidentImages, allocatedResidentImages, 64 );
+				residentImages[ numResidentImages ].image = image;
+				residentImages[ numResidentImages ].time = ImageFileTime( image->name, filename );
+				numResidentImages++;
+			}
+		}
+
+		/* model <frame> <name> */
+		else if ( !strncmp( line, "model ", 6 ) ) {
+			frame = atoi( line + 6 );
+			name = strchr( line + 6, ' ' );
+			if ( name == NULL || FindModel( ++name, frame ) != NULL ) {
+				continue;
+			}
+			model = LoadModel( name, frame );
+			if ( model != NULL ) {
+				AUTOEXPAND_BY_REALLOC( residentModels, numResidentModels, allocatedResidentModels, 64 );
+				residentModels[ numResidentModels ].model = model;
+				residentModels[ numResidentModels ].time = vfsGetFileTime( name, 0 );
+				numResidentModels++;
+			}
+		}
+	}
+}
+
+
+
+/*
+   DaemonReceive()
+   reads a request and the stdio that comes with it
+ */
+
+static qboolean DaemonReceive( int client, daemonRequest_t *request, int *fds ){
+	ssize_t n;
+	struct iovec iov;
+	struct msghdr msg;
+	struct cmsghdr      *cmsg;
+	union
+	{
+		struct cmsghdr header;
+		char buffer[ CMSG_SPACE( 3 * sizeof( int ) ) ];
+	} control;
+
+
+	iov.iov_base = request;
+	iov.iov_len = sizeof( *request );
+	memset( &msg, 0, sizeof( msg ) );
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buffer;
+	msg.msg_controllen = sizeof( control.buffer );
+	do
+	{
+		n = recvmsg( client, &msg, 0 );
+	} while ( n < 0 && errno == EINTR );
+
+	cmsg = n > 0 ? CMSG_FIRSTHDR( &msg ) : NULL;
+	if ( cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+	     || cmsg->cmsg_len != CMSG_LEN( 3 * sizeof( int ) ) ) {
+		return qfalse;
+	}
+	memcpy( fds, CMSG_DATA( cmsg ), 3 * sizeof( int ) );
+
+	if ( n != sizeof( *request ) || request->ident != DAEMON_IDENT || request->version != DAEMON_VERSION
+	     || request->numArgs < 1 || request->numArgs > DAEMON_MAX_ARGS || request->size < 1 || request->size > DAEMON_MAX_REQUEST ) {
+		close( fds[ 0 ] );
+		close( fds[ 1 ] );
+		close( fds[ 2 ] );
+		return qfalse;
+	}
+	return qtrue;
+}
+
+
+
+/*
+   DaemonJob()
+   runs one request in a forked child and answers with its exit code
+ */
+
+static void DaemonJob( int client, int listener ){
+	int i, fds[ 3 ], report[ 2 ], code, status, size, allocated;
+	char                *buffer, *p, **args, *text;
+	qboolean valid;
+	double start;
+	ssize_t n;
+	pid_t pid, waited;
+	daemonRequest_t request;
+	struct pollfd poller[ 2 ];
+
+
+	/* read the request */
+	start = I_FloatTime();
+	if ( !DaemonReceive( client, &request, fds ) ) {
+		return;
+	}
+	buffer = safe_malloc( request.size + 1 );
+	args = safe_malloc( ( request.numArgs + 1 ) * sizeof( *args ) );
+	buffer[ request.size ] = '\0';
+	if ( !DaemonRead( client, buffer, request.size ) ) {
+		request.numArgs = 0;
+	}
+
+	/* the working dir, then the args */
+	p = buffer + strlen( buffer ) + 1;
+	for ( i = 0; i < request.numArgs && p < buffer + request.size; i++ )
+	{
+		args[ i ] = p;
+		p += strlen( p ) + 1;
+	}
+	args[ i ] = NULL;
+	valid = ( i == request.numArgs && i > 0 );
+
+	pid = -1;
+	report[ 0 ] = report[ 1 ] = -1;
+	if ( valid ) {
+		/* throw out what changed since the last job */
+		DaemonRefresh();
+
+		/* run it */
+		Sys_Printf( "Job:" );
+		for ( i = 1; i < request.numArgs; i++ )
+			Sys_Printf( " %s", args[ i ] );
+		Sys_Printf( "\n" );
+		fflush( stdout );
+		fflush( stderr );
+		if ( pipe( report ) == 0 ) {
+			pid = fork();
+			if ( pid == 0 ) {
+				close( listener );
+				close( client );
+				close( report[ 0 ] );
+				DaemonRunJob( buffer, request.numArgs, args, fds, report[ 1 ] );
+			}
+			close( report[ 1 ] );
+		}
+	}
+	close( fds[ 0 ] );
+	close( fds[ 1 ] );
+	close( fds[ 2 ] );
+
+	/* gather the report until the child is done, kill it when the client goes away */
+	text = NULL;
+	size = allocated = 0;
+	if ( pid > 0 ) {
+		poller[ 0 ].fd = report[ 0 ];
+		poller[ 1 ].fd = client;
+		poller[ 0 ].events = poller[ 1 ].events = POLLIN;
+		while ( 1 )
+		{
+			if ( poll( poller, 2, -1 ) < 0 ) {
+				if ( errno == EINTR ) {
+					continue;
+				}
+				break;
+			}
+
+			/* clients send nothing after the request, so this is a hangup */
+			if ( poller[ 1 ].revents ) {
+				Sys_Printf( "Client went away, killing the job\n" );
+				kill( pid, SIGKILL );
+				poller[ 1 ].fd = -1;
+			}
+
+			if ( poller[ 0 ].revents ) {
+				AUTOEXPAND_BY_REALLOC( text, size + 4096, allocated, 4096 );
+				n = read( report[ 0 ], text + size, 4096 );
+				if ( n < 0 && errno == EINTR ) {
+					continue;
+				}
+				if ( n <= 0 ) {
+					break;
+				}
+				size += n;
+			}
+		}
+		while ( ( waited = waitpid( pid, &status, 0 ) ) < 0 && errno == EINTR )
+			;
+		if ( waited < 0 ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: could not wait for the job: %s\n", strerror( errno ) );
+			code = 1;
+		}
+		else{
+			code = WIFEXITED( status ) ? WEXITSTATUS( status ) : 128 + WTERMSIG( status );
+		}
+	}
+	else if ( valid ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: could not start a job: %s\n", strerror( errno ) );
+		code = DAEMON_REFUSED;
+	}
+	else{
+		code = DAEMON_REFUSED;
+	}
+	if ( report[ 0 ] >= 0 ) {
+		close( report[ 0 ] );
+	}
+	if ( text != NULL ) {
+		text[ size ] = '\0';
+		if ( !strcmp( text, "refused\n" ) ) {
+			code = DAEMON_REFUSED;
+		}
+	}
+
+	/* answer */
+	DaemonWrite( client, &code, sizeof( code ) );
+	Sys_Printf( "Job done with exit code %d after %.1f seconds\n", code, I_FloatTime() - start );
+
+	/* keep what it loaded for the next one */
+	if ( text != NULL ) {
+		DaemonWarm( text );
+		free( text );
+	}
+	free( args );
+	free( buffer );
+	fflush( stdout );
+}
+
+
+
+/*
+   DaemonMain()
+   keeps the vfs, shaders, images and models warm and runs the jobs clients send
+ */
+
+int DaemonMain( int argc, char **argv ){
+	int fd, listener, client;
+
+
+	/* note it */
+	Sys_Printf( "--- Daemon ---\n" );
+	if ( !DaemonSetAddress( qtrue ) ) {
+		Error( "No usable socket path, set VMAP_SOCKET" );
+	}
+
+	/* the paths are indexed already, parse the shaders */
+	LoadShaderInfo();
+
+	/* don't steal the socket of a live daemon, but replace a stale one */
+	fd = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( fd >= 0 && connect( fd, (struct sockaddr*) &daemonAddress, sizeof( daemonAddress ) ) == 0 ) {
+		Error( "A vmap daemon is already listening on %s", daemonAddress.sun_path );
+	}
+	if ( fd >= 0 ) {
+		close( fd );
+	}
+	unlink( daemonAddress.sun_path );
+
+	/* listen */
+	listener = socket( AF_UNIX, SOCK_STREAM, 0 );
+	if ( listener < 0 || bind( listener, (struct sockaddr*) &daemonAddress, sizeof( daemonAddress ) ) != 0 || listen( listener, 16 ) != 0 ) {
+		Error( "Could not listen on %s: %s", daemonAddress.sun_path, strerror( errno ) );
+	}
+	daemonPid = getpid();
+	atexit( DaemonRemoveSocket );
+	signal( SIGINT, DaemonSignal );
+	signal( SIGTERM, DaemonSignal );
+	signal( SIGHUP, DaemonSignal );
+	signal( SIGPIPE, SIG_IGN );
+	Sys_Printf( "Listening on %s\n", daemonAddress.sun_path );
+	fflush( stdout );
+
+	/* one job at a time */
+	while ( 1 )
+	{
+		client = accept( listener, NULL, NULL );
+		if ( client < 0 ) {
+			if ( errno == EINTR || errno == ECONNABORTED ) {
+				continue;
+			}
+			Error( "Could not accept a client: %s", strerror( errno ) );
+		}
+		if ( !DaemonPeerIsUs( client ) ) {
+			Sys_FPrintf( SYS_WRN, "WARNING: refusing a client of another user\n" );
+			close( client );
+			continue;
+		}
+		DaemonJob( client, listener );
+		close( client );
+	}
+
+	return 0;
+}
+
+#endif
@@ -40,6 +40,13 @@
 
 int c_faceLeafs;
 
+/* subtrees handed to the worker threads hold at most faces / ( threads * this ) faces */
+#define FACEBSP_TASKS_PER_THREAD    8
+#define FACEBSP_MIN_TASK_FACES      32
+
+/* face lists at least this long have their candidate splits scored on the worker threads */
+#define FACEBSP_THREAD_SCORE        512
+
 
 /*
    ================
@@ -72,32 +79,18 @@ void    FreeBspFace( face_t *f ) {
 
 
 /*
-   SelectSplitPlaneNum()
-   finds the best split plane for this node
+   FaceNodeCrossesBlock()
+   returns the plane of the first block boundary the node straddles, or -1
  */
 
-static void SelectSplitPlaneNum( node_t *node, face_t *list, int *splitPlaneNum, int *compileFlags ){
-	face_t *split;
-	face_t *check;
-	face_t *bestSplit;
-	int splits, facing, front, back;
-	int side;
-	plane_t *plane;
-	int value, bestValue;
+static int FaceNodeCrossesBlock( node_t *node ){
 	int i;
 	vec3_t normal;
 	float dist;
-	int planenum;
-	float sizeBias;
 
-	/* ydnar: set some defaults */
-	*splitPlaneNum = -1; /* leaf */
-	*compileFlags = 0;
 
 	/* ydnar 2002-06-24: changed this to split on z-axis as well */
 	/* ydnar 2002-09-21: changed blocksize to be a vector, so mappers can specify a 3 element value */
-
-	/* if it is crossing a block boundary, force a split */
 	for ( i = 0; i < 3; i++ )
 	{
 		if ( blockSize[ i ] <= 0 ) {
@@ -107,90 +100,116 @@ static void SelectSplitPlaneNum( node_t *node, face_t *list, int *splitPlaneNum,
 		if ( node->maxs[ i ] > dist ) {
 			VectorClear( normal );
 			normal[ i ] = 1;
-			planenum = FindFloatPlane( normal, dist, 0, NULL );
-			*splitPlaneNum = planenum;
-			return;
+			return FindFloatPlane( normal, dist, 0, NULL );
 		}
 	}
 
-	/* pick one of the face planes */
-	bestValue = -99999;
-	bestSplit = list;
+	return -1;
+}
 
 
-	// div0: this check causes detail/structural mixes
-	//for( split = list; split; split = split->next )
-	//	split->checked = qfalse;
 
-	for ( split = list; split; split = split->next )
-	{
-		//if ( split->checked )
-		//	continue;
+/*
+   ScoreSplitFace()
+   rates a face plane as the split for a node, higher is better
+ */
 
-		plane = &mapplanes[ split->planenum ];
-		splits = 0;
-		facing = 0;
-		front = 0;
-		back = 0;
-		for ( check = list; check; check = check->next ) {
-			if ( check->planenum == split->planenum ) {
-				facing++;
-				//check->checked = qtrue;	// won't need to test this plane again
-				continue;
-			}
-			side = WindingOnPlaneSide( check->w, plane->normal, plane->dist );
-			if ( side == SIDE_CROSS ) {
-				splits++;
-			}
-			else if ( side == SIDE_FRONT ) {
-				front++;
-			}
-			else if ( side == SIDE_BACK ) {
-				back++;
-			}
-		}
+static int ScoreSplitFace( face_t *split, face_t *list ){
+	face_t *check;
+	int splits, facing, front, back;
+	int side;
+	plane_t *plane;
+	int value;
+	float sizeBias;
 
-		if ( bspAlternateSplitWeights ) {
-			// from 27
 
-			//Bigger is better
-			sizeBias = WindingArea( split->w );
+	// div0: this check causes detail/structural mixes
+	//for( split = list; split; split = split->next )
+	//	split->checked = qfalse;
 
-			//Base score = 20000 perfectly balanced
-			value = 20000 - ( abs( front - back ) );
-			value -= plane->counter; // If we've already used this plane sometime in the past try not to use it again
-			value -= facing;        // if we're going to have alot of other surfs use this plane, we want to get it in quickly.
-			value -= splits * 5;        //more splits = bad
-			value +=  sizeBias * 10; //We want a huge score bias based on plane size
+	plane = &mapplanes[ split->planenum ];
+	splits = 0;
+	facing = 0;
+	front = 0;
+	back = 0;
+	for ( check = list; check; check = check->next ) {
+		if ( check->planenum == split->planenum ) {
+			facing++;
+			//check->checked = qtrue;	// won't need to test this plane again
+			continue;
 		}
-		else
-		{
-			value =  5 * facing - 5 * splits; // - abs(front-back);
-			if ( plane->type < 3 ) {
-				value += 5;       // axial is better
-			}
+		side = WindingOnPlaneSide( check->w, plane->normal, plane->dist );
+		if ( side == SIDE_CROSS ) {
+			splits++;
+		}
+		else if ( side == SIDE_FRONT ) {
+			front++;
 		}
+		else if ( side == SIDE_BACK ) {
+			back++;
+		}
+	}
 
-		value += split->priority;       // prioritize hints higher
+	if ( bspAlternateSplitWeights ) {
+		// from 27
 
-		if ( value > bestValue ) {
-			bestValue = value;
-			bestSplit = split;
+		//Bigger is better
+		sizeBias = WindingArea( split->w );
+
+		//Base score = 20000 perfectly balanced
+		value = 20000 - ( abs( front - back ) );
+		value -= plane->counter; // If we've already used this plane sometime in the past try not to use it again
+		value -= facing;        // if we're going to have alot of other surfs use this plane, we want to get it in quickly.
+		value -= splits * 5;        //more splits = bad
+		value +=  sizeBias * 10; //We want a huge score bias based on plane size
+	}
+	else
+	{
+		value =  5 * facing - 5 * splits; // - abs(front-back);
+		if ( plane->type < 3 ) {
+			value += 5;       // axial is better
 		}
 	}
 
-	/* nothing, we have a leaf */
-	if ( bestValue == -99999 ) {
-		return;
-	}
+	value += split->priority;       // prioritize hints higher
 
-	/* set best split data */
-	*splitPlaneNum = bestSplit->planenum;
-	*compileFlags = bestSplit->compileFlags;
+	return value;
+}
 
-	if ( *splitPlaneNum > -1 ) {
-		mapplanes[ *splitPlaneNum ].counter++;
+
+
+/*
+   ScoreSplitFaces()
+   scores every face of a large list against it on the worker threads
+ */
+
+static face_t *scoreList;
+static face_t **scoreFaces;
+static int *scoreValues;
+static int maxScoreFaces;
+
+static void ScoreSplitFaceThread( int num ){
+	scoreValues[ num ] = ScoreSplitFace( scoreFaces[ num ], scoreList );
+}
+
+static void ScoreSplitFaces( face_t *list, int count ){
+	face_t *split;
+	int i;
+
+
+	if ( count > maxScoreFaces ) {
+		free( scoreFaces );
+		free( scoreValues );
+		maxScoreFaces = count;
+		scoreFaces = safe_malloc( maxScoreFaces * sizeof( *scoreFaces ) );
+		scoreValues = safe_malloc( maxScoreFaces * sizeof( *scoreValues ) );
 	}
+
+	for ( i = 0, split = list; split; i++, split = split->next )
+		scoreFaces[ i ] = split;
+	scoreList = list;
+
+	RunThreadsOnIndividual( count, qfalse, ScoreSplitFaceThread );
 }
 
 
@@ -213,34 +232,100 @@ int CountFaceList( face_t *list ){
 
 
 /*
-   BuildFaceTree_r()
-   recursively builds the bsp, splitting on face planes
+   SelectSplitPlaneNum()
+   finds the best split plane for this node
+   threaded scoring picks the same plane as a serial pass: ties go to the earliest face in the list
  */
 
-void BuildFaceTree_r( node_t *node, face_t *list ){
+static void SelectSplitPlaneNum( node_t *node, face_t *list, qboolean threaded, qboolean countPlanes, int *splitPlaneNum, int *compileFlags ){
+	face_t *split;
+	face_t *bestSplit;
+	int value, bestValue;
+	int i, count;
+	int planenum;
+
+
+	/* ydnar: set some defaults */
+	*splitPlaneNum = -1; /* leaf */
+	*compileFlags = 0;
+
+	/* if it is crossing a block boundary, force a split */
+	planenum = FaceNodeCrossesBlock( node );
+	if ( planenum >= 0 ) {
+		*splitPlaneNum = planenum;
+		return;
+	}
+
+	/* score large lists on the worker threads */
+	count = 0;
+	if ( threaded ) {
+		count = CountFaceList( list );
+		if ( count >= FACEBSP_THREAD_SCORE ) {
+			ScoreSplitFaces( list, count );
+		}
+		else{
+			count = 0;
+		}
+	}
+
+	/* pick one of the face planes */
+	bestValue = -99999;
+	bestSplit = list;
+
+	for ( i = 0, split = list; split; i++, split = split->next )
+	{
+		//if ( split->checked )
+		//	continue;
+
+		value = count > 0 ? scoreValues[ i ] : ScoreSplitFace( split, list );
+		if ( value > bestValue ) {
+			bestValue = value;
+			bestSplit = split;
+		}
+	}
+
+	/* nothing, we have a leaf */
+	if ( bestValue == -99999 ) {
+		return;
+	}
+
+	/* set best split data */
+	*splitPlaneNum = bestSplit->planenum;
+	*compileFlags = bestSplit->compileFlags;
+
+	/* the counters only feed bspAlternateSplitWeights, which never builds subtrees on threads */
+	if ( *splitPlaneNum > -1 && countPlanes ) {
+		mapplanes[ *splitPlaneNum ].counter++;
+	}
+}
+
+
+
+/*
+   PartitionFaceNode()
+   splits a node on its best face plane and hands the faces to its two new children
+   returns qfalse if the node is a leaf
+ */
+
+static qboolean PartitionFaceNode( node_t *node, face_t *list, qboolean threaded, qboolean countPlanes, face_t *childLists[ 2 ] ){
 	face_t      *split;
 	face_t      *next;
 	int side;
 	plane_t     *plane;
 	face_t      *newFace;
-	face_t      *childLists[2];
 	winding_t   *frontWinding, *backWinding;
 	int i;
 	int splitPlaneNum, compileFlags;
 
 
-	/* count faces left */
-	i = CountFaceList( list );
-
 	/* select the best split plane */
-	SelectSplitPlaneNum( node, list, &splitPlaneNum, &compileFlags );
+	SelectSplitPlaneNum( node, list, threaded, countPlanes, &splitPlaneNum, &compileFlags );
 
 	/* if we don't have any more faces, this is a node */
 	if ( splitPlaneNum == -1 ) {
 		node->planenum = PLANENUM_LEAF;
 		node->has_structural_children = qfalse;
-		c_faceLeafs++;
-		return;
+		return qfalse;
 	}
 
 	/* partition the list */
@@ -301,7 +386,7 @@ void BuildFaceTree_r( node_t *node, face_t *list ){
 	}
 
 
-	// recursively process children
+	// create the children
 	for ( i = 0; i < 2; i++ ) {
 		node->children[i] = AllocNode();
 		node->children[i]->parent = node;
@@ -322,10 +407,141 @@ void BuildFaceTree_r( node_t *node, face_t *list ){
 		}
 	}
 
+	return qtrue;
+}
+
+
+
+/*
+   BuildFaceTree_r()
+   recursively builds the bsp, splitting on face planes
+   returns the number of leafs created
+ */
+
+static int BuildFaceTree_r( node_t *node, face_t *list, qboolean countPlanes ){
+	face_t      *childLists[2];
+	int i, leafs;
+
+
+	if ( !PartitionFaceNode( node, list, qfalse, countPlanes, childLists ) ) {
+		return 1;
+	}
+
+	// recursively process children
+	leafs = 0;
 	for ( i = 0; i < 2; i++ ) {
-		BuildFaceTree_r( node->children[i], childLists[i] );
+		leafs += BuildFaceTree_r( node->children[i], childLists[i], countPlanes );
 		node->has_structural_children |= node->children[i]->has_structural_children;
 	}
+	return leafs;
+}
+
+
+
+/*
+   threaded face tree
+
+   the top of the tree is split serially (scoring large lists on the worker threads)
+   until the subtrees are small enough to hand out as independent tasks. a node that
+   no longer crosses a block boundary never has a child that does, so the tasks
+   never create planes and the finished tree is the one a serial build makes.
+ */
+
+typedef struct faceTask_s
+{
+	node_t      *node;
+	face_t      *list;
+	int numFaces;
+	int leafs;
+}
+faceTask_t;
+
+static faceTask_t *faceTasks;
+static int numFaceTasks, maxFaceTasks;
+static node_t **faceTreeNodes;
+static int numFaceTreeNodes, maxFaceTreeNodes;
+static int faceTaskSize;
+
+static void BuildFaceTask( int num ){
+	faceTask_t *task = &faceTasks[ num ];
+
+	task->leafs = BuildFaceTree_r( task->node, task->list, qfalse );
+}
+
+static int FaceTaskCost( int num ){
+	return faceTasks[ num ].numFaces;
+}
+
+static void SplitFaceTree_r( node_t *node, face_t *list ){
+	face_t      *childLists[2];
+	faceTask_t  *task;
+	int i, count;
+
+
+	/* small subtrees inside one block become tasks */
+	count = CountFaceList( list );
+	if ( count <= faceTaskSize && FaceNodeCrossesBlock( node ) < 0 ) {
+		AUTOEXPAND_BY_REALLOC( faceTasks, numFaceTasks, maxFaceTasks, 256 );
+		task = &faceTasks[ numFaceTasks++ ];
+		task->node = node;
+		task->list = list;
+		task->numFaces = count;
+		task->leafs = 0;
+		return;
+	}
+
+	if ( !PartitionFaceNode( node, list, qtrue, qtrue, childLists ) ) {
+		c_faceLeafs++;
+		return;
+	}
+
+	for ( i = 0; i < 2; i++ )
+		SplitFaceTree_r( node->children[i], childLists[i] );
+
+	/* children are finished before their parents in this list */
+	AUTOEXPAND_BY_REALLOC( faceTreeNodes, numFaceTreeNodes, maxFaceTreeNodes, 256 );
+	faceTreeNodes[ numFaceTreeNodes++ ] = node;
+}
+
+static void BuildFaceTreeThreaded( node_t *node, face_t *list, int count ){
+	int i, j;
+
+
+	/* aim for several tasks per thread so the work stealing can even out lopsided subtrees */
+	faceTaskSize = count / ( numthreads * FACEBSP_TASKS_PER_THREAD );
+	if ( faceTaskSize < FACEBSP_MIN_TASK_FACES ) {
+		faceTaskSize = FACEBSP_MIN_TASK_FACES;
+	}
+
+	/* the alternate weights read plane counters, so only the scoring is threaded */
+	if ( bspAlternateSplitWeights ) {
+		faceTaskSize = -1;
+	}
+
+	numFaceTasks = 0;
+	numFaceTreeNodes = 0;
+	SplitFaceTree_r( node, list );
+	Sys_FPrintf( SYS_VRB, "%9d subtree tasks\n", numFaceTasks );
+
+	RunThreadsOnIndividualCost( numFaceTasks, qfalse, BuildFaceTask, FaceTaskCost );
+
+	for ( i = 0; i < numFaceTasks; i++ )
+		c_faceLeafs += faceTasks[ i ].leafs;
+	for ( i = 0; i < numFaceTreeNodes; i++ )
+	{
+		for ( j = 0; j < 2; j++ )
+			faceTreeNodes[ i ]->has_structural_children |= faceTreeNodes[ i ]->children[ j ]->has_structural_children;
+	}
+
+	free( faceTasks );
+	free( faceTreeNodes );
+	free( scoreFaces );
+	free( scoreValues );
+	faceTasks = NULL;
+	faceTreeNodes = NULL;
+	scoreFaces = NULL;
+	scoreValues = NULL;
+	maxFaceTasks = maxFaceTreeNodes = maxScoreFaces = 0;
 }
 
 
@@ -343,6 +559,7 @@ tree_t *FaceBSP( face_t *list ) {
 	int count;
 
 	Sys_FPrintf( SYS_VRB, "--- FaceBSP ---\n" );
+	ProfileBegin( "FaceBSP" );
 
 	tree = AllocTree();
 
@@ -356,6 +573,7 @@ tree_t *FaceBSP( face_t *list ) {
 		}
 	}
 	Sys_FPrintf( SYS_VRB, "%9d faces\n", count );
+	ProfileAddWork( count );
 
 	for ( i = 0; i < nummapplanes; i++ )
 	{
@@ -367,10 +585,16 @@ tree_t *FaceBSP( face_t *list ) {
 	VectorCopy( tree->maxs, tree->headnode->maxs );
 	c_faceLeafs = 0;
 
-	BuildFaceTree_r( tree->headnode, list );
+	if ( numthreads > 1 ) {
+		BuildFaceTreeThreaded( tree->headnode, list, count );
+	}
+	else{
+		c_faceLeafs = BuildFaceTree_r( tree->headnode, list, qtrue );
+	}
 
 	Sys_FPrintf( SYS_VRB, "%9d leafs\n", c_faceLeafs );
 
+	ProfileEnd();
 	return tree;
 }
 
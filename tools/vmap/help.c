@@ -102,6 +102,7 @@ void HelpBsp()
 		{"-leaktest", "Continue even if a leak was found"},
 		{"-linfile <filename.lin>", "Line file to write"},
 		{"-meta", "Combine adjacent triangles of the same texture to surfaces (ALWAYS USE THIS)"},
+		{"-merge", "Combine the files of `-shard` runs; stores the lightmaps after the last pass, otherwise saves the light state for the next `-shardpass`"},
 		{"-minsamplesize <N>", "Sets minimum lightmap resolution in luxels/qu"},
 		{"-mi <N>", "Sets the maximum number of indexes per surface"},
 		{"-mv <N>", "Sets the maximum number of vertices of a lightmapped surface"},
@@ -136,6 +137,7 @@ void HelpVis()
 		{"-vis <filename.map>", "Switch that enters this stage"},
 		{"-fast", "Very fast and crude vis calculation"},
 		{"-hint", "Merge all but hint portals"},
+		{"-incremental", "Keep per-portal results in a .viscache file next to the .prt and only recompute portals whose surroundings changed since the last run"},
 		{"-mergeportals", "The less crude half of `-merge`, makes vis sometimes much faster but doesn't hurt fps usually"},
 		{"-merge", "Faster but still okay vis calculation"},
 		{"-nopassage", "Just use PortalFlow vis (usually less fps)"},
@@ -153,14 +155,22 @@ void HelpLight()
 {
 	struct HelpOption light[] = {
 		{"-light <filename.map>", "Switch that enters this stage"},
+		{"-adaptivegrid", "Trace the light grid coarsely and refine it only where lighting changes, interpolating the rest"},
+		{"-adaptivegridstep <N>", "Grid points between the coarse samples of `-adaptivegrid`, a power of two (default 8)"},
+		{"-adaptivegridthreshold <F>", "Largest byte error inside an `-adaptivegrid` cell that is still interpolated (default 4)"},
+		{"-adaptivesamples", "Random supersampling that stops once a luxel's brightness converges; `-samples` sets the most rays per luxel"},
+		{"-adaptivethreshold <F>", "Standard error of a luxel's brightness at which `-adaptivesamples` stops (default 2)"},
 		{"-approx <N>", "Vertex light approximation tolerance (never use in conjunction with deluxemapping)"},
 		{"-areascale <F, `-area` F>", "Scaling factor for area lights (surfacelight)"},
 		{"-border", "Add a red border to lightmaps for debugging"},
+		{"-bouncecheckpoint", "Write the BSP after every radiosity bounce so an interrupted compile keeps its progress"},
 		{"-bouncegrid", "Also compute radiosity on the light grid"},
 		{"-bounceonly", "Only compute radiosity"},
 		{"-bouncescale <F>", "Scaling factor for radiosity"},
 		{"-bounce <N>", "Number of bounces for radiosity"},
 		{"-bspfile <filename.bsp>", "BSP file to write"},
+		{"-bvh", "Trace against a surface area heuristic bounding volume hierarchy instead of the trace node tree"},
+		{"-checkpoint <N>", "Save the lit lightmaps and grid points to a checkpoint file every N seconds, from a background thread, so `-resume` can pick up an interrupted compile"},
 		{"-cheapgrid", "Use `-cheap` style lighting for radiosity"},
 		{"-cheap", "Abort vertex light calculations when white is reached"},
 		{"-compensate <F>", "Lightmap compensate (darkening factor applied after everything else)"},
@@ -190,6 +200,7 @@ void HelpLight()
 		{"-external", "Force external lightmaps even if at size of internal lightmaps"},
 		{"-extravisnudge", "Broken feature to nudge the luxel origin to a better vis cluster"},
 		{"-fastallocate", "Use `-fastallocate` to trade lightmap size against allocation time (useful with hi res lightmaps on large maps: reduce allocation time from days to minutes for only some extra bytes)"},
+		{"-skylineallocate", "Pack lightmaps largest first with a skyline per output lightmap instead of searching every position; much faster allocation, usually fewer output lightmaps"},
 		{"-slowbounce", "Use the slower method for calculating light spread"},
 		{"-slowgrid", "Uses slower method for calculating light spread"},
 		{"-slow", "Disable fast envelope/distance calculation for lights"},
@@ -205,32 +216,44 @@ void HelpLight()
 		{"-lightmapsearchpower <N>", "Optimize for lightmap merge power <N>"},
 		{"-lightmapsize <N>", "Size of lightmaps to generate (must be a power of two)"},
 		{"-lightsubdiv <N>", "Size of light emitting shader subdivision"},
+		{"-lighttree", "Cluster area and bounce lights into a tree and light each lightmap with an error bounded cut through it"},
+		{"-lighttreeerror <F>", "Largest error bound of a light cut node, relative to the estimated total light (default 0.002)"},
 		{"-lomem", "Low memory but slower lighting mode"},
 		{"-lowquality", "Low quality floodlight (appears to currently break floodlight)"},
 		{"-minsamplesize <N>", "Sets minimum lightmap resolution in luxels/qu"},
+		{"-noclusterlights", "Do not precompute the lights each PVS cluster can see, test every light per surface and grid point"},
 		{"-nocollapse", "Do not collapse identical lightmaps"},
 		{"-nodeluxe, -nodeluxemap", "Disable deluxemapping"},
 		{"-nogrid", "Disable grid light calculation (makes all entities fullbright)"},
 		{"-nolightmapsearch", "Do not optimize lightmap packing for GPU memory usage (as doing so costs fps)"},
+		{"-nopackettrace", "Trace shadow rays one at a time instead of in SIMD packets"},
 		{"-normalmap", "Color the lightmaps according to the direction of the surface normal (TODO is this identical to `-debugnormals`?)"},
+		{"-noshadowcache", "Trace every shadow ray from scratch (the default)"},
 		{"-nostyle, -nostyles", "Disable support for light styles"},
 		{"-nosurf", "Disable tracing against surfaces (only uses BSP nodes then)"},
 		{"-notrace", "Disable shadow occlusion"},
 		{"-novertex", "Disable vertex lighting"},
 		{"-patchshadows", "Cast shadows from patches"},
 		{"-pointscale <F, `-point` F>", "Scaling factor for point lights (light entities)"},
+		{"-raybudget <F>", "Fraction of the uniform ray count `-adaptivesamples` may spend on each raw lightmap (default 1)"},
+		{"-resume", "Load the `-checkpoint` file of an interrupted compile and light only what it is missing; keeps checkpointing (every 300 seconds unless set)"},
 		{"-samplescale <F>", "Scales all lightmap resolutions"},
 		{"-samplesize <N>", "Sets default lightmap resolution in luxels/qu"},
 		{"-samples <N>", "Adaptive supersampling quality"},
 		{"-scale <F>", "Scaling factor for all light types"},
+		{"-shard <i/N>", "Light only shard i of N of the raw lightmaps and grid points and write them to a shard file for `-merge`"},
+		{"-shardpass <N>", "Radiosity bounce a `-shard` run lights, 0 is the direct light; each pass starts from the merge of the one before"},
 		{"-shadeangle <A>", "Angle for phong shading"},
 		{"-shade", "Enable phong shading at default shade angle"},
+		{"-shadowcache", "Test the last occluders of a light in a raw lightmap before tracing its next luxels; faster, but a cached hit can differ slightly from the full trace, so it is off for `-shard`, `-merge`, `-checkpoint` and `-tracebenchmark`"},
 		{"-skyscale <F, `-sky` F>", "Scaling factor for sky and sun light"},
 		{"-srffile <filename.srf>", "Surface file to read"},
+		{"-streamlightmaps", "Light each raw lightmap start to finish and free its supersampled buffers right away; lowers peak memory, costs remapping on every bounce"},
 		{"-style, -styles", "Enable support for light styles"},
 		{"-sunonly", "Only compute sun light"},
 		{"-super <N, `-supersample` N>", "Ordered grid supersampling quality"},
 		{"-thresh <F>", "Triangle subdivision threshold"},
+		{"-tracebenchmark", "Trace a fixed set of random rays through the trace nodes and the bvh and print rays/sec"},
 		{"-trianglecheck", "Broken check that should ensure luxels apply to the right triangle"},
 		{"-trisoup", "Convert brush faces to triangle soup"},
 	};
@@ -272,6 +295,15 @@ void HelpConvert()
 	HelpOptions("Converting & Decompiling", 0, 80, convert, sizeof(convert)/sizeof(struct HelpOption));
 }
 
+void HelpDaemon()
+{
+	struct HelpOption daemon[] = {
+		{"-daemon", "Switch that enters this mode: index the paths and parse the shaders once, then run the compiles of -client invocations, keeping the images and models they load; changed files are reloaded by mtime. Listens on $VMAP_SOCKET, $XDG_RUNTIME_DIR/vmap.sock or /tmp/vmap-<uid>/vmap.sock, and only takes jobs from its own user"},
+	};
+
+	HelpOptions("Compile daemon", 0, 80, daemon, sizeof(daemon)/sizeof(struct HelpOption));
+}
+
 void HelpExport()
 {
 	struct HelpOption exportl[] = {
@@ -320,6 +352,7 @@ void HelpCommon()
 {
 	struct HelpOption common[] = {
 		{"-game <gamename>", "Sets a different game directory name (can be used more than once)"},
+		{"-client", "Run the compile in a listening vmap -daemon with the same paths, else here"},
 		{"-connect <address>", "Talk to a WorldSpawn instance using a specific XML based protocol"},
 		{"-force", "Allow reading some broken/unsupported BSP files e.g. when decompiling, may also crash"},
 		{"-fs_basepath <path>", "Sets the given path as main directory of the game (can be used more than once to look in multiple paths)"},
@@ -329,6 +362,7 @@ void HelpCommon()
 		{"-fs_nomagicpath", "Do not try to guess base path magically"},
 		{"-fs_nohomepath", "Do not load home path in VFS"},
 		{"-fs_pakpath <path>", "Specify a package directory (can be used more than once to look in multiple paths)"},
+		{"-profile <file.json>", "Write per-stage wall/CPU time, peak memory, work counts and thread busy time of -bsp, -vis or -light to a JSON file"},
 		{"-subdivisions <F>", "multiplier for patch subdivisions quality"},
 		{"-threads <N>", "number of threads to use"},
 		{"-v", "Verbose mode"}
@@ -352,6 +386,7 @@ void HelpMain(const char* arg)
 		{"-analyze", "Analyzing BSP-like file structure"},
 		{"-scale", "Scaling"},
 		{"-convert", "Converting & Decompiling"},
+		{"-daemon", "Compile daemon"},
 		{"-export", "Exporting lightmaps"},
 		{"-exportents", "Exporting entities"},
 		{"-fixaas", "Fixing AAS checksum"},
@@ -365,6 +400,7 @@ void HelpMain(const char* arg)
 		HelpAnalyze,
 		HelpScale,
 		HelpConvert,
+		HelpDaemon,
 		HelpExport,
 		HelpExportEnts,
 		HelpFixaas,
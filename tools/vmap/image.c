@@ -226,6 +226,30 @@ static void LoadPNGBuffer( byte *buffer, int size, byte **pixels, int *width, in
 
 
 
+/*
+   AllocImage()
+   returns a cleared image slot, image_t are never moved so pointers to them stay valid
+ */
+
+static strHash_t *imageHash = NULL;
+static int numImageSlotsMade = 0;
+
+static image_t *AllocImage( void ){
+	image_t     *image;
+
+
+	AUTOEXPAND_BY_REALLOC( images, numImageSlots, allocatedImageSlots, 512 );
+	if ( numImageSlots >= numImageSlotsMade ) {
+		images[ numImageSlots ] = safe_malloc( sizeof( image_t ) );
+		numImageSlotsMade++;
+	}
+	image = images[ numImageSlots++ ];
+	memset( image, 0, sizeof( *image ) );
+	return image;
+}
+
+
+
 /*
    ImageInit()
    implicitly called by every function to set up image list
@@ -233,23 +257,30 @@ static void LoadPNGBuffer( byte *buffer, int size, byte **pixels, int *width, in
 
 static void ImageInit( void ){
 	int i;
+	image_t     *image;
 
 
 	if ( numImages <= 0 ) {
 		/* clear images (fixme: this could theoretically leak) */
-		memset( images, 0, sizeof( images ) );
+		if ( imageHash == NULL ) {
+			imageHash = StrHashNew( 512, qtrue );
+		}
+		StrHashClear( imageHash );
+		numImageSlots = 0;
 
 		/* generate *bogus image */
-		images[ 0 ].name = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
-		strcpy( images[ 0 ].name, DEFAULT_IMAGE );
-		images[ 0 ].filename = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
-		strcpy( images[ 0 ].filename, DEFAULT_IMAGE );
-		images[ 0 ].width = 64;
-		images[ 0 ].height = 64;
-		images[ 0 ].refCount = 1;
-		images[ 0 ].pixels = safe_malloc( 64 * 64 * 4 );
+		image = AllocImage();
+		image->name = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
+		strcpy( image->name, DEFAULT_IMAGE );
+		image->filename = safe_malloc( strlen( DEFAULT_IMAGE ) + 1 );
+		strcpy( image->filename, DEFAULT_IMAGE );
+		image->width = 64;
+		image->height = 64;
+		image->refCount = 1;
+		image->pixels = safe_malloc( 64 * 64 * 4 );
 		for ( i = 0; i < ( 64 * 64 * 4 ); i++ )
-			images[ 0 ].pixels[ i ] = 255;
+			image->pixels[ i ] = 255;
+		StrHashAdd( imageHash, image->name, image );
 	}
 }
 
@@ -272,6 +303,7 @@ void ImageFree( image_t *image ){
 	/* free? */
 	if ( image->refCount <= 0 ) {
 		if ( image->name != NULL ) {
+			StrHashRemove( imageHash, image->name, image );
 			free( image->name );
 		}
 		image->name = NULL;
@@ -294,7 +326,6 @@ void ImageFree( image_t *image ){
  */
 
 image_t *ImageFind( const char *filename ){
-	int i;
 	char name[ 1024 ];
 
 
@@ -310,16 +341,8 @@ image_t *ImageFind( const char *filename ){
 	strcpy( name, filename );
 	StripExtension( name );
 
-	/* search list */
-	for ( i = 0; i < MAX_IMAGES; i++ )
-	{
-		if ( images[ i ].name != NULL && !strcmp( name, images[ i ].name ) ) {
-			return &images[ i ];
-		}
-	}
-
-	/* no matching image found */
-	return NULL;
+	/* search hash */
+	return StrHashFind( imageHash, name );
 }
 
 
@@ -330,7 +353,6 @@ image_t *ImageFind( const char *filename ){
  */
 
 image_t *ImageLoad( const char *filename ){
-	int i;
 	image_t     *image;
 	char name[ 1024 ];
 	int size;
@@ -357,20 +379,8 @@ image_t *ImageLoad( const char *filename ){
 		return image;
 	}
 
-	/* none found, so find first non-null image */
-	image = NULL;
-	for ( i = 0; i < MAX_IMAGES; i++ )
-	{
-		if ( images[ i ].name == NULL ) {
-			image = &images[ i ];
-			break;
-		}
-	}
-
-	/* too many images? */
-	if ( image == NULL ) {
-		Error( "MAX_IMAGES (%d) exceeded, there are too many image files referenced by the map.", MAX_IMAGES );
-	}
+	/* none found, so get a new image */
+	image = AllocImage();
 
 	/* set it up */
 	image->name = safe_malloc( strlen( name ) + 1 );
@@ -451,6 +461,9 @@ image_t *ImageLoad( const char *filename ){
 		//%		size, image->width, image->height, image->pixels, name );
 		free( image->name );
 		image->name = NULL;
+
+		/* give the slot back */
+		numImageSlots--;
 		return NULL;
 	}
 
@@ -461,6 +474,7 @@ image_t *ImageLoad( const char *filename ){
 	/* set count */
 	image->refCount = 1;
 	numImages++;
+	StrHashAdd( imageHash, image->name, image );
 
 	if ( alphaHack ) {
 		StripExtension( name );
@@ -489,3 +503,46 @@ image_t *ImageLoad( const char *filename ){
 	/* return the image */
 	return image;
 }
+
+
+
+/*
+   ImageFileTime()
+   finds the file ImageLoad would read for an image name, and the newest time of the files it reads
+ */
+
+time_t ImageFileTime( const char *name, char *filename ){
+	static const char *exts[] = { ".tga", ".png", ".jpg", ".dds", ".ktx", NULL };
+	time_t time, alphaTime;
+	int i;
+
+
+	/* the first extension found wins, as in ImageLoad */
+	for ( i = 0; exts[ i ] != NULL; i++ )
+	{
+		strcpy( filename, name );
+		StripExtension( filename );
+		strcat( filename, exts[ i ] );
+		time = vfsGetFileTime( filename, 0 );
+		if ( time != -1 ) {
+			break;
+		}
+	}
+	if ( exts[ i ] == NULL ) {
+		filename[ 0 ] = '\0';
+		return -1;
+	}
+
+	/* jpgs can take their alpha from another file */
+	if ( i == 2 ) {
+		char alpha[ 1024 ];
+		strcpy( alpha, filename );
+		StripExtension( alpha );
+		strcat( alpha, "_alpha.jpg" );
+		alphaTime = vfsGetFileTime( alpha, 0 );
+		if ( alphaTime > time ) {
+			time = alphaTime;
+		}
+	}
+	return time;
+}
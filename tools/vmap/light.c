@@ -887,7 +887,7 @@ void CreateSurfaceLights( void ){
 		if ( si->sun != NULL && nss[ 0 ] != '1' ) {
 			Sys_FPrintf( SYS_VRB, "Sun: %s\n", si->shader );
 			CreateSunLight( si->sun );
-			si->sun = NULL; /* FIXME: leak! */
+			si->sun = NULL; /* freed with the shaders */
 		}
 
 		/* sky light? */
@@ -1088,11 +1088,12 @@ float PointToPolygonFormFactor( const vec3_t point, const vec3_t normal, const w
 
 
 /*
-   LightContributionTosample()
-   determines the amount of light reaching a sample (luxel or vertex) from a given light
+   PrepareLightContribution()
+   determines the unoccluded amount of light reaching a sample (luxel or vertex) from a given light,
+   returns LIGHT_TRACE_PENDING if the sample still has to be traced and finished with FinishLightContribution()
  */
 
-int LightContributionToSample( trace_t *trace ){
+int PrepareLightContribution( trace_t *trace ){
 	light_t         *light;
 	float angle;
 	float add;
@@ -1465,15 +1466,8 @@ int LightContributionToSample( trace_t *trace ){
 
 		/* trace to point */
 		if ( trace->testOcclusion && !trace->forceSunlight ) {
-			/* trace */
-			TraceLine( trace );
-			trace->forceSubsampling *= add;
-			if ( !( trace->compileFlags & C_SKY ) || trace->opaque ) {
-				VectorClear( trace->color );
-				VectorClear( trace->directionContribution );
-
-				return -1;
-			}
+			trace->pendingAdd = add;
+			return LIGHT_TRACE_PENDING;
 		}
 
 		/* return to sender */
@@ -1522,9 +1516,30 @@ int LightContributionToSample( trace_t *trace ){
 	VectorScale( light->color, add, trace->color );
 
 	/* raytrace */
-	TraceLine( trace );
-	trace->forceSubsampling *= add;
-	if ( trace->passSolid || trace->opaque ) {
+	trace->pendingAdd = add;
+	return LIGHT_TRACE_PENDING;
+}
+
+
+
+/*
+   FinishLightContribution()
+   applies the occlusion trace of a sample prepared with PrepareLightContribution()
+ */
+
+int FinishLightContribution( trace_t *trace ){
+	trace->forceSubsampling *= trace->pendingAdd;
+
+	/* sunlight has to reach the sky */
+	if ( trace->light->type == EMIT_SUN ) {
+		if ( !( trace->compileFlags & C_SKY ) || trace->opaque ) {
+			VectorClear( trace->color );
+			VectorClear( trace->directionContribution );
+
+			return -1;
+		}
+	}
+	else if ( trace->passSolid || trace->opaque ) {
 		VectorClear( trace->color );
 		VectorClear( trace->directionContribution );
 
@@ -1537,6 +1552,27 @@ int LightContributionToSample( trace_t *trace ){
 
 
 
+/*
+   LightContributionTosample()
+   determines the amount of light reaching a sample (luxel or vertex) from a given light
+ */
+
+int LightContributionToSample( trace_t *trace ){
+	int r;
+
+
+	r = PrepareLightContribution( trace );
+	if ( r != LIGHT_TRACE_PENDING ) {
+		return r;
+	}
+
+	/* raytrace */
+	TraceLine( trace );
+	return FinishLightContribution( trace );
+}
+
+
+
 /*
    LightingAtSample()
    determines the amount of light reaching a sample (luxel or vertex)
@@ -1823,6 +1859,46 @@ int LightContributionToPoint( trace_t *trace ){
 
 
 
+/*
+   StoreGridPoint()
+   converts a raw grid point to the bytes stored in the bsp
+ */
+
+static void StoreGridPoint( rawGridPoint_t *gp, bspGridPoint_t *bgp ){
+	int i, j;
+	vec3_t color, thisdir;
+
+
+	/* get the primary light direction */
+	VectorNormalize( gp->dir, thisdir );
+
+	for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+	{
+#if 0
+		/* do some fudging to keep the ambient from being too low (2003-07-05: 0.25 -> 0.125) */
+		if ( !bouncing ) {
+			VectorMA( gp->ambient[ i ], 0.125f, gp->directed[ i ], gp->ambient[ i ] );
+		}
+#endif
+
+		/* set minimum light and copy off to bytes */
+		VectorCopy( gp->ambient[ i ], color );
+		for ( j = 0; j < 3; j++ )
+			if ( color[ j ] < minGridLight[ j ] ) {
+				color[ j ] = minGridLight[ j ];
+			}
+
+		/* vortex: apply gridscale and gridambientscale here */
+		ColorToBytes( color, bgp->ambient[ i ], gridScale * gridAmbientScale );
+		ColorToBytes( gp->directed[ i ], bgp->directed[ i ], gridScale );
+	}
+
+	/* store direction */
+	NormalToLatLong( thisdir, bgp->latLong );
+}
+
+
+
 /*
    TraceGrid()
    grid samples are for quickly determining the lighting
@@ -1841,14 +1917,19 @@ typedef struct
 contribution_t;
 
 void TraceGrid( int num ){
-	int i, j, x, y, z, mod, numCon, numStyles;
+	int i, j, x, y, z, mod, numCon, numStyles, *lightNums;
 	float d, step;
-	vec3_t baseOrigin, cheapColor, color, thisdir;
+	vec3_t baseOrigin, cheapColor, thisdir;
 	rawGridPoint_t          *gp;
 	bspGridPoint_t          *bgp;
 	contribution_t contributions[ MAX_CONTRIBUTIONS ];
 	trace_t trace;
 
+	/* another shard traces this one */
+	if ( !ShardOwnsGridPoint( num ) ) {
+		return;
+	}
+
 	/* get grid points */
 	gp = &rawGridPoints[ num ];
 	bgp = &bspGridPoints[ num ];
@@ -1879,8 +1960,9 @@ void TraceGrid( int num ){
 	/* find point cluster */
 	trace.cluster = ClusterForPointExt( trace.origin, GRID_EPSILON );
 	if ( trace.cluster < 0 ) {
-		/* try to nudge the origin around to find a valid point */
+		/* try to nudge the origin around to find a valid point, the same way whoever traces it */
 		VectorCopy( trace.origin, baseOrigin );
+		SeedRandom( num );
 		for ( step = 0; ( step += 0.005 ) <= 1.0; )
 		{
 			VectorCopy( baseOrigin, trace.origin );
@@ -1894,6 +1976,7 @@ void TraceGrid( int num ){
 				break;
 			}
 		}
+		SeedRandom( -1 );
 
 		/* can't find a valid point at all */
 		if ( step > 1.0 ) {
@@ -1903,20 +1986,31 @@ void TraceGrid( int num ){
 
 	/* setup trace */
 	trace.testOcclusion = (qboolean)(!noTrace);
+	trace.testAll = qfalse;
 	trace.forceSunlight = qfalse;
 	trace.recvShadows = WORLDSPAWN_RECV_SHADOWS;
 	trace.numSurfaces = 0;
 	trace.surfaces = NULL;
 	trace.numLights = 0;
 	trace.lights = NULL;
+	trace.shadowCache = NULL;       /* grid points are dealt to threads one by one, a cache would depend on the dealing */
+	trace.shadowTile = -1;
 
 	/* clear */
 	numCon = 0;
 	VectorClear( cheapColor );
 
+	/* walk only the lights this cluster can see when the grid lists are current */
+	lightNums = NULL;
+	if ( clusterLights != NULL && clusterLightsForGrid && trace.cluster < numLightClusters ) {
+		lightNums = clusterLights[ trace.cluster ];
+	}
+
 	/* trace to all the lights, find the major light direction, and divide the
 	   total light between that along the direction and the remaining in the ambient */
-	for ( trace.light = lights; trace.light != NULL; trace.light = trace.light->next )
+	i = 0;
+	trace.light = ( lightNums != NULL ) ? lightsByNum[ lightNums[ 0 ] ] : lights;
+	for ( ; trace.light != NULL; trace.light = ( lightNums != NULL ) ? lightsByNum[ lightNums[ ++i ] ] : trace.light->next )
 	{
 		float addSize;
 
@@ -1966,6 +2060,7 @@ void TraceGrid( int num ){
 		trace.forceSunlight = qfalse;
 		trace.inhibitRadius = DEFAULT_INHIBIT_RADIUS;
 		trace.testAll = qtrue;
+		trace.shadowCache = NULL;       /* floodlight needs the nearest hit */
 
 		for ( k = 0; k < 2; k++ )
 		{
@@ -2032,83 +2127,655 @@ void TraceGrid( int num ){
 			}
 		}
 
-		/* style not found? */
-		if ( j >= numStyles ) {
-			/* add a new style */
-			if ( numStyles < MAX_LIGHTMAPS ) {
-				gp->styles[ numStyles ] = contributions[ i ].style;
-				bgp->styles[ numStyles ] = contributions[ i ].style;
-				numStyles++;
-				//%	Sys_Printf( "(%d, %d) ", num, contributions[ i ].style );
-			}
+		/* style not found? */
+		if ( j >= numStyles ) {
+			/* add a new style */
+			if ( numStyles < MAX_LIGHTMAPS ) {
+				gp->styles[ numStyles ] = contributions[ i ].style;
+				bgp->styles[ numStyles ] = contributions[ i ].style;
+				numStyles++;
+				//%	Sys_Printf( "(%d, %d) ", num, contributions[ i ].style );
+			}
+
+			/* fallback */
+			else {
+				j = 0;
+			}
+		}
+
+		/* add the directed color */
+		VectorMA( gp->directed[ j ], d, contributions[ i ].color, gp->directed[ j ] );
+
+		/* ambient light will be at 1/4 the value of directed light */
+		/* (ydnar: nuke this in favor of more dramatic lighting?) */
+		/* (PM: how about actually making it work? d=1 when it got here for single lights/sun :P */
+//		d = 0.25f;
+		/* (Hobbes: always setting it to .25 is hardly any better) */
+		d = 0.25f * ( 1.0f - d );
+		VectorMA( gp->ambient[ j ], d, contributions[ i ].color, gp->ambient[ j ] );
+
+		VectorAdd( gp->ambient[ j ], contributions[ i ].ambient, gp->ambient[ j ] );
+
+/*
+ * div0:
+ * the total light average = ambient value + 0.25 * sum of all directional values
+ * we can also get the total light average as 0.25 * the sum of all contributions
+ *
+ * 0.25 * sum(contribution_i) == ambient + 0.25 * sum(d_i contribution_i)
+ *
+ * THIS YIELDS:
+ * ambient == 0.25 * sum((1 - d_i) contribution_i)
+ *
+ * So, 0.25f * (1.0f - d) IS RIGHT. If you want to tune it, tune d BEFORE.
+ */
+	}
+
+
+	/* store off sample */
+	StoreGridPoint( gp, bgp );
+	CheckpointGridPoint( num );
+
+	/* debug code */
+	#if 0
+	//%	Sys_FPrintf( SYS_VRB, "%10d %10d %10d ", &gp->ambient[ 0 ][ 0 ], &gp->ambient[ 0 ][ 1 ], &gp->ambient[ 0 ][ 2 ] );
+	Sys_FPrintf( SYS_VRB, "%9d Amb: (%03.1f %03.1f %03.1f) Dir: (%03.1f %03.1f %03.1f)\n",
+	             num,
+	             gp->ambient[ 0 ][ 0 ], gp->ambient[ 0 ][ 1 ], gp->ambient[ 0 ][ 2 ],
+	             gp->directed[ 0 ][ 0 ], gp->directed[ 0 ][ 1 ], gp->directed[ 0 ][ 2 ] );
+	#endif
+}
+
+
+
+/*
+   adaptive grid
+
+   -adaptivegrid first marks every grid point that sits in solid, then traces
+   every adaptiveGridStep'th point and treats the points between them as cells.
+   the points halfway across a cell with open corners are traced too, and if
+   interpolating the corners predicts them within -adaptivegridthreshold, the
+   rest of the cell is filled by trilinear interpolation. cells next to a point
+   light are never interpolated, as its peak falls between the samples. a cell
+   that is solid all through is left alone, and any other cell is split in
+   eight, so only the grid points along walls, around lights and across light
+   edges are traced at full density. the bsp lump stays the same dense grid,
+   so engines never know.
+
+   radiosity adds to the grid on later passes, so points traced once are always
+   traced again, and interpolated points are interpolated again from the new totals.
+ */
+
+#define GRID_SOLID          1       /* no cluster at the point */
+#define GRID_TRACED         2       /* traced on some pass */
+#define GRID_DONE           4       /* traced or interpolated this pass */
+#define GRID_LIGHT          8       /* near a light, where interpolation misses the peak */
+
+#define ADAPTIVE_GRID_DOT   0.9f    /* least agreement of the corner light directions */
+#define ADAPTIVE_GRID_LIGHT 2       /* grid points around a light that are always traced */
+
+typedef struct gridCell_s
+{
+	int mins[ 3 ];
+	int size;
+}
+gridCell_t;
+
+static byte             *gridFlags = NULL;
+static int              *gridQueue = NULL;
+static byte             *gridQueueSkip = NULL;
+static int numGridQueue;
+static int numGridTraced, numGridInterpolated;
+
+
+
+/*
+   GridPointNum()
+   index of the grid point at grid coordinates
+ */
+
+static int GridPointNum( int x, int y, int z ){
+	return ( z * gridBounds[ 1 ] + y ) * gridBounds[ 0 ] + x;
+}
+
+
+
+/*
+   ClassifyGrid()
+   flags the grid points that sit in solid
+ */
+
+static void ClassifyGrid( void ){
+	int x, y, z, num, numSolid;
+	vec3_t origin;
+
+
+	gridFlags = safe_malloc( numRawGridPoints * sizeof( *gridFlags ) );
+	gridQueue = safe_malloc( numRawGridPoints * sizeof( *gridQueue ) );
+	gridQueueSkip = safe_malloc( numRawGridPoints * sizeof( *gridQueueSkip ) );
+	numSolid = 0;
+	for ( z = 0; z < gridBounds[ 2 ]; z++ )
+	{
+		for ( y = 0; y < gridBounds[ 1 ]; y++ )
+		{
+			for ( x = 0; x < gridBounds[ 0 ]; x++ )
+			{
+				num = GridPointNum( x, y, z );
+				origin[ 0 ] = gridMins[ 0 ] + x * gridSize[ 0 ];
+				origin[ 1 ] = gridMins[ 1 ] + y * gridSize[ 1 ];
+				origin[ 2 ] = gridMins[ 2 ] + z * gridSize[ 2 ];
+				gridFlags[ num ] = 0;
+				if ( ClusterForPointExt( origin, GRID_EPSILON ) < 0 ) {
+					gridFlags[ num ] |= GRID_SOLID;
+					numSolid++;
+				}
+			}
+		}
+	}
+
+	Sys_FPrintf( SYS_VRB, "%9d grid points in solid\n", numSolid );
+}
+
+
+
+/*
+   GridPointTraced()
+   returns qtrue if the adaptive grid traced the point on an earlier pass
+ */
+
+qboolean GridPointTraced( int num ){
+	return ( gridFlags != NULL && ( gridFlags[ num ] & GRID_TRACED ) ) ? qtrue : qfalse;
+}
+
+
+
+/*
+   SetGridPointTraced()
+   restores a traced point of an earlier pass, for light shards picking up a bounce
+ */
+
+void SetGridPointTraced( int num ){
+	if ( gridFlags == NULL ) {
+		ClassifyGrid();
+	}
+	gridFlags[ num ] |= GRID_TRACED;
+}
+
+
+
+/*
+   MarkGridLights()
+   flags the grid points around every point light of this pass
+ */
+
+static void MarkGridLights( void ){
+	int i, x, y, z, mins[ 3 ], maxs[ 3 ];
+	light_t     *light;
+
+
+	for ( i = 0; i < numRawGridPoints; i++ )
+		gridFlags[ i ] &= ~GRID_LIGHT;
+
+	for ( light = lights; light != NULL; light = light->next )
+	{
+		/* area lights spread their peak over the surface they sit on */
+		if ( light->type != EMIT_POINT && light->type != EMIT_SPOT ) {
+			continue;
+		}
+		for ( i = 0; i < 3; i++ )
+		{
+			mins[ i ] = floor( ( light->origin[ i ] - gridMins[ i ] ) / gridSize[ i ] ) - ADAPTIVE_GRID_LIGHT + 1;
+			maxs[ i ] = mins[ i ] + 2 * ADAPTIVE_GRID_LIGHT - 1;
+			mins[ i ] = mins[ i ] < 0 ? 0 : mins[ i ];
+			maxs[ i ] = maxs[ i ] > gridBounds[ i ] - 1 ? gridBounds[ i ] - 1 : maxs[ i ];
+		}
+		for ( z = mins[ 2 ]; z <= maxs[ 2 ]; z++ )
+			for ( y = mins[ 1 ]; y <= maxs[ 1 ]; y++ )
+				for ( x = mins[ 0 ]; x <= maxs[ 0 ]; x++ )
+					gridFlags[ GridPointNum( x, y, z ) ] |= GRID_LIGHT;
+	}
+}
+
+
+
+/*
+   QueueGridPoint()
+   adds a grid point to the next batch of traces, once per pass
+ */
+
+static void QueueGridPoint( int num ){
+	if ( gridFlags[ num ] & GRID_DONE ) {
+		return;
+	}
+	gridFlags[ num ] |= GRID_DONE;
+	gridQueue[ numGridQueue++ ] = num;
+}
+
+
+
+/*
+   TraceQueuedGridPoint()
+   thread callback for a queued grid point
+ */
+
+static void TraceQueuedGridPoint( int num ){
+	TraceGrid( gridQueue[ num ] );
+}
+
+
+
+/*
+   TraceGridQueue()
+   traces the queued grid points
+ */
+
+static void TraceGridQueue( void ){
+	int i;
+	const byte  *done;
+
+
+	/* leave out the points a checkpoint holds */
+	done = CheckpointedGridPoints();
+	if ( done != NULL ) {
+		for ( i = 0; i < numGridQueue; i++ )
+			gridQueueSkip[ i ] = done[ gridQueue[ i ] ];
+		ThreadSkipWork( gridQueueSkip );
+	}
+	RunThreadsOnIndividual( numGridQueue, qfalse, TraceQueuedGridPoint );
+	for ( i = 0; i < numGridQueue; i++ )
+		gridFlags[ gridQueue[ i ] ] |= GRID_TRACED;
+	numGridTraced += numGridQueue;
+	numGridQueue = 0;
+}
+
+
+
+/*
+   GridCellCorners()
+   gets the far corner of a cell, clipped to the grid, and its eight corner points
+ */
+
+static void GridCellCorners( const gridCell_t *cell, int maxs[ 3 ], int corners[ 8 ] ){
+	int i;
+
+
+	for ( i = 0; i < 3; i++ )
+	{
+		maxs[ i ] = cell->mins[ i ] + cell->size;
+		if ( maxs[ i ] > gridBounds[ i ] - 1 ) {
+			maxs[ i ] = gridBounds[ i ] - 1;
+		}
+	}
+	for ( i = 0; i < 8; i++ )
+	{
+		corners[ i ] = GridPointNum( ( i & 1 ) ? maxs[ 0 ] : cell->mins[ 0 ],
+									 ( i & 2 ) ? maxs[ 1 ] : cell->mins[ 1 ],
+									 ( i & 4 ) ? maxs[ 2 ] : cell->mins[ 2 ] );
+	}
+}
+
+
+
+/*
+   GridCellCount()
+   counts the points of a cell with a flag
+ */
+
+static int GridCellCount( const gridCell_t *cell, const int maxs[ 3 ], int flag ){
+	int x, y, z, count;
+
+
+	count = 0;
+	for ( z = cell->mins[ 2 ]; z <= maxs[ 2 ]; z++ )
+		for ( y = cell->mins[ 1 ]; y <= maxs[ 1 ]; y++ )
+			for ( x = cell->mins[ 0 ]; x <= maxs[ 0 ]; x++ )
+				count += ( gridFlags[ GridPointNum( x, y, z ) ] & flag ) != 0;
+	return count;
+}
+
+
+
+/*
+   GridCellLattice()
+   the grid points halfway across a cell, which its children have as corners
+ */
+
+static int GridCellLattice( const gridCell_t *cell, const int maxs[ 3 ], int lattice[ 27 ][ 3 ] ){
+	int i, x, y, z, n, p[ 3 ][ 3 ];
+
+
+	for ( i = 0; i < 3; i++ )
+	{
+		p[ i ][ 0 ] = cell->mins[ i ];
+		p[ i ][ 1 ] = ( cell->mins[ i ] + maxs[ i ] ) / 2;
+		p[ i ][ 2 ] = maxs[ i ];
+	}
+	n = 0;
+	for ( z = 0; z < 3; z++ )
+	{
+		for ( y = 0; y < 3; y++ )
+		{
+			for ( x = 0; x < 3; x++ )
+			{
+				lattice[ n ][ 0 ] = p[ 0 ][ x ];
+				lattice[ n ][ 1 ] = p[ 1 ][ y ];
+				lattice[ n ][ 2 ] = p[ 2 ][ z ];
+				n++;
+			}
+		}
+	}
+	return n;
+}
+
+
+
+/*
+   GridCellWeights()
+   trilinear weights of the corners of a cell at a grid point inside it
+ */
+
+static void GridCellWeights( const gridCell_t *cell, const int maxs[ 3 ], const int p[ 3 ], float weights[ 8 ] ){
+	int i;
+	float f[ 3 ];
+
+
+	for ( i = 0; i < 3; i++ )
+		f[ i ] = maxs[ i ] > cell->mins[ i ] ? (float) ( p[ i ] - cell->mins[ i ] ) / ( maxs[ i ] - cell->mins[ i ] ) : 0.0f;
+	for ( i = 0; i < 8; i++ )
+	{
+		weights[ i ] = ( ( i & 1 ) ? f[ 0 ] : 1.0f - f[ 0 ] ) *
+					   ( ( i & 2 ) ? f[ 1 ] : 1.0f - f[ 1 ] ) *
+					   ( ( i & 4 ) ? f[ 2 ] : 1.0f - f[ 2 ] );
+	}
+}
+
+
+
+/*
+   GridPointPredicted()
+   true if interpolating the corners of a cell predicts a traced point inside it closely enough
+ */
+
+static qboolean GridPointPredicted( const gridCell_t *cell, const int maxs[ 3 ], const int corners[ 8 ], const int p[ 3 ] ){
+	int i, j, k;
+	float weights[ 8 ], predicted, maxDirected;
+	rawGridPoint_t  *gp;
+	vec3_t dir, pointDir;
+
+
+	/* same styles everywhere */
+	gp = &rawGridPoints[ GridPointNum( p[ 0 ], p[ 1 ], p[ 2 ] ) ];
+	for ( i = 0; i < 8; i++ )
+	{
+		if ( memcmp( rawGridPoints[ corners[ i ] ].styles, gp->styles, sizeof( gp->styles ) ) ) {
+			return qfalse;
+		}
+	}
+
+	/* compare unclamped colors, scaled like the bytes they become */
+	GridCellWeights( cell, maxs, p, weights );
+	maxDirected = 0.0f;
+	for ( i = 0; i < MAX_LIGHTMAPS && gp->styles[ i ] != LS_NONE; i++ )
+	{
+		for ( j = 0; j < 3; j++ )
+		{
+			predicted = 0.0f;
+			for ( k = 0; k < 8; k++ )
+				predicted += weights[ k ] * rawGridPoints[ corners[ k ] ].ambient[ i ][ j ];
+			if ( fabs( predicted - gp->ambient[ i ][ j ] ) * gridScale * gridAmbientScale > adaptiveGridThreshold ) {
+				return qfalse;
+			}
+
+			predicted = 0.0f;
+			for ( k = 0; k < 8; k++ )
+				predicted += weights[ k ] * rawGridPoints[ corners[ k ] ].directed[ i ][ j ];
+			if ( fabs( predicted - gp->directed[ i ][ j ] ) * gridScale > adaptiveGridThreshold ) {
+				return qfalse;
+			}
+			if ( gp->directed[ i ][ j ] * gridScale > maxDirected ) {
+				maxDirected = gp->directed[ i ][ j ] * gridScale;
+			}
+		}
+	}
+
+	/* the direction only matters when there is directed light */
+	if ( maxDirected > adaptiveGridThreshold ) {
+		VectorClear( dir );
+		for ( k = 0; k < 8; k++ )
+			VectorMA( dir, weights[ k ], rawGridPoints[ corners[ k ] ].dir, dir );
+		VectorNormalize( dir, dir );
+		VectorNormalize( gp->dir, pointDir );
+		if ( DotProduct( dir, pointDir ) < ADAPTIVE_GRID_DOT ) {
+			return qfalse;
+		}
+	}
+
+	return qtrue;
+}
+
+
+
+/*
+   GridCellSmooth()
+   true if interpolating the corners of a cell predicts all of its traced lattice
+ */
+
+static qboolean GridCellSmooth( const gridCell_t *cell, const int maxs[ 3 ], const int corners[ 8 ] ){
+	int i, numLattice, lattice[ 27 ][ 3 ];
+
+
+	numLattice = GridCellLattice( cell, maxs, lattice );
+	for ( i = 0; i < numLattice; i++ )
+	{
+		if ( !GridPointPredicted( cell, maxs, corners, lattice[ i ] ) ) {
+			return qfalse;
+		}
+	}
+	return qtrue;
+}
+
+
+
+/*
+   InterpolateGridCell()
+   fills the untraced points of a cell from its corners
+ */
+
+static void InterpolateGridCell( const gridCell_t *cell, const int maxs[ 3 ], const int corners[ 8 ] ){
+	int i, j, x, y, z, num, p[ 3 ];
+	float weights[ 8 ];
+	rawGridPoint_t  *gp, *cgp;
+
+
+	for ( z = cell->mins[ 2 ]; z <= maxs[ 2 ]; z++ )
+	{
+		for ( y = cell->mins[ 1 ]; y <= maxs[ 1 ]; y++ )
+		{
+			for ( x = cell->mins[ 0 ]; x <= maxs[ 0 ]; x++ )
+			{
+				num = GridPointNum( x, y, z );
+				if ( gridFlags[ num ] & GRID_DONE ) {
+					continue;
+				}
+				gridFlags[ num ] |= GRID_DONE;
+				numGridInterpolated++;
+
+				/* blend the raw corners */
+				p[ 0 ] = x;
+				p[ 1 ] = y;
+				p[ 2 ] = z;
+				GridCellWeights( cell, maxs, p, weights );
+				gp = &rawGridPoints[ num ];
+				memset( gp->ambient, 0, sizeof( gp->ambient ) );
+				memset( gp->directed, 0, sizeof( gp->directed ) );
+				VectorClear( gp->dir );
+				for ( i = 0; i < 8; i++ )
+				{
+					cgp = &rawGridPoints[ corners[ i ] ];
+					for ( j = 0; j < MAX_LIGHTMAPS; j++ )
+					{
+						VectorMA( gp->ambient[ j ], weights[ i ], cgp->ambient[ j ], gp->ambient[ j ] );
+						VectorMA( gp->directed[ j ], weights[ i ], cgp->directed[ j ], gp->directed[ j ] );
+					}
+					VectorMA( gp->dir, weights[ i ], cgp->dir, gp->dir );
+				}
+				memcpy( gp->styles, rawGridPoints[ corners[ 0 ] ].styles, sizeof( gp->styles ) );
+				memcpy( bspGridPoints[ num ].styles, bspGridPoints[ corners[ 0 ] ].styles, sizeof( bspGridPoints[ num ].styles ) );
+				StoreGridPoint( gp, &bspGridPoints[ num ] );
+			}
+		}
+	}
+}
+
 
-			/* fallback */
-			else {
-				j = 0;
-			}
-		}
 
-		/* add the directed color */
-		VectorMA( gp->directed[ j ], d, contributions[ i ].color, gp->directed[ j ] );
+/*
+   AddGridCell()
+   appends a cell to a growable list
+ */
+
+static void AddGridCell( gridCell_t **cells, int *numCells, int *maxCells, int x, int y, int z, int size ){
+	if ( *numCells >= *maxCells ) {
+		*maxCells = *maxCells > 0 ? *maxCells * 2 : 1024;
+		*cells = realloc( *cells, *maxCells * sizeof( **cells ) );
+		if ( *cells == NULL ) {
+			Error( "AddGridCell: out of memory" );
+		}
+	}
+	( *cells )[ *numCells ].mins[ 0 ] = x;
+	( *cells )[ *numCells ].mins[ 1 ] = y;
+	( *cells )[ *numCells ].mins[ 2 ] = z;
+	( *cells )[ *numCells ].size = size;
+	( *numCells )++;
+}
 
-		/* ambient light will be at 1/4 the value of directed light */
-		/* (ydnar: nuke this in favor of more dramatic lighting?) */
-		/* (PM: how about actually making it work? d=1 when it got here for single lights/sun :P */
-//		d = 0.25f;
-		/* (Hobbes: always setting it to .25 is hardly any better) */
-		d = 0.25f * ( 1.0f - d );
-		VectorMA( gp->ambient[ j ], d, contributions[ i ].color, gp->ambient[ j ] );
 
-		VectorAdd( gp->ambient[ j ], contributions[ i ].ambient, gp->ambient[ j ] );
 
 /*
- * div0:
- * the total light average = ambient value + 0.25 * sum of all directional values
- * we can also get the total light average as 0.25 * the sum of all contributions
- *
- * 0.25 * sum(contribution_i) == ambient + 0.25 * sum(d_i contribution_i)
- *
- * THIS YIELDS:
- * ambient == 0.25 * sum((1 - d_i) contribution_i)
- *
- * So, 0.25f * (1.0f - d) IS RIGHT. If you want to tune it, tune d BEFORE.
+   TraceAdaptiveGrid()
+   traces the light grid coarse to fine, interpolating cells that need no more detail
  */
+
+static void TraceAdaptiveGrid( void ){
+	int i, x, y, z, size, numCells, maxCells, numNext, maxNext, numLattice, maxs[ 3 ], corners[ 8 ], lattice[ 27 ][ 3 ];
+	gridCell_t      *cells, *next, *swap, *cell;
+
+
+	/* another shard traces the whole adaptive grid */
+	if ( !ShardOwnsGridPoint( 0 ) ) {
+		return;
 	}
 
+	/* classify on the first pass */
+	if ( gridFlags == NULL ) {
+		ClassifyGrid();
+	}
+	MarkGridLights();
+	numGridTraced = 0;
+	numGridInterpolated = 0;
+	numGridQueue = 0;
+	for ( i = 0; i < numRawGridPoints; i++ )
+		gridFlags[ i ] &= ~GRID_DONE;
 
-	/* store off sample */
-	for ( i = 0; i < MAX_LIGHTMAPS; i++ )
+	/* anything traced before is traced again */
+	for ( i = 0; i < numRawGridPoints; i++ )
 	{
-#if 0
-		/* do some fudging to keep the ambient from being too low (2003-07-05: 0.25 -> 0.125) */
-		if ( !bouncing ) {
-			VectorMA( gp->ambient[ i ], 0.125f, gp->directed[ i ], gp->ambient[ i ] );
+		if ( gridFlags[ i ] & GRID_TRACED ) {
+			QueueGridPoint( i );
 		}
-#endif
+	}
 
-		/* set minimum light and copy off to bytes */
-		VectorCopy( gp->ambient[ i ], color );
-		for ( j = 0; j < 3; j++ )
-			if ( color[ j ] < minGridLight[ j ] ) {
-				color[ j ] = minGridLight[ j ];
+	/* coarse cells */
+	cells = next = NULL;
+	numCells = maxCells = numNext = maxNext = 0;
+	size = adaptiveGridStep;
+	for ( z = 0; z == 0 || z < gridBounds[ 2 ] - 1; z += size )
+		for ( y = 0; y == 0 || y < gridBounds[ 1 ] - 1; y += size )
+			for ( x = 0; x == 0 || x < gridBounds[ 0 ] - 1; x += size )
+				AddGridCell( &cells, &numCells, &maxCells, x, y, z, size );
+
+	/* refine level by level */
+	while ( numCells > 0 )
+	{
+		/* trace the corners */
+		for ( i = 0, cell = cells; i < numCells; i++, cell++ )
+		{
+			GridCellCorners( cell, maxs, corners );
+			for ( x = 0; x < 8; x++ )
+				QueueGridPoint( corners[ x ] );
+		}
+		TraceGridQueue();
+
+		/* trace the lattices that decide whether open cells are split */
+		for ( i = 0, cell = cells; i < numCells; i++, cell++ )
+		{
+			if ( cell->size <= 1 ) {
+				continue;
+			}
+			GridCellCorners( cell, maxs, corners );
+			for ( x = 0; x < 8 && !( gridFlags[ corners[ x ] ] & GRID_SOLID ); x++ ) ;
+			if ( x == 8 && GridCellCount( cell, maxs, GRID_LIGHT ) == 0 ) {
+				numLattice = GridCellLattice( cell, maxs, lattice );
+				for ( x = 0; x < numLattice; x++ )
+					QueueGridPoint( GridPointNum( lattice[ x ][ 0 ], lattice[ x ][ 1 ], lattice[ x ][ 2 ] ) );
 			}
+		}
+		TraceGridQueue();
 
-		/* vortex: apply gridscale and gridambientscale here */
-		ColorToBytes( color, bgp->ambient[ i ], gridScale * gridAmbientScale );
-		ColorToBytes( gp->directed[ i ], bgp->directed[ i ], gridScale );
-	}
+		/* split the cells that need it */
+		numNext = 0;
+		for ( i = 0, cell = cells; i < numCells; i++, cell++ )
+		{
+			if ( cell->size <= 1 ) {
+				continue;
+			}
+			GridCellCorners( cell, maxs, corners );
+			for ( x = 0; x < 8 && !( gridFlags[ corners[ x ] ] & GRID_SOLID ); x++ ) ;
+			if ( x == 8 ) {
+				if ( GridCellCount( cell, maxs, GRID_LIGHT ) == 0 && GridCellSmooth( cell, maxs, corners ) ) {
+					InterpolateGridCell( cell, maxs, corners );
+					continue;
+				}
+			}
+			else if ( GridCellCount( cell, maxs, GRID_SOLID ) == ( maxs[ 0 ] - cell->mins[ 0 ] + 1 ) * ( maxs[ 1 ] - cell->mins[ 1 ] + 1 ) * ( maxs[ 2 ] - cell->mins[ 2 ] + 1 ) ) {
+				continue;
+			}
+			size = cell->size / 2;
+			for ( z = 0; z < 2; z++ )
+			{
+				if ( z && cell->mins[ 2 ] + size >= maxs[ 2 ] ) {
+					continue;
+				}
+				for ( y = 0; y < 2; y++ )
+				{
+					if ( y && cell->mins[ 1 ] + size >= maxs[ 1 ] ) {
+						continue;
+					}
+					for ( x = 0; x < 2; x++ )
+					{
+						if ( x && cell->mins[ 0 ] + size >= maxs[ 0 ] ) {
+							continue;
+						}
+						AddGridCell( &next, &numNext, &maxNext, cell->mins[ 0 ] + x * size, cell->mins[ 1 ] + y * size, cell->mins[ 2 ] + z * size, size );
+					}
+				}
+			}
+		}
 
-	/* debug code */
-	#if 0
-	//%	Sys_FPrintf( SYS_VRB, "%10d %10d %10d ", &gp->ambient[ 0 ][ 0 ], &gp->ambient[ 0 ][ 1 ], &gp->ambient[ 0 ][ 2 ] );
-	Sys_FPrintf( SYS_VRB, "%9d Amb: (%03.1f %03.1f %03.1f) Dir: (%03.1f %03.1f %03.1f)\n",
-	             num,
-	             gp->ambient[ 0 ][ 0 ], gp->ambient[ 0 ][ 1 ], gp->ambient[ 0 ][ 2 ],
-	             gp->directed[ 0 ][ 0 ], gp->directed[ 0 ][ 1 ], gp->directed[ 0 ][ 2 ] );
-	#endif
+		/* next level */
+		swap = cells;
+		cells = next;
+		next = swap;
+		i = maxCells;
+		maxCells = maxNext;
+		maxNext = i;
+		numCells = numNext;
+	}
+	free( cells );
+	free( next );
 
-	/* store direction */
-	NormalToLatLong( thisdir, bgp->latLong );
+	/* emit some statistics */
+	Sys_Printf( "%9d grid points traced, %d interpolated (%.1f%% traced)\n",
+				numGridTraced, numGridInterpolated, numRawGridPoints > 0 ? 100.0f * numGridTraced / numRawGridPoints : 0.0f );
 }
 
 
@@ -2173,6 +2840,14 @@ void SetupGrid( void ){
 		Sys_FPrintf( SYS_VRB, "Storing adjusted grid size\n" );
 	}
 
+	/* the adaptive grid classifies again */
+	free( gridFlags );
+	gridFlags = NULL;
+	free( gridQueue );
+	gridQueue = NULL;
+	free( gridQueueSkip );
+	gridQueueSkip = NULL;
+
 	/* 2nd variable. fixme: is this silly? */
 	numBSPGridPoints = numRawGridPoints;
 
@@ -2205,15 +2880,116 @@ void SetupGrid( void ){
 
 
 
+/*
+   StreamRawLightmap()
+   maps, dirties, floodlights, illuminates and subsamples a single raw lightmap,
+   then frees its supersampled buffers so only the bsp luxels stay resident
+ */
+
+static void StreamRawLightmap( int rawLightmapNum ){
+	int lightmapNum, size;
+	rawLightmap_t       *lm;
+
+
+	/* bail if this number exceeds the number of raw lightmaps or another shard lights it */
+	if ( rawLightmapNum >= numRawLightmaps || !ShardOwnsRawLightmap( rawLightmapNum ) ) {
+		return;
+	}
+
+	/* get lightmap */
+	lm = &rawLightmaps[ rawLightmapNum ];
+
+	/* allocate the sampling buffers, plus every style an earlier pass lit */
+	AllocRawLightmapSamples( lm );
+	size = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
+	for ( lightmapNum = 1; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( lm->bspLuxels[ lightmapNum ] != NULL && lm->superLuxels[ lightmapNum ] == NULL ) {
+			lm->superLuxels[ lightmapNum ] = safe_malloc( size );
+			memset( lm->superLuxels[ lightmapNum ], 0, size );
+		}
+	}
+
+	/* run the chain */
+	MapRawLightmap( rawLightmapNum );
+	if ( dirty ) {
+		DirtyRawLightmap( rawLightmapNum );
+	}
+	if ( !bouncing ) {
+		FloodLightRawLightmap( rawLightmapNum );
+	}
+	IlluminateRawLightmap( rawLightmapNum );
+
+	/* keep the bsp luxels */
+	SubsampleRawLightmap( lm );
+	FreeRawLightmapSamples( lm );
+	CheckpointRawLightmap( rawLightmapNum );
+}
+
+
+
+/*
+   StreamRawLightmaps()
+   lights the raw lightmaps one at a time instead of stage by stage
+ */
+
+static void StreamRawLightmaps( void ){
+	/* note it */
+	Sys_Printf( "--- StreamRawLightmap ---\n" );
+	numSurfacesFloodlighten = 0;
+
+	ProfileBegin( "StreamRawLightmap" );
+	BeginLightCheckpointStage();
+	ThreadSkipWork( CheckpointedRawLightmaps() );
+	RunThreadsOnIndividualCost( numRawLightmaps, qtrue, StreamRawLightmap, RawLightmapCost );
+	EndLightCheckpointStage();
+	ProfileEnd();
+
+	/* emit some stats, mapping is redone on every bounce so only count the first pass */
+	if ( !bouncing ) {
+		Sys_Printf( "%9d luxels\n", numLuxels );
+		Sys_Printf( "%9d luxels mapped\n", numLuxelsMapped );
+		Sys_Printf( "%9d luxels occluded\n", numLuxelsOccluded );
+		Sys_Printf( "%9d custom lightmaps floodlighted\n", numSurfacesFloodlighten );
+	}
+	Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
+	AdaptiveSampleStats();
+	LightTreeStats();
+}
+
+
+
+/*
+   TraceGridPoints()
+   traces the light grid, leaving out the points a checkpoint holds
+ */
+
+static void TraceGridPoints( void ){
+	inGrid = qtrue;
+	BeginLightCheckpointStage();
+	if ( adaptiveGrid ) {
+		TraceAdaptiveGrid();
+	}
+	else{
+		ThreadSkipWork( CheckpointedGridPoints() );
+		RunThreadsOnIndividual( numRawGridPoints, qtrue, TraceGrid );
+	}
+	EndLightCheckpointStage();
+	inGrid = qfalse;
+}
+
+
+
 /*
    LightWorld()
    does what it says...
+   returns qfalse when a light shard or an unfinished merge leaves the bsp alone
  */
 
-void LightWorld( const char *BSPFilePath, qboolean fastAllocate ){
+qboolean LightWorld( const char *BSPFilePath, qboolean fastAllocate ){
 	vec3_t color;
 	float f;
-	int b, bt;
+	int b, bt, firstPass;
 	qboolean minVertex, minGrid;
 	const char  *value;
 
@@ -2221,12 +2997,25 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate ){
 	/* ydnar: smooth normals */
 	if ( shade ) {
 		Sys_Printf( "--- SmoothNormals ---\n" );
+		ProfileBegin( "SmoothNormals" );
 		SmoothNormals();
+		ProfileEnd();
 	}
 
 	/* determine the number of grid points */
 	Sys_Printf( "--- SetupGrid ---\n" );
+	ProfileBegin( "SetupGrid" );
 	SetupGrid();
+	ProfileEnd();
+
+	/* light shards did the lighting */
+	if ( lightShardMerge ) {
+		return MergeLightShards( fastAllocate );
+	}
+
+	/* shards past the direct light and resumed compiles skip the passes done before */
+	SetupLightCheckpoint( BSPFilePath );
+	firstPass = lightShard >= 0 ? lightShardPass : ResumeLightCheckpoint();
 
 	/* find the optional minimum lighting values */
 	GetVectorForKey( &entities[ 0 ], "_color", color );
@@ -2295,51 +3084,75 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate ){
 
 	/* create world lights */
 	Sys_FPrintf( SYS_VRB, "--- CreateLights ---\n" );
+	ProfileBegin( "CreateLights" );
 	CreateEntityLights();
 	CreateSurfaceLights();
+	ProfileAddWork( numPointLights + numSpotLights + numDiffuseLights + numSunLights );
+	ProfileEnd();
 	Sys_Printf( "%9d point lights\n", numPointLights );
 	Sys_Printf( "%9d spotlights\n", numSpotLights );
 	Sys_Printf( "%9d diffuse (area) lights\n", numDiffuseLights );
 	Sys_Printf( "%9d sun/sky lights\n", numSunLights );
 
-	/* calculate lightgrid */
-	if ( !noGridLighting ) {
+	/* snapshot the direct light, or load what it lit before */
+	if ( firstPass == 0 ) {
+		StartLightCheckpointPass( 0 );
+	}
+
+	/* calculate lightgrid, shards past the direct pass read it back */
+	if ( !noGridLighting && firstPass == 0 ) {
 		/* ydnar: set up light envelopes */
 		SetupEnvelopes( qtrue, fastgrid );
+		ProfileBegin( "SetupClusterLights" );
+		SetupClusterLights( qtrue );
+		ProfileEnd();
 
 		Sys_Printf( "--- TraceGrid ---\n" );
-		inGrid = qtrue;
-		RunThreadsOnIndividual( numRawGridPoints, qtrue, TraceGrid );
-		inGrid = qfalse;
+		ProfileBegin( "TraceGrid" );
+		TraceGridPoints();
+		ProfileEnd();
 		Sys_Printf( "%d x %d x %d = %d grid\n",
 		            gridBounds[ 0 ], gridBounds[ 1 ], gridBounds[ 2 ], numBSPGridPoints );
 
 		/* ydnar: emit statistics on light culling */
 		Sys_FPrintf( SYS_VRB, "%9d grid points envelope culled\n", gridEnvelopeCulled );
 		Sys_FPrintf( SYS_VRB, "%9d grid points bounds culled\n", gridBoundsCulled );
+		ShadowCacheStats();
 	}
 
 	/* slight optimization to remove a sqrt */
 	subdivideThreshold *= subdivideThreshold;
 
-	/* map the world luxels */
-	Sys_Printf( "--- MapRawLightmap ---\n" );
-	RunThreadsOnIndividual( numRawLightmaps, qtrue, MapRawLightmap );
-	Sys_Printf( "%9d luxels\n", numLuxels );
-	Sys_Printf( "%9d luxels mapped\n", numLuxelsMapped );
-	Sys_Printf( "%9d luxels occluded\n", numLuxelsOccluded );
-
-	/* dirty them up */
-	if ( dirty ) {
-		Sys_Printf( "--- DirtyRawLightmap ---\n" );
-		RunThreadsOnIndividual( numRawLightmaps, qtrue, DirtyRawLightmap );
+	/* map the world luxels, streamed lightmaps run these stages as they are lit */
+	if ( !streamLightmaps ) {
+		Sys_Printf( "--- MapRawLightmap ---\n" );
+		ProfileBegin( "MapRawLightmap" );
+		RunThreadsOnIndividualCost( numRawLightmaps, qtrue, MapRawLightmap, RawLightmapCost );
+		ProfileEnd();
+		Sys_Printf( "%9d luxels\n", numLuxels );
+		Sys_Printf( "%9d luxels mapped\n", numLuxelsMapped );
+		Sys_Printf( "%9d luxels occluded\n", numLuxelsOccluded );
+
+		/* dirty them up */
+		if ( dirty ) {
+			Sys_Printf( "--- DirtyRawLightmap ---\n" );
+			ProfileBegin( "DirtyRawLightmap" );
+			RunThreadsOnIndividualCost( numRawLightmaps, qtrue, DirtyRawLightmap, RawLightmapCost );
+			ProfileEnd();
+		}
+
+		/* floodlight pass */
+		FloodlightRawLightmaps();
 	}
 
-	/* floodlight pass */
-	FloodlightRawLightmaps();
-
 	/* ydnar: set up light envelopes */
 	SetupEnvelopes( qfalse, fast );
+	ProfileBegin( "SetupClusterLights" );
+	SetupClusterLights( qfalse );
+	ProfileEnd();
+	ProfileBegin( "SetupLightTree" );
+	SetupLightTree();
+	ProfileEnd();
 
 	/* light up my world */
 	lightsPlaneCulled = 0;
@@ -2347,15 +3160,31 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate ){
 	lightsBoundsCulled = 0;
 	lightsClusterCulled = 0;
 
-	Sys_Printf( "--- IlluminateRawLightmap ---\n" );
-	RunThreadsOnIndividual( numRawLightmaps, qtrue, IlluminateRawLightmap );
-	Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
+	if ( streamLightmaps ) {
+		if ( firstPass == 0 ) {
+			StreamRawLightmaps();
+		}
+	}
+	else
+	{
+		Sys_Printf( "--- IlluminateRawLightmap ---\n" );
+		ProfileBegin( "IlluminateRawLightmap" );
+		RunThreadsOnIndividualCost( numRawLightmaps, qtrue, IlluminateRawLightmap, RawLightmapCost );
+		ProfileEnd();
+		Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
+		AdaptiveSampleStats();
+		LightTreeStats();
+	}
 
+	ProfileBegin( "StitchSurfaceLightmaps" );
 	StitchSurfaceLightmaps();
+	ProfileEnd();
 
 #ifdef VERTEXLIGHT
 	Sys_Printf( "--- IlluminateVertexes ---\n" );
-	RunThreadsOnIndividual( numBSPDrawSurfaces, qtrue, IlluminateVertexes );
+	ProfileBegin( "IlluminateVertexes" );
+	RunThreadsOnIndividualCost( numBSPDrawSurfaces, qtrue, IlluminateVertexes, DrawSurfaceCost );
+	ProfileEnd();
 	Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
 #endif
 
@@ -2364,17 +3193,39 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate ){
 	Sys_FPrintf( SYS_VRB, "%9d lights envelope culled\n", lightsEnvelopeCulled );
 	Sys_FPrintf( SYS_VRB, "%9d lights bounds culled\n", lightsBoundsCulled );
 	Sys_FPrintf( SYS_VRB, "%9d lights cluster culled\n", lightsClusterCulled );
+	ShadowCacheStats();
 
 	/* radiosity */
 	b = 1;
 	bt = bounce;
+
+	/* light shards save the direct light for the merge */
+	if ( lightShard >= 0 && firstPass == 0 ) {
+		WriteLightShard( qfalse );
+		return qfalse;
+	}
+
+	/* pick up a later bounce where it left off */
+	if ( firstPass > 0 ) {
+		if ( lightShard >= 0 ) {
+			ReadLightState();
+		}
+		b = firstPass;
+		bounce -= firstPass - 1;
+	}
+
 	while ( bounce > 0 )
 	{
-		/* store off the bsp between bounces */
+		/* store off the lightmaps between bounces; radiosity reads them back from memory,
+		   so the bsp only needs to hit the disk once at the end unless checkpointing */
+		ProfileBegin( "StoreSurfaceLightmaps" );
 		StoreSurfaceLightmaps( fastAllocate );
-		UnparseEntities();
-		Sys_Printf( "Writing %s\n", BSPFilePath );
-		WriteBSPFile( BSPFilePath );
+		ProfileEnd();
+		if ( bounceCheckpoint ) {
+			UnparseEntities();
+			Sys_Printf( "Writing %s\n", BSPFilePath );
+			WriteBSPFile( BSPFilePath );
+		}
 
 		/* note it */
 		Sys_Printf( "\n--- Radiosity (bounce %d of %d) ---\n", b, bt );
@@ -2385,45 +3236,79 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate ){
 		floodlighty = qfalse;
 
 		/* generate diffuse lights */
+		ProfileBegin( "RadCreateDiffuseLights" );
 		RadFreeLights();
 		RadCreateDiffuseLights();
+		ProfileEnd();
 
 		/* setup light envelopes */
 		SetupEnvelopes( qfalse, fastbounce );
 		if ( numLights == 0 ) {
 			Sys_Printf( "No diffuse light to calculate, ending radiosity.\n" );
-			return;
+			if ( lightShard >= 0 ) {
+				WriteLightShard( qtrue );
+				return qfalse;
+			}
+			return qtrue;
 		}
 
+		/* snapshot the light this bounce starts from, or load what it lit before */
+		StartLightCheckpointPass( b );
+
 		/* add to lightgrid */
 		if ( bouncegrid ) {
 			gridEnvelopeCulled = 0;
 			gridBoundsCulled = 0;
 
+			ProfileBegin( "SetupClusterLights" );
+			SetupClusterLights( qtrue );
+			ProfileEnd();
+
 			Sys_Printf( "--- BounceGrid ---\n" );
-			inGrid = qtrue;
-			RunThreadsOnIndividual( numRawGridPoints, qtrue, TraceGrid );
-			inGrid = qfalse;
+			ProfileBegin( "BounceGrid" );
+			TraceGridPoints();
+			ProfileEnd();
 			Sys_FPrintf( SYS_VRB, "%9d grid points envelope culled\n", gridEnvelopeCulled );
 			Sys_FPrintf( SYS_VRB, "%9d grid points bounds culled\n", gridBoundsCulled );
+			ShadowCacheStats();
 		}
 
 		/* light up my world */
+		ProfileBegin( "SetupClusterLights" );
+		SetupClusterLights( qfalse );
+		ProfileEnd();
+		ProfileBegin( "SetupLightTree" );
+		SetupLightTree();
+		ProfileEnd();
 		lightsPlaneCulled = 0;
 		lightsEnvelopeCulled = 0;
 		lightsBoundsCulled = 0;
 		lightsClusterCulled = 0;
 
-		Sys_Printf( "--- IlluminateRawLightmap ---\n" );
-		RunThreadsOnIndividual( numRawLightmaps, qtrue, IlluminateRawLightmap );
-		Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
+		if ( streamLightmaps ) {
+			StreamRawLightmaps();
+		}
+		else
+		{
+			Sys_Printf( "--- IlluminateRawLightmap ---\n" );
+			ProfileBegin( "IlluminateRawLightmap" );
+			RunThreadsOnIndividualCost( numRawLightmaps, qtrue, IlluminateRawLightmap, RawLightmapCost );
+			ProfileEnd();
+			Sys_Printf( "%9d luxels illuminated\n", numLuxelsIlluminated );
+			AdaptiveSampleStats();
+			LightTreeStats();
+		}
 		Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
 
+		ProfileBegin( "StitchSurfaceLightmaps" );
 		StitchSurfaceLightmaps();
+		ProfileEnd();
 
 #ifdef VERTEXLIGHT
 		Sys_Printf( "--- IlluminateVertexes ---\n" );
-		RunThreadsOnIndividual( numBSPDrawSurfaces, qtrue, IlluminateVertexes );
+		ProfileBegin( "IlluminateVertexes" );
+		RunThreadsOnIndividualCost( numBSPDrawSurfaces, qtrue, IlluminateVertexes, DrawSurfaceCost );
+		ProfileEnd();
 		Sys_Printf( "%9d vertexes illuminated\n", numVertsIlluminated );
 #endif
 
@@ -2432,13 +3317,23 @@ void LightWorld( const char *BSPFilePath, qboolean fastAllocate ){
 		Sys_FPrintf( SYS_VRB, "%9d lights envelope culled\n", lightsEnvelopeCulled );
 		Sys_FPrintf( SYS_VRB, "%9d lights bounds culled\n", lightsBoundsCulled );
 		Sys_FPrintf( SYS_VRB, "%9d lights cluster culled\n", lightsClusterCulled );
+		ShadowCacheStats();
+
+		/* a shard lights one bounce */
+		if ( lightShard >= 0 ) {
+			WriteLightShard( qfalse );
+			return qfalse;
+		}
 
 		/* interate */
 		bounce--;
 		b++;
 	}
 	/* ydnar: store off lightmaps */
+	ProfileBegin( "StoreSurfaceLightmaps" );
 	StoreSurfaceLightmaps( fastAllocate );
+	ProfileEnd();
+	return qtrue;
 }
 
 
@@ -2739,6 +3634,53 @@ int LightMain( int argc, char **argv ){
 			i++;
 		}
 
+		else if ( !strcmp( argv[ i ], "-bouncecheckpoint" ) ) {
+			bounceCheckpoint = qtrue;
+			Sys_Printf( "Writing BSP after every radiosity bounce\n" );
+		}
+
+		else if ( !strcmp( argv[ i ], "-streamlightmaps" ) ) {
+			streamLightmaps = qtrue;
+			Sys_Printf( "Streaming raw lightmaps to reduce peak memory\n" );
+		}
+
+		else if ( !strcmp( argv[ i ], "-shard" ) ) {
+			if ( sscanf( argv[ i + 1 ], "%d/%d", &lightShard, &numLightShards ) != 2 ||
+				 numLightShards < 1 || lightShard < 0 || lightShard >= numLightShards ) {
+				Error( "-shard takes i/N with 0 <= i < N, not %s", argv[ i + 1 ] );
+			}
+			Sys_Printf( "Lighting shard %d of %d\n", lightShard, numLightShards );
+			i++;
+		}
+
+		else if ( !strcmp( argv[ i ], "-shardpass" ) ) {
+			lightShardPass = atoi( argv[ i + 1 ] );
+			if ( lightShardPass < 0 ) {
+				lightShardPass = 0;
+			}
+			Sys_Printf( "Light shard pass set to %d\n", lightShardPass );
+			i++;
+		}
+
+		else if ( !strcmp( argv[ i ], "-merge" ) ) {
+			lightShardMerge = qtrue;
+			Sys_Printf( "Merging light shards\n" );
+		}
+
+		else if ( !strcmp( argv[ i ], "-checkpoint" ) ) {
+			lightCheckpoint = atoi( argv[ i + 1 ] );
+			if ( lightCheckpoint < 1 ) {
+				lightCheckpoint = 1;
+			}
+			Sys_Printf( "Checkpointing the light every %d seconds\n", lightCheckpoint );
+			i++;
+		}
+
+		else if ( !strcmp( argv[ i ], "-resume" ) ) {
+			lightResume = qtrue;
+			Sys_Printf( "Resuming from the light checkpoint\n" );
+		}
+
 		else if ( !strcmp( argv[ i ], "-supersample" ) || !strcmp( argv[ i ], "-super" ) ) {
 			superSample = atoi( argv[ i + 1 ] );
 			if ( superSample < 1 ) {
@@ -2755,6 +3697,44 @@ int LightMain( int argc, char **argv ){
 			Sys_Printf( "Random sampling enabled\n", lightRandomSamples );
 		}
 
+		else if ( !strcmp( argv[ i ], "-lighttree" ) ) {
+			lightTree = qtrue;
+			Sys_Printf( "Clustering area and bounce lights into a light tree\n" );
+		}
+
+		else if ( !strcmp( argv[ i ], "-lighttreeerror" ) ) {
+			lightTreeError = atof( argv[ i + 1 ] );
+			if ( lightTreeError < 0.0f ) {
+				lightTreeError = 0.0f;
+			}
+			Sys_Printf( "Light cuts keep nodes bounded by %f of the estimated total\n", lightTreeError );
+			i++;
+		}
+
+		else if ( !strcmp( argv[ i ], "-adaptivesamples" ) ) {
+			lightAdaptiveSamples = qtrue;
+			lightRandomSamples = qtrue;
+			Sys_Printf( "Variance driven adaptive sampling enabled\n" );
+		}
+
+		else if ( !strcmp( argv[ i ], "-adaptivethreshold" ) ) {
+			adaptiveThreshold = atof( argv[ i + 1 ] );
+			if ( adaptiveThreshold < 0.0f ) {
+				adaptiveThreshold = 0.0f;
+			}
+			Sys_Printf( "Adaptive sampling stops at a standard error of %f\n", adaptiveThreshold );
+			i++;
+		}
+
+		else if ( !strcmp( argv[ i ], "-raybudget" ) ) {
+			adaptiveRayBudget = atof( argv[ i + 1 ] );
+			if ( adaptiveRayBudget < 0.0f ) {
+				adaptiveRayBudget = 0.0f;
+			}
+			Sys_Printf( "Adaptive sampling may spend %.0f%% of the uniform ray count\n", adaptiveRayBudget * 100.0f );
+			i++;
+		}
+
 		else if ( !strcmp( argv[ i ], "-samples" ) ) {
 			if ( *argv[i + 1] == '+' ) {
 				lightSamplesInsist = qtrue;
@@ -2990,6 +3970,11 @@ int LightMain( int argc, char **argv ){
 			Sys_Printf( "Fast allocation mode enabled\n" );
 		}
 
+		else if ( !strcmp( argv[ i ], "-skylineallocate" ) ) {
+			skylineAllocate = qtrue;
+			Sys_Printf( "Skyline lightmap allocation enabled\n" );
+		}
+
 		else if ( !strcmp( argv[ i ], "-cheap" ) ) {
 			cheap = qtrue;
 			cheapgrid = qtrue;
@@ -3001,6 +3986,31 @@ int LightMain( int argc, char **argv ){
 			Sys_Printf( "Cheap grid mode enabled\n" );
 		}
 
+		else if ( !strcmp( argv[ i ], "-adaptivegrid" ) ) {
+			adaptiveGrid = qtrue;
+			Sys_Printf( "Adaptive grid mode enabled\n" );
+		}
+
+		else if ( !strcmp( argv[ i ], "-adaptivegridstep" ) ) {
+			adaptiveGridStep = atoi( argv[ i + 1 ] );
+			if ( adaptiveGridStep < 1 ) {
+				adaptiveGridStep = 1;
+			}
+			while ( adaptiveGridStep & ( adaptiveGridStep - 1 ) )
+				adaptiveGridStep++;
+			Sys_Printf( "Adaptive grid traces every %d grid points first\n", adaptiveGridStep );
+			i++;
+		}
+
+		else if ( !strcmp( argv[ i ], "-adaptivegridthreshold" ) ) {
+			adaptiveGridThreshold = atof( argv[ i + 1 ] );
+			if ( adaptiveGridThreshold < 0.0f ) {
+				adaptiveGridThreshold = 0.0f;
+			}
+			Sys_Printf( "Adaptive grid interpolates cells within %f\n", adaptiveGridThreshold );
+			i++;
+		}
+
 		else if ( !strcmp( argv[ i ], "-normalmap" ) ) {
 			normalmap = qtrue;
 			Sys_Printf( "Storing normal map instead of lightmap\n" );
@@ -3103,6 +4113,30 @@ int LightMain( int argc, char **argv ){
 			noSurfaces = qtrue;
 			Sys_Printf( "Not tracing against surfaces\n" );
 		}
+		else if ( !strcmp( argv[ i ], "-nopackettrace" ) ) {
+			noPacketTrace = qtrue;
+			Sys_Printf( "Tracing one ray at a time\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-shadowcache" ) ) {
+			useShadowCache = qtrue;
+			Sys_Printf( "Testing the last occluders of a light before tracing neighbouring luxels\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-noshadowcache" ) ) {
+			useShadowCache = qfalse;
+			Sys_Printf( "Tracing every shadow ray from scratch\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-noclusterlights" ) ) {
+			noClusterLights = qtrue;
+			Sys_Printf( "Testing the pvs of every light per surface\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-bvh" ) ) {
+			traceBVH = qtrue;
+			Sys_Printf( "Tracing against a surface area heuristic bvh\n" );
+		}
+		else if ( !strcmp( argv[ i ], "-tracebenchmark" ) ) {
+			traceBenchmark = qtrue;
+			Sys_Printf( "Benchmarking ray throughput before lighting\n" );
+		}
 		else if ( !strcmp( argv[ i ], "-dump" ) ) {
 			dump = qtrue;
 			Sys_Printf( "Dumping radiosity lights into numbered prefabs\n" );
@@ -3267,6 +4301,39 @@ int LightMain( int argc, char **argv ){
 		}
 	}
 
+	/* light shards stream their lightmaps so the merge gets bsp luxels, and leave the bsp to it */
+	if ( lightShard >= 0 || lightShardMerge ) {
+		if ( lightShard >= 0 && lightShardMerge ) {
+			Error( "-shard and -merge are separate runs" );
+		}
+		if ( lightShardPass > bounce ) {
+			Error( "-shardpass %d is past the last bounce (%d)", lightShardPass, bounce );
+		}
+		streamLightmaps = qtrue;
+		bounceCheckpoint = qfalse;
+	}
+	else if ( lightShardPass > 0 ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: -shardpass without -shard, ignoring it\n" );
+		lightShardPass = 0;
+	}
+
+	/* checkpoints hold bsp luxels too, and a resumed compile keeps checkpointing */
+	if ( lightResume && lightCheckpoint <= 0 ) {
+		lightCheckpoint = 300;
+	}
+	if ( lightCheckpoint > 0 ) {
+		if ( lightShard >= 0 || lightShardMerge ) {
+			Error( "-checkpoint and -resume can't be used with light shards" );
+		}
+		streamLightmaps = qtrue;
+	}
+
+	/* a cached occluder doesn't always give the hit of the full trace, keep it out of runs that must match a plain one */
+	if ( useShadowCache && ( lightShard >= 0 || lightShardMerge || lightCheckpoint > 0 || traceBenchmark ) ) {
+		Sys_Printf( "Shadow cache disabled for light shards, checkpoints and -tracebenchmark\n" );
+		useShadowCache = qfalse;
+	}
+
 	/* fix up lightmap search power */
 	if ( lightmapMergeSize ) {
 		lightmapSearchBlockSize = ( lightmapMergeSize / lmCustomSize ) * ( lightmapMergeSize / lmCustomSize );
@@ -3307,7 +4374,9 @@ int LightMain( int argc, char **argv ){
 	LoadSurfaceExtraFile( surfaceFilePath );
 
 	/* load bsp file */
+	ProfileBegin( "LoadBSPFile" );
 	LoadBSPFile( BSPFilePath );
+	ProfileEnd();
 
 	/* parse bsp entities */
 	ParseEntities();
@@ -3328,18 +4397,29 @@ int LightMain( int argc, char **argv ){
 	SetupBrushes();
 	SetupDirt();
 	SetupFloodLight();
+	ProfileBegin( "SetupSurfaceLightmaps" );
 	SetupSurfaceLightmaps();
+	ProfileAddWork( numRawLightmaps );
+	ProfileEnd();
+	SetupLightShards( BSPFilePath );
 
 	/* initialize the surface facet tracing */
+	ProfileBegin( "SetupTraceNodes" );
 	SetupTraceNodes();
+	ProfileEnd();
 
 	/* light the world */
-	LightWorld( BSPFilePath, fastAllocate );
+	if ( !LightWorld( BSPFilePath, fastAllocate ) ) {
+		return 0;
+	}
 
 	/* write out the bsp */
 	UnparseEntities();
 	Sys_Printf( "Writing %s\n", BSPFilePath );
+	ProfileBegin( "WriteBSPFile" );
 	WriteBSPFile( BSPFilePath );
+	ProfileEnd();
+	RemoveLightCheckpoint();
 
 	/* ydnar: export lightmaps */
 	if ( exportLightmaps && !externalLightmaps ) {
@@ -38,6 +38,12 @@
 
 
 
+/* lights RadLight made per surface, RadCreateDiffuseLights links them up in surface order so
+   the light list is the same however the threads took the surfaces */
+static light_t **surfaceDiffuseLights;
+
+
+
 /* functions */
 
 /*
@@ -537,10 +543,8 @@ static void RadSubdivideDiffuseLight( int lightmapNum, bspDrawSurface_t *ds, raw
 	memset( light, 0, sizeof( *light ) );
 
 	/* attach it */
-	ThreadLock();
-	light->next = lights;
-	lights = light;
-	ThreadUnlock();
+	light->next = surfaceDiffuseLights[ ds - bspDrawSurfaces ];
+	surfaceDiffuseLights[ ds - bspDrawSurfaces ] = light;
 
 	/* initialize the light */
 	light->flags = LIGHT_AREA_DEFAULT;
@@ -583,8 +587,8 @@ static void RadSubdivideDiffuseLight( int lightmapNum, bspDrawSurface_t *ds, raw
 			/* allocate a new point light */
 			splash = safe_malloc( sizeof( *splash ) );
 			memset( splash, 0, sizeof( *splash ) );
-			splash->next = lights;
-			lights = splash;
+			splash->next = surfaceDiffuseLights[ ds - bspDrawSurfaces ];
+			surfaceDiffuseLights[ ds - bspDrawSurfaces ] = splash;
 
 			/* set it up */
 			splash->flags = LIGHT_Q3A_DEFAULT;
@@ -922,6 +926,10 @@ void RadLight( int num ){
 int iterations = 0;
 
 void RadCreateDiffuseLights( void ){
+	int i;
+	light_t     *light;
+
+
 	/* startup */
 	Sys_FPrintf( SYS_VRB, "--- RadCreateDiffuseLights ---\n" );
 	numDiffuseSurfaces = 0;
@@ -932,8 +940,23 @@ void RadCreateDiffuseLights( void ){
 	numAreaLights = 0;
 
 	/* hit every surface (threaded) */
+	surfaceDiffuseLights = safe_malloc( numBSPDrawSurfaces * sizeof( *surfaceDiffuseLights ) );
+	memset( surfaceDiffuseLights, 0, numBSPDrawSurfaces * sizeof( *surfaceDiffuseLights ) );
 	RunThreadsOnIndividual( numBSPDrawSurfaces, qtrue, RadLight );
 
+	/* link them up the way a single thread would have, the last surface first */
+	for ( i = 0; i < numBSPDrawSurfaces; i++ )
+	{
+		if ( surfaceDiffuseLights[ i ] == NULL ) {
+			continue;
+		}
+		for ( light = surfaceDiffuseLights[ i ]; light->next != NULL; light = light->next ) ;
+		light->next = lights;
+		lights = surfaceDiffuseLights[ i ];
+	}
+	free( surfaceDiffuseLights );
+	surfaceDiffuseLights = NULL;
+
 	/* dump the lights generated to a file */
 	if ( dump ) {
 		char dumpName[ 1024 ], ext[ 64 ];
@@ -0,0 +1,1020 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+/* marker */
+#define LIGHT_SHARD_C
+
+
+
+/* dependencies */
+#include "vmap.h"
+
+
+
+/*
+   light shards
+
+   -light -shard i/N lights every raw lightmap and grid point shard i owns and
+   writes their subsampled luxels and grid values to <map>.shard<i>. raw
+   lightmaps are dealt out largest first to the least loaded shard, grid points
+   round robin, except that -adaptivegrid leaves the whole grid to shard 0.
+   shards light their lightmaps streamed, which gives the same luxels as the
+   stage by stage path, and every random sequence is seeded per work item, so
+   a shard lights its share exactly like a single process would.
+
+   -light -merge reads the shards back. a bounce needs the light of the whole
+   world, so with -bounce the merge of pass p (-shardpass, 0 is the direct
+   light) saves everything to <map>.lightstate and the shards of pass p + 1
+   start from there. the merge of the last pass stores the lightmaps and
+   writes the bsp.
+ */
+
+#define LIGHTSHARD_IDENT        ( ( 'D' << 24 ) + ( 'R' << 16 ) + ( 'H' << 8 ) + 'S' )
+#define LIGHTSHARD_VERSION      2
+
+#define SHARD_RAD_LUXELS( n )   ( 1 << ( MAX_LIGHTMAPS + ( n ) ) )
+#define SHARD_DELUXELS          ( 1 << ( 2 * MAX_LIGHTMAPS ) )
+
+typedef struct lightShardHeader_s
+{
+	int ident;
+	int version;
+	int pass;                           /* radiosity bounce, 0 is the direct light */
+	int shard, numShards;               /* -1 for a merged light state */
+	int bounces;                        /* -bounce of the compile */
+	int finished;                       /* radiosity ran out of light in this pass */
+	int numRawLightmaps, numRawGridPoints;
+	int deluxemap;
+	int numLightmapRecords, numGridRecords;
+}
+lightShardHeader_t;
+
+typedef struct lightShardLightmap_s
+{
+	int num;
+	int used;
+	int present;                        /* bsp luxels per style, then SHARD_RAD_LUXELS() and SHARD_DELUXELS */
+	qboolean solid[ MAX_LIGHTMAPS ];
+	vec3_t solidColor[ MAX_LIGHTMAPS ];
+	byte styles[ MAX_LIGHTMAPS ];
+}
+lightShardLightmap_t;
+
+static char shardBase[ 1024 ];
+static int shardBounces;
+static int *rawLightmapShards;
+static byte *lightmapsRead, *gridPointsRead;
+
+
+
+/*
+   CompareRawLightmapCost()
+   sorts raw lightmaps by descending cost, ties by number
+ */
+
+static int CompareRawLightmapCost( const void *a, const void *b ){
+	int ia, ib, ca, cb;
+
+	ia = *( (const int*) a );
+	ib = *( (const int*) b );
+	ca = RawLightmapCost( ia );
+	cb = RawLightmapCost( ib );
+	if ( ca != cb ) {
+		return ca > cb ? -1 : 1;
+	}
+	return ia - ib;
+}
+
+
+
+/*
+   SetupLightShards()
+   deals out the raw lightmaps, call after SetupSurfaceLightmaps()
+ */
+
+void SetupLightShards( const char *BSPFilePath ){
+	int i, j, best, *order;
+	double *load, total;
+
+
+	if ( numLightShards <= 0 && !lightShardMerge ) {
+		return;
+	}
+
+	/* shard files live next to the bsp */
+	strcpy( shardBase, BSPFilePath );
+	StripExtension( shardBase );
+	shardBounces = bounce;
+
+	if ( lightShard < 0 ) {
+		return;
+	}
+
+	/* largest lightmap first to the least loaded shard */
+	order = safe_malloc( ( numRawLightmaps > 0 ? numRawLightmaps : 1 ) * sizeof( *order ) );
+	rawLightmapShards = safe_malloc( ( numRawLightmaps > 0 ? numRawLightmaps : 1 ) * sizeof( *rawLightmapShards ) );
+	load = safe_malloc( numLightShards * sizeof( *load ) );
+	for ( i = 0; i < numRawLightmaps; i++ )
+		order[ i ] = i;
+	qsort( order, numRawLightmaps, sizeof( *order ), CompareRawLightmapCost );
+	memset( load, 0, numLightShards * sizeof( *load ) );
+	total = 0.0;
+	for ( i = 0; i < numRawLightmaps; i++ )
+	{
+		best = 0;
+		for ( j = 1; j < numLightShards; j++ )
+		{
+			if ( load[ j ] < load[ best ] ) {
+				best = j;
+			}
+		}
+		rawLightmapShards[ order[ i ] ] = best;
+		load[ best ] += RawLightmapCost( order[ i ] );
+		total += RawLightmapCost( order[ i ] );
+	}
+
+	Sys_Printf( "Lighting shard %d of %d, pass %d: %.0f of %.0f superluxels\n",
+				lightShard, numLightShards, lightShardPass, load[ lightShard ], total );
+
+	free( load );
+	free( order );
+}
+
+
+
+/*
+   ShardOwnsRawLightmap()
+   returns qtrue if this process lights the raw lightmap
+ */
+
+qboolean ShardOwnsRawLightmap( int num ){
+	if ( lightShard < 0 ) {
+		return qtrue;
+	}
+	return rawLightmapShards[ num ] == lightShard ? qtrue : qfalse;
+}
+
+
+
+/*
+   ShardOwnsGridPoint()
+   returns qtrue if this process traces the grid point
+ */
+
+qboolean ShardOwnsGridPoint( int num ){
+	if ( lightShard < 0 ) {
+		return qtrue;
+	}
+
+	/* the adaptive grid refines from its neighbors, so it can't be split */
+	if ( adaptiveGrid ) {
+		return lightShard == 0 ? qtrue : qfalse;
+	}
+	return ( num % numLightShards ) == lightShard ? qtrue : qfalse;
+}
+
+
+
+/*
+   SetupLightHeader()
+   fills in the header of a light file
+ */
+
+static void SetupLightHeader( lightShardHeader_t *header, int shard, int pass, qboolean finished ){
+	memset( header, 0, sizeof( *header ) );
+	header->ident = LIGHTSHARD_IDENT;
+	header->version = LIGHTSHARD_VERSION;
+	header->pass = pass;
+	header->shard = shard;
+	header->numShards = shard < 0 ? 0 : numLightShards;
+	header->bounces = shardBounces;
+	header->finished = finished;
+	header->numRawLightmaps = numRawLightmaps;
+	header->numRawGridPoints = numRawGridPoints;
+	header->deluxemap = deluxemap;
+}
+
+
+
+/*
+   CheckLightHeader()
+   makes sure a light file belongs to this bsp and these options
+ */
+
+static void CheckLightHeader( const char *path, const lightShardHeader_t *header ){
+	if ( header->ident != LIGHTSHARD_IDENT || header->version != LIGHTSHARD_VERSION ) {
+		Error( "%s is not a light shard of this version", path );
+	}
+	if ( header->numRawLightmaps != numRawLightmaps || header->numRawGridPoints != numRawGridPoints ||
+		 header->deluxemap != deluxemap ) {
+		Error( "%s was lit from another bsp or with other options", path );
+	}
+}
+
+
+
+/*
+   LightmapRecordBytes()
+   size of the luxels that follow a raw lightmap record
+ */
+
+static int LightmapRecordBytes( const lightShardLightmap_t *record ){
+	int lightmapNum, size;
+	rawLightmap_t *lm;
+
+
+	lm = &rawLightmaps[ record->num ];
+	size = 0;
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( record->present & ( 1 << lightmapNum ) ) {
+			size += lm->w * lm->h * BSP_LUXEL_SIZE * sizeof( float );
+		}
+		if ( record->present & SHARD_RAD_LUXELS( lightmapNum ) ) {
+			size += lm->w * lm->h * RAD_LUXEL_SIZE * sizeof( float );
+		}
+	}
+	if ( record->present & SHARD_DELUXELS ) {
+		size += lm->w * lm->h * BSP_DELUXEL_SIZE * sizeof( float );
+	}
+	return size;
+}
+
+
+
+/*
+   WriteLightmapRecord()
+   writes the subsampled luxels of a raw lightmap
+ */
+
+static void WriteLightmapRecord( FILE *f, int num ){
+	int lightmapNum;
+	lightShardLightmap_t record;
+	rawLightmap_t *lm;
+
+
+	lm = &rawLightmaps[ num ];
+
+	memset( &record, 0, sizeof( record ) );
+	record.num = num;
+	record.used = lm->used;
+	memcpy( record.solid, lm->solid, sizeof( record.solid ) );
+	memcpy( record.solidColor, lm->solidColor, sizeof( record.solidColor ) );
+	memcpy( record.styles, lm->styles, sizeof( record.styles ) );
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( lm->bspLuxels[ lightmapNum ] != NULL ) {
+			record.present |= 1 << lightmapNum;
+		}
+		if ( lm->radLuxels[ lightmapNum ] != NULL ) {
+			record.present |= SHARD_RAD_LUXELS( lightmapNum );
+		}
+	}
+	if ( lm->bspDeluxels != NULL ) {
+		record.present |= SHARD_DELUXELS;
+	}
+	SafeWrite( f, &record, sizeof( record ) );
+
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( lm->bspLuxels[ lightmapNum ] != NULL ) {
+			SafeWrite( f, lm->bspLuxels[ lightmapNum ], lm->w * lm->h * BSP_LUXEL_SIZE * sizeof( float ) );
+		}
+		if ( lm->radLuxels[ lightmapNum ] != NULL ) {
+			SafeWrite( f, lm->radLuxels[ lightmapNum ], lm->w * lm->h * RAD_LUXEL_SIZE * sizeof( float ) );
+		}
+	}
+	if ( lm->bspDeluxels != NULL ) {
+		SafeWrite( f, lm->bspDeluxels, lm->w * lm->h * BSP_DELUXEL_SIZE * sizeof( float ) );
+	}
+}
+
+
+
+/*
+   ReadLightmapRecord()
+   loads the subsampled luxels of a raw lightmap, returns its number
+ */
+
+static int ReadLightmapRecord( FILE *f, const char *path ){
+	int lightmapNum, size;
+	lightShardLightmap_t record;
+	rawLightmap_t *lm;
+
+
+	SafeRead( f, &record, sizeof( record ) );
+	if ( record.num < 0 || record.num >= numRawLightmaps ) {
+		Error( "%s: bad raw lightmap %d", path, record.num );
+	}
+	lm = &rawLightmaps[ record.num ];
+
+	lm->used = record.used;
+	memcpy( lm->solid, record.solid, sizeof( lm->solid ) );
+	memcpy( lm->solidColor, record.solidColor, sizeof( lm->solidColor ) );
+	memcpy( lm->styles, record.styles, sizeof( lm->styles ) );
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( record.present & ( 1 << lightmapNum ) ) {
+			size = lm->w * lm->h * BSP_LUXEL_SIZE * sizeof( float );
+			if ( lm->bspLuxels[ lightmapNum ] == NULL ) {
+				lm->bspLuxels[ lightmapNum ] = safe_malloc( size );
+			}
+			SafeRead( f, lm->bspLuxels[ lightmapNum ], size );
+		}
+		if ( record.present & SHARD_RAD_LUXELS( lightmapNum ) ) {
+			size = lm->w * lm->h * RAD_LUXEL_SIZE * sizeof( float );
+			if ( lm->radLuxels[ lightmapNum ] == NULL ) {
+				lm->radLuxels[ lightmapNum ] = safe_malloc( size );
+			}
+			SafeRead( f, lm->radLuxels[ lightmapNum ], size );
+		}
+	}
+	if ( record.present & SHARD_DELUXELS ) {
+		size = lm->w * lm->h * BSP_DELUXEL_SIZE * sizeof( float );
+		if ( lm->bspDeluxels == NULL ) {
+			lm->bspDeluxels = safe_malloc( size );
+		}
+		SafeRead( f, lm->bspDeluxels, size );
+	}
+	return record.num;
+}
+
+
+
+/*
+   WriteGridRecord()
+   writes a grid point and whether the adaptive grid traced it
+ */
+
+static void WriteGridRecord( FILE *f, int num ){
+	int traced;
+
+
+	traced = GridPointTraced( num );
+	SafeWrite( f, &num, sizeof( num ) );
+	SafeWrite( f, &traced, sizeof( traced ) );
+	SafeWrite( f, &rawGridPoints[ num ], sizeof( *rawGridPoints ) );
+	SafeWrite( f, &bspGridPoints[ num ], sizeof( *bspGridPoints ) );
+}
+
+
+
+/*
+   ReadGridRecord()
+   loads a grid point, returns its number; restoreTraced picks up the adaptive grid
+   of an earlier pass, which retraces what it traced before
+ */
+
+static int ReadGridRecord( FILE *f, const char *path, qboolean restoreTraced ){
+	int num, traced;
+
+
+	SafeRead( f, &num, sizeof( num ) );
+	SafeRead( f, &traced, sizeof( traced ) );
+	if ( num < 0 || num >= numRawGridPoints ) {
+		Error( "%s: bad grid point %d", path, num );
+	}
+	if ( traced && restoreTraced ) {
+		SetGridPointTraced( num );
+	}
+	SafeRead( f, &rawGridPoints[ num ], sizeof( *rawGridPoints ) );
+	SafeRead( f, &bspGridPoints[ num ], sizeof( *bspGridPoints ) );
+	return num;
+}
+
+
+
+/*
+   WriteLightFile()
+   writes the raw lightmaps and grid points of a shard, or all of them for shard -1
+ */
+
+static void WriteLightFile( const char *path, int shard, int pass, qboolean finished ){
+	int i;
+	FILE *f;
+	lightShardHeader_t header;
+
+
+	/* count */
+	SetupLightHeader( &header, shard, pass, finished );
+	for ( i = 0; i < numRawLightmaps; i++ )
+	{
+		if ( shard < 0 || ShardOwnsRawLightmap( i ) ) {
+			header.numLightmapRecords++;
+		}
+	}
+	for ( i = 0; i < numRawGridPoints; i++ )
+	{
+		if ( shard < 0 || ShardOwnsGridPoint( i ) ) {
+			header.numGridRecords++;
+		}
+	}
+
+	Sys_Printf( "Writing %s\n", path );
+	f = SafeOpenWrite( path );
+	SafeWrite( f, &header, sizeof( header ) );
+
+	/* subsampled luxels */
+	for ( i = 0; i < numRawLightmaps; i++ )
+	{
+		if ( shard < 0 || ShardOwnsRawLightmap( i ) ) {
+			WriteLightmapRecord( f, i );
+		}
+	}
+
+	/* grid */
+	for ( i = 0; i < numRawGridPoints; i++ )
+	{
+		if ( shard < 0 || ShardOwnsGridPoint( i ) ) {
+			WriteGridRecord( f, i );
+		}
+	}
+
+	fclose( f );
+}
+
+
+
+/*
+   ReadLightFile()
+   loads the raw lightmaps and grid points of a shard or light state file
+ */
+
+static void ReadLightFile( const char *path, lightShardHeader_t *header ){
+	int i;
+	FILE *f;
+
+
+	Sys_Printf( "Reading %s\n", path );
+	f = SafeOpenRead( path );
+	SafeRead( f, header, sizeof( *header ) );
+	CheckLightHeader( path, header );
+
+	for ( i = 0; i < header->numLightmapRecords; i++ )
+		lightmapsRead[ ReadLightmapRecord( f, path ) ]++;
+	for ( i = 0; i < header->numGridRecords; i++ )
+		gridPointsRead[ ReadGridRecord( f, path, qtrue ) ]++;
+
+	fclose( f );
+}
+
+
+
+/*
+   BeginReadLightFiles()
+   clears the tallies of what the light files covered
+ */
+
+static void BeginReadLightFiles( void ){
+	lightmapsRead = safe_malloc( numRawLightmaps + 1 );
+	memset( lightmapsRead, 0, numRawLightmaps + 1 );
+	gridPointsRead = safe_malloc( numRawGridPoints + 1 );
+	memset( gridPointsRead, 0, numRawGridPoints + 1 );
+}
+
+
+
+/*
+   EndReadLightFiles()
+   makes sure every raw lightmap and grid point was read exactly once
+ */
+
+static void EndReadLightFiles( void ){
+	int i;
+
+
+	for ( i = 0; i < numRawLightmaps; i++ )
+	{
+		if ( lightmapsRead[ i ] != 1 ) {
+			Error( "Raw lightmap %d is in %d light shards, expected 1", i, lightmapsRead[ i ] );
+		}
+	}
+	for ( i = 0; i < numRawGridPoints; i++ )
+	{
+		if ( gridPointsRead[ i ] != 1 ) {
+			Error( "Grid point %d is in %d light shards, expected 1", i, gridPointsRead[ i ] );
+		}
+	}
+
+	free( lightmapsRead );
+	lightmapsRead = NULL;
+	free( gridPointsRead );
+	gridPointsRead = NULL;
+}
+
+
+
+/*
+   WriteLightShard()
+   saves what this shard lit, finished says radiosity found no more light to bounce
+ */
+
+void WriteLightShard( qboolean finished ){
+	char path[ 1024 + 20 ];
+
+
+	sprintf( path, "%s.shard%d", shardBase, lightShard );
+	WriteLightFile( path, lightShard, lightShardPass, finished );
+}
+
+
+
+/*
+   ReadLightState()
+   picks up the merged light of the pass before this shard's
+ */
+
+void ReadLightState( void ){
+	char path[ 1024 + 20 ];
+	lightShardHeader_t header;
+
+
+	sprintf( path, "%s.lightstate", shardBase );
+	BeginReadLightFiles();
+	ReadLightFile( path, &header );
+	EndReadLightFiles();
+	if ( header.pass != lightShardPass - 1 || header.bounces != shardBounces ) {
+		Error( "%s holds pass %d of %d bounces, -shardpass %d -bounce %d needs pass %d",
+			   path, header.pass, header.bounces, lightShardPass, shardBounces, lightShardPass - 1 );
+	}
+	if ( header.finished ) {
+		Error( "%s: radiosity already ran out of light, merge it to finish", path );
+	}
+}
+
+
+
+/*
+   MergeLightShards()
+   combines the shard files, then either saves the light state for the next pass
+   or stores the lightmaps; returns qtrue if the bsp is ready to write
+ */
+
+qboolean MergeLightShards( qboolean fastAllocate ){
+	int i, numShards;
+	char path[ 1024 + 20 ];
+	lightShardHeader_t first, header;
+
+
+	Sys_Printf( "--- MergeLightShards ---\n" );
+	ProfileBegin( "MergeLightShards" );
+
+	/* the first shard says how many to expect */
+	BeginReadLightFiles();
+	sprintf( path, "%s.shard0", shardBase );
+	ReadLightFile( path, &first );
+	numShards = first.numShards;
+	for ( i = 1; i < numShards; i++ )
+	{
+		sprintf( path, "%s.shard%d", shardBase, i );
+		ReadLightFile( path, &header );
+		if ( header.shard != i || header.numShards != numShards ||
+			 header.pass != first.pass || header.bounces != first.bounces || header.finished != first.finished ) {
+			Error( "%s is not shard %d of %d from pass %d", path, i, numShards, first.pass );
+		}
+	}
+	EndReadLightFiles();
+	ProfileEnd();
+
+	if ( first.bounces != shardBounces ) {
+		Error( "Light shards were lit with -bounce %d, merging with -bounce %d", first.bounces, shardBounces );
+	}
+	Sys_Printf( "%9d light shards of pass %d merged\n", numShards, first.pass );
+
+	/* more bounces to go */
+	if ( first.pass < first.bounces && !first.finished ) {
+		sprintf( path, "%s.lightstate", shardBase );
+		WriteLightFile( path, -1, first.pass, qfalse );
+		Sys_Printf( "Light the next shards with -shardpass %d, then merge again\n", first.pass + 1 );
+		return qfalse;
+	}
+
+	/* store the lightmaps like the last bounce would */
+	bouncing = first.pass > 0 ? qtrue : qfalse;
+	bounce = first.finished ? first.bounces - first.pass + 1 : 0;
+	ProfileBegin( "StoreSurfaceLightmaps" );
+	StoreSurfaceLightmaps( fastAllocate );
+	ProfileEnd();
+	return qtrue;
+}
+
+
+
+/*
+   light checkpoints
+
+   -light -checkpoint <seconds> keeps <map>.lightcheckpoint up to date. every
+   pass starts it over with a snapshot of the raw lightmaps and grid points the
+   pass begins from (none for the direct light), then a background thread
+   appends the ones the workers finished since its last write, so the workers
+   never wait on the disk. each batch ends in a trailer, and one cut off by a
+   crash is dropped. -resume loads the snapshot and the whole batches, and the
+   pass goes on with only the work that is left.
+ */
+
+#define CHECKPOINT_BATCH_IDENT  ( ( 'H' << 24 ) + ( 'C' << 16 ) + ( 'T' << 8 ) + 'B' )
+#define CHECKPOINT_END_IDENT    ( ( 'D' << 24 ) + ( 'N' << 16 ) + ( 'E' << 8 ) + 'B' )
+
+#define GRID_RECORD_BYTES       ( 2 * sizeof( int ) + sizeof( rawGridPoint_t ) + sizeof( bspGridPoint_t ) )
+
+typedef struct checkpointBatch_s
+{
+	int ident;
+	int pass;
+	int numLightmapRecords, numGridRecords;
+}
+checkpointBatch_t;
+
+static char checkpointPath[ 1024 + 20 ];
+static int checkpointPass = -1;             /* pass the checkpoint holds */
+static int resumePass = -1;                 /* pass whose batches -resume has yet to load */
+static long resumeOffset;
+static byte *lightmapsDone, *gridPointsDone;
+static int *pendingLightmaps, *pendingGridPoints;
+static int numPendingLightmaps, numPendingGridPoints;
+static int numWrittenLightmaps, numWrittenGridPoints;
+
+
+
+/*
+   SetupLightCheckpoint()
+   allocates the per pass bookkeeping, call after SetupGrid()
+ */
+
+void SetupLightCheckpoint( const char *BSPFilePath ){
+	if ( lightCheckpoint <= 0 ) {
+		return;
+	}
+
+	strcpy( shardBase, BSPFilePath );
+	StripExtension( shardBase );
+	sprintf( checkpointPath, "%s.lightcheckpoint", shardBase );
+	shardBounces = bounce;
+
+	lightmapsDone = safe_malloc( numRawLightmaps + 1 );
+	gridPointsDone = safe_malloc( numRawGridPoints + 1 );
+	pendingLightmaps = safe_malloc( ( numRawLightmaps + 1 ) * sizeof( *pendingLightmaps ) );
+	pendingGridPoints = safe_malloc( ( numRawGridPoints + 1 ) * sizeof( *pendingGridPoints ) );
+}
+
+
+
+/*
+   ResumeLightCheckpoint()
+   loads the snapshot of a checkpoint, returns the pass to pick up at
+ */
+
+int ResumeLightCheckpoint( void ){
+	int i;
+	FILE *f;
+	lightShardHeader_t header;
+
+
+	if ( !lightResume ) {
+		return 0;
+	}
+
+	f = fopen( checkpointPath, "rb" );
+	if ( f == NULL ) {
+		Sys_Printf( "No %s, lighting from the start\n", checkpointPath );
+		return 0;
+	}
+
+	Sys_Printf( "Reading %s\n", checkpointPath );
+	SafeRead( f, &header, sizeof( header ) );
+	CheckLightHeader( checkpointPath, &header );
+	if ( header.bounces != shardBounces ) {
+		Error( "%s was lit with -bounce %d, resuming with -bounce %d", checkpointPath, header.bounces, shardBounces );
+	}
+	for ( i = 0; i < header.numLightmapRecords; i++ )
+		ReadLightmapRecord( f, checkpointPath );
+	for ( i = 0; i < header.numGridRecords; i++ )
+		ReadGridRecord( f, checkpointPath, qtrue );
+	resumeOffset = ftell( f );
+	fclose( f );
+
+	checkpointPass = resumePass = header.pass;
+	Sys_Printf( "Resuming light at pass %d\n", header.pass );
+	return header.pass;
+}
+
+
+
+/*
+   ReadCheckpointBatches()
+   loads what the interrupted pass finished and drops a batch cut off mid write
+ */
+
+static void ReadCheckpointBatches( void ){
+	int i, num, trailer, numLightmaps, numGridPoints;
+	long end, validEnd, copied, size;
+	char tempPath[ 1024 + 32 ], buffer[ 65536 ];
+	FILE *f, *out;
+	checkpointBatch_t batch;
+	lightShardLightmap_t record;
+
+
+	f = SafeOpenRead( checkpointPath );
+	fseek( f, 0, SEEK_END );
+	end = ftell( f );
+
+	/* find the end of the last whole batch */
+	fseek( f, resumeOffset, SEEK_SET );
+	validEnd = resumeOffset;
+	while ( fread( &batch, sizeof( batch ), 1, f ) == 1 &&
+			batch.ident == CHECKPOINT_BATCH_IDENT && batch.pass == checkpointPass &&
+			batch.numLightmapRecords >= 0 && batch.numLightmapRecords <= numRawLightmaps &&
+			batch.numGridRecords >= 0 && batch.numGridRecords <= numRawGridPoints )
+	{
+		for ( i = 0; i < batch.numLightmapRecords; i++ )
+		{
+			if ( fread( &record, sizeof( record ), 1, f ) != 1 || record.num < 0 || record.num >= numRawLightmaps ) {
+				break;
+			}
+			fseek( f, LightmapRecordBytes( &record ), SEEK_CUR );
+		}
+		if ( i < batch.numLightmapRecords ) {
+			break;
+		}
+		fseek( f, batch.numGridRecords * GRID_RECORD_BYTES, SEEK_CUR );
+		if ( fread( &trailer, sizeof( trailer ), 1, f ) != 1 || trailer != CHECKPOINT_END_IDENT ) {
+			break;
+		}
+		validEnd = ftell( f );
+	}
+
+	/* load them */
+	numLightmaps = numGridPoints = 0;
+	fseek( f, resumeOffset, SEEK_SET );
+	while ( ftell( f ) < validEnd )
+	{
+		SafeRead( f, &batch, sizeof( batch ) );
+		for ( i = 0; i < batch.numLightmapRecords; i++ )
+		{
+			num = ReadLightmapRecord( f, checkpointPath );
+			lightmapsDone[ num ] = 1;
+			numLightmaps++;
+		}
+		for ( i = 0; i < batch.numGridRecords; i++ )
+		{
+			num = ReadGridRecord( f, checkpointPath, qfalse );
+			gridPointsDone[ num ] = 1;
+			numGridPoints++;
+		}
+		SafeRead( f, &trailer, sizeof( trailer ) );
+	}
+	Sys_Printf( "%9d raw lightmaps and %d grid points already lit\n", numLightmaps, numGridPoints );
+
+	/* the next batch goes after the last whole one */
+	if ( validEnd < end ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: %s ends in a partial batch, dropping %ld bytes\n", checkpointPath, end - validEnd );
+		sprintf( tempPath, "%s.tmp", checkpointPath );
+		out = SafeOpenWrite( tempPath );
+		fseek( f, 0, SEEK_SET );
+		for ( copied = 0; copied < validEnd; copied += size )
+		{
+			size = validEnd - copied < (long) sizeof( buffer ) ? validEnd - copied : (long) sizeof( buffer );
+			SafeRead( f, buffer, size );
+			SafeWrite( out, buffer, size );
+		}
+		fclose( out );
+		fclose( f );
+		remove( checkpointPath );
+		if ( rename( tempPath, checkpointPath ) != 0 ) {
+			Error( "Unable to rename %s to %s", tempPath, checkpointPath );
+		}
+		return;
+	}
+	fclose( f );
+}
+
+
+
+/*
+   StartLightCheckpointPass()
+   snapshots the light a pass starts from, or picks up the pass -resume stopped in
+ */
+
+void StartLightCheckpointPass( int pass ){
+	int i;
+	char tempPath[ 1024 + 32 ];
+	FILE *f;
+	lightShardHeader_t header;
+
+
+	if ( lightCheckpoint <= 0 ) {
+		return;
+	}
+
+	memset( lightmapsDone, 0, numRawLightmaps + 1 );
+	memset( gridPointsDone, 0, numRawGridPoints + 1 );
+	numPendingLightmaps = numPendingGridPoints = 0;
+	numWrittenLightmaps = numWrittenGridPoints = 0;
+
+	if ( pass == resumePass ) {
+		resumePass = -1;
+		ReadCheckpointBatches();
+		return;
+	}
+
+	/* the direct light starts from nothing */
+	SetupLightHeader( &header, -1, pass, qfalse );
+	if ( pass > 0 ) {
+		header.numLightmapRecords = numRawLightmaps;
+		header.numGridRecords = numRawGridPoints;
+	}
+
+	/* a crash mid snapshot leaves the last checkpoint in place */
+	Sys_Printf( "Writing %s\n", checkpointPath );
+	sprintf( tempPath, "%s.tmp", checkpointPath );
+	f = SafeOpenWrite( tempPath );
+	SafeWrite( f, &header, sizeof( header ) );
+	for ( i = 0; i < header.numLightmapRecords; i++ )
+		WriteLightmapRecord( f, i );
+	for ( i = 0; i < header.numGridRecords; i++ )
+		WriteGridRecord( f, i );
+	fclose( f );
+	remove( checkpointPath );
+	if ( rename( tempPath, checkpointPath ) != 0 ) {
+		Error( "Unable to rename %s to %s", tempPath, checkpointPath );
+	}
+	checkpointPass = pass;
+}
+
+
+
+/*
+   WriteCheckpointBatch()
+   appends the raw lightmaps and grid points finished since the last batch
+ */
+
+static void WriteCheckpointBatch( void ){
+	int i, numLightmaps, numGridPoints, trailer;
+	FILE *f;
+	checkpointBatch_t batch;
+
+
+	/* the workers only ever add to the pending lists */
+	ThreadBackgroundLock();
+	numLightmaps = numPendingLightmaps;
+	numGridPoints = numPendingGridPoints;
+	ThreadBackgroundUnlock();
+	if ( numLightmaps == numWrittenLightmaps && numGridPoints == numWrittenGridPoints ) {
+		return;
+	}
+
+	f = fopen( checkpointPath, "ab" );
+	if ( f == NULL ) {
+		Error( "Unable to append to %s", checkpointPath );
+	}
+	batch.ident = CHECKPOINT_BATCH_IDENT;
+	batch.pass = checkpointPass;
+	batch.numLightmapRecords = numLightmaps - numWrittenLightmaps;
+	batch.numGridRecords = numGridPoints - numWrittenGridPoints;
+	SafeWrite( f, &batch, sizeof( batch ) );
+	for ( i = numWrittenLightmaps; i < numLightmaps; i++ )
+		WriteLightmapRecord( f, pendingLightmaps[ i ] );
+	for ( i = numWrittenGridPoints; i < numGridPoints; i++ )
+		WriteGridRecord( f, pendingGridPoints[ i ] );
+	trailer = CHECKPOINT_END_IDENT;
+	SafeWrite( f, &trailer, sizeof( trailer ) );
+	fclose( f );
+
+	numWrittenLightmaps = numLightmaps;
+	numWrittenGridPoints = numGridPoints;
+}
+
+
+
+/*
+   LightCheckpointThread()
+   writes a batch every -checkpoint seconds, and the rest when the stage ends
+ */
+
+static void LightCheckpointThread( void ){
+	while ( ThreadBackgroundSleep( lightCheckpoint * 1000 ) )
+		WriteCheckpointBatch();
+	WriteCheckpointBatch();
+}
+
+
+
+/*
+   BeginLightCheckpointStage()
+   starts the checkpoint writer beside a threaded stage
+ */
+
+void BeginLightCheckpointStage( void ){
+	if ( lightCheckpoint > 0 ) {
+		ThreadBackground( LightCheckpointThread );
+	}
+}
+
+
+
+/*
+   EndLightCheckpointStage()
+   writes what is left and stops the checkpoint writer
+ */
+
+void EndLightCheckpointStage( void ){
+	if ( lightCheckpoint > 0 ) {
+		ThreadBackgroundJoin();
+	}
+}
+
+
+
+/*
+   CheckpointRawLightmap()
+   queues a lit raw lightmap for the next batch, called by the workers
+ */
+
+void CheckpointRawLightmap( int num ){
+	if ( lightCheckpoint <= 0 ) {
+		return;
+	}
+	ThreadBackgroundLock();
+	lightmapsDone[ num ] = 1;
+	pendingLightmaps[ numPendingLightmaps++ ] = num;
+	ThreadBackgroundUnlock();
+}
+
+
+
+/*
+   CheckpointGridPoint()
+   queues a traced grid point for the next batch, called by the workers
+ */
+
+void CheckpointGridPoint( int num ){
+	if ( lightCheckpoint <= 0 ) {
+		return;
+	}
+	ThreadBackgroundLock();
+	gridPointsDone[ num ] = 1;
+	pendingGridPoints[ numPendingGridPoints++ ] = num;
+	ThreadBackgroundUnlock();
+}
+
+
+
+/*
+   CheckpointedRawLightmaps()
+   flags the raw lightmaps this pass already lit, NULL without checkpoints
+ */
+
+const byte *CheckpointedRawLightmaps( void ){
+	return lightCheckpoint > 0 ? lightmapsDone : NULL;
+}
+
+
+
+/*
+   CheckpointedGridPoints()
+   flags the grid points this pass already traced, NULL without checkpoints
+ */
+
+const byte *CheckpointedGridPoints( void ){
+	return lightCheckpoint > 0 ? gridPointsDone : NULL;
+}
+
+
+
+/*
+   RemoveLightCheckpoint()
+   deletes the checkpoint once the bsp holds the light
+ */
+
+void RemoveLightCheckpoint( void ){
+	if ( lightCheckpoint > 0 ) {
+		remove( checkpointPath );
+	}
+}
@@ -1301,6 +1301,319 @@ static void PopulateTraceNodes( void ){
 
 
 
+/* -------------------------------------------------------------------------------
+
+   bounding volume hierarchy (-bvh)
+
+   ------------------------------------------------------------------------------- */
+
+/*
+   the bvh is built from the finished trace triangles with the surface area heuristic.
+   nodes live in one flat, cache line aligned array in depth first order (the first
+   child follows its parent) and the triangles of each leaf are stored next to each other.
+   the trace node tree is still walked for solid space
+ */
+
+#define BVH_BINS                16
+#define BVH_LEAF_TRIANGLES      2       /* always make a leaf at this size */
+#define BVH_MAX_LEAF_TRIANGLES  8       /* never make a leaf above this size unless it can't be split */
+#define BVH_MAX_DEPTH           64
+#define BVH_TRAVERSAL_COST      1.0f    /* relative to one triangle test */
+#define BVH_BOUNDS_EPSILON      0.1f
+
+typedef struct traceBVHNode_s
+{
+	float mins[ 3 ], maxs[ 3 ];
+	int offset;                         /* leaf: first triangle, otherwise: second child */
+	short numTriangles;                 /* 0 means two children */
+	short axis;                         /* split axis, used to visit the near child first */
+}
+traceBVHNode_t;
+
+typedef struct traceBVH_s
+{
+	int numNodes, maxNodes;
+	traceBVHNode_t              *nodes;
+	void                        *nodeBuffer;
+	int numTriangles;
+	traceTriangle_t             *triangles;
+}
+traceBVH_t;
+
+typedef struct traceBVHRef_s
+{
+	float mins[ 3 ], maxs[ 3 ], center[ 3 ];
+	int triangleNum;
+}
+traceBVHRef_t;
+
+typedef struct traceBVHBin_s
+{
+	vec3_t mins, maxs;
+	int count;
+}
+traceBVHBin_t;
+
+static int numBSPTraceNodes = 0;
+static traceBVH_t headBVH, skyboxBVH;
+
+static void TraceBenchmark( void );
+static void AllocShadowCaches( void );
+
+
+
+/*
+   CountTraceNodeTriangles_r()
+   counts the triangles in the leafs of a trace node (sub)tree, filling the list if given
+ */
+
+static int CountTraceNodeTriangles_r( int nodeNum, int *list ){
+	int count;
+	traceNode_t     *node;
+
+
+	/* dummy check */
+	if ( nodeNum < 0 || nodeNum >= numTraceNodes ) {
+		return 0;
+	}
+
+	/* is this a decision node? */
+	node = &traceNodes[ nodeNum ];
+	if ( node->type >= 0 ) {
+		count = CountTraceNodeTriangles_r( node->children[ 0 ], list );
+		count += CountTraceNodeTriangles_r( node->children[ 1 ], list != NULL ? list + count : NULL );
+		return count;
+	}
+
+	/* leaf */
+	if ( list != NULL && node->numItems > 0 ) {
+		memcpy( list, node->items, node->numItems * sizeof( *list ) );
+	}
+	return node->numItems;
+}
+
+
+
+/*
+   BVHBoundsArea()
+   returns half the surface area of a box
+ */
+
+static float BVHBoundsArea( const vec3_t mins, const vec3_t maxs ){
+	vec3_t size;
+
+
+	if ( mins[ 0 ] > maxs[ 0 ] ) {
+		return 0.0f;
+	}
+	VectorSubtract( maxs, mins, size );
+	return size[ 0 ] * size[ 1 ] + size[ 1 ] * size[ 2 ] + size[ 2 ] * size[ 0 ];
+}
+
+
+
+/*
+   BuildTraceBVH_r()
+   builds the bvh node for a range of triangle refs, returns the node number
+ */
+
+static int BuildTraceBVH_r( traceBVH_t *bvh, traceBVHRef_t *refs, int numRefs, int depth ){
+	int i, j, axis, bestAxis, bestSplit, nodeNum, numLeft, bin;
+	float scale, cost, leafCost, bestCost, area;
+	vec3_t mins, maxs, centerMins, centerMaxs, leftMins, leftMaxs;
+	traceBVHBin_t bins[ BVH_BINS ];
+	float rightArea[ BVH_BINS ];
+	int rightCount[ BVH_BINS ];
+	traceBVHRef_t temp;
+	traceBVHNode_t  *node;
+
+
+	/* allocate node */
+	nodeNum = bvh->numNodes++;
+	node = &bvh->nodes[ nodeNum ];
+
+	/* bound refs and their centers */
+	ClearBounds( mins, maxs );
+	ClearBounds( centerMins, centerMaxs );
+	for ( i = 0; i < numRefs; i++ )
+	{
+		AddPointToBounds( refs[ i ].mins, mins, maxs );
+		AddPointToBounds( refs[ i ].maxs, mins, maxs );
+		AddPointToBounds( refs[ i ].center, centerMins, centerMaxs );
+	}
+	VectorCopy( mins, node->mins );
+	VectorCopy( maxs, node->maxs );
+	node->axis = 0;
+
+	/* find the cheapest binned split */
+	bestAxis = -1;
+	bestSplit = 0;
+	bestCost = 0.0f;
+	area = BVHBoundsArea( mins, maxs );
+	leafCost = numRefs;
+	if ( numRefs > BVH_LEAF_TRIANGLES && depth < BVH_MAX_DEPTH - 1 && area > 0.0f ) {
+		for ( axis = 0; axis < 3; axis++ )
+		{
+			if ( centerMaxs[ axis ] <= centerMins[ axis ] ) {
+				continue;
+			}
+			scale = BVH_BINS / ( centerMaxs[ axis ] - centerMins[ axis ] );
+
+			/* bin refs */
+			for ( i = 0; i < BVH_BINS; i++ )
+			{
+				ClearBounds( bins[ i ].mins, bins[ i ].maxs );
+				bins[ i ].count = 0;
+			}
+			for ( i = 0; i < numRefs; i++ )
+			{
+				bin = ( refs[ i ].center[ axis ] - centerMins[ axis ] ) * scale;
+				bin = bin < 0 ? 0 : bin >= BVH_BINS ? BVH_BINS - 1 : bin;
+				AddPointToBounds( refs[ i ].mins, bins[ bin ].mins, bins[ bin ].maxs );
+				AddPointToBounds( refs[ i ].maxs, bins[ bin ].mins, bins[ bin ].maxs );
+				bins[ bin ].count++;
+			}
+
+			/* sweep from the right */
+			ClearBounds( leftMins, leftMaxs );
+			numLeft = 0;
+			for ( i = BVH_BINS - 1; i > 0; i-- )
+			{
+				if ( bins[ i ].count > 0 ) {
+					AddPointToBounds( bins[ i ].mins, leftMins, leftMaxs );
+					AddPointToBounds( bins[ i ].maxs, leftMins, leftMaxs );
+				}
+				numLeft += bins[ i ].count;
+				rightArea[ i ] = BVHBoundsArea( leftMins, leftMaxs );
+				rightCount[ i ] = numLeft;
+			}
+
+			/* sweep from the left and evaluate each split plane */
+			ClearBounds( leftMins, leftMaxs );
+			numLeft = 0;
+			for ( i = 0; i < BVH_BINS - 1; i++ )
+			{
+				if ( bins[ i ].count > 0 ) {
+					AddPointToBounds( bins[ i ].mins, leftMins, leftMaxs );
+					AddPointToBounds( bins[ i ].maxs, leftMins, leftMaxs );
+				}
+				numLeft += bins[ i ].count;
+				if ( numLeft == 0 || rightCount[ i + 1 ] == 0 ) {
+					continue;
+				}
+				cost = BVH_TRAVERSAL_COST + ( BVHBoundsArea( leftMins, leftMaxs ) * numLeft + rightArea[ i + 1 ] * rightCount[ i + 1 ] ) / area;
+				if ( bestAxis < 0 || cost < bestCost ) {
+					bestAxis = axis;
+					bestSplit = i;
+					bestCost = cost;
+				}
+			}
+		}
+	}
+
+	/* split if it pays off or the leaf would be too big */
+	if ( bestAxis >= 0 && ( bestCost < leafCost || numRefs > BVH_MAX_LEAF_TRIANGLES ) ) {
+		scale = BVH_BINS / ( centerMaxs[ bestAxis ] - centerMins[ bestAxis ] );
+		for ( i = 0, j = numRefs - 1; i <= j; )
+		{
+			bin = ( refs[ i ].center[ bestAxis ] - centerMins[ bestAxis ] ) * scale;
+			bin = bin < 0 ? 0 : bin >= BVH_BINS ? BVH_BINS - 1 : bin;
+			if ( bin <= bestSplit ) {
+				i++;
+			}
+			else
+			{
+				temp = refs[ i ];
+				refs[ i ] = refs[ j ];
+				refs[ j ] = temp;
+				j--;
+			}
+		}
+		numLeft = i;
+		node->axis = bestAxis;
+	}
+
+	/* degenerate centers, split in the middle if there are too many */
+	else if ( numRefs > BVH_MAX_LEAF_TRIANGLES && depth < BVH_MAX_DEPTH - 1 ) {
+		numLeft = numRefs / 2;
+	}
+
+	/* make a leaf */
+	else
+	{
+		node->offset = bvh->numTriangles;
+		node->numTriangles = numRefs;
+		for ( i = 0; i < numRefs; i++ )
+			bvh->triangles[ bvh->numTriangles++ ] = traceTriangles[ refs[ i ].triangleNum ];
+		return nodeNum;
+	}
+
+	/* build children (first child directly follows this node) */
+	node->numTriangles = 0;
+	BuildTraceBVH_r( bvh, refs, numLeft, depth + 1 );
+	i = BuildTraceBVH_r( bvh, refs + numLeft, numRefs - numLeft, depth + 1 );
+	bvh->nodes[ nodeNum ].offset = i;
+	return nodeNum;
+}
+
+
+
+/*
+   BuildTraceBVH()
+   builds a bvh over the triangles of a trace node subtree
+ */
+
+static void BuildTraceBVH( traceBVH_t *bvh, int nodeNum ){
+	int i, j, k, numRefs, *list;
+	float pad;
+	traceBVHRef_t   *refs;
+	traceTriangle_t *tt;
+
+
+	/* clear it */
+	memset( bvh, 0, sizeof( *bvh ) );
+
+	/* get the triangles */
+	numRefs = CountTraceNodeTriangles_r( nodeNum, NULL );
+	if ( numRefs <= 0 ) {
+		return;
+	}
+	list = safe_malloc( numRefs * sizeof( *list ) );
+	CountTraceNodeTriangles_r( nodeNum, list );
+
+	/* make refs, padded so that triangle hits within the barycentric epsilon are inside */
+	refs = safe_malloc( numRefs * sizeof( *refs ) );
+	for ( i = 0; i < numRefs; i++ )
+	{
+		tt = &traceTriangles[ list[ i ] ];
+		refs[ i ].triangleNum = list[ i ];
+		ClearBounds( refs[ i ].mins, refs[ i ].maxs );
+		for ( j = 0; j < 3; j++ )
+			AddPointToBounds( tt->v[ j ].xyz, refs[ i ].mins, refs[ i ].maxs );
+		for ( k = 0; k < 3; k++ )
+		{
+			pad = BVH_BOUNDS_EPSILON + 0.02f * ( refs[ i ].maxs[ k ] - refs[ i ].mins[ k ] );
+			refs[ i ].mins[ k ] -= pad;
+			refs[ i ].maxs[ k ] += pad;
+			refs[ i ].center[ k ] = 0.5f * ( refs[ i ].mins[ k ] + refs[ i ].maxs[ k ] );
+		}
+	}
+	free( list );
+
+	/* allocate cache line aligned nodes and the triangle array */
+	bvh->maxNodes = 2 * numRefs;
+	bvh->nodeBuffer = safe_malloc( bvh->maxNodes * sizeof( traceBVHNode_t ) + 64 );
+	bvh->nodes = (traceBVHNode_t*) ( ( (size_t) bvh->nodeBuffer + 63 ) & ~( (size_t) 63 ) );
+	bvh->triangles = safe_malloc( numRefs * sizeof( *bvh->triangles ) );
+
+	/* build it */
+	BuildTraceBVH_r( bvh, refs, numRefs, 0 );
+	free( refs );
+}
+
+
+
+
 /* -------------------------------------------------------------------------------
 
    trace initialization
@@ -1325,6 +1638,7 @@ void SetupTraceNodes( void ){
 
 	/* create outside node for skybox surfaces */
 	skyboxNodeNum = AllocTraceNode();
+	numBSPTraceNodes = numTraceNodes;
 
 	/* populate the tree with triangles from the world and shadow casting entities */
 	PopulateTraceNodes();
@@ -1355,6 +1669,22 @@ void SetupTraceNodes( void ){
 	maxTraceWindings = 0;
 	deadWinding = -1;
 
+	/* every thread remembers its recent occluders */
+	AllocShadowCaches();
+
+	/* build the bvh (the benchmark needs it to compare against) */
+	if ( traceBVH || traceBenchmark ) {
+		BuildTraceBVH( &headBVH, headNodeNum );
+		BuildTraceBVH( &skyboxBVH, skyboxNodeNum );
+		Sys_FPrintf( SYS_VRB, "%9d bvh nodes (%.2fMB)\n", headBVH.numNodes + skyboxBVH.numNodes,
+		             (float) ( ( headBVH.numNodes + skyboxBVH.numNodes ) * sizeof( traceBVHNode_t ) ) / ( 1024.0f * 1024.0f ) );
+		Sys_FPrintf( SYS_VRB, "%9d bvh triangles (%.2fMB)\n", headBVH.numTriangles + skyboxBVH.numTriangles,
+		             (float) ( ( headBVH.numTriangles + skyboxBVH.numTriangles ) * sizeof( traceTriangle_t ) ) / ( 1024.0f * 1024.0f ) );
+
+		/* compare ray throughput */
+		TraceBenchmark();
+	}
+
 	/* debug code: write out trace triangles to an alias obj file */
 	#if 0
 	{
@@ -1397,32 +1727,22 @@ void SetupTraceNodes( void ){
 
    ------------------------------------------------------------------------------- */
 
-/*
-   TraceTriangle()
-   based on code written by william 'spog' joseph
-   based on code originally written by tomas moller and ben trumbore, journal of graphics tools, 2(1):21-28, 1997
- */
-
 #define BARY_EPSILON            0.01f
 #define ASLF_EPSILON            0.0001f /* so to not get double shadows */
 #define COPLANAR_EPSILON        0.25f   //%	0.000001f
 #define NEAR_SHADOW_EPSILON     1.5f    //%	1.25f
 #define SELF_SHADOW_EPSILON     0.5f
 
-qboolean TraceTriangle( traceInfo_t *ti, traceTriangle_t *tt, trace_t *trace ){
-	int i;
-	float tvec[ 3 ], pvec[ 3 ], qvec[ 3 ];
-	float det, invDet, depth;
-	float u, v, w, s, t;
-	int is, it;
-	byte            *pixel;
-	float shadow;
-	shaderInfo_t    *si;
 
 
+/*
+   TraceTriangleFilter()
+   returns qfalse if the trace ignores surfaces of this trace info (sky, shadow groups, grid)
+ */
+
+static qboolean TraceTriangleFilter( traceInfo_t *ti, trace_t *trace ){
 	/* don't double-trace against sky */
-	si = ti->si;
-	if ( trace->compileFlags & si->compileFlags & C_SKY ) {
+	if ( trace->compileFlags & ti->si->compileFlags & C_SKY ) {
 		return qfalse;
 	}
 
@@ -1456,43 +1776,28 @@ qboolean TraceTriangle( traceInfo_t *ti, traceTriangle_t *tt, trace_t *trace ){
 		}
 	}
 
-	/* begin calculating determinant - also used to calculate u parameter */
-	CrossProduct( trace->direction, tt->edge2, pvec );
-
-	/* if determinant is near zero, trace lies in plane of triangle */
-	det = DotProduct( tt->edge1, pvec );
-
-	/* the non-culling branch */
-	if ( fabs( det ) < COPLANAR_EPSILON ) {
-		return qfalse;
-	}
-	invDet = 1.0f / det;
+	return qtrue;
+}
 
-	/* calculate distance from first vertex to ray origin */
-	VectorSubtract( trace->origin, tt->v[ 0 ].xyz, tvec );
 
-	/* calculate u parameter and test bounds */
-	u = DotProduct( tvec, pvec ) * invDet;
-	if ( u < -BARY_EPSILON || u > ( 1.0f + BARY_EPSILON ) ) {
-		return qfalse;
-	}
 
-	/* prepare to test v parameter */
-	CrossProduct( tvec, tt->edge1, qvec );
+/*
+   TraceTriangleHit()
+   handles a trace crossing a triangle at barycentric u, v and the given depth
+   returns qtrue if the trace is occluded
+ */
 
-	/* calculate v parameter and test bounds */
-	v = DotProduct( trace->direction, qvec ) * invDet;
-	if ( v < -BARY_EPSILON || ( u + v ) > ( 1.0f + BARY_EPSILON ) ) {
-		return qfalse;
-	}
+static qboolean TraceTriangleHit( traceInfo_t *ti, traceTriangle_t *tt, trace_t *trace, float u, float v, float depth ){
+	int i;
+	float w, s, t;
+	int is, it;
+	byte            *pixel;
+	float shadow;
+	shaderInfo_t    *si;
 
-	/* calculate t (depth) */
-	depth = DotProduct( tt->edge2, qvec ) * invDet;
-	if ( depth <= trace->inhibitRadius || depth >= trace->distance ) {
-		return qfalse;
-	}
 
 	/* if hitpoint is really close to trace origin (sample point), then check for self-shadowing */
+	si = ti->si;
 	if ( depth <= SELF_SHADOW_EPSILON ) {
 		/* don't self-shadow */
 		for ( i = 0; i < trace->numSurfaces; i++ )
@@ -1586,6 +1891,69 @@ qboolean TraceTriangle( traceInfo_t *ti, traceTriangle_t *tt, trace_t *trace ){
 
 
 
+/*
+   TraceTriangle()
+   based on code written by william 'spog' joseph
+   based on code originally written by tomas moller and ben trumbore, journal of graphics tools, 2(1):21-28, 1997
+ */
+
+static qboolean TraceTriangleBary( traceInfo_t *ti, traceTriangle_t *tt, trace_t *trace, float baryEpsilon ){
+	float tvec[ 3 ], pvec[ 3 ], qvec[ 3 ];
+	float det, invDet, depth;
+	float u, v;
+
+
+	/* check surface */
+	if ( !TraceTriangleFilter( ti, trace ) ) {
+		return qfalse;
+	}
+
+	/* begin calculating determinant - also used to calculate u parameter */
+	CrossProduct( trace->direction, tt->edge2, pvec );
+
+	/* if determinant is near zero, trace lies in plane of triangle */
+	det = DotProduct( tt->edge1, pvec );
+
+	/* the non-culling branch */
+	if ( fabs( det ) < COPLANAR_EPSILON ) {
+		return qfalse;
+	}
+	invDet = 1.0f / det;
+
+	/* calculate distance from first vertex to ray origin */
+	VectorSubtract( trace->origin, tt->v[ 0 ].xyz, tvec );
+
+	/* calculate u parameter and test bounds */
+	u = DotProduct( tvec, pvec ) * invDet;
+	if ( u < -baryEpsilon || u > ( 1.0f + baryEpsilon ) ) {
+		return qfalse;
+	}
+
+	/* prepare to test v parameter */
+	CrossProduct( tvec, tt->edge1, qvec );
+
+	/* calculate v parameter and test bounds */
+	v = DotProduct( trace->direction, qvec ) * invDet;
+	if ( v < -baryEpsilon || ( u + v ) > ( 1.0f + baryEpsilon ) ) {
+		return qfalse;
+	}
+
+	/* calculate t (depth) */
+	depth = DotProduct( tt->edge2, qvec ) * invDet;
+	if ( depth <= trace->inhibitRadius || depth >= trace->distance ) {
+		return qfalse;
+	}
+
+	/* handle the hit */
+	return TraceTriangleHit( ti, tt, trace, u, v, depth );
+}
+
+qboolean TraceTriangle( traceInfo_t *ti, traceTriangle_t *tt, trace_t *trace ){
+	return TraceTriangleBary( ti, tt, trace, BARY_EPSILON );
+}
+
+
+
 /*
    TraceWinding() - ydnar
    temporary hack
@@ -1624,24 +1992,205 @@ qboolean TraceWinding( traceWinding_t *tw, trace_t *trace ){
 
 
 
+/* -------------------------------------------------------------------------------
+
+   shadow cache
+
+   ------------------------------------------------------------------------------- */
+
 /*
-   TraceLine_r()
-   returns qtrue if something is hit and tracing can stop
+   neighbouring luxels are mostly shadowed from a light by the same triangle. with -shadowcache
+   every thread remembers the last triangles that blocked each light in the raw lightmap it is
+   lighting, and traces that opt in with a cache test them before walking the tree. the cache
+   starts empty for every raw lightmap, so what it holds only depends on the luxels lit before
+   in the same lightmap, never on the thread count or on which thread got which lightmap.
+   a cached hit is occluded as the full trace would be, but the hit point and the compile flags
+   of the surfaces the full trace passes first are not, so it stays off unless asked for
  */
 
-static qboolean TraceLine_r( int nodeNum, vec3_t origin, vec3_t end, trace_t *trace ){
-	traceNode_t     *node;
-	int side;
-	float front, back, frac;
-	vec3_t mid;
-	qboolean r;
+#define SHADOW_CACHE_SIZE       1024    /* power of two */
+#define SHADOW_CACHE_WAYS       4       /* occluders kept per light and tile, most recent first */
 
+typedef struct shadowCacheEntry_s
+{
+	const light_t               *light;
+	int tile;
+	qboolean missed;                    /* skip lookups until the next occluder, the samples are likely lit */
+	traceTriangle_t             *tt[ SHADOW_CACHE_WAYS ];
+}
+shadowCacheEntry_t;
 
-	/* bogus node number means solid, end tracing unless testing all */
-	if ( nodeNum < 0 ) {
-		VectorCopy( origin, trace->hit );
-		trace->passSolid = qtrue;
-		return qtrue;
+struct shadowCache_s
+{
+	shadowCacheEntry_t entries[ SHADOW_CACHE_SIZE ];
+	int lookups, hits;
+};
+
+static shadowCache_t *shadowCaches;
+static int numShadowCaches;
+
+
+
+/*
+   AllocShadowCaches()
+   makes one empty shadow cache per thread
+ */
+
+static void AllocShadowCaches( void ){
+	free( shadowCaches );
+	numShadowCaches = numthreads > 1 ? numthreads : 1;
+	shadowCaches = safe_malloc( numShadowCaches * sizeof( *shadowCaches ) );
+	memset( shadowCaches, 0, numShadowCaches * sizeof( *shadowCaches ) );
+}
+
+
+
+/*
+   ThreadShadowCache()
+   returns the calling thread's shadow cache emptied for the next raw lightmap, or NULL when it is disabled
+ */
+
+shadowCache_t *ThreadShadowCache( void ){
+	int i = ThreadNum();
+
+	if ( !useShadowCache || i < 0 || i >= numShadowCaches ) {
+		return NULL;
+	}
+	memset( shadowCaches[ i ].entries, 0, sizeof( shadowCaches[ i ].entries ) );
+	return &shadowCaches[ i ];
+}
+
+
+
+/*
+   ShadowCacheStats()
+   prints the shadow cache hit rate since the last call and empties the caches
+ */
+
+void ShadowCacheStats( void ){
+	int i, lookups, hits;
+
+
+	if ( shadowCaches == NULL || !useShadowCache ) {
+		return;
+	}
+
+	lookups = 0;
+	hits = 0;
+	for ( i = 0; i < numShadowCaches; i++ )
+	{
+		lookups += shadowCaches[ i ].lookups;
+		hits += shadowCaches[ i ].hits;
+	}
+	Sys_FPrintf( SYS_VRB, "%9d shadow cache lookups\n", lookups );
+	Sys_FPrintf( SYS_VRB, "%9d traces saved by the shadow cache (%.1f percent hit)\n", hits, lookups > 0 ? 100.0f * hits / lookups : 0.0f );
+
+	/* the lights are rebuilt between passes */
+	memset( shadowCaches, 0, numShadowCaches * sizeof( *shadowCaches ) );
+}
+
+
+
+/*
+   ShadowCacheEntry()
+   returns the cache slot for the light and tile of a trace
+ */
+
+static inline shadowCacheEntry_t *ShadowCacheEntry( trace_t *trace ){
+	unsigned int hash;
+
+
+	hash = (unsigned int) ( (size_t) trace->light >> 4 ) * 2654435761u + (unsigned int) trace->shadowTile * 40503u;
+	return &trace->shadowCache->entries[ ( hash >> 16 ) & ( SHADOW_CACHE_SIZE - 1 ) ];
+}
+
+
+
+/*
+   TraceShadowCache()
+   tests the last occluder of the trace's light and tile, returns qtrue if it blocks this trace too
+   only hits inside the triangle count, the tree walk never sees the epsilon fringe past its edges
+   when that reaches into a leaf the triangle isn't filtered into
+ */
+
+static qboolean TraceShadowCache( trace_t *trace ){
+	int i;
+	shadowCacheEntry_t  *entry;
+	traceTriangle_t     *tt;
+
+
+	entry = ShadowCacheEntry( trace );
+	if ( entry->light != trace->light || entry->tile != trace->shadowTile || entry->tt[ 0 ] == NULL || entry->missed ) {
+		return qfalse;
+	}
+	trace->shadowCache->lookups++;
+	for ( i = 0; i < SHADOW_CACHE_WAYS && entry->tt[ i ] != NULL; i++ )
+	{
+		if ( TraceTriangleBary( &traceInfos[ entry->tt[ i ]->infoNum ], entry->tt[ i ], trace, 0.0f ) ) {
+			break;
+		}
+	}
+	if ( i >= SHADOW_CACHE_WAYS || entry->tt[ i ] == NULL ) {
+		entry->missed = qtrue;
+		return qfalse;
+	}
+
+	/* move it to the front */
+	tt = entry->tt[ i ];
+	for ( ; i > 0; i-- )
+		entry->tt[ i ] = entry->tt[ i - 1 ];
+	entry->tt[ 0 ] = tt;
+	trace->shadowCache->hits++;
+	return qtrue;
+}
+
+
+
+/*
+   StoreShadowCache()
+   remembers the triangle that blocked a trace; filtering surfaces are left out, testing one
+   ahead of the full trace could tint the trace twice
+ */
+
+static void StoreShadowCache( trace_t *trace, traceTriangle_t *tt ){
+	shadowCacheEntry_t  *entry;
+
+
+	if ( trace->shadowCache == NULL || ( traceInfos[ tt->infoNum ].si->compileFlags & ( C_ALPHASHADOW | C_LIGHTFILTER ) ) ) {
+		return;
+	}
+	entry = ShadowCacheEntry( trace );
+	if ( entry->light != trace->light || entry->tile != trace->shadowTile ) {
+		memset( entry, 0, sizeof( *entry ) );
+		entry->light = trace->light;
+		entry->tile = trace->shadowTile;
+	}
+	memmove( &entry->tt[ 1 ], &entry->tt[ 0 ], ( SHADOW_CACHE_WAYS - 1 ) * sizeof( entry->tt[ 0 ] ) );
+	entry->tt[ 0 ] = tt;
+	entry->missed = qfalse;
+}
+
+
+
+
+/*
+   TraceLine_r()
+   returns qtrue if something is hit and tracing can stop
+ */
+
+static qboolean TraceLine_r( int nodeNum, vec3_t origin, vec3_t end, trace_t *trace ){
+	traceNode_t     *node;
+	int side;
+	float front, back, frac;
+	vec3_t mid;
+	qboolean r;
+
+
+	/* bogus node number means solid, end tracing unless testing all */
+	if ( nodeNum < 0 ) {
+		VectorCopy( origin, trace->hit );
+		trace->passSolid = qtrue;
+		return qtrue;
 	}
 
 	/* get node */
@@ -1728,6 +2277,214 @@ static qboolean TraceLine_r( int nodeNum, vec3_t origin, vec3_t end, trace_t *tr
 
 
 
+/*
+   TraceLineSolid_r()
+   walks the bsp part of the trace node tree for solid space only, used with -bvh
+   returns qtrue if the trace passes through solid space
+ */
+
+static qboolean TraceLineSolid_r( int nodeNum, vec3_t origin, vec3_t end, trace_t *trace ){
+	traceNode_t     *node;
+	int side;
+	float front, back, frac;
+	vec3_t mid;
+
+
+	/* bogus node number or solid node means solid */
+	if ( nodeNum < 0 || traceNodes[ nodeNum ].type == TRACE_LEAF_SOLID ) {
+		VectorCopy( origin, trace->hit );
+		trace->passSolid = qtrue;
+		return qtrue;
+	}
+
+	/* get node */
+	node = &traceNodes[ nodeNum ];
+
+	/* leafnodes, and leafnodes split up by SubdivideTraceNode_r(), hold no solid space */
+	if ( node->type < 0 || node->children[ 0 ] >= numBSPTraceNodes ) {
+		return qfalse;
+	}
+
+	/* don't test branches of the bsp with nothing in them when testall is enabled */
+	if ( trace->testAll && node->numItems == 0 ) {
+		return qfalse;
+	}
+
+	/* classify beginning and end points */
+	switch ( node->type )
+	{
+	case PLANE_X:
+	case PLANE_Y:
+	case PLANE_Z:
+		front = origin[ node->type ] - node->plane[ 3 ];
+		back = end[ node->type ] - node->plane[ 3 ];
+		break;
+
+	default:
+		front = DotProduct( origin, node->plane ) - node->plane[ 3 ];
+		back = DotProduct( end, node->plane ) - node->plane[ 3 ];
+		break;
+	}
+
+	/* entirely in front side? */
+	if ( front >= -TRACE_ON_EPSILON && back >= -TRACE_ON_EPSILON ) {
+		return TraceLineSolid_r( node->children[ 0 ], origin, end, trace );
+	}
+
+	/* entirely on back side? */
+	if ( front < TRACE_ON_EPSILON && back < TRACE_ON_EPSILON ) {
+		return TraceLineSolid_r( node->children[ 1 ], origin, end, trace );
+	}
+
+	/* select side */
+	side = front < 0;
+
+	/* calculate intercept point */
+	frac = front / ( front - back );
+	mid[ 0 ] = origin[ 0 ] + ( end[ 0 ] - origin[ 0 ] ) * frac;
+	mid[ 1 ] = origin[ 1 ] + ( end[ 1 ] - origin[ 1 ] ) * frac;
+	mid[ 2 ] = origin[ 2 ] + ( end[ 2 ] - origin[ 2 ] ) * frac;
+
+	/* trace both sides */
+	if ( TraceLineSolid_r( node->children[ side ], origin, mid, trace ) ) {
+		return qtrue;
+	}
+	return TraceLineSolid_r( node->children[ !side ], mid, end, trace );
+}
+
+
+
+/*
+   TraceBVH()
+   tests a trace against the triangles of a bvh, nearer children first
+   returns qtrue if the trace is occluded
+ */
+
+static qboolean TraceBVH( traceBVH_t *bvh, trace_t *trace ){
+	int i, nodeNum, stackDepth, stack[ BVH_MAX_DEPTH ];
+	float tNear, tFar, t0, t1;
+	vec3_t invDirection;
+	traceBVHNode_t  *node;
+	traceTriangle_t *tt;
+
+
+	/* empty? */
+	if ( bvh->numNodes <= 0 ) {
+		return qfalse;
+	}
+
+	/* setup */
+	for ( i = 0; i < 3; i++ )
+		invDirection[ i ] = 1.0f / trace->direction[ i ];
+	nodeNum = 0;
+	stackDepth = 0;
+
+	/* walk nodes */
+	while ( 1 )
+	{
+		node = &bvh->nodes[ nodeNum ];
+
+		/* slab test the node bounds against the trace segment */
+		tNear = 0.0f;
+		tFar = trace->distance;
+		for ( i = 0; i < 3; i++ )
+		{
+			t0 = ( node->mins[ i ] - trace->origin[ i ] ) * invDirection[ i ];
+			t1 = ( node->maxs[ i ] - trace->origin[ i ] ) * invDirection[ i ];
+			if ( t0 > t1 ) {
+				tNear = t1 > tNear ? t1 : tNear;
+				tFar = t0 < tFar ? t0 : tFar;
+			}
+			else
+			{
+				tNear = t0 > tNear ? t0 : tNear;
+				tFar = t1 < tFar ? t1 : tFar;
+			}
+		}
+
+		/* missed */
+		if ( tNear > tFar ) {
+			if ( stackDepth == 0 ) {
+				return qfalse;
+			}
+			nodeNum = stack[ --stackDepth ];
+			continue;
+		}
+
+		/* leaf */
+		if ( node->numTriangles > 0 ) {
+			for ( i = 0, tt = &bvh->triangles[ node->offset ]; i < node->numTriangles; i++, tt++ )
+			{
+				if ( TraceTriangle( &traceInfos[ tt->infoNum ], tt, trace ) ) {
+					StoreShadowCache( trace, tt );
+					return qtrue;
+				}
+			}
+			if ( stackDepth == 0 ) {
+				return qfalse;
+			}
+			nodeNum = stack[ --stackDepth ];
+			continue;
+		}
+
+		/* visit the near child first */
+		if ( trace->direction[ node->axis ] < 0.0f ) {
+			stack[ stackDepth++ ] = nodeNum + 1;
+			nodeNum = node->offset;
+		}
+		else
+		{
+			stack[ stackDepth++ ] = node->offset;
+			nodeNum++;
+		}
+	}
+}
+
+
+
+/*
+   TraceLineBVH()
+   the -bvh version of TraceLine()
+ */
+
+static void TraceLineBVH( trace_t *trace ){
+	qboolean traceSky;
+	float distance;
+	vec3_t delta;
+
+
+	/* trace through solid space */
+	TraceLineSolid_r( headNodeNum, trace->origin, trace->end, trace );
+	if ( trace->passSolid && !trace->testAll ) {
+		trace->opaque = qtrue;
+		return;
+	}
+
+	/* skip surfaces? */
+	if ( noSurfaces ) {
+		return;
+	}
+
+	/* testall means trace through sky (same test as TraceLine()) */
+	traceSky = ( trace->testAll && trace->compileFlags & C_SKY &&
+	             ( trace->numSurfaces == 0 || surfaceInfos[ trace->surfaces[ 0 ] ].childSurfaceNum < 0 ) );
+
+	/* don't look for surfaces behind solid space */
+	distance = trace->distance;
+	if ( trace->passSolid ) {
+		VectorSubtract( trace->hit, trace->origin, delta );
+		trace->distance = VectorLength( delta );
+	}
+
+	/* walk the bvh */
+	if ( !TraceBVH( &headBVH, trace ) && traceSky ) {
+		TraceBVH( &skyboxBVH, trace );
+	}
+	trace->distance = distance;
+}
+
+
+
 /*
    TraceLine() - ydnar
    rewrote this function a bit :)
@@ -1751,6 +2508,17 @@ void TraceLine( trace_t *trace ){
 		return;
 	}
 
+	/* blocked by the last occluder? */
+	if ( trace->shadowCache != NULL && !noSurfaces && TraceShadowCache( trace ) ) {
+		return;
+	}
+
+	/* use the bvh? */
+	if ( traceBVH ) {
+		TraceLineBVH( trace );
+		return;
+	}
+
 	/* trace through nodes */
 	TraceLine_r( headNodeNum, trace->origin, trace->end, trace );
 	if ( trace->passSolid && !trace->testAll ) {
@@ -1783,6 +2551,7 @@ void TraceLine( trace_t *trace ){
 			tt = &traceTriangles[ node->items[ j ] ];
 			ti = &traceInfos[ tt->infoNum ];
 			if ( TraceTriangle( ti, tt, trace ) ) {
+				StoreShadowCache( trace, tt );
 				return;
 			}
 			//%	if( TraceWinding( &traceWindings[ node->items[ j ] ], trace ) )
@@ -1793,6 +2562,618 @@ void TraceLine( trace_t *trace ){
 
 
 
+/*
+   TraceBenchmark()
+   traces the same random rays with the trace nodes and the bvh and prints the ray throughput of both
+ */
+
+#define TRACE_BENCHMARK_RAYS    65536
+
+static void TraceBenchmark( void ){
+	int i, j, pass, seed, numOpaque[ 2 ];
+	double seconds[ 2 ];
+	clock_t start;
+	qboolean bvh;
+	trace_t trace;
+
+
+	/* note it */
+	Sys_FPrintf( SYS_VRB, "--- TraceBenchmark ---\n" );
+
+	/* setup */
+	memset( &trace, 0, sizeof( trace ) );
+	trace.testOcclusion = qtrue;
+	trace.recvShadows = WORLDSPAWN_RECV_SHADOWS;
+	trace.inhibitRadius = DEFAULT_INHIBIT_RADIUS;
+
+	/* trace the same rays both ways */
+	bvh = traceBVH;
+	for ( pass = 0; pass < 2; pass++ )
+	{
+		traceBVH = pass ? qtrue : qfalse;
+		numOpaque[ pass ] = 0;
+		seed = 1;
+		start = clock();
+		for ( i = 0; i < TRACE_BENCHMARK_RAYS; i++ )
+		{
+			/* random segment inside the world bounds */
+			for ( j = 0; j < 3; j++ )
+			{
+				seed = seed * 1103515245 + 12345;
+				trace.origin[ j ] = bspModels[ 0 ].mins[ j ] + ( bspModels[ 0 ].maxs[ j ] - bspModels[ 0 ].mins[ j ] ) * ( ( seed >> 16 ) & 0x7FFF ) / 32767.0f;
+				seed = seed * 1103515245 + 12345;
+				trace.end[ j ] = bspModels[ 0 ].mins[ j ] + ( bspModels[ 0 ].maxs[ j ] - bspModels[ 0 ].mins[ j ] ) * ( ( seed >> 16 ) & 0x7FFF ) / 32767.0f;
+			}
+			SetupTrace( &trace );
+			VectorSet( trace.color, 1.0f, 1.0f, 1.0f );
+
+			/* trace */
+			TraceLine( &trace );
+			if ( trace.opaque ) {
+				numOpaque[ pass ]++;
+			}
+		}
+		seconds[ pass ] = (double) ( clock() - start ) / CLOCKS_PER_SEC;
+		if ( seconds[ pass ] <= 0.0 ) {
+			seconds[ pass ] = 1.0 / CLOCKS_PER_SEC;
+		}
+	}
+	traceBVH = bvh;
+
+	/* emit some stats */
+	Sys_Printf( "%9d benchmark rays (%d occluded with trace nodes, %d with bvh)\n", TRACE_BENCHMARK_RAYS, numOpaque[ 0 ], numOpaque[ 1 ] );
+	Sys_Printf( "%9.0f rays/sec with trace nodes\n", TRACE_BENCHMARK_RAYS / seconds[ 0 ] );
+	Sys_Printf( "%9.0f rays/sec with bvh (%.2fx)\n", TRACE_BENCHMARK_RAYS / seconds[ 1 ], seconds[ 0 ] / seconds[ 1 ] );
+}
+
+
+
+/* -------------------------------------------------------------------------------
+
+   packet raytracer
+
+   ------------------------------------------------------------------------------- */
+
+/*
+   the packet tracer walks the trace nodes and tests the leaf triangles for several
+   rays at once. each ray still visits its leaf nodes and triangles in the same
+   order as TraceLine(), so it stops at the same occluder with the same results
+ */
+
+#if defined( __AVX__ )
+
+#include <immintrin.h>
+
+#define PACKET_WIDTH            8
+
+typedef __m256 packetFloat_t;
+
+static const union { unsigned int u[ 4 ]; float f[ 4 ]; } packetLaneMasks[ 16 ] =
+{
+	{ { 0, 0, 0, 0 } }, { { ~0u, 0, 0, 0 } }, { { 0, ~0u, 0, 0 } }, { { ~0u, ~0u, 0, 0 } },
+	{ { 0, 0, ~0u, 0 } }, { { ~0u, 0, ~0u, 0 } }, { { 0, ~0u, ~0u, 0 } }, { { ~0u, ~0u, ~0u, 0 } },
+	{ { 0, 0, 0, ~0u } }, { { ~0u, 0, 0, ~0u } }, { { 0, ~0u, 0, ~0u } }, { { ~0u, ~0u, 0, ~0u } },
+	{ { 0, 0, ~0u, ~0u } }, { { ~0u, 0, ~0u, ~0u } }, { { 0, ~0u, ~0u, ~0u } }, { { ~0u, ~0u, ~0u, ~0u } }
+};
+
+#define PF_Set1( a )            _mm256_set1_ps( a )
+#define PF_Load( p )            _mm256_loadu_ps( p )
+#define PF_Store( p, a )        _mm256_storeu_ps( p, a )
+#define PF_Add( a, b )          _mm256_add_ps( a, b )
+#define PF_Sub( a, b )          _mm256_sub_ps( a, b )
+#define PF_Mul( a, b )          _mm256_mul_ps( a, b )
+#define PF_Div( a, b )          _mm256_div_ps( a, b )
+#define PF_Abs( a )             _mm256_andnot_ps( _mm256_set1_ps( -0.0f ), a )
+#define PF_MaskLT( a, b )       _mm256_movemask_ps( _mm256_cmp_ps( a, b, _CMP_LT_OQ ) )
+#define PF_MaskLE( a, b )       _mm256_movemask_ps( _mm256_cmp_ps( a, b, _CMP_LE_OQ ) )
+#define PF_MaskGT( a, b )       _mm256_movemask_ps( _mm256_cmp_ps( a, b, _CMP_GT_OQ ) )
+#define PF_MaskGE( a, b )       _mm256_movemask_ps( _mm256_cmp_ps( a, b, _CMP_GE_OQ ) )
+#define PF_Select( a, b, lanes )    _mm256_blendv_ps( a, b, _mm256_insertf128_ps( _mm256_castps128_ps256( _mm_loadu_ps( packetLaneMasks[ ( lanes ) & 15 ].f ) ), _mm_loadu_ps( packetLaneMasks[ ( ( lanes ) >> 4 ) & 15 ].f ), 1 ) )
+
+#elif defined( __SSE__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 1 )
+
+#include <xmmintrin.h>
+
+#define PACKET_WIDTH            4
+
+typedef __m128 packetFloat_t;
+
+static const union { unsigned int u[ 4 ]; float f[ 4 ]; } packetLaneMasks[ 16 ] =
+{
+	{ { 0, 0, 0, 0 } }, { { ~0u, 0, 0, 0 } }, { { 0, ~0u, 0, 0 } }, { { ~0u, ~0u, 0, 0 } },
+	{ { 0, 0, ~0u, 0 } }, { { ~0u, 0, ~0u, 0 } }, { { 0, ~0u, ~0u, 0 } }, { { ~0u, ~0u, ~0u, 0 } },
+	{ { 0, 0, 0, ~0u } }, { { ~0u, 0, 0, ~0u } }, { { 0, ~0u, 0, ~0u } }, { { ~0u, ~0u, 0, ~0u } },
+	{ { 0, 0, ~0u, ~0u } }, { { ~0u, 0, ~0u, ~0u } }, { { 0, ~0u, ~0u, ~0u } }, { { ~0u, ~0u, ~0u, ~0u } }
+};
+
+#define PF_Set1( a )            _mm_set1_ps( a )
+#define PF_Load( p )            _mm_loadu_ps( p )
+#define PF_Store( p, a )        _mm_storeu_ps( p, a )
+#define PF_Add( a, b )          _mm_add_ps( a, b )
+#define PF_Sub( a, b )          _mm_sub_ps( a, b )
+#define PF_Mul( a, b )          _mm_mul_ps( a, b )
+#define PF_Div( a, b )          _mm_div_ps( a, b )
+#define PF_Abs( a )             _mm_andnot_ps( _mm_set1_ps( -0.0f ), a )
+#define PF_MaskLT( a, b )       _mm_movemask_ps( _mm_cmplt_ps( a, b ) )
+#define PF_MaskLE( a, b )       _mm_movemask_ps( _mm_cmple_ps( a, b ) )
+#define PF_MaskGT( a, b )       _mm_movemask_ps( _mm_cmpgt_ps( a, b ) )
+#define PF_MaskGE( a, b )       _mm_movemask_ps( _mm_cmpge_ps( a, b ) )
+
+static inline packetFloat_t PF_Select( packetFloat_t a, packetFloat_t b, int lanes ){
+	packetFloat_t m = _mm_loadu_ps( packetLaneMasks[ lanes & 15 ].f );
+	return _mm_or_ps( _mm_and_ps( m, b ), _mm_andnot_ps( m, a ) );
+}
+
+#else
+
+/* scalar fallback for targets without sse */
+#define PACKET_WIDTH            4
+
+typedef struct packetFloat_s
+{
+	float f[ PACKET_WIDTH ];
+}
+packetFloat_t;
+
+static inline packetFloat_t PF_Set1( float a ){
+	packetFloat_t r;
+	int i;
+	for ( i = 0; i < PACKET_WIDTH; i++ )
+		r.f[ i ] = a;
+	return r;
+}
+
+static inline packetFloat_t PF_Load( const float *p ){
+	packetFloat_t r;
+	memcpy( r.f, p, sizeof( r.f ) );
+	return r;
+}
+
+static inline void PF_Store( float *p, packetFloat_t a ){
+	memcpy( p, a.f, sizeof( a.f ) );
+}
+
+#define PF_OP( name, expr ) \
+	static inline packetFloat_t name( packetFloat_t a, packetFloat_t b ){ \
+		packetFloat_t r; \
+		int i; \
+		for ( i = 0; i < PACKET_WIDTH; i++ ) \
+			r.f[ i ] = expr; \
+		return r; \
+	}
+#define PF_CMP( name, expr ) \
+	static inline int name( packetFloat_t a, packetFloat_t b ){ \
+		int i, r = 0; \
+		for ( i = 0; i < PACKET_WIDTH; i++ ) \
+			if ( expr ) { \
+				r |= 1 << i; } \
+		return r; \
+	}
+
+PF_OP( PF_Add, a.f[ i ] + b.f[ i ] )
+PF_OP( PF_Sub, a.f[ i ] - b.f[ i ] )
+PF_OP( PF_Mul, a.f[ i ] * b.f[ i ] )
+PF_OP( PF_Div, a.f[ i ] / b.f[ i ] )
+PF_CMP( PF_MaskLT, a.f[ i ] < b.f[ i ] )
+PF_CMP( PF_MaskLE, a.f[ i ] <= b.f[ i ] )
+PF_CMP( PF_MaskGT, a.f[ i ] > b.f[ i ] )
+PF_CMP( PF_MaskGE, a.f[ i ] >= b.f[ i ] )
+
+static inline packetFloat_t PF_Abs( packetFloat_t a ){
+	int i;
+	for ( i = 0; i < PACKET_WIDTH; i++ )
+		a.f[ i ] = fabs( a.f[ i ] );
+	return a;
+}
+
+static inline packetFloat_t PF_Select( packetFloat_t a, packetFloat_t b, int lanes ){
+	int i;
+	for ( i = 0; i < PACKET_WIDTH; i++ )
+		if ( lanes & ( 1 << i ) ) {
+			a.f[ i ] = b.f[ i ];
+		}
+	return a;
+}
+
+#endif
+
+
+typedef struct tracePacket_s
+{
+	int numTraces;
+	trace_t                     *traces[ PACKET_WIDTH ];
+
+	int active;                         /* lanes still walking the trace nodes */
+	int testAll;                        /* lanes with testAll set */
+
+	/* leaf nodes in visiting order, with the lanes that visit them */
+	int numLeafs;
+	int leafs[ PACKET_WIDTH * MAX_TRACE_TEST_NODES ];
+	int leafLanes[ PACKET_WIDTH * MAX_TRACE_TEST_NODES ];
+
+	/* ray data, one column per lane */
+	float origin[ 3 ][ PACKET_WIDTH ];
+	float end[ 3 ][ PACKET_WIDTH ];
+	float direction[ 3 ][ PACKET_WIDTH ];
+	float inhibitRadius[ PACKET_WIDTH ];
+	float distance[ PACKET_WIDTH ];
+}
+tracePacket_t;
+
+
+
+/*
+   TracePacketSegment()
+   selects per lane between two sets of segment points
+ */
+
+static void TracePacketSegment( float out[ 3 ][ PACKET_WIDTH ], float a[ 3 ][ PACKET_WIDTH ], float b[ 3 ][ PACKET_WIDTH ], int lanes ){
+	int k;
+
+
+	for ( k = 0; k < 3; k++ )
+		PF_Store( out[ k ], PF_Select( PF_Load( a[ k ] ), PF_Load( b[ k ] ), lanes ) );
+}
+
+
+
+/*
+   TracePacket_r()
+   packet version of TraceLine_r(), walks the given lanes through the trace nodes
+ */
+
+static void TracePacket_r( tracePacket_t *tp, int nodeNum, int lanes, float origin[ 3 ][ PACKET_WIDTH ], float end[ 3 ][ PACKET_WIDTH ] ){
+	int i, k, frontLanes, backLanes, splitLanes, flipLanes, nearLanes, leafLanes;
+	traceNode_t     *node;
+	trace_t         *trace;
+	packetFloat_t o[ 3 ], e[ 3 ], front, back, dist, frac;
+	float mid[ 3 ][ PACKET_WIDTH ], segOrigin[ 3 ][ PACKET_WIDTH ], segEnd[ 3 ][ PACKET_WIDTH ];
+
+
+	/* lanes that hit something solid are done */
+	lanes &= tp->active;
+	if ( lanes == 0 ) {
+		return;
+	}
+
+	/* bogus node number or solid node means solid, end tracing for these lanes */
+	if ( nodeNum < 0 || traceNodes[ nodeNum ].type == TRACE_LEAF_SOLID ) {
+		for ( i = 0; i < tp->numTraces; i++ )
+		{
+			if ( lanes & ( 1 << i ) ) {
+				trace = tp->traces[ i ];
+				for ( k = 0; k < 3; k++ )
+					trace->hit[ k ] = origin[ k ][ i ];
+				trace->passSolid = qtrue;
+			}
+		}
+		tp->active &= ~lanes;
+		return;
+	}
+
+	/* get node */
+	node = &traceNodes[ nodeNum ];
+
+	/* leafnode? */
+	if ( node->type < 0 ) {
+		/* note leaf for each lane */
+		if ( node->numItems > 0 ) {
+			leafLanes = 0;
+			for ( i = 0; i < tp->numTraces; i++ )
+			{
+				trace = tp->traces[ i ];
+				if ( ( lanes & ( 1 << i ) ) && trace->numTestNodes < MAX_TRACE_TEST_NODES ) {
+					trace->testNodes[ trace->numTestNodes++ ] = nodeNum;
+					leafLanes |= ( 1 << i );
+				}
+			}
+			if ( leafLanes ) {
+				tp->leafs[ tp->numLeafs ] = nodeNum;
+				tp->leafLanes[ tp->numLeafs ] = leafLanes;
+				tp->numLeafs++;
+			}
+		}
+		return;
+	}
+
+	/* don't test branches of the bsp with nothing in them when testall is enabled */
+	if ( node->numItems == 0 ) {
+		lanes &= ~tp->testAll;
+		if ( lanes == 0 ) {
+			return;
+		}
+	}
+
+	/* classify beginning and end points */
+	for ( k = 0; k < 3; k++ )
+	{
+		o[ k ] = PF_Load( origin[ k ] );
+		e[ k ] = PF_Load( end[ k ] );
+	}
+	dist = PF_Set1( node->plane[ 3 ] );
+	switch ( node->type )
+	{
+	case PLANE_X:
+	case PLANE_Y:
+	case PLANE_Z:
+		front = PF_Sub( o[ node->type ], dist );
+		back = PF_Sub( e[ node->type ], dist );
+		break;
+
+	default:
+		front = PF_Sub( PF_Add( PF_Add( PF_Mul( o[ 0 ], PF_Set1( node->plane[ 0 ] ) ), PF_Mul( o[ 1 ], PF_Set1( node->plane[ 1 ] ) ) ), PF_Mul( o[ 2 ], PF_Set1( node->plane[ 2 ] ) ) ), dist );
+		back = PF_Sub( PF_Add( PF_Add( PF_Mul( e[ 0 ], PF_Set1( node->plane[ 0 ] ) ), PF_Mul( e[ 1 ], PF_Set1( node->plane[ 1 ] ) ) ), PF_Mul( e[ 2 ], PF_Set1( node->plane[ 2 ] ) ) ), dist );
+		break;
+	}
+
+	/* entirely in front side / entirely on back side / split */
+	frontLanes = lanes & PF_MaskGE( front, PF_Set1( -TRACE_ON_EPSILON ) ) & PF_MaskGE( back, PF_Set1( -TRACE_ON_EPSILON ) );
+	backLanes = lanes & ~frontLanes & PF_MaskLT( front, PF_Set1( TRACE_ON_EPSILON ) ) & PF_MaskLT( back, PF_Set1( TRACE_ON_EPSILON ) );
+	splitLanes = lanes & ~( frontLanes | backLanes );
+
+	/* coherent packet, no splitting */
+	if ( splitLanes == 0 ) {
+		TracePacket_r( tp, node->children[ 0 ], frontLanes, origin, end );
+		TracePacket_r( tp, node->children[ 1 ], backLanes, origin, end );
+		return;
+	}
+
+	/* select side (flipped lanes start on the back side) */
+	flipLanes = splitLanes & PF_MaskLT( front, PF_Set1( 0.0f ) );
+	nearLanes = splitLanes & ~flipLanes;
+
+	/* calculate intercept points */
+	frac = PF_Div( front, PF_Sub( front, back ) );
+	for ( k = 0; k < 3; k++ )
+		PF_Store( mid[ k ], PF_Add( o[ k ], PF_Mul( PF_Sub( e[ k ], o[ k ] ), frac ) ) );
+
+	/* every lane keeps its own near-to-far order, only lanes crossing the other way need a third visit */
+	if ( nearLanes != 0 || flipLanes == 0 ) {
+		TracePacketSegment( segEnd, end, mid, nearLanes );
+		TracePacket_r( tp, node->children[ 0 ], frontLanes | nearLanes, origin, segEnd );
+
+		TracePacketSegment( segOrigin, origin, mid, nearLanes );
+		TracePacketSegment( segEnd, end, mid, flipLanes );
+		TracePacket_r( tp, node->children[ 1 ], backLanes | nearLanes | flipLanes, segOrigin, segEnd );
+
+		if ( flipLanes ) {
+			TracePacket_r( tp, node->children[ 0 ], flipLanes, mid, end );
+		}
+	}
+	else
+	{
+		TracePacketSegment( segEnd, end, mid, flipLanes );
+		TracePacket_r( tp, node->children[ 1 ], backLanes | flipLanes, origin, segEnd );
+
+		TracePacketSegment( segOrigin, origin, mid, flipLanes );
+		TracePacket_r( tp, node->children[ 0 ], frontLanes | flipLanes, segOrigin, end );
+	}
+}
+
+
+
+/*
+   TraceTrianglePacket()
+   vectorized moller-trumbore test of one triangle against the given lanes,
+   returns the lanes that cross it, see TraceTriangle()
+ */
+
+static int TraceTrianglePacket( tracePacket_t *tp, traceTriangle_t *tt, int lanes, float u[ PACKET_WIDTH ], float v[ PACKET_WIDTH ], float depth[ PACKET_WIDTH ] ){
+	int k, miss;
+	packetFloat_t dir[ 3 ], edge1[ 3 ], edge2[ 3 ], tvec[ 3 ], pvec[ 3 ], qvec[ 3 ];
+	packetFloat_t det, invDet, pu, pv, pdepth;
+
+
+	for ( k = 0; k < 3; k++ )
+	{
+		dir[ k ] = PF_Load( tp->direction[ k ] );
+		edge1[ k ] = PF_Set1( tt->edge1[ k ] );
+		edge2[ k ] = PF_Set1( tt->edge2[ k ] );
+	}
+
+	/* begin calculating determinant - also used to calculate u parameter */
+	pvec[ 0 ] = PF_Sub( PF_Mul( dir[ 1 ], edge2[ 2 ] ), PF_Mul( dir[ 2 ], edge2[ 1 ] ) );
+	pvec[ 1 ] = PF_Sub( PF_Mul( dir[ 2 ], edge2[ 0 ] ), PF_Mul( dir[ 0 ], edge2[ 2 ] ) );
+	pvec[ 2 ] = PF_Sub( PF_Mul( dir[ 0 ], edge2[ 1 ] ), PF_Mul( dir[ 1 ], edge2[ 0 ] ) );
+
+	/* if determinant is near zero, trace lies in plane of triangle */
+	det = PF_Add( PF_Add( PF_Mul( edge1[ 0 ], pvec[ 0 ] ), PF_Mul( edge1[ 1 ], pvec[ 1 ] ) ), PF_Mul( edge1[ 2 ], pvec[ 2 ] ) );
+	lanes &= ~PF_MaskLT( PF_Abs( det ), PF_Set1( COPLANAR_EPSILON ) );
+	if ( lanes == 0 ) {
+		return 0;
+	}
+	invDet = PF_Div( PF_Set1( 1.0f ), det );
+
+	/* calculate distance from first vertex to ray origin */
+	for ( k = 0; k < 3; k++ )
+		tvec[ k ] = PF_Sub( PF_Load( tp->origin[ k ] ), PF_Set1( tt->v[ 0 ].xyz[ k ] ) );
+
+	/* calculate u parameter and test bounds */
+	pu = PF_Mul( PF_Add( PF_Add( PF_Mul( tvec[ 0 ], pvec[ 0 ] ), PF_Mul( tvec[ 1 ], pvec[ 1 ] ) ), PF_Mul( tvec[ 2 ], pvec[ 2 ] ) ), invDet );
+	miss = PF_MaskLT( pu, PF_Set1( -BARY_EPSILON ) ) | PF_MaskGT( pu, PF_Set1( 1.0f + BARY_EPSILON ) );
+	lanes &= ~miss;
+	if ( lanes == 0 ) {
+		return 0;
+	}
+
+	/* prepare to test v parameter */
+	qvec[ 0 ] = PF_Sub( PF_Mul( tvec[ 1 ], edge1[ 2 ] ), PF_Mul( tvec[ 2 ], edge1[ 1 ] ) );
+	qvec[ 1 ] = PF_Sub( PF_Mul( tvec[ 2 ], edge1[ 0 ] ), PF_Mul( tvec[ 0 ], edge1[ 2 ] ) );
+	qvec[ 2 ] = PF_Sub( PF_Mul( tvec[ 0 ], edge1[ 1 ] ), PF_Mul( tvec[ 1 ], edge1[ 0 ] ) );
+
+	/* calculate v parameter and test bounds */
+	pv = PF_Mul( PF_Add( PF_Add( PF_Mul( dir[ 0 ], qvec[ 0 ] ), PF_Mul( dir[ 1 ], qvec[ 1 ] ) ), PF_Mul( dir[ 2 ], qvec[ 2 ] ) ), invDet );
+	miss = PF_MaskLT( pv, PF_Set1( -BARY_EPSILON ) ) | PF_MaskGT( PF_Add( pu, pv ), PF_Set1( 1.0f + BARY_EPSILON ) );
+	lanes &= ~miss;
+	if ( lanes == 0 ) {
+		return 0;
+	}
+
+	/* calculate t (depth) */
+	pdepth = PF_Mul( PF_Add( PF_Add( PF_Mul( edge2[ 0 ], qvec[ 0 ] ), PF_Mul( edge2[ 1 ], qvec[ 1 ] ) ), PF_Mul( edge2[ 2 ], qvec[ 2 ] ) ), invDet );
+	miss = PF_MaskLE( pdepth, PF_Load( tp->inhibitRadius ) ) | PF_MaskGE( pdepth, PF_Load( tp->distance ) );
+	lanes &= ~miss;
+
+	/* store lane results */
+	if ( lanes ) {
+		PF_Store( u, pu );
+		PF_Store( v, pv );
+		PF_Store( depth, pdepth );
+	}
+	return lanes;
+}
+
+
+
+/*
+   TraceLinePacket()
+   traces up to PACKET_WIDTH rays at once, larger batches are split up,
+   each trace gets the same result TraceLine() would give it
+ */
+
+void TraceLinePacket( trace_t **traces, int numTraces ){
+	int i, j, k, lanes, leafLanes, hitLanes, skyLanes;
+	traceNode_t     *node;
+	traceTriangle_t *tt;
+	traceInfo_t     *ti;
+	trace_t         *trace;
+	tracePacket_t tp;
+	float u[ PACKET_WIDTH ], v[ PACKET_WIDTH ], depth[ PACKET_WIDTH ];
+
+
+	/* the bvh traces one ray at a time */
+	if ( traceBVH ) {
+		for ( i = 0; i < numTraces; i++ )
+			TraceLine( traces[ i ] );
+		return;
+	}
+
+	/* split up wider batches */
+	while ( numTraces > PACKET_WIDTH )
+	{
+		TraceLinePacket( traces, PACKET_WIDTH );
+		traces += PACKET_WIDTH;
+		numTraces -= PACKET_WIDTH;
+	}
+
+	/* setup output and lanes (note: this code assumes the input data is completely filled out) */
+	memset( tp.origin, 0, sizeof( tp.origin ) );
+	memset( tp.end, 0, sizeof( tp.end ) );
+	memset( tp.direction, 0, sizeof( tp.direction ) );
+	memset( tp.inhibitRadius, 0, sizeof( tp.inhibitRadius ) );
+	memset( tp.distance, 0, sizeof( tp.distance ) );
+	tp.numTraces = numTraces;
+	tp.testAll = 0;
+	tp.numLeafs = 0;
+	lanes = 0;
+	for ( i = 0; i < numTraces; i++ )
+	{
+		trace = traces[ i ];
+		tp.traces[ i ] = trace;
+
+		trace->passSolid = qfalse;
+		trace->opaque = qfalse;
+		trace->compileFlags = 0;
+		trace->numTestNodes = 0;
+
+		/* early outs */
+		if ( !trace->recvShadows || !trace->testOcclusion || trace->distance <= 0.00001f ) {
+			continue;
+		}
+		if ( trace->shadowCache != NULL && !noSurfaces && TraceShadowCache( trace ) ) {
+			continue;
+		}
+		lanes |= ( 1 << i );
+		if ( trace->testAll ) {
+			tp.testAll |= ( 1 << i );
+		}
+
+		for ( k = 0; k < 3; k++ )
+		{
+			tp.origin[ k ][ i ] = trace->origin[ k ];
+			tp.end[ k ][ i ] = trace->end[ k ];
+			tp.direction[ k ][ i ] = trace->direction[ k ];
+		}
+		tp.inhibitRadius[ i ] = trace->inhibitRadius;
+		tp.distance[ i ] = trace->distance;
+	}
+	if ( lanes == 0 ) {
+		return;
+	}
+
+	/* trace through nodes */
+	tp.active = lanes;
+	TracePacket_r( &tp, headNodeNum, lanes, tp.origin, tp.end );
+	for ( i = 0; i < numTraces; i++ )
+	{
+		trace = traces[ i ];
+		if ( ( lanes & ( 1 << i ) ) && trace->passSolid && !trace->testAll ) {
+			trace->opaque = qtrue;
+			lanes &= ~( 1 << i );
+		}
+	}
+
+	/* skip surfaces? */
+	if ( noSurfaces ) {
+		return;
+	}
+
+	/* testall means trace through sky */
+	skyLanes = 0;
+	for ( i = 0; i < numTraces; i++ )
+	{
+		trace = traces[ i ];
+		if ( ( lanes & ( 1 << i ) ) && trace->testAll && trace->numTestNodes < MAX_TRACE_TEST_NODES &&
+		     trace->compileFlags & C_SKY &&
+		     ( trace->numSurfaces == 0 || surfaceInfos[ trace->surfaces[ 0 ] ].childSurfaceNum < 0 ) ) {
+			skyLanes |= ( 1 << i );
+		}
+	}
+	if ( skyLanes ) {
+		tp.active = skyLanes;
+		TracePacket_r( &tp, skyboxNodeNum, skyLanes, tp.origin, tp.end );
+	}
+
+	/* walk node list */
+	for ( i = 0; i < tp.numLeafs && lanes; i++ )
+	{
+		leafLanes = tp.leafLanes[ i ] & lanes;
+		if ( leafLanes == 0 ) {
+			continue;
+		}
+
+		/* get node */
+		node = &traceNodes[ tp.leafs[ i ] ];
+
+		/* walk node item list */
+		for ( j = 0; j < node->numItems && leafLanes; j++ )
+		{
+			tt = &traceTriangles[ node->items[ j ] ];
+			hitLanes = TraceTrianglePacket( &tp, tt, leafLanes, u, v, depth );
+			if ( hitLanes == 0 ) {
+				continue;
+			}
+
+			/* handle the hits in lane order */
+			ti = &traceInfos[ tt->infoNum ];
+			for ( k = 0; k < numTraces; k++ )
+			{
+				if ( !( hitLanes & ( 1 << k ) ) ) {
+					continue;
+				}
+				trace = traces[ k ];
+				if ( TraceTriangleFilter( ti, trace ) && TraceTriangleHit( ti, tt, trace, u[ k ], v[ k ], depth[ k ] ) ) {
+					StoreShadowCache( trace, tt );
+					leafLanes &= ~( 1 << k );
+					lanes &= ~( 1 << k );
+				}
+			}
+		}
+	}
+}
+
+
+
 /*
    SetupTrace() - ydnar
    sets up certain trace values
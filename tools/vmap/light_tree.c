@@ -0,0 +1,975 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+/* marker */
+#define LIGHT_TREE_C
+
+
+
+/* dependencies */
+#include "vmap.h"
+
+
+
+/*
+   light tree
+
+   -lighttree clusters the area lights made by CreateSurfaceLights() and
+   RadCreateDiffuseLights() into a binary tree. lights are only clustered with
+   lights of the same style, flags and facing. clusters are merged bottom up, each one
+   with its cheapest neighbour along a morton curve, cheapest meaning the least
+   power times squared size, with a penalty for diverging normals.
+
+   every raw lightmap then replaces the tree lights in its culled light list by
+   cuts through the tree, one per block of LIGHT_CUT_BLOCK squared superluxels.
+   only the listed lights are summed into the nodes, so pvs and plane culling
+   still hold. a cut starts at the roots and keeps splitting the node with the
+   largest error bound (power over squared distance to the block bounds) until
+   that bound drops below -lighttreeerror times the estimated total. a node left
+   in a cut is lit as its strongest listed light, scaled to the summed flux and
+   color of all listed lights below it. the light list gets the union of the
+   block cuts, and each light only lights the blocks whose cut holds it.
+ */
+
+#define LIGHT_TREE_WINDOW       8       /* neighbours searched on each side of a cluster */
+#define LIGHT_TREE_MIN_DIST     16.0f   /* matches the hot spot clamp of point lights */
+#define LIGHT_CUT_BLOCK         8       /* superluxels on each side of a block sharing a cut */
+
+typedef struct lightTreeNode_s
+{
+	int parent, children[ 2 ];
+	light_t             *light;         /* leaves only */
+	vec3_t mins, maxs;                  /* bounds of the emitting windings */
+	vec3_t normal;                      /* power weighted emitting direction */
+	float flux;                         /* area lights emit add times winding area */
+	float power;                        /* flux times brightest channel */
+	float envelope;                     /* largest leaf envelope plus the node diagonal */
+}
+lightTreeNode_t;
+
+typedef struct lightTreeSort_s
+{
+	light_t             *light;
+	int style, flags, facing;
+	unsigned int morton;
+}
+lightTreeSort_t;
+
+/* per thread cut state, every node is zero between cuts */
+typedef struct lightTreeWork_s
+{
+	int                 *count;         /* listed lights below the node */
+	int                 *rep;           /* strongest listed leaf below the node */
+	float               *flux;          /* summed flux of the listed lights */
+	vec3_t              *color;         /* summed flux times color */
+	float               *power;         /* summed power of the listed lights */
+	float               *bound;         /* heap key */
+	int                 *touched;
+	int                 *heap;
+	int                 *cut;
+	int                 *slot;          /* index in the union of the block cuts, -1 if not in it */
+	int                 *slotNodes;
+}
+lightTreeWork_t;
+
+static int numLightTreeNodes, numLightTreeLeafs, numLightTreeRoots;
+static lightTreeNode_t  *lightTreeNodes;
+static int              *lightTreeRoots;
+static int numLightTreeWorks;
+static lightTreeWork_t  *lightTreeWorks;
+
+/* cut statistics */
+static double lightTreeFull, lightTreeCut, lightTreeErrorSum;
+static float lightTreeErrorMax;
+static int numLightTreeCuts;
+
+
+
+/*
+   LightFlux()
+   how much an area light emits, bounce lights have no photons so go by add
+ */
+
+static float LightFlux( const light_t *light ){
+	if ( light->type != EMIT_AREA || light->w == NULL ) {
+		return 0.0f;
+	}
+	return light->add * WindingArea( light->w );
+}
+
+
+
+/*
+   LightPower()
+   brightness of a light for clustering and error bounds
+ */
+
+static float LightPower( const light_t *light ){
+	float c;
+
+
+	c = light->color[ 0 ];
+	if ( light->color[ 1 ] > c ) {
+		c = light->color[ 1 ];
+	}
+	if ( light->color[ 2 ] > c ) {
+		c = light->color[ 2 ];
+	}
+	return LightFlux( light ) * c;
+}
+
+
+
+/*
+   MortonCode()
+   interleaves three 10 bit coordinates
+ */
+
+static unsigned int MortonSpread( unsigned int v ){
+	v = ( v * 0x00010001u ) & 0xFF0000FFu;
+	v = ( v * 0x00000101u ) & 0x0F00F00Fu;
+	v = ( v * 0x00000011u ) & 0xC30C30C3u;
+	v = ( v * 0x00000005u ) & 0x49249249u;
+	return v;
+}
+
+static unsigned int MortonCode( const vec3_t point, const vec3_t mins, const vec3_t scale ){
+	int i;
+	unsigned int q[ 3 ];
+
+
+	for ( i = 0; i < 3; i++ )
+	{
+		float f = ( point[ i ] - mins[ i ] ) * scale[ i ];
+		q[ i ] = f <= 0.0f ? 0 : f >= 1023.0f ? 1023 : (unsigned int) f;
+	}
+	return ( MortonSpread( q[ 0 ] ) << 2 ) | ( MortonSpread( q[ 1 ] ) << 1 ) | MortonSpread( q[ 2 ] );
+}
+
+
+
+/*
+   LightFacing()
+   major axis an area light emits along, so walls on either side of a corner never share a cluster
+ */
+
+static int LightFacing( const light_t *light ){
+	int i, axis;
+
+
+	if ( light->type != EMIT_AREA ) {
+		return 0;
+	}
+	axis = 0;
+	for ( i = 1; i < 3; i++ )
+	{
+		if ( fabs( light->normal[ i ] ) > fabs( light->normal[ axis ] ) ) {
+			axis = i;
+		}
+	}
+	return 1 + axis * 2 + ( light->normal[ axis ] < 0.0f );
+}
+
+
+
+/*
+   CompareLightTreeSort()
+   qsort callback, groups lights by style, flags and facing, then along the morton curve
+ */
+
+static int CompareLightTreeSort( const void *a, const void *b ){
+	const lightTreeSort_t *sa = (const lightTreeSort_t*) a, *sb = (const lightTreeSort_t*) b;
+
+
+	if ( sa->style != sb->style ) {
+		return sa->style < sb->style ? -1 : 1;
+	}
+	if ( sa->flags != sb->flags ) {
+		return sa->flags < sb->flags ? -1 : 1;
+	}
+	if ( sa->facing != sb->facing ) {
+		return sa->facing < sb->facing ? -1 : 1;
+	}
+	if ( sa->morton != sb->morton ) {
+		return sa->morton < sb->morton ? -1 : 1;
+	}
+	return 0;
+}
+
+
+
+/*
+   LightTreeMetric()
+   cost of merging two clusters
+ */
+
+static float LightTreeMetric( const lightTreeNode_t *a, const lightTreeNode_t *b ){
+	int i;
+	float size2, bend, d;
+
+
+	size2 = 0.0f;
+	for ( i = 0; i < 3; i++ )
+	{
+		d = ( a->maxs[ i ] > b->maxs[ i ] ? a->maxs[ i ] : b->maxs[ i ] ) -
+			( a->mins[ i ] < b->mins[ i ] ? a->mins[ i ] : b->mins[ i ] );
+		size2 += d * d;
+	}
+	bend = 1.0f - DotProduct( a->normal, b->normal );
+	return ( a->power + b->power ) * size2 * ( 1.0f + bend * bend );
+}
+
+
+
+/*
+   MergeLightTreeNodes()
+   makes a parent for two clusters and returns its number
+ */
+
+static int MergeLightTreeNodes( int a, int b ){
+	int n;
+	lightTreeNode_t *node, *na, *nb;
+	vec3_t diag;
+
+
+	n = numLightTreeNodes++;
+	node = &lightTreeNodes[ n ];
+	na = &lightTreeNodes[ a ];
+	nb = &lightTreeNodes[ b ];
+
+	node->parent = -1;
+	node->children[ 0 ] = a;
+	node->children[ 1 ] = b;
+	node->light = NULL;
+	na->parent = n;
+	nb->parent = n;
+
+	VectorCopy( na->mins, node->mins );
+	VectorCopy( na->maxs, node->maxs );
+	AddPointToBounds( nb->mins, node->mins, node->maxs );
+	AddPointToBounds( nb->maxs, node->mins, node->maxs );
+
+	node->flux = na->flux + nb->flux;
+	node->power = na->power + nb->power;
+	VectorScale( na->normal, na->power, node->normal );
+	VectorMA( node->normal, nb->power, nb->normal, node->normal );
+	if ( VectorNormalize( node->normal, node->normal ) == 0.0f ) {
+		VectorCopy( na->normal, node->normal );
+	}
+
+	/* any light below is within the diagonal of any other */
+	VectorSubtract( node->maxs, node->mins, diag );
+	node->envelope = ( na->envelope > nb->envelope ? na->envelope : nb->envelope ) + VectorLength( diag );
+
+	return n;
+}
+
+
+
+/*
+   ClusterLightTreeGroup()
+   agglomerates a run of sorted leaves into a single root
+ */
+
+static int ClusterLightTreeGroup( int *active, int numActive, int *nn ){
+	int i, j, n, best, merged;
+	float metric, bestMetric;
+
+
+	while ( numActive > 1 )
+	{
+		/* find each cluster's cheapest neighbour */
+		for ( i = 0; i < numActive; i++ )
+		{
+			best = -1;
+			bestMetric = 0.0f;
+			for ( j = ( i > LIGHT_TREE_WINDOW ? i - LIGHT_TREE_WINDOW : 0 ); j < numActive && j <= i + LIGHT_TREE_WINDOW; j++ )
+			{
+				if ( j == i ) {
+					continue;
+				}
+				metric = LightTreeMetric( &lightTreeNodes[ active[ i ] ], &lightTreeNodes[ active[ j ] ] );
+				if ( best < 0 || metric < bestMetric ) {
+					best = j;
+					bestMetric = metric;
+				}
+			}
+			nn[ i ] = best;
+		}
+
+		/* merge mutual neighbours in place, keeping curve order */
+		merged = 0;
+		for ( i = 0, n = 0; i < numActive; i++ )
+		{
+			j = nn[ i ];
+			if ( nn[ j ] == i ) {
+				if ( i < j ) {
+					active[ n++ ] = MergeLightTreeNodes( active[ i ], active[ j ] );
+					merged++;
+				}
+			}
+			else{
+				active[ n++ ] = active[ i ];
+			}
+		}
+		numActive = n;
+
+		/* ties can leave no mutual pair */
+		if ( merged == 0 ) {
+			active[ 0 ] = MergeLightTreeNodes( active[ 0 ], active[ 1 ] );
+			memmove( &active[ 1 ], &active[ 2 ], ( numActive - 2 ) * sizeof( *active ) );
+			numActive--;
+		}
+	}
+
+	return active[ 0 ];
+}
+
+
+
+/*
+   FreeLightTree()
+   releases the tree and the per thread cut state
+ */
+
+static void FreeLightTree( void ){
+	int i;
+	lightTreeWork_t *work;
+
+
+	for ( i = 0; i < numLightTreeWorks; i++ )
+	{
+		work = &lightTreeWorks[ i ];
+		free( work->count );
+		free( work->rep );
+		free( work->flux );
+		free( work->color );
+		free( work->power );
+		free( work->bound );
+		free( work->touched );
+		free( work->heap );
+		free( work->cut );
+		free( work->slot );
+		free( work->slotNodes );
+	}
+	free( lightTreeWorks );
+	lightTreeWorks = NULL;
+	numLightTreeWorks = 0;
+
+	free( lightTreeNodes );
+	lightTreeNodes = NULL;
+	free( lightTreeRoots );
+	lightTreeRoots = NULL;
+	numLightTreeNodes = 0;
+	numLightTreeLeafs = 0;
+	numLightTreeRoots = 0;
+}
+
+
+
+/*
+   SetupLightTree()
+   clusters the current area lights, call after the light list is final
+ */
+
+void SetupLightTree( void ){
+	int i, j, start, *active, *nn;
+	light_t         *light;
+	lightTreeSort_t *sort;
+	lightTreeNode_t *node;
+	lightTreeWork_t *work;
+	vec3_t mins, maxs, scale;
+
+
+	FreeLightTree();
+	for ( light = lights; light != NULL; light = light->next )
+		light->treeNode = -1;
+	if ( !lightTree ) {
+		return;
+	}
+
+	/* note it */
+	Sys_FPrintf( SYS_VRB, "--- SetupLightTree ---\n" );
+
+	/* gather area lights */
+	for ( light = lights; light != NULL; light = light->next )
+	{
+		if ( light->envelope > 0.0f && LightPower( light ) > 0.0f && !( light->flags & LIGHT_NEGATIVE ) ) {
+			numLightTreeLeafs++;
+		}
+	}
+	if ( numLightTreeLeafs < 2 ) {
+		numLightTreeLeafs = 0;
+		return;
+	}
+	sort = safe_malloc( numLightTreeLeafs * sizeof( *sort ) );
+	ClearBounds( mins, maxs );
+	for ( i = 0, light = lights; light != NULL; light = light->next )
+	{
+		if ( light->envelope > 0.0f && LightPower( light ) > 0.0f && !( light->flags & LIGHT_NEGATIVE ) ) {
+			sort[ i ].light = light;
+			sort[ i ].style = light->style;
+			sort[ i ].flags = light->flags;
+			sort[ i ].facing = LightFacing( light );
+			AddPointToBounds( light->origin, mins, maxs );
+			i++;
+		}
+	}
+
+	/* sort along a morton curve */
+	for ( i = 0; i < 3; i++ )
+		scale[ i ] = maxs[ i ] > mins[ i ] ? 1023.0f / ( maxs[ i ] - mins[ i ] ) : 0.0f;
+	for ( i = 0; i < numLightTreeLeafs; i++ )
+		sort[ i ].morton = MortonCode( sort[ i ].light->origin, mins, scale );
+	qsort( sort, numLightTreeLeafs, sizeof( *sort ), CompareLightTreeSort );
+
+	/* make the leaves */
+	lightTreeNodes = safe_malloc( ( 2 * numLightTreeLeafs - 1 ) * sizeof( *lightTreeNodes ) );
+	for ( i = 0; i < numLightTreeLeafs; i++ )
+	{
+		light = sort[ i ].light;
+		node = &lightTreeNodes[ i ];
+		memset( node, 0, sizeof( *node ) );
+		node->parent = -1;
+		node->children[ 0 ] = node->children[ 1 ] = -1;
+		node->light = light;
+		ClearBounds( node->mins, node->maxs );
+		AddPointToBounds( light->origin, node->mins, node->maxs );
+		if ( light->w != NULL ) {
+			for ( j = 0; j < light->w->numpoints; j++ )
+				AddPointToBounds( light->w->p[ j ], node->mins, node->maxs );
+		}
+		VectorCopy( light->normal, node->normal );
+		node->flux = LightFlux( light );
+		node->power = LightPower( light );
+		node->envelope = light->envelope;
+		light->treeNode = i;
+	}
+	numLightTreeNodes = numLightTreeLeafs;
+
+	/* cluster each style, flags and facing group into its own root */
+	active = safe_malloc( numLightTreeLeafs * sizeof( *active ) );
+	nn = safe_malloc( numLightTreeLeafs * sizeof( *nn ) );
+	lightTreeRoots = safe_malloc( numLightTreeLeafs * sizeof( *lightTreeRoots ) );
+	for ( start = 0; start < numLightTreeLeafs; start = i )
+	{
+		for ( i = start; i < numLightTreeLeafs && sort[ i ].style == sort[ start ].style && sort[ i ].flags == sort[ start ].flags && sort[ i ].facing == sort[ start ].facing; i++ )
+			active[ i - start ] = i;
+		lightTreeRoots[ numLightTreeRoots++ ] = ClusterLightTreeGroup( active, i - start, nn );
+	}
+	free( active );
+	free( nn );
+	free( sort );
+
+	/* allocate the cut state */
+	numLightTreeWorks = numthreads > 1 ? numthreads : 1;
+	lightTreeWorks = safe_malloc( numLightTreeWorks * sizeof( *lightTreeWorks ) );
+	for ( i = 0; i < numLightTreeWorks; i++ )
+	{
+		work = &lightTreeWorks[ i ];
+		work->count = safe_malloc( numLightTreeNodes * sizeof( *work->count ) );
+		memset( work->count, 0, numLightTreeNodes * sizeof( *work->count ) );
+		work->rep = safe_malloc( numLightTreeNodes * sizeof( *work->rep ) );
+		work->flux = safe_malloc( numLightTreeNodes * sizeof( *work->flux ) );
+		memset( work->flux, 0, numLightTreeNodes * sizeof( *work->flux ) );
+		work->color = safe_malloc( numLightTreeNodes * sizeof( *work->color ) );
+		memset( work->color, 0, numLightTreeNodes * sizeof( *work->color ) );
+		work->power = safe_malloc( numLightTreeNodes * sizeof( *work->power ) );
+		memset( work->power, 0, numLightTreeNodes * sizeof( *work->power ) );
+		work->bound = safe_malloc( numLightTreeNodes * sizeof( *work->bound ) );
+		work->touched = safe_malloc( numLightTreeNodes * sizeof( *work->touched ) );
+		work->heap = safe_malloc( numLightTreeNodes * sizeof( *work->heap ) );
+		work->cut = safe_malloc( numLightTreeNodes * sizeof( *work->cut ) );
+		work->slot = safe_malloc( numLightTreeNodes * sizeof( *work->slot ) );
+		for ( j = 0; j < numLightTreeNodes; j++ )
+			work->slot[ j ] = -1;
+		work->slotNodes = safe_malloc( numLightTreeNodes * sizeof( *work->slotNodes ) );
+	}
+
+	/* emit some statistics */
+	Sys_FPrintf( SYS_VRB, "%9d lights clustered\n", numLightTreeLeafs );
+	Sys_FPrintf( SYS_VRB, "%9d light tree nodes\n", numLightTreeNodes );
+	Sys_FPrintf( SYS_VRB, "%9d light tree roots\n", numLightTreeRoots );
+}
+
+
+
+/*
+   LightTreeHeapPush() / LightTreeHeapPop()
+   max heap of nodes by error bound
+ */
+
+static void LightTreeHeapPush( lightTreeWork_t *work, int *numHeap, int node ){
+	int i, parent;
+
+
+	i = ( *numHeap )++;
+	while ( i > 0 )
+	{
+		parent = ( i - 1 ) >> 1;
+		if ( work->bound[ work->heap[ parent ] ] >= work->bound[ node ] ) {
+			break;
+		}
+		work->heap[ i ] = work->heap[ parent ];
+		i = parent;
+	}
+	work->heap[ i ] = node;
+}
+
+static int LightTreeHeapPop( lightTreeWork_t *work, int *numHeap ){
+	int i, child, top, last;
+
+
+	top = work->heap[ 0 ];
+	last = work->heap[ --( *numHeap ) ];
+	i = 0;
+	while ( ( child = 2 * i + 1 ) < *numHeap )
+	{
+		if ( child + 1 < *numHeap && work->bound[ work->heap[ child + 1 ] ] > work->bound[ work->heap[ child ] ] ) {
+			child++;
+		}
+		if ( work->bound[ last ] >= work->bound[ work->heap[ child ] ] ) {
+			break;
+		}
+		work->heap[ i ] = work->heap[ child ];
+		i = child;
+	}
+	work->heap[ i ] = last;
+	return top;
+}
+
+
+
+/*
+   LightTreeBounds()
+   error bound and estimate of a node's listed lights for the receiver bounds
+ */
+
+static void LightTreeBounds( lightTreeWork_t *work, int n, const vec3_t mins, const vec3_t maxs, const vec3_t center, float *estimate ){
+	int i;
+	float d, near2, far2;
+	lightTreeNode_t *node = &lightTreeNodes[ n ];
+
+
+	/* nearest distance between the boxes, and center to center */
+	near2 = 0.0f;
+	far2 = 0.0f;
+	for ( i = 0; i < 3; i++ )
+	{
+		if ( node->mins[ i ] > maxs[ i ] ) {
+			d = node->mins[ i ] - maxs[ i ];
+		}
+		else if ( node->maxs[ i ] < mins[ i ] ) {
+			d = mins[ i ] - node->maxs[ i ];
+		}
+		else{
+			d = 0.0f;
+		}
+		near2 += d * d;
+		d = ( node->mins[ i ] + node->maxs[ i ] ) * 0.5f - center[ i ];
+		far2 += d * d;
+	}
+	if ( near2 < LIGHT_TREE_MIN_DIST * LIGHT_TREE_MIN_DIST ) {
+		near2 = LIGHT_TREE_MIN_DIST * LIGHT_TREE_MIN_DIST;
+	}
+	if ( far2 < LIGHT_TREE_MIN_DIST * LIGHT_TREE_MIN_DIST ) {
+		far2 = LIGHT_TREE_MIN_DIST * LIGHT_TREE_MIN_DIST;
+	}
+
+	work->bound[ n ] = work->power[ n ] / near2;
+	*estimate = work->power[ n ] / far2;
+}
+
+
+
+/*
+   CutBlock()
+   splits the worst node of the listed tree until its bound is within the error,
+   leaves the cut in work->cut and returns its size
+ */
+
+static int CutBlock( lightTreeWork_t *work, const vec3_t mins, const vec3_t maxs ){
+	int i, n, numHeap, numCut;
+	float estimate, total;
+	lightTreeNode_t *node;
+	vec3_t center;
+
+
+	/* start at the touched roots */
+	VectorAdd( mins, maxs, center );
+	VectorScale( center, 0.5f, center );
+	numHeap = 0;
+	total = 0.0f;
+	for ( i = 0; i < numLightTreeRoots; i++ )
+	{
+		if ( work->count[ lightTreeRoots[ i ] ] > 0 ) {
+			LightTreeBounds( work, lightTreeRoots[ i ], mins, maxs, center, &estimate );
+			total += estimate;
+			LightTreeHeapPush( work, &numHeap, lightTreeRoots[ i ] );
+		}
+	}
+
+	/* single lights go straight to the cut */
+	numCut = 0;
+	while ( numHeap > 0 && work->bound[ work->heap[ 0 ] ] > lightTreeError * total )
+	{
+		n = LightTreeHeapPop( work, &numHeap );
+		node = &lightTreeNodes[ n ];
+		if ( work->count[ n ] == 1 ) {
+			work->cut[ numCut++ ] = n;
+			continue;
+		}
+		LightTreeBounds( work, n, mins, maxs, center, &estimate );
+		total -= estimate;
+		for ( i = 0; i < 2; i++ )
+		{
+			if ( work->count[ node->children[ i ] ] > 0 ) {
+				LightTreeBounds( work, node->children[ i ], mins, maxs, center, &estimate );
+				total += estimate;
+				LightTreeHeapPush( work, &numHeap, node->children[ i ] );
+			}
+		}
+	}
+
+	/* the rest of the heap is within the error */
+	memcpy( &work->cut[ numCut ], work->heap, numHeap * sizeof( *work->cut ) );
+	return numCut + numHeap;
+}
+
+
+
+/*
+   CutError()
+   relative error of a cut against its listed lights, comparing unshadowed inverse square light at a point
+ */
+
+static float CutError( lightTreeWork_t *work, int numCut, trace_t *trace, int first, const vec3_t point ){
+	int i;
+	float exact, approx, d2;
+	light_t         *light;
+	vec3_t delta;
+
+
+	exact = 0.0f;
+	for ( i = first; i < trace->numLights; i++ )
+	{
+		light = trace->lights[ i ];
+		VectorSubtract( light->origin, point, delta );
+		d2 = DotProduct( delta, delta );
+		exact += lightTreeNodes[ light->treeNode ].power / ( d2 > LIGHT_TREE_MIN_DIST * LIGHT_TREE_MIN_DIST ? d2 : LIGHT_TREE_MIN_DIST * LIGHT_TREE_MIN_DIST );
+	}
+
+	approx = 0.0f;
+	for ( i = 0; i < numCut; i++ )
+	{
+		light = lightTreeNodes[ work->rep[ work->cut[ i ] ] ].light;
+		VectorSubtract( light->origin, point, delta );
+		d2 = DotProduct( delta, delta );
+		approx += work->power[ work->cut[ i ] ] / ( d2 > LIGHT_TREE_MIN_DIST * LIGHT_TREE_MIN_DIST ? d2 : LIGHT_TREE_MIN_DIST * LIGHT_TREE_MIN_DIST );
+	}
+
+	return exact > 0.0f ? fabs( approx - exact ) / exact : 0.0f;
+}
+
+
+
+/*
+   CutLightTree()
+   replaces the tree lights in a raw lightmap's trace light list with the union of
+   the cuts of its blocks, LightCutSkips() tells which blocks each of them lights
+ */
+
+lightCut_t *CutLightTree( rawLightmap_t *lm, trace_t *trace ){
+	int i, b, n, x, y, leaf, num, thread, numTouched, numListed, numCut, numSlots, maxSlots, numNodeLights, bestBlock;
+	int                 *cluster, *blockLuxels;
+	float flux, power, scale, error;
+	double full, cut;
+	light_t         *light, **lights;
+	lightTreeNode_t *node;
+	lightTreeWork_t *work;
+	lightCut_t      *lc;
+	vec3_t          *blockMins, *blockMaxs, center;
+
+
+	/* dummy check */
+	thread = ThreadNum();
+	if ( numLightTreeLeafs == 0 || trace->numLights == 0 || thread < 0 || thread >= numLightTreeWorks ) {
+		return NULL;
+	}
+	work = &lightTreeWorks[ thread ];
+
+	/* move the tree lights to the end of the list */
+	lights = safe_malloc( ( trace->numLights + 1 ) * sizeof( *lights ) );
+	for ( i = 0, n = 0; i < trace->numLights; i++ )
+	{
+		if ( trace->lights[ i ]->treeNode < 0 ) {
+			lights[ n++ ] = trace->lights[ i ];
+		}
+	}
+	numListed = trace->numLights - n;
+	if ( numListed == 0 ) {
+		free( lights );
+		return NULL;
+	}
+	for ( i = 0; i < trace->numLights; i++ )
+	{
+		if ( trace->lights[ i ]->treeNode >= 0 ) {
+			lights[ n++ ] = trace->lights[ i ];
+		}
+	}
+	memcpy( trace->lights, lights, trace->numLights * sizeof( *lights ) );
+	free( lights );
+
+	/* sum the listed lights up to their roots */
+	numTouched = 0;
+	for ( i = trace->numLights - numListed; i < trace->numLights; i++ )
+	{
+		light = trace->lights[ i ];
+		leaf = light->treeNode;
+		flux = lightTreeNodes[ leaf ].flux;
+		power = lightTreeNodes[ leaf ].power;
+		for ( num = leaf; num >= 0; num = lightTreeNodes[ num ].parent )
+		{
+			if ( work->count[ num ]++ == 0 ) {
+				work->touched[ numTouched++ ] = num;
+				work->rep[ num ] = leaf;
+			}
+			else if ( power > lightTreeNodes[ work->rep[ num ] ].power ) {
+				work->rep[ num ] = leaf;
+			}
+			work->flux[ num ] += flux;
+			VectorMA( work->color[ num ], flux, light->color, work->color[ num ] );
+			work->power[ num ] += power;
+		}
+	}
+
+	/* bound the mapped luxels of each block */
+	lc = safe_malloc( sizeof( *lc ) );
+	memset( lc, 0, sizeof( *lc ) );
+	lc->first = trace->numLights - numListed;
+	lc->blocksWide = ( lm->sw + LIGHT_CUT_BLOCK - 1 ) / LIGHT_CUT_BLOCK;
+	lc->numBlocks = lc->blocksWide * ( ( lm->sh + LIGHT_CUT_BLOCK - 1 ) / LIGHT_CUT_BLOCK );
+	lc->rowBytes = ( lc->numBlocks + 7 ) >> 3;
+	blockMins = safe_malloc( lc->numBlocks * sizeof( *blockMins ) );
+	blockMaxs = safe_malloc( lc->numBlocks * sizeof( *blockMaxs ) );
+	blockLuxels = safe_malloc( lc->numBlocks * sizeof( *blockLuxels ) );
+	memset( blockLuxels, 0, lc->numBlocks * sizeof( *blockLuxels ) );
+	for ( b = 0; b < lc->numBlocks; b++ )
+		ClearBounds( blockMins[ b ], blockMaxs[ b ] );
+	for ( y = 0; y < lm->sh; y++ )
+	{
+		for ( x = 0; x < lm->sw; x++ )
+		{
+			cluster = SUPER_CLUSTER( x, y );
+			if ( *cluster < 0 ) {
+				continue;
+			}
+			b = ( y / LIGHT_CUT_BLOCK ) * lc->blocksWide + x / LIGHT_CUT_BLOCK;
+			AddPointToBounds( SUPER_ORIGIN( x, y ), blockMins[ b ], blockMaxs[ b ] );
+			blockLuxels[ b ]++;
+		}
+	}
+
+	/* cut each block, collecting the nodes of all cuts once */
+	numSlots = 0;
+	maxSlots = 0;
+	full = 0.0;
+	cut = 0.0;
+	error = 0.0f;
+	bestBlock = -1;
+	for ( b = 0; b < lc->numBlocks; b++ )
+	{
+		if ( blockLuxels[ b ] == 0 ) {
+			continue;
+		}
+		numCut = CutBlock( work, blockMins[ b ], blockMaxs[ b ] );
+		full += (double) blockLuxels[ b ] * numListed;
+		cut += (double) blockLuxels[ b ] * numCut;
+
+		/* measure the error of the fullest block */
+		if ( bestBlock < 0 || blockLuxels[ b ] > blockLuxels[ bestBlock ] ) {
+			bestBlock = b;
+			VectorAdd( blockMins[ b ], blockMaxs[ b ], center );
+			VectorScale( center, 0.5f, center );
+			error = CutError( work, numCut, trace, lc->first, center );
+		}
+
+		for ( i = 0; i < numCut; i++ )
+		{
+			num = work->cut[ i ];
+			if ( work->slot[ num ] < 0 ) {
+				if ( numSlots == maxSlots ) {
+					maxSlots = maxSlots ? maxSlots * 2 : 64;
+					lc->masks = realloc( lc->masks, maxSlots * lc->rowBytes );
+					if ( lc->masks == NULL ) {
+						Error( "CutLightTree: out of memory" );
+					}
+				}
+				memset( &lc->masks[ numSlots * lc->rowBytes ], 0, lc->rowBytes );
+				work->slot[ num ] = numSlots;
+				work->slotNodes[ numSlots++ ] = num;
+			}
+			lc->masks[ work->slot[ num ] * lc->rowBytes + ( b >> 3 ) ] |= 1 << ( b & 7 );
+		}
+	}
+	free( blockMins );
+	free( blockMaxs );
+	free( blockLuxels );
+
+	/* a node and lights below it can both be in the union, so the list may grow */
+	lights = safe_malloc( ( lc->first + numSlots + 1 ) * sizeof( *lights ) );
+	memcpy( lights, trace->lights, lc->first * sizeof( *lights ) );
+	free( trace->lights );
+	trace->lights = lights;
+
+	numNodeLights = 0;
+	for ( i = 0; i < numSlots; i++ )
+	{
+		if ( work->count[ work->slotNodes[ i ] ] > 1 ) {
+			numNodeLights++;
+		}
+	}
+	lc->nodeLights = numNodeLights > 0 ? safe_malloc( numNodeLights * sizeof( *lc->nodeLights ) ) : NULL;
+
+	/* write the union into the list */
+	n = lc->first;
+	numNodeLights = 0;
+	for ( i = 0; i < numSlots; i++ )
+	{
+		num = work->slotNodes[ i ];
+		node = &lightTreeNodes[ num ];
+		leaf = work->rep[ num ];
+
+		/* single lights stand for themselves */
+		if ( work->count[ num ] == 1 ) {
+			trace->lights[ n++ ] = lightTreeNodes[ leaf ].light;
+			continue;
+		}
+
+		/* clusters are lit as their strongest light scaled up to everyone's flux */
+		light = &lc->nodeLights[ numNodeLights++ ];
+		memcpy( light, lightTreeNodes[ leaf ].light, sizeof( *light ) );
+		light->next = NULL;
+		light->treeNode = -1;
+		scale = work->flux[ num ] / lightTreeNodes[ leaf ].flux;
+		light->photons *= scale;
+		light->add *= scale;
+		VectorScale( work->color[ num ], 1.0f / work->flux[ num ], light->color );
+		VectorScale( light->color, light->add, light->emitColor );
+		light->envelope = node->envelope;
+		light->envelope2 = light->envelope * light->envelope;
+		trace->lights[ n++ ] = light;
+	}
+	trace->numLights = n;
+	trace->lights[ n ] = NULL;
+
+	/* reset the touched nodes */
+	for ( i = 0; i < numTouched; i++ )
+	{
+		num = work->touched[ i ];
+		work->count[ num ] = 0;
+		work->flux[ num ] = 0.0f;
+		VectorClear( work->color[ num ] );
+		work->power[ num ] = 0.0f;
+		work->slot[ num ] = -1;
+	}
+
+	/* emit some statistics */
+	ThreadLock();
+	lightTreeFull += full;
+	lightTreeCut += cut;
+	lightTreeErrorSum += error;
+	if ( error > lightTreeErrorMax ) {
+		lightTreeErrorMax = error;
+	}
+	numLightTreeCuts++;
+	ThreadUnlock();
+
+	return lc;
+}
+
+
+
+/*
+   LightCutSkips()
+   true if a light of a cut list is not part of the cut of the block holding a luxel
+ */
+
+qboolean LightCutSkips( const lightCut_t *lc, int light, int x, int y ){
+	int b;
+
+
+	if ( lc == NULL || light < lc->first ) {
+		return qfalse;
+	}
+	b = ( y / LIGHT_CUT_BLOCK ) * lc->blocksWide + x / LIGHT_CUT_BLOCK;
+	return ( lc->masks[ ( light - lc->first ) * lc->rowBytes + ( b >> 3 ) ] & ( 1 << ( b & 7 ) ) ) == 0;
+}
+
+
+
+/*
+   FreeLightCut()
+   frees a cut once its trace light list is done with
+ */
+
+void FreeLightCut( lightCut_t *lc ){
+	if ( lc == NULL ) {
+		return;
+	}
+	free( lc->masks );
+	free( lc->nodeLights );
+	free( lc );
+}
+
+
+
+/*
+   LightTreeStats()
+   prints how many luxel light evaluations the cuts saved and their measured error, then resets
+ */
+
+void LightTreeStats( void ){
+	if ( !lightTree || numLightTreeCuts == 0 ) {
+		return;
+	}
+
+	Sys_Printf( "%9.0f tree light evaluations, %.0f with light cuts (%.1fx fewer)\n",
+				lightTreeFull, lightTreeCut, lightTreeCut > 0.0 ? lightTreeFull / lightTreeCut : 0.0 );
+	Sys_Printf( "%9.2f percent average light cut error, %.2f percent max (unshadowed, at the fullest block of each lightmap)\n",
+				100.0 * lightTreeErrorSum / numLightTreeCuts, 100.0 * lightTreeErrorMax );
+
+	/* reset for the next pass */
+	lightTreeFull = 0.0;
+	lightTreeCut = 0.0;
+	lightTreeErrorSum = 0.0;
+	lightTreeErrorMax = 0.0f;
+	numLightTreeCuts = 0;
+}
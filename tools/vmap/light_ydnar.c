@@ -235,91 +235,67 @@ void ColorToHDR( const float *color, float *colorBytes ){
 #define MAX_SAMPLES             256
 #define THETA_EPSILON           0.000001
 #define EQUAL_NORMAL_EPSILON    0.01
+#define SMOOTH_CELL_EPSILON     0.01    /* must be larger than EQUAL_EPSILON */
 
-void SmoothNormals( void ){
-	int i, j, k, f, cs, numVerts, numVotes, fOld, start;
-	float shadeAngle, defaultShadeAngle, maxShadeAngle, dot, testAngle;
-	bspDrawSurface_t    *ds;
-	shaderInfo_t        *si;
-	float               *shadeAngles;
-	byte                *smoothed;
-	vec3_t average, diff;
-	int indexes[ MAX_SAMPLES ];
-	vec3_t votes[ MAX_SAMPLES ];
+static float                *smoothShadeAngles;
+static byte                 *smoothed;
+static int                  *smoothGroupFirst;
+static int                  *smoothGroupVerts;
 
 
-	/* allocate shade angle table */
-	shadeAngles = safe_malloc( numBSPDrawVerts * sizeof( float ) );
-	memset( shadeAngles, 0, numBSPDrawVerts * sizeof( float ) );
 
-	/* allocate smoothed table */
-	cs = ( numBSPDrawVerts / 8 ) + 1;
-	smoothed = safe_malloc( cs );
-	memset( smoothed, 0, cs );
+/*
+   SmoothCellHash()
+   hashes an integer position cell for coincident vertex binning
+ */
 
-	/* set default shade angle */
-	defaultShadeAngle = DEG2RAD( shadeAngleDegrees );
-	maxShadeAngle = 0;
+static int SmoothCellHash( int x, int y, int z, int numBuckets ){
+	return ( ( x * 73856093u ) ^ ( y * 19349663u ) ^ ( z * 83492791u ) ) & ( numBuckets - 1 );
+}
 
-	/* run through every surface and flag verts belonging to non-lightmapped surfaces
-	   and set per-vertex smoothing angle */
-	for ( i = 0; i < numBSPDrawSurfaces; i++ )
-	{
-		/* get drawsurf */
-		ds = &bspDrawSurfaces[ i ];
 
-		/* get shader for shade angle */
-		si = surfaceInfos[ i ].si;
-		if ( si->shadeAngleDegrees ) {
-			shadeAngle = DEG2RAD( si->shadeAngleDegrees );
-		}
-		else{
-			shadeAngle = defaultShadeAngle;
-		}
-		if ( shadeAngle > maxShadeAngle ) {
-			maxShadeAngle = shadeAngle;
-		}
 
-		/* flag its verts */
-		for ( j = 0; j < ds->numVerts; j++ )
-		{
-			f = ds->firstVert + j;
-			shadeAngles[ f ] = shadeAngle;
-			if ( ds->surfaceType == MST_TRIANGLE_SOUP ) {
-				smoothed[ f >> 3 ] |= ( 1 << ( f & 7 ) );
-			}
-		}
+/*
+   FindSmoothRoot()
+   union-find root of a vertex
+ */
 
-		/* ydnar: optional force-to-trisoup */
-		if ( trisoup && ds->surfaceType == MST_PLANAR ) {
-			ds->surfaceType = MST_TRIANGLE_SOUP;
-			ds->lightmapNum[ 0 ] = -3;
-		}
+static int FindSmoothRoot( int *parent, int v ){
+	while ( parent[ v ] != v )
+	{
+		parent[ v ] = parent[ parent[ v ] ];
+		v = parent[ v ];
 	}
+	return v;
+}
 
-	/* bail if no surfaces have a shade angle */
-	if ( maxShadeAngle == 0 ) {
-		free( shadeAngles );
-		free( smoothed );
-		return;
-	}
 
-	/* init pacifier */
-	fOld = -1;
-	start = I_FloatTime();
+
+/*
+   SmoothVertexGroup()
+   smooths a group of coincident verts, which is the old exhaustive search
+   restricted to the verts that can pass VectorCompare() against each other
+ */
+
+static void SmoothVertexGroup( int groupNum ){
+	int a, b, i, j, k, count, numVerts, numVotes;
+	int                 *members;
+	float shadeAngle, dot, testAngle;
+	vec3_t average, diff;
+	int indexes[ MAX_SAMPLES ];
+	vec3_t votes[ MAX_SAMPLES ];
+
+
+	/* get group */
+	members = &smoothGroupVerts[ smoothGroupFirst[ groupNum ] ];
+	count = smoothGroupFirst[ groupNum + 1 ] - smoothGroupFirst[ groupNum ];
 
 	/* go through the list of vertexes */
-	for ( i = 0; i < numBSPDrawVerts; i++ )
+	for ( a = 0; a < count; a++ )
 	{
-		/* print pacifier */
-		f = 10 * i / numBSPDrawVerts;
-		if ( f != fOld ) {
-			fOld = f;
-			Sys_Printf( "%i...", f );
-		}
-
 		/* already smoothed? */
-		if ( smoothed[ i >> 3 ] & ( 1 << ( i & 7 ) ) ) {
+		i = members[ a ];
+		if ( smoothed[ i ] ) {
 			continue;
 		}
 
@@ -329,10 +305,11 @@ void SmoothNormals( void ){
 		numVotes = 0;
 
 		/* build a table of coincident vertexes */
-		for ( j = i; j < numBSPDrawVerts && numVerts < MAX_SAMPLES; j++ )
+		for ( b = a; b < count && numVerts < MAX_SAMPLES; b++ )
 		{
 			/* already smoothed? */
-			if ( smoothed[ j >> 3 ] & ( 1 << ( j & 7 ) ) ) {
+			j = members[ b ];
+			if ( smoothed[ j ] ) {
 				continue;
 			}
 
@@ -342,7 +319,7 @@ void SmoothNormals( void ){
 			}
 
 			/* use smallest shade angle */
-			shadeAngle = ( shadeAngles[ i ] < shadeAngles[ j ] ? shadeAngles[ i ] : shadeAngles[ j ] );
+			shadeAngle = ( smoothShadeAngles[ i ] < smoothShadeAngles[ j ] ? smoothShadeAngles[ i ] : smoothShadeAngles[ j ] );
 
 			/* check shade angle */
 			dot = DotProduct( bspDrawVerts[ i ].normal, bspDrawVerts[ j ].normal );
@@ -354,16 +331,14 @@ void SmoothNormals( void ){
 			}
 			testAngle = acos( dot ) + THETA_EPSILON;
 			if ( testAngle >= shadeAngle ) {
-				//Sys_Printf( "F(%3.3f >= %3.3f) ", RAD2DEG( testAngle ), RAD2DEG( shadeAngle ) );
 				continue;
 			}
-			//Sys_Printf( "P(%3.3f < %3.3f) ", RAD2DEG( testAngle ), RAD2DEG( shadeAngle ) );
 
 			/* add to the list */
 			indexes[ numVerts++ ] = j;
 
 			/* flag vertex */
-			smoothed[ j >> 3 ] |= ( 1 << ( j & 7 ) );
+			smoothed[ j ] = 1;
 
 			/* see if this normal has already been voted */
 			for ( k = 0; k < numVotes; k++ )
@@ -396,13 +371,168 @@ void SmoothNormals( void ){
 				VectorCopy( average, yDrawVerts[ indexes[ j ] ].normal );
 		}
 	}
+}
+
+
+
+void SmoothNormals( void ){
+	int i, j, a, b, f, x, y, z, numBuckets, numGroups;
+	int mins[ 3 ], maxs[ 3 ];
+	float shadeAngle, defaultShadeAngle, maxShadeAngle;
+	bspDrawSurface_t    *ds;
+	shaderInfo_t        *si;
+	int                 *buckets, *next, *parent, *groupNums;
+	float               *xyz;
+
+
+	/* allocate shade angle table */
+	smoothShadeAngles = safe_malloc( numBSPDrawVerts * sizeof( float ) );
+	memset( smoothShadeAngles, 0, numBSPDrawVerts * sizeof( float ) );
+
+	/* allocate smoothed table */
+	smoothed = safe_malloc( numBSPDrawVerts + 1 );
+	memset( smoothed, 0, numBSPDrawVerts + 1 );
+
+	/* set default shade angle */
+	defaultShadeAngle = DEG2RAD( shadeAngleDegrees );
+	maxShadeAngle = 0;
+
+	/* run through every surface and flag verts belonging to non-lightmapped surfaces
+	   and set per-vertex smoothing angle */
+	for ( i = 0; i < numBSPDrawSurfaces; i++ )
+	{
+		/* get drawsurf */
+		ds = &bspDrawSurfaces[ i ];
+
+		/* get shader for shade angle */
+		si = surfaceInfos[ i ].si;
+		if ( si->shadeAngleDegrees ) {
+			shadeAngle = DEG2RAD( si->shadeAngleDegrees );
+		}
+		else{
+			shadeAngle = defaultShadeAngle;
+		}
+		if ( shadeAngle > maxShadeAngle ) {
+			maxShadeAngle = shadeAngle;
+		}
+
+		/* flag its verts */
+		for ( j = 0; j < ds->numVerts; j++ )
+		{
+			f = ds->firstVert + j;
+			smoothShadeAngles[ f ] = shadeAngle;
+			if ( ds->surfaceType == MST_TRIANGLE_SOUP ) {
+				smoothed[ f ] = 1;
+			}
+		}
+
+		/* ydnar: optional force-to-trisoup */
+		if ( trisoup && ds->surfaceType == MST_PLANAR ) {
+			ds->surfaceType = MST_TRIANGLE_SOUP;
+			ds->lightmapNum[ 0 ] = -3;
+		}
+	}
+
+	/* bail if no surfaces have a shade angle */
+	if ( maxShadeAngle == 0 ) {
+		free( smoothShadeAngles );
+		free( smoothed );
+		return;
+	}
+
+	/* bin the verts by unit cell, joining every pair that passes VectorCompare() */
+	for ( numBuckets = 1024; numBuckets < numBSPDrawVerts; numBuckets <<= 1 ) ;
+	buckets = safe_malloc( numBuckets * sizeof( int ) );
+	memset( buckets, -1, numBuckets * sizeof( int ) );
+	next = safe_malloc( numBSPDrawVerts * sizeof( int ) );
+	parent = safe_malloc( numBSPDrawVerts * sizeof( int ) );
+
+	for ( i = 0; i < numBSPDrawVerts; i++ )
+	{
+		parent[ i ] = i;
+		if ( smoothed[ i ] ) {
+			continue;
+		}
+
+		/* search every cell within epsilon */
+		xyz = yDrawVerts[ i ].xyz;
+		for ( j = 0; j < 3; j++ )
+		{
+			mins[ j ] = (int) floor( xyz[ j ] - SMOOTH_CELL_EPSILON );
+			maxs[ j ] = (int) floor( xyz[ j ] + SMOOTH_CELL_EPSILON );
+		}
+		for ( z = mins[ 2 ]; z <= maxs[ 2 ]; z++ )
+			for ( y = mins[ 1 ]; y <= maxs[ 1 ]; y++ )
+				for ( x = mins[ 0 ]; x <= maxs[ 0 ]; x++ )
+					for ( j = buckets[ SmoothCellHash( x, y, z, numBuckets ) ]; j >= 0; j = next[ j ] )
+					{
+						if ( VectorCompare( xyz, yDrawVerts[ j ].xyz ) ) {
+							a = FindSmoothRoot( parent, i );
+							b = FindSmoothRoot( parent, j );
+							if ( a < b ) {
+								parent[ b ] = a;
+							}
+							else{
+								parent[ a ] = b;
+							}
+						}
+					}
+
+		/* add to its own cell */
+		f = SmoothCellHash( (int) floor( xyz[ 0 ] ), (int) floor( xyz[ 1 ] ), (int) floor( xyz[ 2 ] ), numBuckets );
+		next[ i ] = buckets[ f ];
+		buckets[ f ] = i;
+	}
+
+	/* make groups of two or more verts, each listed in vertex order */
+	groupNums = buckets;
+	if ( numBuckets < numBSPDrawVerts + 1 ) {
+		free( buckets );
+		groupNums = safe_malloc( ( numBSPDrawVerts + 1 ) * sizeof( int ) );
+	}
+	memset( groupNums, 0, ( numBSPDrawVerts + 1 ) * sizeof( int ) );
+	for ( i = 0; i < numBSPDrawVerts; i++ )
+	{
+		parent[ i ] = FindSmoothRoot( parent, i );
+		if ( !smoothed[ i ] ) {
+			groupNums[ parent[ i ] ]++;
+		}
+	}
+	numGroups = 0;
+	for ( i = 0; i < numBSPDrawVerts; i++ )
+		groupNums[ i ] = ( groupNums[ i ] >= 2 ? numGroups++ : -1 );
+
+	smoothGroupFirst = safe_malloc( ( numGroups + 1 ) * sizeof( int ) );
+	memset( smoothGroupFirst, 0, ( numGroups + 1 ) * sizeof( int ) );
+	for ( i = 0; i < numBSPDrawVerts; i++ )
+	{
+		if ( !smoothed[ i ] && groupNums[ parent[ i ] ] >= 0 ) {
+			smoothGroupFirst[ groupNums[ parent[ i ] ] + 1 ]++;
+		}
+	}
+	for ( i = 0; i < numGroups; i++ )
+		smoothGroupFirst[ i + 1 ] += smoothGroupFirst[ i ];
+	smoothGroupVerts = safe_malloc( ( smoothGroupFirst[ numGroups ] + 1 ) * sizeof( int ) );
+	memcpy( next, smoothGroupFirst, numGroups * sizeof( int ) );
+	for ( i = 0; i < numBSPDrawVerts; i++ )
+	{
+		if ( !smoothed[ i ] && groupNums[ parent[ i ] ] >= 0 ) {
+			smoothGroupVerts[ next[ groupNums[ parent[ i ] ] ]++ ] = i;
+		}
+	}
+	free( groupNums );
+	free( next );
+	free( parent );
+
+	/* smooth each group */
+	Sys_FPrintf( SYS_VRB, "%9d coincident vertex groups\n", numGroups );
+	RunThreadsOnIndividual( numGroups, qtrue, SmoothVertexGroup );
 
 	/* free the tables */
-	free( shadeAngles );
+	free( smoothGroupFirst );
+	free( smoothGroupVerts );
+	free( smoothShadeAngles );
 	free( smoothed );
-
-	/* print time */
-	Sys_Printf( " (%i)\n", (int) ( I_FloatTime() - start ) );
 }
 
 
@@ -1087,6 +1217,28 @@ static qboolean MapQuad( rawLightmap_t *lm, surfaceInfo_t *info, bspDrawVert_t *
 
 
 
+/*
+   RawLightmapCost()
+   estimates the work for a raw lightmap, so the threads get the largest lightmaps first
+ */
+
+int RawLightmapCost( int rawLightmapNum ){
+	return rawLightmaps[ rawLightmapNum ].sw * rawLightmaps[ rawLightmapNum ].sh;
+}
+
+
+
+/*
+   DrawSurfaceCost()
+   estimates the work for a draw surface's vertexes
+ */
+
+int DrawSurfaceCost( int num ){
+	return bspDrawSurfaces[ num ].numVerts;
+}
+
+
+
 /*
    MapRawLightmap()
    maps the locations, normals, and pvs clusters for a raw lightmap
@@ -1527,15 +1679,34 @@ void SetupDirt( void ){
 }
 
 
+/*
+   DirtForTrace()
+   returns the dirt amount of one traced dirt ray
+ */
+
+static float DirtForTrace( trace_t *trace, float ooDepth, qboolean skyIsOpen ){
+	vec3_t displacement;
+
+
+	if ( !trace->opaque || ( skyIsOpen && ( trace->compileFlags & C_SKY ) ) ) {
+		return 0.0f;
+	}
+	VectorSubtract( trace->hit, trace->origin, displacement );
+	return 1.0f - ooDepth * VectorLength( displacement );
+}
+
+
+
 /*
    DirtForSample()
    calculates dirt value for a given sample
  */
 
 float DirtForSample( trace_t *trace ){
-	int i;
+	int i, j, numRays, numPending;
 	float gatherDirt, outDirt, angle, elevation, ooDepth;
-	vec3_t normal, worldUp, myUp, myRt, temp, direction, displacement;
+	vec3_t normal, worldUp, myUp, myRt, temp, direction;
+	trace_t packet[ MAX_TRACE_PACKET ], *packetTraces[ MAX_TRACE_PACKET ], *rayTrace;
 
 
 	/* dummy check */
@@ -1571,11 +1742,27 @@ float DirtForSample( trace_t *trace ){
 		VectorNormalize( myUp, myUp );
 	}
 
-	/* 1 = random mode, 0 (well everything else) = non-random mode */
-	if ( dirtMode == 1 ) {
-		/* iterate */
-		for ( i = 0; i < numDirtVectors; i++ )
+	/* setup packet lanes */
+	if ( !noPacketTrace ) {
+		for ( j = 0; j < MAX_TRACE_PACKET; j++ )
 		{
+			packet[ j ] = *trace;
+			packetTraces[ j ] = &packet[ j ];
+		}
+	}
+
+	/* the dirt vectors are followed by the direct ray along the normal */
+	numRays = numDirtVectors + 1;
+	numPending = 0;
+	for ( i = 0; i < numRays; i++ )
+	{
+		/* direct ray */
+		if ( i == numDirtVectors ) {
+			VectorCopy( normal, direction );
+		}
+
+		/* 1 = random mode, 0 (well everything else) = non-random mode */
+		else if ( dirtMode == 1 ) {
 			/* get random vector */
 			angle = Random() * DEG2RAD( 360.0f );
 			elevation = Random() * DEG2RAD( DIRT_CONE_ANGLE );
@@ -1587,54 +1774,42 @@ float DirtForSample( trace_t *trace ){
 			direction[ 0 ] = myRt[ 0 ] * temp[ 0 ] + myUp[ 0 ] * temp[ 1 ] + normal[ 0 ] * temp[ 2 ];
 			direction[ 1 ] = myRt[ 1 ] * temp[ 0 ] + myUp[ 1 ] * temp[ 1 ] + normal[ 1 ] * temp[ 2 ];
 			direction[ 2 ] = myRt[ 2 ] * temp[ 0 ] + myUp[ 2 ] * temp[ 1 ] + normal[ 2 ] * temp[ 2 ];
-
-			/* set endpoint */
-			VectorMA( trace->origin, dirtDepth, direction, trace->end );
-			SetupTrace( trace );
-			VectorSet(trace->color, 1.0f, 1.0f, 1.0f);
-
-			/* trace */
-			TraceLine( trace );
-			if ( trace->opaque && !( trace->compileFlags & C_SKY ) ) {
-				VectorSubtract( trace->hit, trace->origin, displacement );
-				gatherDirt += 1.0f - ooDepth * VectorLength( displacement );
-			}
 		}
-	}
-	else
-	{
-		/* iterate through ordered vectors */
-		for ( i = 0; i < numDirtVectors; i++ )
+		else
 		{
-			/* transform vector into tangent space */
+			/* transform ordered vector into tangent space */
 			direction[ 0 ] = myRt[ 0 ] * dirtVectors[ i ][ 0 ] + myUp[ 0 ] * dirtVectors[ i ][ 1 ] + normal[ 0 ] * dirtVectors[ i ][ 2 ];
 			direction[ 1 ] = myRt[ 1 ] * dirtVectors[ i ][ 0 ] + myUp[ 1 ] * dirtVectors[ i ][ 1 ] + normal[ 1 ] * dirtVectors[ i ][ 2 ];
 			direction[ 2 ] = myRt[ 2 ] * dirtVectors[ i ][ 0 ] + myUp[ 2 ] * dirtVectors[ i ][ 1 ] + normal[ 2 ] * dirtVectors[ i ][ 2 ];
+		}
 
-			/* set endpoint */
-			VectorMA( trace->origin, dirtDepth, direction, trace->end );
-			SetupTrace( trace );
-			VectorSet(trace->color, 1.0f, 1.0f, 1.0f);
+		/* set endpoint */
+		rayTrace = noPacketTrace ? trace : &packet[ numPending ];
+		VectorMA( rayTrace->origin, dirtDepth, direction, rayTrace->end );
+		SetupTrace( rayTrace );
+		VectorSet( rayTrace->color, 1.0f, 1.0f, 1.0f );
 
-			/* trace */
+		/* trace (random mode ignores sky hits, except for the direct ray) */
+		if ( noPacketTrace ) {
 			TraceLine( trace );
-			if ( trace->opaque ) {
-				VectorSubtract( trace->hit, trace->origin, displacement );
-				gatherDirt += 1.0f - ooDepth * VectorLength( displacement );
-			}
+			gatherDirt += DirtForTrace( trace, ooDepth, dirtMode == 1 && i < numDirtVectors );
+			continue;
 		}
-	}
 
-	/* direct ray */
-	VectorMA( trace->origin, dirtDepth, normal, trace->end );
-	SetupTrace( trace );
-	VectorSet(trace->color, 1.0f, 1.0f, 1.0f);
+		/* trace full packets */
+		numPending++;
+		if ( numPending < MAX_TRACE_PACKET && i < numRays - 1 ) {
+			continue;
+		}
+		TraceLinePacket( packetTraces, numPending );
+		for ( j = 0; j < numPending; j++ )
+			gatherDirt += DirtForTrace( &packet[ j ], ooDepth, dirtMode == 1 && ( i - numPending + 1 + j ) < numDirtVectors );
+		numPending = 0;
+	}
 
-	/* trace */
-	TraceLine( trace );
-	if ( trace->opaque ) {
-		VectorSubtract( trace->hit, trace->origin, displacement );
-		gatherDirt += 1.0f - ooDepth * VectorLength( displacement );
+	/* leave the direct ray in the trace, like the single ray path does */
+	if ( !noPacketTrace ) {
+		*trace = packet[ ( numRays - 1 ) % MAX_TRACE_PACKET ];
 	}
 
 	/* early out */
@@ -1681,6 +1856,7 @@ void DirtyRawLightmap( int rawLightmapNum ){
 
 	/* get lightmap */
 	lm = &rawLightmaps[ rawLightmapNum ];
+	SeedRandom( rawLightmapNum );
 
 	/* setup trace */
 	trace.testOcclusion = qtrue;
@@ -1690,6 +1866,7 @@ void DirtyRawLightmap( int rawLightmapNum ){
 	trace.surfaces = &lightSurfaces[ lm->firstLightSurface ];
 	trace.inhibitRadius = 0.0f;
 	trace.testAll = qfalse;
+	trace.shadowCache = NULL;
 
 	/* twosided lighting (may or may not be a good idea for lightmapped stuff) */
 	trace.twoSided = qfalse;
@@ -1807,6 +1984,7 @@ void DirtyRawLightmap( int rawLightmapNum ){
 			*dirt = average / samples;
 		}
 	}
+	SeedRandom( -1 );
 }
 
 
@@ -2008,10 +2186,10 @@ static void SubsampleRawLuxel_r( rawLightmap_t *lm, trace_t *trace, vec3_t sampl
 	}
 }
 
-/* A mostly Gaussian-like bounded random distribution (sigma is expected standard deviation) */
-static void GaussLikeRandom( float sigma, float *x, float *y ){
+/* A mostly Gaussian-like bounded random distribution (sigma is expected standard deviation), u picks the angle */
+static void GaussLikeRandomAngle( float sigma, float u, float *x, float *y ){
 	float r;
-	r = Random() * 2 * Q_PI;
+	r = u * 2 * Q_PI;
 	*x = sigma * 2.73861278752581783822 * cos( r );
 	*y = sigma * 2.73861278752581783822 * sin( r );
 	r = Random();
@@ -2020,6 +2198,9 @@ static void GaussLikeRandom( float sigma, float *x, float *y ){
 	*x *= r;
 	*y *= r;
 }
+static void GaussLikeRandom( float sigma, float *x, float *y ){
+	GaussLikeRandomAngle( sigma, Random(), x, y );
+}
 static void RandomSubsampleRawLuxel( rawLightmap_t *lm, trace_t *trace, vec3_t sampleOrigin, int x, int y, float bias, float *lightLuxel, float *lightDeluxel ){
 	int b, mapped;
 	int cluster;
@@ -2071,6 +2252,165 @@ static void RandomSubsampleRawLuxel( rawLightmap_t *lm, trace_t *trace, vec3_t s
 
 
 
+/*
+   AdaptiveSubsampleRawLuxel()
+   jitters samples around a luxel like RandomSubsampleRawLuxel(), but stops as soon as the
+   standard error of their brightness drops under -adaptivethreshold; the luxel's own sample
+   from the initial pass seeds the estimate. extra rays are drawn from the raw lightmap's own
+   credit, which grows by -raybudget times the uniform ray count for every luxel visited, so
+   the rays a luxel gets don't depend on what other threads are lighting.
+ */
+
+#define ADAPTIVE_MIN_SAMPLES    8               /* fewer lets a thin shadow edge slip between the samples */
+
+typedef struct adaptiveBudget_s
+{
+	float credit;
+	int numLuxels, numRays, numStopped;
+}
+adaptiveBudget_t;
+
+static int numAdaptiveLuxels, numAdaptiveRays, numAdaptiveStopped;
+
+static void AdaptiveSubsampleRawLuxel( rawLightmap_t *lm, adaptiveBudget_t *budget, trace_t *trace, vec3_t sampleOrigin, int x, int y, float bias, float *lightLuxel, float *lightDeluxel ){
+	int b, n, minSamples, maxSamples, rays;
+	int cluster;
+	vec3_t origin, normal;
+	vec3_t total, totaldirection;
+	float dx, dy, gray, mean, delta, m2;
+
+
+	/* reserve rays from the budget */
+	budget->credit += adaptiveRayBudget * lightSamples;
+	maxSamples = budget->credit < lightSamples ? (int) budget->credit : lightSamples;
+	if ( maxSamples < 0 ) {
+		maxSamples = 0;
+	}
+	budget->credit -= maxSamples;
+	minSamples = lightSamples / 4 > ADAPTIVE_MIN_SAMPLES ? lightSamples / 4 : ADAPTIVE_MIN_SAMPLES;
+
+	/* seed the estimate with the initial pass sample */
+	VectorCopy( lightLuxel, total );
+	VectorClear( totaldirection );
+	if ( lightDeluxel ) {
+		VectorCopy( lightDeluxel, totaldirection );
+	}
+	n = 1;
+	mean = RGBTOGRAY( lightLuxel );
+	m2 = 0.0f;
+
+	rays = 0;
+	for ( b = 0; b < maxSamples; b++ )
+	{
+		/* stop once the mean is good enough */
+		if ( rays >= minSamples && sqrt( m2 / ( ( n - 1 ) * n ) ) < adaptiveThreshold ) {
+			break;
+		}
+
+		/* set origin, spreading the first samples around the luxel so the early variance sees all of it */
+		VectorCopy( sampleOrigin, origin );
+		if ( b < minSamples ) {
+			GaussLikeRandomAngle( bias, ( b + Random() ) / minSamples, &dx, &dy );
+		}
+		else{
+			GaussLikeRandom( bias, &dx, &dy );
+		}
+
+		/* calculate position */
+		if ( !SubmapRawLuxel( lm, x, y, dx, dy, &cluster, origin, normal ) ) {
+			continue;
+		}
+		rays++;
+
+		trace->cluster = cluster;
+		VectorCopy( origin, trace->origin );
+		VectorCopy( normal, trace->normal );
+
+		LightContributionToSample( trace );
+		VectorAdd( total, trace->color, total );
+		if ( lightDeluxel ) {
+			VectorAdd( totaldirection, trace->directionContribution, totaldirection );
+		}
+
+		/* running variance of the brightness */
+		n++;
+		gray = RGBTOGRAY( trace->color );
+		delta = gray - mean;
+		mean += delta / n;
+		m2 += delta * ( gray - mean );
+	}
+
+	/* average */
+	VectorScale( total, 1.0f / n, lightLuxel );
+	if ( lightDeluxel ) {
+		VectorScale( totaldirection, 1.0f / n, lightDeluxel );
+	}
+
+	/* return the rays not traced, samples that missed the surface cost nothing */
+	budget->credit += maxSamples - rays;
+	budget->numLuxels++;
+	budget->numRays += rays;
+	if ( b < maxSamples ) {
+		budget->numStopped++;
+	}
+}
+
+
+
+/*
+   AdaptiveSampleStats()
+   prints how many rays -adaptivesamples spent against uniform -randomsamples on the same luxels
+ */
+
+void AdaptiveSampleStats( void ){
+	double uniform;
+
+
+	if ( !lightAdaptiveSamples ) {
+		return;
+	}
+
+	uniform = (double) numAdaptiveLuxels * lightSamples;
+	Sys_Printf( "%9d luxels adaptively sampled, %d stopped early\n", numAdaptiveLuxels, numAdaptiveStopped );
+	Sys_Printf( "%9d adaptive rays, %.0f uniform rays (%.1f percent saved)\n", numAdaptiveRays, uniform,
+				uniform > 0.0 ? 100.0 * ( 1.0 - numAdaptiveRays / uniform ) : 0.0 );
+
+	/* reset for the next pass */
+	numAdaptiveLuxels = 0;
+	numAdaptiveRays = 0;
+	numAdaptiveStopped = 0;
+}
+
+
+
+/*
+   StoreLuxelLight()
+   stores the light a luxel got in the initial pass, returns 1 if it counts as lit
+ */
+
+static int StoreLuxelLight( trace_t *trace, float *lightLuxel, float *lightDeluxel, unsigned char *flag, qboolean subsample ){
+	VectorCopy( trace->color, lightLuxel );
+
+	/* add the contribution to the deluxemap */
+	if ( deluxemap ) {
+		VectorCopy( trace->directionContribution, lightDeluxel );
+	}
+
+	/* check for evilness */
+	if ( trace->forceSubsampling > 1.0f && subsample ) {
+		*flag |= FLAG_FORCE_SUBSAMPLING; /* force */
+		return 1;
+	}
+
+	/* add to count */
+	if ( trace->color[ 0 ] || trace->color[ 1 ] || trace->color[ 2 ] ) {
+		return 1;
+	}
+	return 0;
+}
+
+
+
 /*
    IlluminateRawLightmap()
    illuminates the luxels
@@ -2082,7 +2422,7 @@ static void RandomSubsampleRawLuxel( rawLightmap_t *lm, trace_t *trace, vec3_t s
 
 void IlluminateRawLightmap( int rawLightmapNum ){
 	int i, t, x, y, sx, sy, size, luxelFilterRadius, lightmapNum;
-	int                 *cluster, *cluster2, mapped, lighted, totalLighted;
+	int                 *cluster, *cluster2, mapped, lighted, totalLighted, numPending;
 	size_t llSize, ldSize;
 	rawLightmap_t       *lm;
 	surfaceInfo_t       *info;
@@ -2095,6 +2435,12 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 	float tests[ 4 ][ 2 ] = { { 0.0f, 0 }, { 1, 0 }, { 0, 1 }, { 1, 1 } };
 	trace_t trace;
 	float stackLightLuxels[ STACK_LL_SIZE ];
+	trace_t packet[ MAX_TRACE_PACKET ], *packetTraces[ MAX_TRACE_PACKET ];
+	float               *pendingLuxels[ MAX_TRACE_PACKET ], *pendingDeluxels[ MAX_TRACE_PACKET ];
+	unsigned char       *pendingFlags[ MAX_TRACE_PACKET ];
+	qboolean subsample;
+	lightCut_t          *lightCut;
+	adaptiveBudget_t adaptiveBudget;
 
 
 	/* bail if this number exceeds the number of raw lightmaps */
@@ -2102,8 +2448,9 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 		return;
 	}
 
-	/* get lightmap */
+	/* get lightmap, jittered samples draw from its own sequence */
 	lm = &rawLightmaps[ rawLightmapNum ];
+	SeedRandom( rawLightmapNum );
 
 	/* setup trace */
 	trace.testOcclusion = (qboolean)(!noTrace);
@@ -2112,6 +2459,8 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 	trace.numSurfaces = lm->numLightSurfaces;
 	trace.surfaces = &lightSurfaces[ lm->firstLightSurface ];
 	trace.inhibitRadius = DEFAULT_INHIBIT_RADIUS;
+	trace.shadowCache = ThreadShadowCache();
+	trace.shadowTile = rawLightmapNum;
 
 	/* twosided lighting (may or may not be a good idea for lightmapped stuff) */
 	trace.twoSided = qfalse;
@@ -2130,6 +2479,15 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 	/* create a culled light list for this raw lightmap */
 	CreateTraceLightsForBounds( lm->mins, lm->maxs, lm->plane, lm->numLightClusters, lm->lightClusters, LIGHT_SURFACES, &trace );
 
+	/* -adaptivesamples spends this lightmap's own ray credit */
+	memset( &adaptiveBudget, 0, sizeof( adaptiveBudget ) );
+
+	/* replace clustered lights with cuts through the light tree */
+	lightCut = NULL;
+	if ( lightTree ) {
+		lightCut = CutLightTree( lm, &trace );
+	}
+
 	/* -----------------------------------------------------------------
 	   fill pass
 	   ----------------------------------------------------------------- */
@@ -2321,6 +2679,17 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 				memset( (void *) lm->superFlags, 0, size );
 			}
 
+			/* setup packet lanes */
+			subsample = ( ( lightSamples > 1 || lightRandomSamples ) && luxelFilterRadius == 0 );
+			numPending = 0;
+			if ( !noPacketTrace ) {
+				for ( t = 0; t < MAX_TRACE_PACKET; t++ )
+				{
+					packet[ t ] = trace;
+					packetTraces[ t ] = &packet[ t ];
+				}
+			}
+
 			/* initial pass, one sample per luxel */
 			for ( y = 0; y < lm->sh; y++ )
 			{
@@ -2328,7 +2697,7 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 				{
 					/* get cluster */
 					cluster = SUPER_CLUSTER( x, y );
-					if ( *cluster < 0 ) {
+					if ( *cluster < 0 || LightCutSkips( lightCut, i, x, y ) ) {
 						continue;
 					}
 
@@ -2342,32 +2711,52 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 					/* set contribution count */
 					lightLuxel[ 3 ] = 1.0f;
 
-					/* setup trace */
-					trace.cluster = *cluster;
-					VectorCopy( origin, trace.origin );
-					VectorCopy( normal, trace.normal );
-
 					/* get light for this sample */
-					LightContributionToSample( &trace );
-					VectorCopy( trace.color, lightLuxel );
-
-					/* add the contribution to the deluxemap */
-					if ( deluxemap ) {
-						VectorCopy( trace.directionContribution, lightDeluxel );
+					if ( noPacketTrace ) {
+						trace.cluster = *cluster;
+						VectorCopy( origin, trace.origin );
+						VectorCopy( normal, trace.normal );
+						LightContributionToSample( &trace );
+						totalLighted += StoreLuxelLight( &trace, lightLuxel, lightDeluxel, flag, subsample );
+						continue;
 					}
 
-					/* check for evilness */
-					if ( trace.forceSubsampling > 1.0f && ( lightSamples > 1 || lightRandomSamples ) && luxelFilterRadius == 0 ) {
-						totalLighted++;
-						*flag |= FLAG_FORCE_SUBSAMPLING; /* force */
+					/* queue occlusion tests in a packet */
+					packet[ numPending ].cluster = *cluster;
+					VectorCopy( origin, packet[ numPending ].origin );
+					VectorCopy( normal, packet[ numPending ].normal );
+					if ( PrepareLightContribution( &packet[ numPending ] ) != LIGHT_TRACE_PENDING ) {
+						totalLighted += StoreLuxelLight( &packet[ numPending ], lightLuxel, lightDeluxel, flag, subsample );
+						continue;
 					}
-					/* add to count */
-					else if ( trace.color[ 0 ] || trace.color[ 1 ] || trace.color[ 2 ] ) {
-						totalLighted++;
+					pendingLuxels[ numPending ] = lightLuxel;
+					pendingDeluxels[ numPending ] = lightDeluxel;
+					pendingFlags[ numPending ] = flag;
+					numPending++;
+
+					/* flush full packets */
+					if ( numPending == MAX_TRACE_PACKET ) {
+						TraceLinePacket( packetTraces, numPending );
+						for ( t = 0; t < numPending; t++ )
+						{
+							FinishLightContribution( &packet[ t ] );
+							totalLighted += StoreLuxelLight( &packet[ t ], pendingLuxels[ t ], pendingDeluxels[ t ], pendingFlags[ t ], subsample );
+						}
+						numPending = 0;
 					}
 				}
 			}
 
+			/* flush the last packet */
+			if ( numPending > 0 ) {
+				TraceLinePacket( packetTraces, numPending );
+				for ( t = 0; t < numPending; t++ )
+				{
+					FinishLightContribution( &packet[ t ] );
+					totalLighted += StoreLuxelLight( &packet[ t ], pendingLuxels[ t ], pendingDeluxels[ t ], pendingFlags[ t ], subsample );
+				}
+			}
+
 			/* don't even bother with everything else if nothing was lit */
 			if ( totalLighted == 0 ) {
 				continue;
@@ -2395,7 +2784,7 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 
 							/* get cluster */
 							cluster = SUPER_CLUSTER( sx, sy );
-							if ( *cluster < 0 ) {
+							if ( *cluster < 0 || LightCutSkips( lightCut, i, sx, sy ) ) {
 								continue;
 							}
 							mapped++;
@@ -2430,7 +2819,7 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 
 								/* get luxel */
 								cluster = SUPER_CLUSTER( sx, sy );
-								if ( *cluster < 0 ) {
+								if ( *cluster < 0 || LightCutSkips( lightCut, i, sx, sy ) ) {
 									continue;
 								}
 								flag = SUPER_FLAG( sx, sy );
@@ -2446,7 +2835,10 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 								//%		continue;
 
 								/* subsample it */
-								if ( lightRandomSamples ) {
+								if ( lightAdaptiveSamples ) {
+									AdaptiveSubsampleRawLuxel( lm, &adaptiveBudget, &trace, origin, sx, sy, 0.5f * lightSamplesSearchBoxSize, lightLuxel, deluxemap ? lightDeluxel : NULL );
+								}
+								else if ( lightRandomSamples ) {
 									RandomSubsampleRawLuxel( lm, &trace, origin, sx, sy, 0.5f * lightSamplesSearchBoxSize, lightLuxel, deluxemap ? lightDeluxel : NULL );
 								}
 								else{
@@ -2636,6 +3028,16 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 
 	/* free light list */
 	FreeTraceLights( &trace );
+	FreeLightCut( lightCut );
+
+	/* add up the adaptive sampling stats */
+	if ( adaptiveBudget.numLuxels > 0 ) {
+		ThreadLock();
+		numAdaptiveLuxels += adaptiveBudget.numLuxels;
+		numAdaptiveRays += adaptiveBudget.numRays;
+		numAdaptiveStopped += adaptiveBudget.numStopped;
+		ThreadUnlock();
+	}
 
 	/* floodlight pass */
 	if ( floodlighty ) {
@@ -2814,6 +3216,7 @@ void IlluminateRawLightmap( int rawLightmapNum ){
 			}
 		}
 	}
+	SeedRandom( -1 );
 }
 
 #ifdef VERTEXLIGHT
@@ -2857,6 +3260,7 @@ void IlluminateVertexes( int num ){
 		trace.numSurfaces = 1;
 		trace.surfaces = &num;
 		trace.inhibitRadius = DEFAULT_INHIBIT_RADIUS;
+		trace.shadowCache = NULL;
 
 		/* twosided lighting */
 		trace.twoSided = info->si->twoSided;
@@ -3952,13 +4356,201 @@ void SetupEnvelopes( qboolean forGrid, qboolean fastFlag ){
 
 
 
+/* per thread bit per light, for merging the lists of several clusters */
+static int numClusterLightMasks, clusterLightMaskWords;
+static uint64_t **clusterLightMasks;
+
+
+
+/*
+   ClusterLightsForCluster()
+   lists the lights a single pvs cluster can see, in light list order
+ */
+
+static void ClusterLightsForCluster( int cluster ){
+	int i, count, *list;
+	light_t     *light;
+
+
+	/* walk the light list, sun lights reach every cluster */
+	list = safe_malloc( sizeof( int ) * numLights );
+	count = 0;
+	for ( i = 0; i < numLights; i++ )
+	{
+		light = lightsByNum[ i ];
+		if ( light->type != EMIT_SUN ) {
+			if ( sunOnly ) {
+				continue;
+			}
+			if ( clusterLightsForGrid ) {
+				if ( !ClusterVisible( cluster, light->cluster ) ) {
+					continue;
+				}
+			}
+			else if ( !ClusterVisible( light->cluster, cluster ) ) {
+				continue;
+			}
+		}
+		list[ count++ ] = i;
+	}
+
+	/* store a tight copy, ended by the null past the last light */
+	clusterNumLights[ cluster ] = count;
+	clusterLights[ cluster ] = safe_malloc( sizeof( int ) * ( count + 1 ) );
+	memcpy( clusterLights[ cluster ], list, sizeof( int ) * count );
+	clusterLights[ cluster ][ count ] = numLights;
+	free( list );
+}
+
+
+
+/*
+   SetupClusterLights()
+   precomputes the lights each pvs cluster can see for the current light list,
+   so per surface and per grid point light setup only walks the lists of its clusters
+   note: grid points test the pvs from the point's cluster, surfaces from the light's
+ */
+
+void SetupClusterLights( qboolean forGrid ){
+	int i, total;
+	light_t     *light;
+
+
+	/* free the old lists, they point into the previous light list */
+	if ( clusterLights != NULL ) {
+		for ( i = 0; i < numLightClusters; i++ )
+		{
+			free( clusterLights[ i ] );
+		}
+		free( clusterLights );
+		free( clusterNumLights );
+		clusterLights = NULL;
+		clusterNumLights = NULL;
+	}
+	for ( i = 0; i < numClusterLightMasks; i++ )
+	{
+		free( clusterLightMasks[ i ] );
+	}
+	free( clusterLightMasks );
+	clusterLightMasks = NULL;
+	numClusterLightMasks = 0;
+	free( lightsByNum );
+	lightsByNum = NULL;
+	numLightClusters = 0;
+
+	/* without a pvs every cluster sees every light, so there is nothing to precompute */
+	if ( noClusterLights || numLights == 0 || numBSPVisBytes <= VIS_HEADER_SIZE ) {
+		return;
+	}
+
+	/* number the lights, the extra null ends merged lists */
+	lightsByNum = safe_malloc( sizeof( light_t* ) * ( numLights + 1 ) );
+	for ( i = 0, light = lights; light != NULL && i < numLights; light = light->next, i++ )
+	{
+		lightsByNum[ i ] = light;
+	}
+	lightsByNum[ numLights ] = NULL;
+
+	/* allocate the merge masks */
+	numClusterLightMasks = numthreads > 1 ? numthreads : 1;
+	clusterLightMaskWords = ( numLights + 63 ) >> 6;
+	clusterLightMasks = safe_malloc( sizeof( uint64_t* ) * numClusterLightMasks );
+	for ( i = 0; i < numClusterLightMasks; i++ )
+	{
+		clusterLightMasks[ i ] = safe_malloc( sizeof( uint64_t ) * clusterLightMaskWords );
+		memset( clusterLightMasks[ i ], 0, sizeof( uint64_t ) * clusterLightMaskWords );
+	}
+
+	/* build the lists */
+	numLightClusters = ( (int*) bspVisBytes )[ 0 ];
+	clusterLightsForGrid = forGrid;
+	clusterNumLights = safe_malloc( sizeof( int ) * numLightClusters );
+	clusterLights = safe_malloc( sizeof( int* ) * numLightClusters );
+	Sys_FPrintf( SYS_VRB, "--- SetupClusterLights%s ---\n", forGrid ? " (grid)" : "" );
+	RunThreadsOnIndividual( numLightClusters, qfalse, ClusterLightsForCluster );
+
+	/* emit some statistics */
+	total = 0;
+	for ( i = 0; i < numLightClusters; i++ )
+	{
+		total += clusterNumLights[ i ];
+	}
+	Sys_FPrintf( SYS_VRB, "%9d clusters\n", numLightClusters );
+	Sys_FPrintf( SYS_VRB, "%9.1f lights per cluster\n", numLightClusters > 0 ? (float) total / numLightClusters : 0.0f );
+}
+
+
+
+/*
+   MergeClusterLights()
+   gathers the lights any of the clusters can see, once each and in light list order,
+   returns NULL when the caller has to test every light itself
+ */
+
+static int *MergeClusterLights( int numClusters, int *clusters, int *numCandidates ){
+	int i, j, n, b, thread, *candidates;
+	uint64_t        *mask, word;
+
+
+	/* count */
+	n = 0;
+	for ( i = 0; i < numClusters; i++ )
+	{
+		if ( clusters[ i ] >= 0 && clusters[ i ] < numLightClusters ) {
+			n += clusterNumLights[ clusters[ i ] ];
+		}
+	}
+	thread = ThreadNum();
+	if ( n == 0 || thread < 0 || thread >= numClusterLightMasks ) {
+		return NULL;
+	}
+
+	/* flag every light seen */
+	mask = clusterLightMasks[ thread ];
+	for ( i = 0; i < numClusters; i++ )
+	{
+		if ( clusters[ i ] >= 0 && clusters[ i ] < numLightClusters ) {
+			for ( j = 0; j < clusterNumLights[ clusters[ i ] ]; j++ )
+			{
+				b = clusterLights[ clusters[ i ] ][ j ];
+				mask[ b >> 6 ] |= ( (uint64_t) 1 ) << ( b & 63 );
+			}
+		}
+	}
+
+	/* read the flags back in order, clearing them for the next surface */
+	candidates = safe_malloc( sizeof( int ) * ( n + 1 ) );
+	n = 0;
+	for ( i = 0; i < clusterLightMaskWords; i++ )
+	{
+		word = mask[ i ];
+		if ( word == 0 ) {
+			continue;
+		}
+		mask[ i ] = 0;
+		for ( b = 0; word != 0; b++, word >>= 1 )
+		{
+			if ( word & 1 ) {
+				candidates[ n++ ] = ( i << 6 ) + b;
+			}
+		}
+	}
+
+	/* end with the null past the last light */
+	candidates[ n ] = numLights;
+	*numCandidates = n;
+	return candidates;
+}
+
+
+
 /*
    CreateTraceLightsForBounds()
    creates a list of lights that affect the given bounding box and pvs clusters (bsp leaves)
  */
 
 void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int numClusters, int *clusters, int flags, trace_t *trace ){
-	int i;
+	int i, j, numCandidates, *candidates;
 	light_t     *light;
 	vec3_t origin, dir, nullVector = { 0.0f, 0.0f, 0.0f };
 	float radius, dist, length;
@@ -3992,9 +4584,21 @@ void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int nu
 		length = 0;
 	}
 
+	/* merge the precomputed lists of the clusters instead of testing the pvs of every light */
+	candidates = NULL;
+	numCandidates = 0;
+	if ( clusterLights != NULL && !clusterLightsForGrid && numClusters > 0 && clusters != NULL ) {
+		candidates = MergeClusterLights( numClusters, clusters, &numCandidates );
+		if ( candidates != NULL ) {
+			lightsClusterCulled += numLights - numCandidates;
+		}
+	}
+
 	/* test each light and see if it reaches the sphere */
 	/* note: the attenuation code MUST match LightingAtSample() */
-	for ( light = lights; light; light = light->next )
+	j = 0;
+	light = ( candidates != NULL ) ? lightsByNum[ candidates[ 0 ] ] : lights;
+	for ( ; light != NULL; light = ( candidates != NULL ) ? lightsByNum[ candidates[ ++j ] ] : light->next )
 	{
 		/* check zero sized envelope */
 		if ( light->envelope <= 0 ) {
@@ -4015,7 +4619,7 @@ void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int nu
 			}
 
 			/* check against pvs cluster */
-			if ( numClusters > 0 && clusters != NULL ) {
+			if ( candidates == NULL && numClusters > 0 && clusters != NULL ) {
 				for ( i = 0; i < numClusters; i++ )
 				{
 					if ( ClusterVisible( light->cluster, clusters[ i ] ) ) {
@@ -4077,6 +4681,7 @@ void CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int nu
 
 	/* make last night null */
 	trace->lights[ trace->numLights ] = NULL;
+	free( candidates );
 }
 
 
@@ -4215,6 +4820,40 @@ void SetupFloodLight( void ){
 	ColorNormalize( floodlightRGB,floodlightRGB );
 }
 
+/*
+   FloodLightForTrace()
+   returns the floodlight contribution of one traced floodlight ray
+ */
+
+static float FloodLightForTrace( trace_t *trace, float dd ){
+	float d, contribution;
+	vec3_t displacement;
+
+
+	contribution = 1;
+
+	if ( trace->compileFlags & C_SKY || trace->compileFlags & C_TRANSLUCENT ) {
+		contribution = 1.0f;
+	}
+	else if ( trace->opaque ) {
+		VectorSubtract( trace->hit, trace->origin, displacement );
+		d = VectorLength( displacement );
+
+		// d=trace->distance;
+		//if (d>256) gatherDirt+=1;
+		contribution = d / dd;
+		if ( contribution > 1 ) {
+			contribution = 1.0f;
+		}
+
+		//gatherDirt += 1.0f - ooDepth * VectorLength( displacement );
+	}
+
+	return contribution;
+}
+
+
+
 /*
    FloodLightForSample()
    calculates floodlight value for a given sample
@@ -4223,13 +4862,13 @@ void SetupFloodLight( void ){
 
 float FloodLightForSample( trace_t *trace, float floodLightDistance, qboolean floodLightLowQuality ){
 	int i;
-	float d;
-	float contribution;
 	int sub = 0;
 	float gatherLight, outLight;
-	vec3_t normal, worldUp, myUp, myRt, direction, displacement;
+	vec3_t normal, worldUp, myUp, myRt, direction;
 	float dd;
 	int vecs = 0;
+	int j, numPending;
+	trace_t packet[ MAX_TRACE_PACKET ], *packetTraces[ MAX_TRACE_PACKET ], *rayTrace;
 
 	gatherLight = 0;
 	/* dummy check */
@@ -4274,6 +4913,16 @@ float FloodLightForSample( trace_t *trace, float floodLightDistance, qboolean fl
 	}
 	else
 	{
+		/* setup packet lanes */
+		if ( !noPacketTrace ) {
+			for ( j = 0; j < MAX_TRACE_PACKET; j++ )
+			{
+				packet[ j ] = *trace;
+				packetTraces[ j ] = &packet[ j ];
+			}
+		}
+		numPending = 0;
+
 		/* iterate through ordered vectors */
 		for ( i = 0; i < numFloodVectors; i++ )
 		{
@@ -4285,34 +4934,35 @@ float FloodLightForSample( trace_t *trace, float floodLightDistance, qboolean fl
 			direction[ 2 ] = myRt[ 2 ] * floodVectors[ i ][ 0 ] + myUp[ 2 ] * floodVectors[ i ][ 1 ] + normal[ 2 ] * floodVectors[ i ][ 2 ];
 
 			/* set endpoint */
-			VectorMA( trace->origin, dd, direction, trace->end );
+			rayTrace = noPacketTrace ? trace : &packet[ numPending ];
+			VectorMA( rayTrace->origin, dd, direction, rayTrace->end );
 
 			//VectorMA( trace->origin, 1, direction, trace->origin );
 
-			SetupTrace( trace );
-			VectorSet(trace->color, 1.0f, 1.0f, 1.0f);
-			/* trace */
-			TraceLine( trace );
-			contribution = 1;
+			SetupTrace( rayTrace );
+			VectorSet( rayTrace->color, 1.0f, 1.0f, 1.0f );
 
-			if ( trace->compileFlags & C_SKY || trace->compileFlags & C_TRANSLUCENT ) {
-				contribution = 1.0f;
+			/* trace */
+			if ( noPacketTrace ) {
+				TraceLine( trace );
+				gatherLight += FloodLightForTrace( trace, dd );
+				continue;
 			}
-			else if ( trace->opaque ) {
-				VectorSubtract( trace->hit, trace->origin, displacement );
-				d = VectorLength( displacement );
-
-				// d=trace->distance;
-				//if (d>256) gatherDirt+=1;
-				contribution = d / dd;
-				if ( contribution > 1 ) {
-					contribution = 1.0f;
-				}
 
-				//gatherDirt += 1.0f - ooDepth * VectorLength( displacement );
+			/* trace full packets */
+			numPending++;
+			if ( numPending < MAX_TRACE_PACKET && i < numFloodVectors - 1 ) {
+				continue;
 			}
+			TraceLinePacket( packetTraces, numPending );
+			for ( j = 0; j < numPending; j++ )
+				gatherLight += FloodLightForTrace( &packet[ j ], dd );
+			numPending = 0;
+		}
 
-			gatherLight += contribution;
+		/* leave the last ray in the trace, like the single ray path does */
+		if ( !noPacketTrace && numFloodVectors > 0 ) {
+			*trace = packet[ ( numFloodVectors - 1 ) % MAX_TRACE_PACKET ];
 		}
 	}
 
@@ -4500,7 +5150,9 @@ void FloodLightRawLightmap( int rawLightmapNum ){
 void FloodlightRawLightmaps(){
 	Sys_Printf( "--- FloodlightRawLightmap ---\n" );
 	numSurfacesFloodlighten = 0;
-	RunThreadsOnIndividual( numRawLightmaps, qtrue, FloodLightRawLightmap );
+	ProfileBegin( "FloodlightRawLightmap" );
+	RunThreadsOnIndividualCost( numRawLightmaps, qtrue, FloodLightRawLightmap, RawLightmapCost );
+	ProfileEnd();
 	Sys_Printf( "%9d custom lightmaps floodlighted\n", numSurfacesFloodlighten );
 }
 
@@ -89,6 +89,7 @@ void WriteTGA24( char *filename, byte *data, int width, int height, qboolean fli
 	if ( file == NULL ) {
 		Error( "Unable to open %s for writing", filename );
 	}
+	vfsAddWrittenFile( filename );
 
 	/* flip vertically? */
 	if ( flip ) {
@@ -105,40 +106,59 @@ void WriteTGA24( char *filename, byte *data, int width, int height, qboolean fli
 	free( buffer );
 }
 
-static unsigned int PackE5BRG9(float *rgb, float one)
-{       //5 bits exponent, 3*9 bits of mantissa. no sign bit.
-	int e = 0;
-	int r,g,b;
-	float scale;
-	float m = rgb[0]; if(m<rgb[1]) m=rgb[1]; if(m<rgb[1]) m=rgb[1];
-	m /= one;
+/*
+   FloatToRGB9E5()
+   packs a non-negative rgb color into a shared exponent e5b9g9r9 word (EXT_texture_shared_exponent)
+ */
+
+#define RGB9E5_MAX              32704.0f        /* 511/512 * 2^15, keeps the exponent below 31 */
+
+static unsigned int FloatToRGB9E5( const float *rgb ){
+	int i, e, m[ 3 ];
+	float c[ 3 ], maxc, scale;
+
+
+	/* clamp */
+	maxc = 0.0f;
+	for ( i = 0; i < 3; i++ )
+	{
+		c[ i ] = rgb[ i ] > 0.0f ? ( rgb[ i ] < RGB9E5_MAX ? rgb[ i ] : RGB9E5_MAX ) : 0.0f;
+		if ( c[ i ] > maxc ) {
+			maxc = c[ i ];
+		}
+	}
 
-	if (m >= 0.5)
-	{       //positive exponent
-		while (m >= (1<<(e)) && e < 30-15)      //don't do nans.
-			e++;
+	/* pick the exponent from the largest channel */
+	frexp( maxc, &e );
+	if ( e < -15 ) {
+		e = -15;
 	}
-	else
-	{       //negative exponent...
-		while (m < 1/(1<< -e) && e > -15)       //don't do denormals.
-			e--;
+	scale = ldexp( 1.0, e - 9 );
+	if ( (int) ( maxc / scale + 0.5f ) > 0x1ff ) {
+		e++;
+		scale *= 2.0f;
 	}
 
-	scale = pow(2, e-9);
-	scale *= one;
+	/* quantize */
+	for ( i = 0; i < 3; i++ )
+	{
+		m[ i ] = (int) ( c[ i ] / scale + 0.5f );
+		if ( m[ i ] > 0x1ff ) {
+			m[ i ] = 0x1ff;
+		}
+	}
+	return ( ( e + 15 ) << 27 ) | ( m[ 2 ] << 18 ) | ( m[ 1 ] << 9 ) | m[ 0 ];
+}
 
-	r = rgb[0]/scale + 0.5;
-	if (r < 0) r = 0;
-	if (r > 0x1ff) r = 0x1ff;
-	g = rgb[1]/scale + 0.5;
-	if (g < 0) g = 0;
-	if (g > 0x1ff) g = 0x1ff;
-	b = rgb[2]/scale + 0.5;
-	if (b < 0) b = 0;
-	if (b > 0x1ff) b = 0x1ff;
+static unsigned int PackE5BRG9( float *rgb, float one ){
+	vec3_t scaled;
 
-	return ((e+15)<<27) | (b<<18) | (g<<9) | r;
+	VectorScale( rgb, 1.0f / one, scaled );
+	return FloatToRGB9E5( scaled );
 }
+
+
+
 /*
    WriteHDR()
    Writes a Khronos TeXture, using some hdr format...
@@ -157,6 +177,7 @@ void WriteHDR( char *filename, float *data, int width, int height, qboolean flip
 	if ( file == NULL ) {
 		Error( "Unable to open %s for writing", filename );
 	}
+	vfsAddWrittenFile( filename );
 
 	if (fmt == 0)
 	{       //tga bgr format
@@ -451,13 +472,102 @@ static int CompareLightSurface( const void *a, const void *b ){
 
 
 
+/*
+   AllocRawLightmapSamples()
+   allocates and clears a raw lightmap's supersampled buffers
+ */
+
+void AllocRawLightmapSamples( rawLightmap_t *lm ){
+	int i, size, *sc;
+
+
+	/* allocate sampling lightmap storage */
+	size = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
+	if ( lm->superLuxels[ 0 ] == NULL ) {
+		lm->superLuxels[ 0 ] = safe_malloc( size );
+	}
+	memset( lm->superLuxels[ 0 ], 0, size );
+
+	/* allocate origin map storage */
+	size = lm->sw * lm->sh * SUPER_ORIGIN_SIZE * sizeof( float );
+	if ( lm->superOrigins == NULL ) {
+		lm->superOrigins = safe_malloc( size );
+	}
+	memset( lm->superOrigins, 0, size );
+
+	/* allocate normal map storage */
+	size = lm->sw * lm->sh * SUPER_NORMAL_SIZE * sizeof( float );
+	if ( lm->superNormals == NULL ) {
+		lm->superNormals = safe_malloc( size );
+	}
+	memset( lm->superNormals, 0, size );
+
+	/* allocate floodlight map storage */
+	size = lm->sw * lm->sh * SUPER_FLOODLIGHT_SIZE * sizeof( float );
+	if ( lm->superFloodLight == NULL ) {
+		lm->superFloodLight = safe_malloc( size );
+	}
+	memset( lm->superFloodLight, 0, size );
+
+	/* allocate cluster map storage */
+	size = lm->sw * lm->sh * sizeof( int );
+	if ( lm->superClusters == NULL ) {
+		lm->superClusters = safe_malloc( size );
+	}
+	size = lm->sw * lm->sh;
+	sc = lm->superClusters;
+	for ( i = 0; i < size; i++ )
+		( *sc++ ) = CLUSTER_UNMAPPED;
+
+	/* allocate sampling deluxel storage */
+	if ( deluxemap ) {
+		size = lm->sw * lm->sh * SUPER_DELUXEL_SIZE * sizeof( float );
+		if ( lm->superDeluxels == NULL ) {
+			lm->superDeluxels = safe_malloc( size );
+		}
+		memset( lm->superDeluxels, 0, size );
+	}
+}
+
+
+
+/*
+   FreeRawLightmapSamples()
+   frees a raw lightmap's supersampled buffers, leaving the bsp luxels
+ */
+
+void FreeRawLightmapSamples( rawLightmap_t *lm ){
+	int lightmapNum;
+
+
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+	{
+		if ( lm->superLuxels[ lightmapNum ] != NULL ) {
+			free( lm->superLuxels[ lightmapNum ] );
+			lm->superLuxels[ lightmapNum ] = NULL;
+		}
+	}
+	free( lm->superOrigins );
+	lm->superOrigins = NULL;
+	free( lm->superNormals );
+	lm->superNormals = NULL;
+	free( lm->superFloodLight );
+	lm->superFloodLight = NULL;
+	free( lm->superClusters );
+	lm->superClusters = NULL;
+	free( lm->superDeluxels );
+	lm->superDeluxels = NULL;
+}
+
+
+
 /*
    FinishRawLightmap()
    allocates a raw lightmap's necessary buffers
  */
 
 void FinishRawLightmap( rawLightmap_t *lm ){
-	int i, j, c, size, *sc;
+	int i, j, c, size;
 	float is;
 	surfaceInfo_t       *info;
 
@@ -540,54 +650,8 @@ void FinishRawLightmap( rawLightmap_t *lm ){
 		memset( lm->radLuxels[ 0 ], 0, size );
 	}
 
-	/* allocate sampling lightmap storage */
-	size = lm->sw * lm->sh * SUPER_LUXEL_SIZE * sizeof( float );
-	if ( lm->superLuxels[ 0 ] == NULL ) {
-		lm->superLuxels[ 0 ] = safe_malloc( size );
-	}
-	memset( lm->superLuxels[ 0 ], 0, size );
-
-	/* allocate origin map storage */
-	size = lm->sw * lm->sh * SUPER_ORIGIN_SIZE * sizeof( float );
-	if ( lm->superOrigins == NULL ) {
-		lm->superOrigins = safe_malloc( size );
-	}
-	memset( lm->superOrigins, 0, size );
-
-	/* allocate normal map storage */
-	size = lm->sw * lm->sh * SUPER_NORMAL_SIZE * sizeof( float );
-	if ( lm->superNormals == NULL ) {
-		lm->superNormals = safe_malloc( size );
-	}
-	memset( lm->superNormals, 0, size );
-
-	/* allocate floodlight map storage */
-	size = lm->sw * lm->sh * SUPER_FLOODLIGHT_SIZE * sizeof( float );
-	if ( lm->superFloodLight == NULL ) {
-		lm->superFloodLight = safe_malloc( size );
-	}
-	memset( lm->superFloodLight, 0, size );
-
-	/* allocate cluster map storage */
-	size = lm->sw * lm->sh * sizeof( int );
-	if ( lm->superClusters == NULL ) {
-		lm->superClusters = safe_malloc( size );
-	}
-	size = lm->sw * lm->sh;
-	sc = lm->superClusters;
-	for ( i = 0; i < size; i++ )
-		( *sc++ ) = CLUSTER_UNMAPPED;
-
-	/* deluxemap allocation */
+	/* allocate bsp deluxel storage */
 	if ( deluxemap ) {
-		/* allocate sampling deluxel storage */
-		size = lm->sw * lm->sh * SUPER_DELUXEL_SIZE * sizeof( float );
-		if ( lm->superDeluxels == NULL ) {
-			lm->superDeluxels = safe_malloc( size );
-		}
-		memset( lm->superDeluxels, 0, size );
-
-		/* allocate bsp deluxel storage */
 		size = lm->w * lm->h * BSP_DELUXEL_SIZE * sizeof( float );
 		if ( lm->bspDeluxels == NULL ) {
 			lm->bspDeluxels = safe_malloc( size );
@@ -595,6 +659,11 @@ void FinishRawLightmap( rawLightmap_t *lm ){
 		memset( lm->bspDeluxels, 0, size );
 	}
 
+	/* streamed lightmaps allocate their sampling buffers when they are lit */
+	if ( !streamLightmaps ) {
+		AllocRawLightmapSamples( lm );
+	}
+
 	/* add to count */
 	numLuxels += ( lm->sw * lm->sh );
 }
@@ -2094,6 +2163,112 @@ static qboolean TestOutLightmapStamp( rawLightmap_t *lm, int lightmapNum, outLig
 
 
 
+/*
+   RaiseSkyline()
+   marks everything below top in the columns [x, x + width) of an output lightmap as taken
+ */
+
+static void RaiseSkyline( outLightmap_t *olm, int x, int width, int top ){
+	int i, numNodes, x0, x1;
+	skylineNode_t   *node, nodes[ 3 ];
+
+
+	x0 = x;
+	x1 = x + width;
+
+	/* split the overlapped nodes (a node becomes at most 3) */
+	numNodes = olm->numSkylineNodes;
+	olm->skyline = realloc( olm->skyline, ( numNodes + 2 ) * sizeof( skylineNode_t ) );
+	if ( olm->skyline == NULL ) {
+		Error( "RaiseSkyline: out of memory" );
+	}
+	for ( i = 0; i < numNodes; i++ )
+	{
+		node = &olm->skyline[ i ];
+		if ( node->x + node->width <= x0 || node->x >= x1 || node->y >= top ) {
+			continue;
+		}
+
+		width = 0;
+		if ( node->x < x0 ) {
+			nodes[ width ].x = node->x;
+			nodes[ width ].y = node->y;
+			nodes[ width ].width = x0 - node->x;
+			width++;
+		}
+		nodes[ width ].x = node->x > x0 ? node->x : x0;
+		nodes[ width ].y = top;
+		nodes[ width ].width = ( node->x + node->width < x1 ? node->x + node->width : x1 ) - nodes[ width ].x;
+		width++;
+		if ( node->x + node->width > x1 ) {
+			nodes[ width ].x = x1;
+			nodes[ width ].y = node->y;
+			nodes[ width ].width = node->x + node->width - x1;
+			width++;
+		}
+
+		memmove( node + width, node + 1, ( numNodes - i - 1 ) * sizeof( skylineNode_t ) );
+		memcpy( node, nodes, width * sizeof( skylineNode_t ) );
+		numNodes += width - 1;
+		i += width - 1;
+	}
+
+	/* merge neighbours of the same height */
+	for ( i = 1; i < numNodes; i++ )
+	{
+		if ( olm->skyline[ i - 1 ].y == olm->skyline[ i ].y ) {
+			olm->skyline[ i - 1 ].width += olm->skyline[ i ].width;
+			memmove( &olm->skyline[ i ], &olm->skyline[ i + 1 ], ( numNodes - i - 1 ) * sizeof( skylineNode_t ) );
+			numNodes--;
+			i--;
+		}
+	}
+	olm->numSkylineNodes = numNodes;
+}
+
+
+
+/*
+   FindSkylinePosition()
+   finds the lowest (then leftmost) spot on the skyline of an output lightmap a w * h rectangle fits on
+ */
+
+static qboolean FindSkylinePosition( outLightmap_t *olm, int w, int h, int *x, int *y ){
+	int i, j, top, bestTop, bestX;
+
+
+	bestTop = olm->customHeight - h + 1;
+	bestX = -1;
+	for ( i = 0; i < olm->numSkylineNodes && olm->skyline[ i ].x + w <= olm->customWidth; i++ )
+	{
+		/* rest on the highest node under the rectangle */
+		top = 0;
+		for ( j = i; j < olm->numSkylineNodes && olm->skyline[ j ].x < olm->skyline[ i ].x + w; j++ )
+		{
+			if ( olm->skyline[ j ].y > top ) {
+				top = olm->skyline[ j ].y;
+				if ( top >= bestTop ) {
+					break;
+				}
+			}
+		}
+
+		if ( top < bestTop ) {
+			bestTop = top;
+			bestX = olm->skyline[ i ].x;
+		}
+	}
+
+	if ( bestX < 0 ) {
+		return qfalse;
+	}
+	*x = bestX;
+	*y = bestTop;
+	return qtrue;
+}
+
+
+
 /*
    SetupOutLightmap()
    sets up an output lightmap
@@ -2129,6 +2304,13 @@ static void SetupOutLightmap( rawLightmap_t *lm, outLightmap_t *olm ){
 	olm->freeLuxels = olm->customWidth * olm->customHeight;
 	olm->numShaders = 0;
 
+	/* start with an empty skyline */
+	olm->numSkylineNodes = 1;
+	olm->skyline = safe_malloc( sizeof( skylineNode_t ) );
+	olm->skyline[ 0 ].x = 0;
+	olm->skyline[ 0 ].y = 0;
+	olm->skyline[ 0 ].width = olm->customWidth;
+
 	/* allocate buffers */
 	olm->lightBits = safe_malloc( ( olm->customWidth * olm->customHeight / 8 ) + 8 );
 	memset( olm->lightBits, 0, ( olm->customWidth * olm->customHeight / 8 ) + 8 );
@@ -2274,7 +2456,7 @@ static void FindOutLightmaps( rawLightmap_t *lm, qboolean fastAllocate ){
 				}
 
 				/* if fast allocation, skip lightmap files that are more than 90% complete */
-				if ( fastAllocate == qtrue ) {
+				if ( fastAllocate == qtrue && skylineAllocate == qfalse ) {
 					if (olm->freeLuxels < (olm->customWidth * olm->customHeight) / 10) {
 						continue;
 					}
@@ -2286,6 +2468,20 @@ static void FindOutLightmaps( rawLightmap_t *lm, qboolean fastAllocate ){
 					continue;
 				}
 
+				/* skyline allocation places the bounding rectangle on the lowest fitting spot */
+				if ( skylineAllocate ) {
+					if ( lm->solid[ lightmapNum ] ) {
+						ok = FindSkylinePosition( olm, 1, 1, &x, &y );
+					}
+					else{
+						ok = FindSkylinePosition( olm, lm->w, lm->h, &x, &y );
+					}
+					if ( ok ) {
+						break;
+					}
+					continue;
+				}
+
 				/* set maxs */
 				if ( lm->solid[ lightmapNum ] ) {
 					xMax = olm->customWidth;
@@ -2405,6 +2601,9 @@ static void FindOutLightmaps( rawLightmap_t *lm, qboolean fastAllocate ){
 			yMax = lm->h;
 		}
 
+		/* keep the skyline above everything stored */
+		RaiseSkyline( olm, lm->lightmapX[ lightmapNum ], xMax, lm->lightmapY[ lightmapNum ] + yMax );
+
 		/* mark the bits used */
 		for ( y = 0; y < yMax; y++ )
 		{
@@ -2527,6 +2726,40 @@ static int CompareRawLightmap( const void *a, const void *b ){
 
 
 
+/*
+   CompareRawLightmapArea()
+   compare function for qsort(), largest lightmaps first for skyline allocation
+ */
+
+static int CompareRawLightmapArea( const void *a, const void *b ){
+	rawLightmap_t   *alm, *blm;
+	int diff;
+
+
+	/* get lightmaps */
+	alm = &rawLightmaps[ *( (const int*) a ) ];
+	blm = &rawLightmaps[ *( (const int*) b ) ];
+
+	/* compare size */
+	diff = ( blm->w * blm->h ) - ( alm->w * alm->h );
+	if ( diff != 0 ) {
+		return diff;
+	}
+	diff = blm->h - alm->h;
+	if ( diff != 0 ) {
+		return diff;
+	}
+
+	/* then as usual, keeping the order stable */
+	diff = CompareRawLightmap( a, b );
+	if ( diff != 0 ) {
+		return diff;
+	}
+	return *( (const int*) a ) - *( (const int*) b );
+}
+
+
+
 void FillOutLightmap( outLightmap_t *olm ){
 	int x, y;
 	int ofs;
@@ -2681,469 +2914,508 @@ void FillOutLightmap( outLightmap_t *olm ){
 
 
 
+/* luxels used by SubsampleRawLightmap() since the last store */
+static int subsampledLuxels;
+
+
+
 /*
-   StoreSurfaceLightmaps()
-   stores the surface lightmaps into the bsp as byte rgb triplets
+   SubsampleRawLightmap()
+   averages a raw lightmap's supersampled luxels into its bsp (and radiosity) luxels
+   safe to call from the worker threads, the used luxel count is gathered for StoreSurfaceLightmaps()
  */
 
-void StoreSurfaceLightmaps( qboolean fastAllocate ){
-	int i, j, k, x, y, lx, ly, sx, sy, *cluster, mappedSamples;
-	int style, size, lightmapNum, lightmapNum2;
+void SubsampleRawLightmap( rawLightmap_t *lm ){
+	int j, x, y, lx, ly, sx, sy, *cluster, mappedSamples;
+	int size, lightmapNum, used;
 	float               *normal, *luxel, *bspLuxel, *bspLuxel2, *radLuxel, samples, occludedSamples;
 	vec3_t sample, occludedSample, dirSample, colorMins, colorMaxs;
 	float               *deluxel, *bspDeluxel, *bspDeluxel2;
-	byte                *lb;
-	int numUsed, numTwins, numTwinLuxels, numStored;
-	float lmx, lmy, efficiency;
-	vec3_t color;
-	bspDrawSurface_t    *ds, *parent, dsTemp;
-	surfaceInfo_t       *info;
-	rawLightmap_t       *lm, *lm2;
-	outLightmap_t       *olm;
-	bspDrawVert_t       *dv, *ydv, *dvParent;
-	char dirname[ 1024 ], filename[ 1024+20 ];
-	shaderInfo_t        *csi;
-	char lightmapName[ 128 ];
-	const char          *rgbGenValues[ 256 ];
-	const char          *alphaGenValues[ 256 ];
-
-
-	/* note it */
-	Sys_Printf( "--- StoreSurfaceLightmaps ---\n" );
-
-	/* setup */
-	if ( lmCustomDir ) {
-		strcpy( dirname, lmCustomDir );
-	}
-	else
-	{
-		strcpy( dirname, source );
-		StripExtension( dirname );
-	}
-	memset( rgbGenValues, 0, sizeof( rgbGenValues ) );
-	memset( alphaGenValues, 0, sizeof( alphaGenValues ) );
-
-	/* -----------------------------------------------------------------
-	   average the sampled luxels into the bsp luxels
-	   ----------------------------------------------------------------- */
 
-	/* note it */
-	Sys_FPrintf( SYS_VRB, "Subsampling..." );
 
-	/* walk the list of raw lightmaps */
-	numUsed = 0;
-	numTwins = 0;
-	numTwinLuxels = 0;
-	numSolidLightmaps = 0;
-	for ( i = 0; i < numRawLightmaps; i++ )
+	/* walk individual lightmaps */
+	used = 0;
+	for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
 	{
-		/* get lightmap */
-		lm = &rawLightmaps[ i ];
-
-		/* walk individual lightmaps */
-		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
-		{
-			/* early outs */
-			if ( lm->superLuxels[ lightmapNum ] == NULL ) {
-				continue;
-			}
+		/* early outs */
+		if ( lm->superLuxels[ lightmapNum ] == NULL ) {
+			continue;
+		}
 
-			/* allocate bsp luxel storage */
-			if ( lm->bspLuxels[ lightmapNum ] == NULL ) {
-				size = lm->w * lm->h * BSP_LUXEL_SIZE * sizeof( float );
-				lm->bspLuxels[ lightmapNum ] = safe_malloc( size );
-				memset( lm->bspLuxels[ lightmapNum ], 0, size );
-			}
+		/* allocate bsp luxel storage */
+		if ( lm->bspLuxels[ lightmapNum ] == NULL ) {
+			size = lm->w * lm->h * BSP_LUXEL_SIZE * sizeof( float );
+			lm->bspLuxels[ lightmapNum ] = safe_malloc( size );
+			memset( lm->bspLuxels[ lightmapNum ], 0, size );
+		}
 
-			/* allocate radiosity lightmap storage */
-			if ( bounce ) {
-				size = lm->w * lm->h * RAD_LUXEL_SIZE * sizeof( float );
-				if ( lm->radLuxels[ lightmapNum ] == NULL ) {
-					lm->radLuxels[ lightmapNum ] = safe_malloc( size );
-				}
-				memset( lm->radLuxels[ lightmapNum ], 0, size );
+		/* allocate radiosity lightmap storage */
+		if ( bounce ) {
+			size = lm->w * lm->h * RAD_LUXEL_SIZE * sizeof( float );
+			if ( lm->radLuxels[ lightmapNum ] == NULL ) {
+				lm->radLuxels[ lightmapNum ] = safe_malloc( size );
 			}
+			memset( lm->radLuxels[ lightmapNum ], 0, size );
+		}
 
-			/* average supersampled luxels */
-			for ( y = 0; y < lm->h; y++ )
+		/* average supersampled luxels */
+		for ( y = 0; y < lm->h; y++ )
+		{
+			for ( x = 0; x < lm->w; x++ )
 			{
-				for ( x = 0; x < lm->w; x++ )
+				/* subsample */
+				samples = 0.0f;
+				occludedSamples = 0.0f;
+				mappedSamples = 0;
+				VectorClear( sample );
+				VectorClear( occludedSample );
+				VectorClear( dirSample );
+				for ( ly = 0; ly < superSample; ly++ )
 				{
-					/* subsample */
-					samples = 0.0f;
-					occludedSamples = 0.0f;
-					mappedSamples = 0;
-					VectorClear( sample );
-					VectorClear( occludedSample );
-					VectorClear( dirSample );
-					for ( ly = 0; ly < superSample; ly++ )
+					for ( lx = 0; lx < superSample; lx++ )
 					{
-						for ( lx = 0; lx < superSample; lx++ )
-						{
-							/* sample luxel */
-							sx = x * superSample + lx;
-							sy = y * superSample + ly;
-							luxel = SUPER_LUXEL( lightmapNum, sx, sy );
-							deluxel = SUPER_DELUXEL( sx, sy );
-							normal = SUPER_NORMAL( sx, sy );
-							cluster = SUPER_CLUSTER( sx, sy );
+						/* sample luxel */
+						sx = x * superSample + lx;
+						sy = y * superSample + ly;
+						luxel = SUPER_LUXEL( lightmapNum, sx, sy );
+						deluxel = SUPER_DELUXEL( sx, sy );
+						normal = SUPER_NORMAL( sx, sy );
+						cluster = SUPER_CLUSTER( sx, sy );
+
+						/* sample deluxemap */
+						if ( deluxemap && lightmapNum == 0 ) {
+							VectorAdd( dirSample, deluxel, dirSample );
+						}
 
-							/* sample deluxemap */
-							if ( deluxemap && lightmapNum == 0 ) {
-								VectorAdd( dirSample, deluxel, dirSample );
-							}
+						/* keep track of used/occluded samples */
+						if ( *cluster != CLUSTER_UNMAPPED ) {
+							mappedSamples++;
+						}
+
+						/* handle lightmap border? */
+						if ( lightmapBorder && ( sx == 0 || sx == ( lm->sw - 1 ) || sy == 0 || sy == ( lm->sh - 1 ) ) && luxel[ 3 ] > 0.0f ) {
+							VectorSet( sample, 255.0f, 0.0f, 0.0f );
+							samples += 1.0f;
+						}
 
-							/* keep track of used/occluded samples */
-							if ( *cluster != CLUSTER_UNMAPPED ) {
-								mappedSamples++;
+						/* handle debug */
+						else if ( debug && *cluster < 0 ) {
+							if ( *cluster == CLUSTER_UNMAPPED ) {
+								VectorSet( luxel, 255, 204, 0 );
+							}
+							else if ( *cluster == CLUSTER_OCCLUDED ) {
+								VectorSet( luxel, 255, 0, 255 );
 							}
+							else if ( *cluster == CLUSTER_FLOODED ) {
+								VectorSet( luxel, 0, 32, 255 );
+							}
+							VectorAdd( occludedSample, luxel, occludedSample );
+							occludedSamples += 1.0f;
+						}
 
-							/* handle lightmap border? */
-							if ( lightmapBorder && ( sx == 0 || sx == ( lm->sw - 1 ) || sy == 0 || sy == ( lm->sh - 1 ) ) && luxel[ 3 ] > 0.0f ) {
-								VectorSet( sample, 255.0f, 0.0f, 0.0f );
-								samples += 1.0f;
+						/* normal luxel handling */
+						else if ( luxel[ 3 ] > 0.0f ) {
+							/* handle lit or flooded luxels */
+							if ( *cluster > 0 || *cluster == CLUSTER_FLOODED ) {
+								VectorAdd( sample, luxel, sample );
+								samples += luxel[ 3 ];
 							}
 
-							/* handle debug */
-							else if ( debug && *cluster < 0 ) {
-								if ( *cluster == CLUSTER_UNMAPPED ) {
-									VectorSet( luxel, 255, 204, 0 );
-								}
-								else if ( *cluster == CLUSTER_OCCLUDED ) {
-									VectorSet( luxel, 255, 0, 255 );
-								}
-								else if ( *cluster == CLUSTER_FLOODED ) {
-									VectorSet( luxel, 0, 32, 255 );
-								}
+							/* handle occluded or unmapped luxels */
+							else
+							{
 								VectorAdd( occludedSample, luxel, occludedSample );
-								occludedSamples += 1.0f;
+								occludedSamples += luxel[ 3 ];
 							}
 
-							/* normal luxel handling */
-							else if ( luxel[ 3 ] > 0.0f ) {
-								/* handle lit or flooded luxels */
-								if ( *cluster > 0 || *cluster == CLUSTER_FLOODED ) {
-									VectorAdd( sample, luxel, sample );
-									samples += luxel[ 3 ];
-								}
-
-								/* handle occluded or unmapped luxels */
-								else
-								{
-									VectorAdd( occludedSample, luxel, occludedSample );
-									occludedSamples += luxel[ 3 ];
-								}
-
-								/* handle style debugging */
-								if ( debug && lightmapNum > 0 && x < 2 && y < 2 ) {
-									VectorCopy( debugColors[ 0 ], sample );
-									samples = 1;
-								}
+							/* handle style debugging */
+							if ( debug && lightmapNum > 0 && x < 2 && y < 2 ) {
+								VectorCopy( debugColors[ 0 ], sample );
+								samples = 1;
 							}
 						}
 					}
+				}
 
-					/* only use occluded samples if necessary */
-					if ( samples <= 0.0f ) {
-						VectorCopy( occludedSample, sample );
-						samples = occludedSamples;
-					}
+				/* only use occluded samples if necessary */
+				if ( samples <= 0.0f ) {
+					VectorCopy( occludedSample, sample );
+					samples = occludedSamples;
+				}
 
-					/* get luxels */
-					luxel = SUPER_LUXEL( lightmapNum, x, y );
-					deluxel = SUPER_DELUXEL( x, y );
+				/* get luxels */
+				luxel = SUPER_LUXEL( lightmapNum, x, y );
+				deluxel = SUPER_DELUXEL( x, y );
 
-					/* store light direction */
-					if ( deluxemap && lightmapNum == 0 ) {
-						VectorCopy( dirSample, deluxel );
-					}
+				/* store light direction */
+				if ( deluxemap && lightmapNum == 0 ) {
+					VectorCopy( dirSample, deluxel );
+				}
 
-					/* store the sample back in super luxels */
-					if ( samples > 0.01f ) {
-						VectorScale( sample, ( 1.0f / samples ), luxel );
-						luxel[ 3 ] = 1.0f;
-					}
+				/* store the sample back in super luxels */
+				if ( samples > 0.01f ) {
+					VectorScale( sample, ( 1.0f / samples ), luxel );
+					luxel[ 3 ] = 1.0f;
+				}
 
-					/* if any samples were mapped in any way, store ambient color */
-					else if ( mappedSamples > 0 ) {
-						if ( lightmapNum == 0 ) {
-							VectorCopy( ambientColor, luxel );
-						}
-						else{
-							VectorClear( luxel );
-						}
-						luxel[ 3 ] = 1.0f;
+				/* if any samples were mapped in any way, store ambient color */
+				else if ( mappedSamples > 0 ) {
+					if ( lightmapNum == 0 ) {
+						VectorCopy( ambientColor, luxel );
 					}
-
-					/* store a bogus value to be fixed later */
-					else
-					{
+					else{
 						VectorClear( luxel );
-						luxel[ 3 ] = -1.0f;
 					}
+					luxel[ 3 ] = 1.0f;
+				}
+
+				/* store a bogus value to be fixed later */
+				else
+				{
+					VectorClear( luxel );
+					luxel[ 3 ] = -1.0f;
 				}
 			}
+		}
 
-			/* setup */
-			lm->used = 0;
-			ClearBounds( colorMins, colorMaxs );
+		/* setup */
+		lm->used = 0;
+		ClearBounds( colorMins, colorMaxs );
 
-			/* clean up and store into bsp luxels */
-			for ( y = 0; y < lm->h; y++ )
+		/* clean up and store into bsp luxels */
+		for ( y = 0; y < lm->h; y++ )
+		{
+			for ( x = 0; x < lm->w; x++ )
 			{
-				for ( x = 0; x < lm->w; x++ )
-				{
-					/* get luxels */
-					luxel = SUPER_LUXEL( lightmapNum, x, y );
-					deluxel = SUPER_DELUXEL( x, y );
+				/* get luxels */
+				luxel = SUPER_LUXEL( lightmapNum, x, y );
+				deluxel = SUPER_DELUXEL( x, y );
 
-					/* copy light direction */
-					if ( deluxemap && lightmapNum == 0 ) {
-						VectorCopy( deluxel, dirSample );
-					}
+				/* copy light direction */
+				if ( deluxemap && lightmapNum == 0 ) {
+					VectorCopy( deluxel, dirSample );
+				}
 
-					/* is this a valid sample? */
-					if ( luxel[ 3 ] > 0.0f ) {
-						VectorCopy( luxel, sample );
-						samples = luxel[ 3 ];
-						numUsed++;
-						lm->used++;
+				/* is this a valid sample? */
+				if ( luxel[ 3 ] > 0.0f ) {
+					VectorCopy( luxel, sample );
+					samples = luxel[ 3 ];
+					used++;
+					lm->used++;
 
-						/* fix negative samples */
-						for ( j = 0; j < 3; j++ )
-						{
-							if ( sample[ j ] < 0.0f ) {
-								sample[ j ] = 0.0f;
-							}
+					/* fix negative samples */
+					for ( j = 0; j < 3; j++ )
+					{
+						if ( sample[ j ] < 0.0f ) {
+							sample[ j ] = 0.0f;
 						}
 					}
-					else
+				}
+				else
+				{
+					/* nick an average value from the neighbors */
+					VectorClear( sample );
+					VectorClear( dirSample );
+					samples = 0.0f;
+
+					/* fixme: why is this disabled?? */
+					for ( sy = ( y - 1 ); sy <= ( y + 1 ); sy++ )
 					{
-						/* nick an average value from the neighbors */
-						VectorClear( sample );
-						VectorClear( dirSample );
-						samples = 0.0f;
+						if ( sy < 0 || sy >= lm->h ) {
+							continue;
+						}
 
-						/* fixme: why is this disabled?? */
-						for ( sy = ( y - 1 ); sy <= ( y + 1 ); sy++ )
+						for ( sx = ( x - 1 ); sx <= ( x + 1 ); sx++ )
 						{
-							if ( sy < 0 || sy >= lm->h ) {
+							if ( sx < 0 || sx >= lm->w || ( sx == x && sy == y ) ) {
 								continue;
 							}
 
-							for ( sx = ( x - 1 ); sx <= ( x + 1 ); sx++ )
-							{
-								if ( sx < 0 || sx >= lm->w || ( sx == x && sy == y ) ) {
-									continue;
-								}
-
-								/* get neighbor's particulars */
-								luxel = SUPER_LUXEL( lightmapNum, sx, sy );
-								if ( luxel[ 3 ] < 0.0f ) {
-									continue;
-								}
-								VectorAdd( sample, luxel, sample );
-								samples += luxel[ 3 ];
+							/* get neighbor's particulars */
+							luxel = SUPER_LUXEL( lightmapNum, sx, sy );
+							if ( luxel[ 3 ] < 0.0f ) {
+								continue;
 							}
+							VectorAdd( sample, luxel, sample );
+							samples += luxel[ 3 ];
 						}
+					}
 
-						/* no samples? */
-						if ( samples == 0.0f ) {
-							VectorSet( sample, -1.0f, -1.0f, -1.0f );
-							samples = 1.0f;
-						}
-						else
-						{
-							numUsed++;
-							lm->used++;
+					/* no samples? */
+					if ( samples == 0.0f ) {
+						VectorSet( sample, -1.0f, -1.0f, -1.0f );
+						samples = 1.0f;
+					}
+					else
+					{
+						used++;
+						lm->used++;
 
-							/* fix negative samples */
-							for ( j = 0; j < 3; j++ )
-							{
-								if ( sample[ j ] < 0.0f ) {
-									sample[ j ] = 0.0f;
-								}
+						/* fix negative samples */
+						for ( j = 0; j < 3; j++ )
+						{
+							if ( sample[ j ] < 0.0f ) {
+								sample[ j ] = 0.0f;
 							}
 						}
 					}
+				}
 
-					/* scale the sample */
-					VectorScale( sample, ( 1.0f / samples ), sample );
+				/* scale the sample */
+				VectorScale( sample, ( 1.0f / samples ), sample );
 
-					/* store the sample in the radiosity luxels */
-					if ( bounce > 0 ) {
-						radLuxel = RAD_LUXEL( lightmapNum, x, y );
-						VectorCopy( sample, radLuxel );
+				/* store the sample in the radiosity luxels */
+				if ( bounce > 0 ) {
+					radLuxel = RAD_LUXEL( lightmapNum, x, y );
+					VectorCopy( sample, radLuxel );
 
-						/* if only storing bounced light, early out here */
-						if ( bounceOnly && !bouncing ) {
-							continue;
-						}
+					/* if only storing bounced light, early out here */
+					if ( bounceOnly && !bouncing ) {
+						continue;
 					}
+				}
 
-					/* store the sample in the bsp luxels */
-					bspLuxel = BSP_LUXEL( lightmapNum, x, y );
-					bspDeluxel = BSP_DELUXEL( x, y );
+				/* store the sample in the bsp luxels */
+				bspLuxel = BSP_LUXEL( lightmapNum, x, y );
+				bspDeluxel = BSP_DELUXEL( x, y );
 
-					VectorAdd( bspLuxel, sample, bspLuxel );
-					if ( deluxemap && lightmapNum == 0 ) {
-						VectorAdd( bspDeluxel, dirSample, bspDeluxel );
-					}
+				VectorAdd( bspLuxel, sample, bspLuxel );
+				if ( deluxemap && lightmapNum == 0 ) {
+					VectorAdd( bspDeluxel, dirSample, bspDeluxel );
+				}
 
-					/* add color to bounds for solid checking */
-					if ( samples > 0.0f ) {
-						AddPointToBounds( bspLuxel, colorMins, colorMaxs );
-					}
+				/* add color to bounds for solid checking */
+				if ( samples > 0.0f ) {
+					AddPointToBounds( bspLuxel, colorMins, colorMaxs );
 				}
 			}
+		}
 
-			/* set solid color */
-			lm->solid[ lightmapNum ] = qfalse;
-			VectorAdd( colorMins, colorMaxs, lm->solidColor[ lightmapNum ] );
-			VectorScale( lm->solidColor[ lightmapNum ], 0.5f, lm->solidColor[ lightmapNum ] );
+		/* set solid color */
+		lm->solid[ lightmapNum ] = qfalse;
+		VectorAdd( colorMins, colorMaxs, lm->solidColor[ lightmapNum ] );
+		VectorScale( lm->solidColor[ lightmapNum ], 0.5f, lm->solidColor[ lightmapNum ] );
 
-			/* nocollapse prevents solid lightmaps */
-			if ( noCollapse == qfalse ) {
-				/* check solid color */
-				VectorSubtract( colorMaxs, colorMins, sample );
-				if ( ( sample[ 0 ] <= SOLID_EPSILON && sample[ 1 ] <= SOLID_EPSILON && sample[ 2 ] <= SOLID_EPSILON ) ||
-				     ( lm->w <= 2 && lm->h <= 2 ) ) {     /* small lightmaps get forced to solid color */
-					/* set to solid */
-					VectorCopy( colorMins, lm->solidColor[ lightmapNum ] );
-					lm->solid[ lightmapNum ] = qtrue;
-					numSolidLightmaps++;
-				}
+		/* nocollapse prevents solid lightmaps */
+		if ( noCollapse == qfalse ) {
+			/* check solid color */
+			VectorSubtract( colorMaxs, colorMins, sample );
+			if ( ( sample[ 0 ] <= SOLID_EPSILON && sample[ 1 ] <= SOLID_EPSILON && sample[ 2 ] <= SOLID_EPSILON ) ||
+			     ( lm->w <= 2 && lm->h <= 2 ) ) {     /* small lightmaps get forced to solid color */
+				/* set to solid */
+				VectorCopy( colorMins, lm->solidColor[ lightmapNum ] );
+				lm->solid[ lightmapNum ] = qtrue;
+			}
 
-				/* if all lightmaps aren't solid, then none of them are solid */
-				if ( lm->solid[ lightmapNum ] != lm->solid[ 0 ] ) {
-					for ( y = 0; y < MAX_LIGHTMAPS; y++ )
-					{
-						if ( lm->solid[ y ] ) {
-							numSolidLightmaps--;
-						}
-						lm->solid[ y ] = qfalse;
-					}
+			/* if all lightmaps aren't solid, then none of them are solid */
+			if ( lm->solid[ lightmapNum ] != lm->solid[ 0 ] ) {
+				for ( y = 0; y < MAX_LIGHTMAPS; y++ )
+					lm->solid[ y ] = qfalse;
+			}
+		}
+
+		/* wrap bsp luxels if necessary */
+		if ( lm->wrap[ 0 ] ) {
+			for ( y = 0; y < lm->h; y++ )
+			{
+				bspLuxel = BSP_LUXEL( lightmapNum, 0, y );
+				bspLuxel2 = BSP_LUXEL( lightmapNum, lm->w - 1, y );
+				VectorAdd( bspLuxel, bspLuxel2, bspLuxel );
+				VectorScale( bspLuxel, 0.5f, bspLuxel );
+				VectorCopy( bspLuxel, bspLuxel2 );
+				if ( deluxemap && lightmapNum == 0 ) {
+					bspDeluxel = BSP_DELUXEL( 0, y );
+					bspDeluxel2 = BSP_DELUXEL( lm->w - 1, y );
+					VectorAdd( bspDeluxel, bspDeluxel2, bspDeluxel );
+					VectorScale( bspDeluxel, 0.5f, bspDeluxel );
+					VectorCopy( bspDeluxel, bspDeluxel2 );
+				}
+			}
+		}
+		if ( lm->wrap[ 1 ] ) {
+			for ( x = 0; x < lm->w; x++ )
+			{
+				bspLuxel = BSP_LUXEL( lightmapNum, x, 0 );
+				bspLuxel2 = BSP_LUXEL( lightmapNum, x, lm->h - 1 );
+				VectorAdd( bspLuxel, bspLuxel2, bspLuxel );
+				VectorScale( bspLuxel, 0.5f, bspLuxel );
+				VectorCopy( bspLuxel, bspLuxel2 );
+				if ( deluxemap && lightmapNum == 0 ) {
+					bspDeluxel = BSP_DELUXEL( x, 0 );
+					bspDeluxel2 = BSP_DELUXEL( x, lm->h - 1 );
+					VectorAdd( bspDeluxel, bspDeluxel2, bspDeluxel );
+					VectorScale( bspDeluxel, 0.5f, bspDeluxel );
+					VectorCopy( bspDeluxel, bspDeluxel2 );
 				}
 			}
+		}
+	}
 
-			/* wrap bsp luxels if necessary */
-			if ( lm->wrap[ 0 ] ) {
-				for ( y = 0; y < lm->h; y++ )
-				{
-					bspLuxel = BSP_LUXEL( lightmapNum, 0, y );
-					bspLuxel2 = BSP_LUXEL( lightmapNum, lm->w - 1, y );
-					VectorAdd( bspLuxel, bspLuxel2, bspLuxel );
-					VectorScale( bspLuxel, 0.5f, bspLuxel );
-					VectorCopy( bspLuxel, bspLuxel2 );
-					if ( deluxemap && lightmapNum == 0 ) {
-						bspDeluxel = BSP_DELUXEL( 0, y );
-						bspDeluxel2 = BSP_DELUXEL( lm->w - 1, y );
-						VectorAdd( bspDeluxel, bspDeluxel2, bspDeluxel );
-						VectorScale( bspDeluxel, 0.5f, bspDeluxel );
-						VectorCopy( bspDeluxel, bspDeluxel2 );
+	/* convert modelspace deluxemaps to tangentspace */
+	if ( !bouncing && deluxemap && deluxemode == 1 ) {
+		vec3_t worldUp, myNormal, myTangent, myBinormal;
+		float dist;
+
+		/* walk bsp luxels, taking the normal of their first supersample */
+		for ( y = 0; y < lm->h; y++ )
+		{
+			for ( x = 0; x < lm->w; x++ )
+			{
+				/* get normal and deluxel */
+				normal = SUPER_NORMAL( x * superSample, y * superSample );
+				bspDeluxel = BSP_DELUXEL( x, y );
+
+				/* get normal */
+				VectorSet( myNormal, normal[0], normal[1], normal[2] );
+
+				/* get tangent vectors (unmapped luxels have no normal, give them the world basis) */
+				if ( myNormal[ 0 ] == 0.0f && myNormal[ 1 ] == 0.0f ) {
+					if ( myNormal[ 2 ] == -1.0f ) {
+						VectorSet( myTangent, -1.0f, 0.0f, 0.0f );
+						VectorSet( myBinormal,  0.0f, 1.0f, 0.0f );
+					}
+					else
+					{
+						VectorSet( myTangent, 1.0f, 0.0f, 0.0f );
+						VectorSet( myBinormal, 0.0f, 1.0f, 0.0f );
 					}
 				}
-			}
-			if ( lm->wrap[ 1 ] ) {
-				for ( x = 0; x < lm->w; x++ )
+				else
 				{
-					bspLuxel = BSP_LUXEL( lightmapNum, x, 0 );
-					bspLuxel2 = BSP_LUXEL( lightmapNum, x, lm->h - 1 );
-					VectorAdd( bspLuxel, bspLuxel2, bspLuxel );
-					VectorScale( bspLuxel, 0.5f, bspLuxel );
-					VectorCopy( bspLuxel, bspLuxel2 );
-					if ( deluxemap && lightmapNum == 0 ) {
-						bspDeluxel = BSP_DELUXEL( x, 0 );
-						bspDeluxel2 = BSP_DELUXEL( x, lm->h - 1 );
-						VectorAdd( bspDeluxel, bspDeluxel2, bspDeluxel );
-						VectorScale( bspDeluxel, 0.5f, bspDeluxel );
-						VectorCopy( bspDeluxel, bspDeluxel2 );
-					}
+					VectorSet( worldUp, 0.0f, 0.0f, 1.0f );
+					CrossProduct( myNormal, worldUp, myTangent );
+					VectorNormalize( myTangent, myTangent );
+					CrossProduct( myTangent, myNormal, myBinormal );
+					VectorNormalize( myBinormal, myBinormal );
+				}
+
+				/* project onto plane */
+				dist = -DotProduct( myTangent, myNormal );
+				VectorMA( myTangent, dist, myNormal, myTangent );
+				dist = -DotProduct( myBinormal, myNormal );
+				VectorMA( myBinormal, dist, myNormal, myBinormal );
+
+				/* renormalize */
+				VectorNormalize( myTangent, myTangent );
+				VectorNormalize( myBinormal, myBinormal );
+
+				/* convert modelspace deluxel to tangentspace */
+				dirSample[0] = bspDeluxel[0];
+				dirSample[1] = bspDeluxel[1];
+				dirSample[2] = bspDeluxel[2];
+				VectorNormalize( dirSample, dirSample );
+
+				/* fix tangents to world matrix */
+				if ( myNormal[0] > 0 || myNormal[1] < 0 || myNormal[2] < 0 ) {
+					VectorNegate( myTangent, myTangent );
 				}
+
+				/* build tangentspace vectors */
+				bspDeluxel[0] = DotProduct( dirSample, myTangent );
+				bspDeluxel[1] = DotProduct( dirSample, myBinormal );
+				bspDeluxel[2] = DotProduct( dirSample, myNormal );
 			}
 		}
 	}
 
-	/* -----------------------------------------------------------------
-	   convert modelspace deluxemaps to tangentspace
-	   ----------------------------------------------------------------- */
-	/* note it */
-	if ( !bouncing ) {
-		if ( deluxemap && deluxemode == 1 ) {
-			vec3_t worldUp, myNormal, myTangent, myBinormal;
-			float dist;
+	ThreadLock();
+	subsampledLuxels += used;
+	ThreadUnlock();
+}
 
-			Sys_Printf( "converting..." );
 
-			for ( i = 0; i < numRawLightmaps; i++ )
-			{
-				/* get lightmap */
-				lm = &rawLightmaps[ i ];
 
-				/* walk lightmap samples */
-				for ( y = 0; y < lm->sh; y++ )
-				{
-					for ( x = 0; x < lm->sw; x++ )
-					{
-						/* get normal and deluxel */
-						normal = SUPER_NORMAL( x, y );
-						cluster = SUPER_CLUSTER( x, y );
-						bspDeluxel = BSP_DELUXEL( x, y );
-						deluxel = SUPER_DELUXEL( x, y );
-
-						/* get normal */
-						VectorSet( myNormal, normal[0], normal[1], normal[2] );
-
-						/* get tangent vectors */
-						if ( myNormal[ 0 ] == 0.0f && myNormal[ 1 ] == 0.0f ) {
-							if ( myNormal[ 2 ] == 1.0f ) {
-								VectorSet( myTangent, 1.0f, 0.0f, 0.0f );
-								VectorSet( myBinormal, 0.0f, 1.0f, 0.0f );
-							}
-							else if ( myNormal[ 2 ] == -1.0f ) {
-								VectorSet( myTangent, -1.0f, 0.0f, 0.0f );
-								VectorSet( myBinormal,  0.0f, 1.0f, 0.0f );
-							}
-						}
-						else
-						{
-							VectorSet( worldUp, 0.0f, 0.0f, 1.0f );
-							CrossProduct( myNormal, worldUp, myTangent );
-							VectorNormalize( myTangent, myTangent );
-							CrossProduct( myTangent, myNormal, myBinormal );
-							VectorNormalize( myBinormal, myBinormal );
-						}
+/*
+   CountSolidLightmaps()
+   counts the raw lightmap styles that collapsed to a solid color
+ */
 
-						/* project onto plane */
-						dist = -DotProduct( myTangent, myNormal );
-						VectorMA( myTangent, dist, myNormal, myTangent );
-						dist = -DotProduct( myBinormal, myNormal );
-						VectorMA( myBinormal, dist, myNormal, myBinormal );
-
-						/* renormalize */
-						VectorNormalize( myTangent, myTangent );
-						VectorNormalize( myBinormal, myBinormal );
-
-						/* convert modelspace deluxel to tangentspace */
-						dirSample[0] = bspDeluxel[0];
-						dirSample[1] = bspDeluxel[1];
-						dirSample[2] = bspDeluxel[2];
-						VectorNormalize( dirSample, dirSample );
-
-						/* fix tangents to world matrix */
-						if ( myNormal[0] > 0 || myNormal[1] < 0 || myNormal[2] < 0 ) {
-							VectorNegate( myTangent, myTangent );
-						}
+static int CountSolidLightmaps( void ){
+	int i, lightmapNum, count;
 
-						/* build tangentspace vectors */
-						bspDeluxel[0] = DotProduct( dirSample, myTangent );
-						bspDeluxel[1] = DotProduct( dirSample, myBinormal );
-						bspDeluxel[2] = DotProduct( dirSample, myNormal );
-					}
-				}
+	count = 0;
+	for ( i = 0; i < numRawLightmaps; i++ )
+	{
+		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
+		{
+			if ( rawLightmaps[ i ].solid[ lightmapNum ] ) {
+				count++;
 			}
 		}
 	}
+	return count;
+}
+
+
+
+/*
+   StoreSurfaceLightmaps()
+   stores the surface lightmaps into the bsp as byte rgb triplets
+ */
+
+void StoreSurfaceLightmaps( qboolean fastAllocate ){
+	int i, j, k;
+	int style, lightmapNum, lightmapNum2;
+	float               *luxel;
+	byte                *lb;
+	int numUsed, numTwins, numTwinLuxels, numStored;
+	float lmx, lmy, efficiency;
+	double numOutLuxels, numOccupiedLuxels, allocateTime;
+	clock_t start;
+	vec3_t color;
+	bspDrawSurface_t    *ds, *parent, dsTemp;
+	surfaceInfo_t       *info;
+	rawLightmap_t       *lm, *lm2;
+	outLightmap_t       *olm;
+	bspDrawVert_t       *dv, *ydv, *dvParent;
+	char dirname[ 1024 ], filename[ 1024+20 ];
+	shaderInfo_t        *csi;
+	char lightmapName[ 128 ];
+	const char          *rgbGenValues[ 256 ];
+	const char          *alphaGenValues[ 256 ];
+
+
+	/* note it */
+	Sys_Printf( "--- StoreSurfaceLightmaps ---\n" );
+
+	/* setup */
+	if ( lmCustomDir ) {
+		strcpy( dirname, lmCustomDir );
+	}
+	else
+	{
+		strcpy( dirname, source );
+		StripExtension( dirname );
+	}
+	memset( rgbGenValues, 0, sizeof( rgbGenValues ) );
+	memset( alphaGenValues, 0, sizeof( alphaGenValues ) );
+
+	/* -----------------------------------------------------------------
+	   average the sampled luxels into the bsp luxels
+	   ----------------------------------------------------------------- */
+
+	/* note it */
+	Sys_FPrintf( SYS_VRB, "Subsampling..." );
+
+	/* walk the list of raw lightmaps, streamed lightmaps were subsampled as they finished */
+	numTwins = 0;
+	numTwinLuxels = 0;
+	if ( !streamLightmaps ) {
+		for ( i = 0; i < numRawLightmaps; i++ )
+			SubsampleRawLightmap( &rawLightmaps[ i ] );
+	}
+	numUsed = subsampledLuxels;
+	subsampledLuxels = 0;
+	numSolidLightmaps = CountSolidLightmaps();
+
+	/* -----------------------------------------------------------------
+	   convert modelspace deluxemaps to tangentspace
+	   ----------------------------------------------------------------- */
+
+	/* note it, SubsampleRawLightmap did the work */
+	if ( !bouncing && deluxemap && deluxemode == 1 ) {
+		Sys_Printf( "converting..." );
+	}
 
 	/* -----------------------------------------------------------------
 	   blend lightmaps
@@ -3165,7 +3437,7 @@ void StoreSurfaceLightmaps( qboolean fastAllocate ){
 		for ( lightmapNum = 0; lightmapNum < MAX_LIGHTMAPS; lightmapNum++ )
 		{
 			/* early outs */
-			if ( lm->superLuxels[ lightmapNum ] == NULL ) {
+			if ( lm->bspLuxels[ lightmapNum ] == NULL ) {
 				continue;
 			}
 
@@ -3275,7 +3547,7 @@ void StoreSurfaceLightmaps( qboolean fastAllocate ){
 	/* fill it out and sort it */
 	for ( i = 0; i < numRawLightmaps; i++ )
 		sortLightmaps[ i ] = i;
-	qsort( sortLightmaps, numRawLightmaps, sizeof( int ), CompareRawLightmap );
+	qsort( sortLightmaps, numRawLightmaps, sizeof( int ), skylineAllocate ? CompareRawLightmapArea : CompareRawLightmap );
 
 	/* -----------------------------------------------------------------
 	   allocate output lightmaps
@@ -3289,6 +3561,7 @@ void StoreSurfaceLightmaps( qboolean fastAllocate ){
 		for ( i = 0; i < numOutLightmaps; i++ )
 		{
 			free( outLightmaps[ i ].lightBits );
+			free( outLightmaps[ i ].skyline );
 #ifdef LIGHTMAP_HDR
 			free( outLightmaps[ i ].bspLightHDR );
 #else
@@ -3305,11 +3578,22 @@ void StoreSurfaceLightmaps( qboolean fastAllocate ){
 	numExtLightmaps = 0;
 
 	/* find output lightmap */
+	start = clock();
 	for ( i = 0; i < numRawLightmaps; i++ )
 	{
 		lm = &rawLightmaps[ sortLightmaps[ i ] ];
 		FindOutLightmaps( lm, fastAllocate );
 	}
+	allocateTime = (double) ( clock() - start ) / CLOCKS_PER_SEC;
+
+	/* measure occupancy before any filling */
+	numOutLuxels = 0;
+	numOccupiedLuxels = 0;
+	for ( i = 0; i < numOutLightmaps; i++ )
+	{
+		numOutLuxels += outLightmaps[ i ].customWidth * outLightmaps[ i ].customHeight;
+		numOccupiedLuxels += outLightmaps[ i ].customWidth * outLightmaps[ i ].customHeight - outLightmaps[ i ].freeLuxels;
+	}
 
 	/* set output numbers in twinned lightmaps */
 	for ( i = 0; i < numRawLightmaps; i++ )
@@ -3738,6 +4022,8 @@ void StoreSurfaceLightmaps( qboolean fastAllocate ){
 	Sys_Printf( "%9d vertex approximated surfaces\n", numSurfsVertexApproximated );
 	Sys_Printf( "%9d BSP lightmaps\n", numBSPLightmaps );
 	Sys_Printf( "%9d total lightmaps\n", numOutLightmaps );
+	Sys_Printf( "%9.0f output lightmap luxels (%3.2f percent occupied)\n", numOutLuxels, numOutLuxels > 0 ? 100.0 * numOccupiedLuxels / numOutLuxels : 0.0 );
+	Sys_Printf( "%9.3f seconds allocating lightmaps\n", allocateTime );
 	Sys_Printf( "%9d unique lightmap/shader combinations\n", numLightmapShaders );
 
 	/* write map shader file */
@@ -42,11 +42,50 @@
    returns a pseudorandom number between 0 and 1
  */
 
+#if GDEF_COMPILER_MSVC
+static __declspec( thread ) qboolean randomSeeded;
+static __declspec( thread ) unsigned int randomState;
+#else
+static __thread qboolean randomSeeded;
+static __thread unsigned int randomState;
+#endif
+
 vec_t Random( void ){
+	/* seeded threads run their own sequence */
+	if ( randomSeeded ) {
+		randomState = randomState * 1664525u + 1013904223u;
+		return (vec_t) ( randomState >> 8 ) / 0xFFFFFF;
+	}
 	return (vec_t) rand() / RAND_MAX;
 }
 
 
+
+/*
+   SeedRandom()
+   starts a private random sequence for the calling thread, so a work item that seeds
+   itself draws the same numbers whichever thread or process runs it; -1 returns to rand()
+ */
+
+void SeedRandom( int seed ){
+	unsigned int h;
+
+
+	/* back to the shared sequence */
+	if ( seed < 0 ) {
+		randomSeeded = qfalse;
+		return;
+	}
+
+	/* scramble the seed so neighboring work items don't share a sequence */
+	h = (unsigned int) seed + 0x9E3779B9u;
+	h = ( h ^ ( h >> 16 ) ) * 0x85EBCA6Bu;
+	h = ( h ^ ( h >> 13 ) ) * 0xC2B2AE35u;
+	randomState = h ^ ( h >> 16 );
+	randomSeeded = qtrue;
+}
+
+
 char *Q_strncpyz( char *dst, const char *src, size_t len ) {
 	if ( len == 0 ) {
 		abort();
@@ -94,33 +133,22 @@ static void ExitQ3Map( void ){
 
 
 /*
-   main()
-   q3map mojo...
+   ReadGeneralOptions()
+   reads the options every mode shares and nulls them out of argv,
+   returns qfalse when -help was asked for and printed
  */
 
-int main( int argc, char **argv ){
-	int i, r;
-	double start, end;
-
-	Sys_Printf( "VMAP - v1.0 (c) 2015-2020 Vera Visions, LLC.\n" );
-
-	/* we want consistent 'randomness' */
-	srand( 0 );
-
-	/* start timer */
-	start = I_FloatTime();
+qboolean ReadGeneralOptions( int argc, char **argv ){
+	int i;
 
-	/* set exit call */
-	atexit( ExitQ3Map );
 
-	/* read general options first */
 	for ( i = 1; i < argc; i++ )
 	{
 		/* -help */
 		if ( !strcmp( argv[ i ], "-h" ) || !strcmp( argv[ i ], "--help" )
 		     || !strcmp( argv[ i ], "-help" ) ) {
 			HelpMain(argv[i+1]);
-			return 0;
+			return qfalse;
 		}
 
 		/* -connect */
@@ -163,28 +191,31 @@ int main( int argc, char **argv ){
 			numthreads = atoi( argv[ i ] );
 			argv[ i ] = NULL;
 		}
+
+		/* per-stage profile */
+		else if ( !strcmp( argv[ i ], "-profile" ) ) {
+			argv[ i ] = NULL;
+			i++;
+			ProfileInit( argv[ i ] );
+			Sys_Printf( "Profiling compile stages into %s\n", argv[ i ] );
+			argv[ i ] = NULL;
+		}
 	}
 
-	/* init model library */
-	PicoInit();
-	PicoSetMallocFunc( safe_malloc );
-	PicoSetFreeFunc( free );
-	PicoSetPrintFunc( PicoPrintFunc );
-	PicoSetLoadFileFunc( PicoLoadFileFunc );
-	PicoSetFreeFileFunc( free );
+	return qtrue;
+}
 
-	/* set number of threads */
-	ThreadSetDefault();
 
-	/* generate sinusoid jitter table */
-	for ( i = 0; i < MAX_JITTERS; i++ )
-	{
-		jitters[ i ] = sin( i * 139.54152147 );
-		//%	Sys_Printf( "Jitter %4d: %f\n", i, jitters[ i ] );
-	}
 
-	/* ydnar: new path initialization */
-	InitPaths( &argc, argv );
+/*
+   VMapMain()
+   runs the mode named by the first argument left over after the general and path options
+ */
+
+int VMapMain( int argc, char **argv, double start ){
+	int r;
+	double end;
+
 
 	/* set game options */
 	if ( !patchSubdivisions ) {
@@ -213,11 +244,13 @@ int main( int argc, char **argv ){
 
 	/* vis */
 	else if ( !strcmp( argv[ 1 ], "-vis" ) ) {
+		ProfileBegin( "vis" );
 		r = VisMain( argc - 1, argv + 1 );
 	}
 
 	/* light */
 	else if ( !strcmp( argv[ 1 ], "-light" ) ) {
+		ProfileBegin( "light" );
 		r = LightMain( argc - 1, argv + 1 );
 	}
 
@@ -255,9 +288,13 @@ int main( int argc, char **argv ){
 
 	/* ydnar: otherwise create a bsp */
 	else{
+		ProfileBegin( "bsp" );
 		r = BSPMain( argc, argv );
 	}
 
+	/* write the profile (closes the stage opened above) */
+	ProfileWrite();
+
 	/* emit time */
 	end = I_FloatTime();
 	Sys_Printf( "%9.0f seconds elapsed\n", end - start );
@@ -268,3 +305,72 @@ int main( int argc, char **argv ){
 	/* return any error code */
 	return r;
 }
+
+
+
+/*
+   main()
+   q3map mojo...
+ */
+
+int main( int argc, char **argv ){
+	int i, r;
+	double start;
+
+
+	/* hand the compile to a running daemon */
+	for ( i = 1; i < argc && strcmp( argv[ i ], "-client" ); i++ ) ;
+	if ( i < argc ) {
+		for ( argc--; i < argc; i++ )
+			argv[ i ] = argv[ i + 1 ];
+		r = DaemonClient( argc, argv );
+		if ( r >= 0 ) {
+			return r;
+		}
+	}
+
+	Sys_Printf( "VMAP - v1.0 (c) 2015-2020 Vera Visions, LLC.\n" );
+
+	/* we want consistent 'randomness' */
+	srand( 0 );
+
+	/* start timer */
+	start = I_FloatTime();
+
+	/* set exit call */
+	atexit( ExitQ3Map );
+
+	/* read general options first */
+	if ( !ReadGeneralOptions( argc, argv ) ) {
+		return 0;
+	}
+
+	/* init model library */
+	PicoInit();
+	PicoSetMallocFunc( safe_malloc );
+	PicoSetFreeFunc( free );
+	PicoSetPrintFunc( PicoPrintFunc );
+	PicoSetLoadFileFunc( PicoLoadFileFunc );
+	PicoSetFreeFileFunc( free );
+
+	/* set number of threads */
+	ThreadSetDefault();
+
+	/* generate sinusoid jitter table */
+	for ( i = 0; i < MAX_JITTERS; i++ )
+	{
+		jitters[ i ] = sin( i * 139.54152147 );
+		//%	Sys_Printf( "Jitter %4d: %f\n", i, jitters[ i ] );
+	}
+
+	/* ydnar: new path initialization */
+	InitPaths( &argc, argv );
+
+	/* keep the paths, shaders, images and models warm for clients */
+	if ( argc >= 2 && !strcmp( argv[ 1 ], "-daemon" ) ) {
+		return DaemonMain( argc - 1, argv + 1 );
+	}
+
+	/* run the mode */
+	return VMapMain( argc, argv, start );
+}
@@ -1978,6 +1978,7 @@ void LoadMapFile( char *filename, qboolean onlyLights, qboolean noCollapseGroups
 	/* note it */
 	Sys_FPrintf( SYS_VRB, "--- LoadMapFile ---\n" );
 	Sys_Printf( "Loading %s\n", filename );
+	ProfileBegin( "LoadMapFile" );
 
 	/* hack */
 	file = SafeOpenRead( filename );
@@ -2044,4 +2045,7 @@ void LoadMapFile( char *filename, qboolean onlyLights, qboolean noCollapseGroups
 			WriteBSPBrushMap( "fakemap.map", entities[ 0 ].brushes );
 		}
 	}
+
+	ProfileAddWork( numEntities - oldNumEntities );
+	ProfileEnd();
 }
@@ -78,32 +78,47 @@ void PicoLoadFileFunc( const char *name, byte **buffer, int *bufSize ){
 
 
 
+/*
+   InitModels()
+   sets up the picoModel list and its name hash
+ */
+
+static strHash_t *picoModelHash = NULL;
+
+static void InitModels( void ){
+	if ( picoModelHash == NULL ) {
+		picoModelHash = StrHashNew( 512, qtrue );
+	}
+	if ( numPicoModels <= 0 ) {
+		StrHashClear( picoModelHash );
+		numPicoModelSlots = 0;
+	}
+}
+
+
+
 /*
    FindModel() - ydnar
    finds an existing picoModel and returns a pointer to the picoModel_t struct or NULL if not found
  */
 
 picoModel_t *FindModel( const char *name, int frame ){
-	int i;
+	strHashNode_t   *node;
 
 
 	/* init */
-	if ( numPicoModels <= 0 ) {
-		memset( picoModels, 0, sizeof( picoModels ) );
-	}
+	InitModels();
 
 	/* dummy check */
 	if ( name == NULL || name[ 0 ] == '\0' ) {
 		return NULL;
 	}
 
-	/* search list */
-	for ( i = 0; i < MAX_MODELS; i++ )
+	/* search hash (all frames of a model share a name) */
+	for ( node = StrHashFirst( picoModelHash, name ); node != NULL; node = StrHashNext( picoModelHash, node ) )
 	{
-		if ( picoModels[ i ] != NULL &&
-		     !strcmp( PicoGetModelName( picoModels[ i ] ), name ) &&
-		     PicoGetModelFrameNum( picoModels[ i ] ) == frame ) {
-			return picoModels[ i ];
+		if ( PicoGetModelFrameNum( node->value ) == frame ) {
+			return node->value;
 		}
 	}
 
@@ -119,14 +134,11 @@ picoModel_t *FindModel( const char *name, int frame ){
  */
 
 picoModel_t *LoadModel( const char *name, int frame ){
-	int i;
 	picoModel_t     *model, **pm;
 
 
 	/* init */
-	if ( numPicoModels <= 0 ) {
-		memset( picoModels, 0, sizeof( picoModels ) );
-	}
+	InitModels();
 
 	/* dummy check */
 	if ( name == NULL || name[ 0 ] == '\0' ) {
@@ -139,20 +151,10 @@ picoModel_t *LoadModel( const char *name, int frame ){
 		return model;
 	}
 
-	/* none found, so find first non-null picoModel */
-	pm = NULL;
-	for ( i = 0; i < MAX_MODELS; i++ )
-	{
-		if ( picoModels[ i ] == NULL ) {
-			pm = &picoModels[ i ];
-			break;
-		}
-	}
-
-	/* too many picoModels? */
-	if ( pm == NULL ) {
-		Error( "MAX_MODELS (%d) exceeded, there are too many model files referenced by the map.", MAX_MODELS );
-	}
+	/* none found, so add a picoModel */
+	AUTOEXPAND_BY_REALLOC( picoModels, numPicoModelSlots, allocatedPicoModelSlots, 512 );
+	pm = &picoModels[ numPicoModelSlots ];
+	*pm = NULL;
 
 	/* attempt to parse model */
 	*pm = PicoLoadModel( name, frame );
@@ -173,7 +175,7 @@ picoModel_t *LoadModel( const char *name, int frame ){
 	/* debug code */
 	#if 0
 	{
-		int numSurfaces, numVertexes;
+		int i, numSurfaces, numVertexes;
 		picoSurface_t   *ps;
 
 
@@ -190,7 +192,9 @@ picoModel_t *LoadModel( const char *name, int frame ){
 
 	/* set count */
 	if ( *pm != NULL ) {
+		numPicoModelSlots++;
 		numPicoModels++;
+		StrHashAdd( picoModelHash, PicoGetModelName( *pm ), *pm );
 	}
 
 	/* return the picoModel */
@@ -199,6 +203,34 @@ picoModel_t *LoadModel( const char *name, int frame ){
 
 
 
+/*
+   UnloadModel()
+   frees a picoModel and drops it from the list, so the next LoadModel() parses it again
+ */
+
+void UnloadModel( picoModel_t *model ){
+	int i;
+
+
+	/* init */
+	InitModels();
+
+	/* find its slot */
+	for ( i = 0; i < numPicoModelSlots && picoModels[ i ] != model; i++ ) ;
+	if ( model == NULL || i == numPicoModelSlots ) {
+		return;
+	}
+
+	/* drop it */
+	StrHashRemove( picoModelHash, PicoGetModelName( model ), model );
+	PicoFreeModel( model );
+	picoModels[ i ] = picoModels[ numPicoModelSlots - 1 ];
+	numPicoModelSlots--;
+	numPicoModels--;
+}
+
+
+
 /*
    InsertModel() - ydnar
    adds a picomodel into the bsp
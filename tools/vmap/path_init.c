@@ -414,6 +414,10 @@ void InitPaths( int *argc, char **argv ){
 	/* note it */
 	Sys_FPrintf( SYS_VRB, "--- InitPaths ---\n" );
 
+	/* start over, daemon jobs come through here again */
+	homePath = NULL;
+	homeBasePath = NULL;
+
 	/* get the install path for backup */
 	LokiInitPaths( argv[ 0 ] );
 
@@ -421,6 +425,7 @@ void InitPaths( int *argc, char **argv ){
 	game = &games[ 0 ];
 	numBasePaths = 0;
 	numGamePaths = 0;
+	numPakPaths = 0;
 
 	/* parse through the arguments and extract those relevant to paths */
 	for ( i = 0; i < *argc; i++ )
@@ -555,10 +555,12 @@ void MakeTreePortals_r( node_t *node ){
  */
 void MakeTreePortals( tree_t *tree ){
 	Sys_FPrintf( SYS_VRB, "--- MakeTreePortals ---\n" );
+	ProfileBegin( "MakeTreePortals" );
 	MakeHeadnodePortals( tree );
 	MakeTreePortals_r( tree->headnode );
 	Sys_FPrintf( SYS_VRB, "%9d tiny portals\n", c_tinyportals );
 	Sys_FPrintf( SYS_VRB, "%9d bad portals\n", c_badportals );  /* ydnar */
+	ProfileEnd();
 }
 
 /*
@@ -674,6 +676,7 @@ int FloodEntities( tree_t *tree ){
 
 	headnode = tree->headnode;
 	Sys_FPrintf( SYS_VRB,"--- FloodEntities ---\n" );
+	ProfileBegin( "FloodEntities" );
 	inside = qfalse;
 	tree->outside_node.occupied = 0;
 
@@ -761,6 +764,8 @@ int FloodEntities( tree_t *tree ){
 	}
 
 	Sys_FPrintf( SYS_VRB, "%9d flooded leafs\n", c_floodedleafs );
+	ProfileAddWork( c_floodedleafs );
+	ProfileEnd();
 
 	if ( !inside ) {
 		Sys_FPrintf( SYS_VRB, "no entities in open -- no filling\n" );
@@ -386,6 +386,7 @@ void WriteMapShaderFile( void ){
 		Sys_FPrintf( SYS_WRN, "WARNING: Unable to open map shader file %s for writing\n", mapShaderFile );
 		return;
 	}
+	vfsAddWrittenFile( mapShaderFile );
 
 	/* print header */
 	fprintf( file,
@@ -423,6 +424,38 @@ void WriteMapShaderFile( void ){
 
 
 
+/*
+   AllocShaderData() - CopyShaderString()
+   allocates memory owned by the shaders; shaders cloned with memcpy share it, so it is
+   kept on one list and freed all at once by ClearShaderInfo
+ */
+
+typedef union shaderData_u
+{
+	union shaderData_u      *next;
+	double align;                       /* keeps the data that follows aligned */
+}
+shaderData_t;
+
+static shaderData_t *shaderData = NULL;
+
+static void *AllocShaderData( size_t size ){
+	shaderData_t    *sd;
+
+
+	sd = safe_malloc( sizeof( *sd ) + size );
+	memset( sd + 1, 0, size );
+	sd->next = shaderData;
+	shaderData = sd;
+	return sd + 1;
+}
+
+static char *CopyShaderString( const char *text ){
+	return strcpy( AllocShaderData( strlen( text ) + 1 ), text );
+}
+
+
+
 /*
    CustomShader() - ydnar
    sets up a custom map shader
@@ -574,8 +607,7 @@ shaderInfo_t *CustomShader( shaderInfo_t *si, char *find, char *replace ){
 	csi->custom = qtrue;
 
 	/* store new shader text */
-	csi->shaderText = safe_malloc( strlen( shaderText ) + 1 );
-	strcpy( csi->shaderText, shaderText );  /* LEAK! */
+	csi->shaderText = CopyShaderString( shaderText );
 
 	/* return it */
 	return csi;
@@ -617,6 +649,41 @@ void EmitVertexRemapShader( char *from, char *to ){
 
 
 
+/*
+   HashShaderInfo()
+   adds any shaderInfo allocated since the last call to the name hash
+ */
+
+static strHash_t *shaderInfoHash = NULL;
+static int numHashedShaderInfo = 0;
+
+static void HashShaderInfo( void ){
+	if ( shaderInfoHash == NULL ) {
+		shaderInfoHash = StrHashNew( MAX_SHADER_INFO, qfalse );
+	}
+	for ( ; numHashedShaderInfo < numShaderInfo; numHashedShaderInfo++ )
+		StrHashAdd( shaderInfoHash, shaderInfo[ numHashedShaderInfo ].shader, &shaderInfo[ numHashedShaderInfo ] );
+}
+
+
+
+/*
+   FirstShaderInfo() - NextShaderInfo()
+   walks the shaderInfo with a name in allocation order, same as a linear scan would
+ */
+
+static strHashNode_t *FirstShaderInfo( const char *shader ){
+	HashShaderInfo();
+	return StrHashFirst( shaderInfoHash, shader );
+}
+
+static strHashNode_t *NextShaderInfo( strHashNode_t *node ){
+	HashShaderInfo();
+	return StrHashNext( shaderInfoHash, node );
+}
+
+
+
 /*
    AllocShaderInfo()
    allocates and initializes a new shader
@@ -891,8 +958,8 @@ void Parse1DMatMatrixAppend( char *buffer, int x, vec_t *m ){
 int
 ShaderInfoExists(const char *shaderName)
 {
-	int i;
 	shaderInfo_t    *si;
+	strHashNode_t   *node;
 	char shader[ MAX_QPATH ];
 	char filename[ MAX_QPATH ];
 	char shaderText[ 8192 ], temp[ 1024 ];
@@ -914,9 +981,11 @@ ShaderInfoExists(const char *shaderName)
 	StripExtension( shader );
 
 	int deprecationDepth = 0;
-	for ( i = 0; i < numShaderInfo; i++ )
+	node = FirstShaderInfo( shader );
+	while ( node != NULL )
 	{
-		si = &shaderInfo[ i ];
+		si = node->value;
+		node = NextShaderInfo( node );
 		if ( !Q_stricmp( shader, si->shader ) ) {
 			/* check if shader is deprecated */
 			if ( deprecationDepth < MAX_SHADER_DEPRECATION_DEPTH && si->deprecateShader && si->deprecateShader[ 0 ] ) {
@@ -929,7 +998,7 @@ ShaderInfoExists(const char *shaderName)
 					Sys_FPrintf( SYS_WRN, "WARNING: Max deprecation depth of %i is reached on shader '%s'\n", MAX_SHADER_DEPRECATION_DEPTH, shader );
 				}
 				/* search again from beginning */
-				i = -1;
+				node = FirstShaderInfo( shader );
 				continue;
 			}
 
@@ -949,6 +1018,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 	int i;
 	int deprecationDepth;
 	shaderInfo_t    *si;
+	strHashNode_t   *node;
 	char shader[ MAX_QPATH ];
 	char filename[ MAX_QPATH ];
 	char shaderText[ 8192 ], temp[ 1024 ];
@@ -972,9 +1042,10 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 	/* force new allocation */
 	if (force == 0) {
 	deprecationDepth = 0;
-	for ( i = 0; i < numShaderInfo; i++ )
+	node = FirstShaderInfo( shader );
+	while ( node != NULL )
 	{
-		si = &shaderInfo[ i ];
+		si = node->value;
 		if ( !Q_stricmp( shader, si->shader ) ) {
 			/* check if shader is deprecated */
 			if ( deprecationDepth < MAX_SHADER_DEPRECATION_DEPTH && si->deprecateShader && si->deprecateShader[ 0 ] ) {
@@ -987,7 +1058,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 					Sys_FPrintf( SYS_WRN, "WARNING: Max deprecation depth of %i is reached on shader '%s'\n", MAX_SHADER_DEPRECATION_DEPTH, shader );
 				}
 				/* search again from beginning */
-				i = -1;
+				node = FirstShaderInfo( shader );
 				continue;
 			}
 
@@ -999,12 +1070,14 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 
 			/* this is a remapped shader, continue */
 			if (si->remapped == qtrue) {
+				node = NextShaderInfo( node );
 				continue;
 			}
 
 			/* return it */
 			return si;
 		}
+		node = NextShaderInfo( node );
 	}
 	}
 
@@ -1028,8 +1101,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 	/* copy shader text to the shaderinfo */
 	if ( si != NULL && shaderText[ 0 ] != '\0' ) {
 		strcat( shaderText, "\n" );
-		si->shaderText = safe_malloc( strlen( shaderText ) + 1 );
-		strcpy( si->shaderText, shaderText );
+		si->shaderText = CopyShaderString( shaderText );
 		//%	if( VectorLength( si->vecs[ 0 ] ) )
 		//%		Sys_Printf( "%s\n", shaderText );
 	}
@@ -1136,8 +1208,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 		else if ( !Q_stricmp( mattoken, "damageShader" ) ) {
 			GetMatTokenAppend( shaderText, qfalse );
 			if ( mattoken[ 0 ] != '\0' ) {
-				si->damageShader = safe_malloc( strlen( mattoken ) + 1 );
-				strcpy( si->damageShader, mattoken );
+				si->damageShader = CopyShaderString( mattoken );
 			}
 			GetMatTokenAppend( shaderText, qfalse );           /* don't do anything with health */
 		}
@@ -1262,8 +1333,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 				surfaceModel_t  *model;
 
 				/* allocate new model and attach it */
-				model = safe_malloc( sizeof( *model ) );
-				memset( model, 0, sizeof( *model ) );
+				model = AllocShaderData( sizeof( *model ) );
 				model->next = si->surfaceModel;
 				si->surfaceModel = model;
 
@@ -1296,8 +1366,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 
 
 				/* allocate new foliage struct and attach it */
-				foliage = safe_malloc( sizeof( *foliage ) );
-				memset( foliage, 0, sizeof( *foliage ) );
+				foliage = AllocShaderData( sizeof( *foliage ) );
 				foliage->next = si->foliage;
 				si->foliage = foliage;
 
@@ -1501,8 +1570,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 			else if ( !Q_stricmp( mattoken, "q3map_backMaterial" ) || !Q_stricmp( mattoken, "vmap_backMaterial" ) ) {
 				GetMatTokenAppend( shaderText, qfalse );
 				if ( mattoken[ 0 ] != '\0' ) {
-					si->backShader = safe_malloc( strlen( mattoken ) + 1 );
-					strcpy( si->backShader, mattoken );
+					si->backShader = CopyShaderString( mattoken );
 				}
 			}
 
@@ -1510,8 +1578,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 			else if ( !Q_stricmp( mattoken, "q3map_cloneShader" ) || !Q_stricmp( mattoken, "vmap_cloneMaterial" ) ) {
 				GetMatTokenAppend( shaderText, qfalse );
 				if ( mattoken[ 0 ] != '\0' ) {
-					si->cloneShader = safe_malloc( strlen( mattoken ) + 1 );
-					strcpy( si->cloneShader, mattoken );
+					si->cloneShader = CopyShaderString( mattoken );
 				}
 			}
 
@@ -1519,8 +1586,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 			else if ( !Q_stricmp( mattoken, "q3map_remapShader" ) || !Q_stricmp( mattoken, "vmap_remapMaterial" ) ) {
 				GetMatTokenAppend( shaderText, qfalse );
 				if ( mattoken[ 0 ] != '\0' ) {
-					si->remapShader = safe_malloc( strlen( mattoken ) + 1 );
-					strcpy( si->remapShader, mattoken );
+					si->remapShader = CopyShaderString( mattoken );
 				}
 			}
 
@@ -1529,8 +1595,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 				GetMatTokenAppend( shaderText, qfalse );
 				if ( mattoken[ 0 ] != '\0' ) {
 
-					si->deprecateShader = safe_malloc( strlen( mattoken ) + 1 );
-					strcpy( si->deprecateShader, mattoken );
+					si->deprecateShader = CopyShaderString( mattoken );
 				}
 			}
 
@@ -1610,8 +1675,7 @@ shaderInfo_t *ShaderInfoForShader( const char *shaderName, int force ){
 				alpha = ( !Q_stricmp( mattoken, "q3map_alphaGen" ) || !Q_stricmp( mattoken, "q3map_alphaMod" ) ) ? 1 : 0;
 
 				/* allocate new colormod */
-				cm = safe_malloc( sizeof( *cm ) );
-				memset( cm, 0, sizeof( *cm ) );
+				cm = AllocShaderData( sizeof( *cm ) );
 
 				/* attach to shader */
 				if ( si->colorMod == NULL ) {
@@ -1950,8 +2014,7 @@ static void ParseShaderFile( const char *filename ){
 		/* copy shader text to the shaderinfo */
 		if ( si != NULL && shaderText[ 0 ] != '\0' ) {
 			strcat( shaderText, "\n" );
-			si->shaderText = safe_malloc( strlen( shaderText ) + 1 );
-			strcpy( si->shaderText, shaderText );
+			si->shaderText = CopyShaderString( shaderText );
 			//%	if( VectorLength( si->vecs[ 0 ] ) )
 			//%		Sys_Printf( "%s\n", shaderText );
 		}
@@ -2124,8 +2187,7 @@ static void ParseShaderFile( const char *filename ){
 			else if ( !Q_stricmp( token, "damageShader" ) ) {
 				GetTokenAppend( shaderText, qfalse );
 				if ( token[ 0 ] != '\0' ) {
-					si->damageShader = safe_malloc( strlen( token ) + 1 );
-					strcpy( si->damageShader, token );
+					si->damageShader = CopyShaderString( token );
 				}
 				GetTokenAppend( shaderText, qfalse );   /* don't do anything with health */
 			}
@@ -2232,8 +2294,7 @@ static void ParseShaderFile( const char *filename ){
 				}
 
 				/* allocate sun */
-				sun = safe_malloc( sizeof( *sun ) );
-				memset( sun, 0, sizeof( *sun ) );
+				sun = AllocShaderData( sizeof( *sun ) );
 
 				/* set style */
 				sun->style = si->lightStyle;
@@ -2333,8 +2394,7 @@ static void ParseShaderFile( const char *filename ){
 					surfaceModel_t  *model;
 
 					/* allocate new model and attach it */
-					model = safe_malloc( sizeof( *model ) );
-					memset( model, 0, sizeof( *model ) );
+					model = AllocShaderData( sizeof( *model ) );
 					model->next = si->surfaceModel;
 					si->surfaceModel = model;
 
@@ -2367,8 +2427,7 @@ static void ParseShaderFile( const char *filename ){
 
 
 					/* allocate new foliage struct and attach it */
-					foliage = safe_malloc( sizeof( *foliage ) );
-					memset( foliage, 0, sizeof( *foliage ) );
+					foliage = AllocShaderData( sizeof( *foliage ) );
 					foliage->next = si->foliage;
 					si->foliage = foliage;
 
@@ -2566,8 +2625,7 @@ static void ParseShaderFile( const char *filename ){
 				else if ( !Q_stricmp( token, "q3map_backShader" ) || !Q_stricmp( token, "vmap_backMaterial" ) ) {
 					GetTokenAppend( shaderText, qfalse );
 					if ( token[ 0 ] != '\0' ) {
-						si->backShader = safe_malloc( strlen( token ) + 1 );
-						strcpy( si->backShader, token );
+						si->backShader = CopyShaderString( token );
 					}
 				}
 
@@ -2575,8 +2633,7 @@ static void ParseShaderFile( const char *filename ){
 				else if ( !Q_stricmp( token, "q3map_cloneShader" ) || !Q_stricmp( token, "vmap_cloneMaterial" ) ) {
 					GetTokenAppend( shaderText, qfalse );
 					if ( token[ 0 ] != '\0' ) {
-						si->cloneShader = safe_malloc( strlen( token ) + 1 );
-						strcpy( si->cloneShader, token );
+						si->cloneShader = CopyShaderString( token );
 					}
 				}
 
@@ -2584,8 +2641,7 @@ static void ParseShaderFile( const char *filename ){
 				else if ( !Q_stricmp( token, "q3map_remapShader" ) || !Q_stricmp( token, "vmap_remapMaterial" ) ) {
 					GetTokenAppend( shaderText, qfalse );
 					if ( token[ 0 ] != '\0' ) {
-						si->remapShader = safe_malloc( strlen( token ) + 1 );
-						strcpy( si->remapShader, token );
+						si->remapShader = CopyShaderString( token );
 					}
 				}
 
@@ -2594,8 +2650,7 @@ static void ParseShaderFile( const char *filename ){
 					GetTokenAppend( shaderText, qfalse );
 					if ( token[ 0 ] != '\0' ) {
 
-						si->deprecateShader = safe_malloc( strlen( token ) + 1 );
-						strcpy( si->deprecateShader, token );
+						si->deprecateShader = CopyShaderString( token );
 					}
 				}
 
@@ -2675,8 +2730,7 @@ static void ParseShaderFile( const char *filename ){
 					alpha = ( !Q_stricmp( token, "q3map_alphaGen" ) || !Q_stricmp( token, "q3map_alphaMod" ) ) ? 1 : 0;
 
 					/* allocate new colormod */
-					cm = safe_malloc( sizeof( *cm ) );
-					memset( cm, 0, sizeof( *cm ) );
+					cm = AllocShaderData( sizeof( *cm ) );
 
 					/* attach to shader */
 					if ( si->colorMod == NULL ) {
@@ -3009,11 +3063,41 @@ static void ParseCustomInfoParms( void ){
 
 #define MAX_SHADER_FILES 1024
 
+typedef struct shaderScript_s
+{
+	char                *filename;
+	int index;
+	time_t time;
+}
+shaderScript_t;
+
+static shaderScript_t *shaderScripts = NULL;
+static int numShaderScripts = 0, allocatedShaderScripts = 0;
+static int numShaderLists = 0;
+
+static void StampShaderScript( const char *filename, int index ){
+	AUTOEXPAND_BY_REALLOC( shaderScripts, numShaderScripts, allocatedShaderScripts, 64 );
+	shaderScripts[ numShaderScripts ].filename = copystring( filename );
+	shaderScripts[ numShaderScripts ].index = index;
+	shaderScripts[ numShaderScripts ].time = vfsGetFileTime( filename, index );
+	numShaderScripts++;
+}
+
 void LoadShaderInfo( void ){
 	int i, j, numShaderFiles, count;
 	char filename[ 1024 ];
 	char            *shaderFiles[ MAX_SHADER_FILES ];
 
+	/* a daemon job starts from the shaders the daemon keeps resident */
+	if ( daemonJob && numShaderInfo > 0 ) {
+		if ( !useCustomInfoParms ) {
+			return;
+		}
+
+		/* custom infoparms change how the scripts parse */
+		ClearShaderInfo();
+	}
+
 	/* rr2do2: parse custom infoparms first */
 	if ( useCustomInfoParms ) {
 		ParseCustomInfoParms();
@@ -3025,6 +3109,7 @@ void LoadShaderInfo( void ){
 	/* we can pile up several shader files, the one in baseq3 and ones in the mod dir or other spots */
 	sprintf( filename, "%s/shaderlist.txt", game->shaderPath );
 	count = vfsGetFileCount( filename );
+	numShaderLists = count;
 
 	/* load them all */
 	for ( i = 0; i < count; i++ )
@@ -3032,6 +3117,7 @@ void LoadShaderInfo( void ){
 		/* load shader list */
 		sprintf( filename, "%s/shaderlist.txt", game->shaderPath );
 		LoadScriptFile( filename, i );
+		StampShaderScript( filename, i );
 
 		/* parse it */
 		while ( GetToken( qtrue ) )
@@ -3061,9 +3147,68 @@ void LoadShaderInfo( void ){
 	{
 		sprintf( filename, "%s/%s.shader", game->shaderPath, shaderFiles[ i ] );
 		ParseShaderFile( filename );
+		StampShaderScript( filename, 0 );
 		free( shaderFiles[ i ] );
 	}
 
 	/* emit some statistics */
 	Sys_FPrintf( SYS_VRB, "%9d shaderInfo\n", numShaderInfo );
 }
+
+
+
+/*
+   ShaderInfoChanged()
+   tells if one of the scripts LoadShaderInfo parsed was edited, added or removed since
+ */
+
+qboolean ShaderInfoChanged( void ){
+	int i;
+	char filename[ 1024 ];
+
+
+	/* a shaderlist.txt came or went */
+	sprintf( filename, "%s/shaderlist.txt", game->shaderPath );
+	if ( vfsGetFileCount( filename ) != numShaderLists ) {
+		return qtrue;
+	}
+
+	for ( i = 0; i < numShaderScripts; i++ )
+	{
+		if ( vfsGetFileTime( shaderScripts[ i ].filename, shaderScripts[ i ].index ) != shaderScripts[ i ].time ) {
+			return qtrue;
+		}
+	}
+	return qfalse;
+}
+
+
+
+/*
+   ClearShaderInfo()
+   forgets all shaders, so LoadShaderInfo can parse the scripts again
+ */
+
+void ClearShaderInfo( void ){
+	int i;
+	shaderData_t    *sd;
+
+
+	numShaderInfo = 0;
+	numHashedShaderInfo = 0;
+	if ( shaderInfoHash != NULL ) {
+		StrHashClear( shaderInfoHash );
+	}
+
+	/* free their text, strings, sun, models, foliage and colormods */
+	while ( shaderData != NULL )
+	{
+		sd = shaderData;
+		shaderData = sd->next;
+		free( sd );
+	}
+
+	for ( i = 0; i < numShaderScripts; i++ )
+		free( shaderScripts[ i ].filename );
+	numShaderScripts = 0;
+}
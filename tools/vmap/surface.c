@@ -1570,6 +1570,8 @@ void ClipSidesIntoTree( entity_t *e, tree_t *tree ){
 	shaderInfo_t    *si;
 
 
+	ProfileBegin( "ClipSidesIntoTree" );
+
 	/* ydnar: cull brush sides */
 	CullSides( e );
 
@@ -1579,6 +1581,8 @@ void ClipSidesIntoTree( entity_t *e, tree_t *tree ){
 	/* walk the brush list */
 	for ( b = e->brushes; b; b = b->next )
 	{
+		ProfileAddWork( b->numsides );
+
 		/* walk the brush sides */
 		for ( i = 0; i < b->numsides; i++ )
 		{
@@ -1635,6 +1639,8 @@ void ClipSidesIntoTree( entity_t *e, tree_t *tree ){
 			DrawSurfaceForSide( e, b, newSide, w );
 		}
 	}
+
+	ProfileEnd();
 }
 
 
@@ -3301,6 +3307,7 @@ void FilterDrawsurfsIntoTree( entity_t *e, tree_t *tree ){
 
 	/* note it */
 	Sys_FPrintf( SYS_VRB, "--- FilterDrawsurfsIntoTree ---\n" );
+	ProfileBegin( "FilterDrawsurfsIntoTree" );
 
 	/* filter surfaces into the tree */
 	numSurfs = 0;
@@ -3499,4 +3506,6 @@ void FilterDrawsurfsIntoTree( entity_t *e, tree_t *tree ){
 		Sys_FPrintf( SYS_VRB, "%9d %s surfaces\n", numSurfacesByType[ i ], surfaceTypes[ i ] );
 
 	Sys_FPrintf( SYS_VRB, "%9d redundant indexes supressed, saving %d Kbytes\n", numRedundantIndexes, ( numRedundantIndexes * 4 / 1024 ) );
+	ProfileAddWork( numSurfs );
+	ProfileEnd();
 }
@@ -49,6 +49,9 @@
 #define GROW_META_VERTS     1024
 #define GROW_META_TRIANGLES 1024
 
+#define META_HASH_SIZE      65536       /* power of two */
+#define META_HASH_GRID      1.0f        /* size of a position hash cell */
+
 static int numMetaSurfaces, numPatchMetaSurfaces;
 
 static int maxMetaVerts = 0;
@@ -60,6 +63,23 @@ static int maxMetaTriangles = 0;
 static int numMetaTriangles = 0;
 static metaTriangle_t       *metaTriangles = NULL;
 
+/* ydnar: hashed meta vertex/triangle lookup, a bucket is only valid in the epoch it was written in */
+typedef struct metaHashBucket_s
+{
+	int head, epoch;
+}
+metaHashBucket_t;
+
+static int metaHashEpoch = 1;
+static metaHashBucket_t     *metaVertHash = NULL;
+static int                  *metaVertHashNext = NULL;
+#ifdef USE_EXHAUSTIVE_SEARCH
+static metaHashBucket_t     *metaTriangleHash = NULL;
+static int                  *metaTriangleHashNext = NULL;
+static int maxMetaTriangleHashNext = 0;
+#endif
+static int numMetaVertLookups, numMetaVertHashHits, numMetaVertHashProbes;
+
 
 
 /*
@@ -70,10 +90,61 @@ static metaTriangle_t       *metaTriangles = NULL;
 void ClearMetaTriangles( void ){
 	numMetaVerts = 0;
 	numMetaTriangles = 0;
+
+	/* invalidate the hash buckets */
+	metaHashEpoch++;
 }
 
 
 
+/*
+   HashMetaVertex()
+   hashes a drawvert by quantized position and the bytes of its other attributes
+ */
+
+static unsigned int HashMetaVertex( const bspDrawVert_t *v ){
+	unsigned int hash;
+	const byte      *b;
+	size_t i;
+
+
+	/* position cell */
+	hash = ( (unsigned int) (int) floor( v->xyz[ 0 ] / META_HASH_GRID ) * 73856093u ) ^
+	       ( (unsigned int) (int) floor( v->xyz[ 1 ] / META_HASH_GRID ) * 19349663u ) ^
+	       ( (unsigned int) (int) floor( v->xyz[ 2 ] / META_HASH_GRID ) * 83492791u );
+
+	/* attributes (fnv-1a) */
+	b = (const byte*) v + sizeof( v->xyz );
+	for ( i = sizeof( v->xyz ); i < sizeof( *v ); i++, b++ )
+		hash = ( hash ^ *b ) * 16777619u;
+
+	return hash & ( META_HASH_SIZE - 1 );
+}
+
+
+
+#ifdef USE_EXHAUSTIVE_SEARCH
+/*
+   HashMetaTriangle()
+   hashes a metatriangle by its bytes
+ */
+
+static unsigned int HashMetaTriangle( const metaTriangle_t *tri ){
+	unsigned int hash;
+	const byte      *b;
+	size_t i;
+
+
+	hash = 2166136261u;
+	for ( i = 0, b = (const byte*) tri; i < sizeof( *tri ); i++, b++ )
+		hash = ( hash ^ *b ) * 16777619u;
+
+	return hash & ( META_HASH_SIZE - 1 );
+}
+#endif
+
+
+
 /*
    FindMetaVertex()
    finds a matching metavertex in the global list, returning its index
@@ -81,13 +152,29 @@ void ClearMetaTriangles( void ){
 
 static int FindMetaVertex( bspDrawVert_t *src ){
 	int i;
-	bspDrawVert_t   *v, *temp;
+	unsigned int hash;
+	bspDrawVert_t   *temp;
+	int             *tempNext;
 
 
-	/* try to find an existing drawvert */
-	for ( i = firstSearchMetaVert, v = &metaVerts[ i ]; i < numMetaVerts; i++, v++ )
+	/* setup hash */
+	if ( metaVertHash == NULL ) {
+		metaVertHash = safe_malloc( META_HASH_SIZE * sizeof( *metaVertHash ) );
+		memset( metaVertHash, 0, META_HASH_SIZE * sizeof( *metaVertHash ) );
+	}
+	hash = HashMetaVertex( src );
+	if ( metaVertHash[ hash ].epoch != metaHashEpoch ) {
+		metaVertHash[ hash ].head = -1;
+		metaVertHash[ hash ].epoch = metaHashEpoch;
+	}
+
+	/* try to find an existing drawvert (chains run from newest to oldest, so stop below the search start) */
+	numMetaVertLookups++;
+	for ( i = metaVertHash[ hash ].head; i >= firstSearchMetaVert; i = metaVertHashNext[ i ] )
 	{
-		if ( memcmp( src, v, sizeof( bspDrawVert_t ) ) == 0 ) {
+		numMetaVertHashProbes++;
+		if ( memcmp( src, &metaVerts[ i ], sizeof( bspDrawVert_t ) ) == 0 ) {
+			numMetaVertHashHits++;
 			return i;
 		}
 	}
@@ -97,15 +184,21 @@ static int FindMetaVertex( bspDrawVert_t *src ){
 		/* reallocate more room */
 		maxMetaVerts += GROW_META_VERTS;
 		temp = safe_malloc( maxMetaVerts * sizeof( bspDrawVert_t ) );
+		tempNext = safe_malloc( maxMetaVerts * sizeof( int ) );
 		if ( metaVerts != NULL ) {
 			memcpy( temp, metaVerts, numMetaVerts * sizeof( bspDrawVert_t ) );
+			memcpy( tempNext, metaVertHashNext, numMetaVerts * sizeof( int ) );
 			free( metaVerts );
+			free( metaVertHashNext );
 		}
 		metaVerts = temp;
+		metaVertHashNext = tempNext;
 	}
 
 	/* add the triangle */
 	memcpy( &metaVerts[ numMetaVerts ], src, sizeof( bspDrawVert_t ) );
+	metaVertHashNext[ numMetaVerts ] = metaVertHash[ hash ].head;
+	metaVertHash[ hash ].head = numMetaVerts;
 	numMetaVerts++;
 
 	/* return the count */
@@ -218,20 +311,48 @@ int FindMetaTriangle( metaTriangle_t *src, bspDrawVert_t *a, bspDrawVert_t *b, b
 	#ifdef USE_EXHAUSTIVE_SEARCH
 	{
 		int i;
-		metaTriangle_t  *tri;
+		unsigned int hash;
+		int             *tempNext;
+
 
+		/* setup hash */
+		if ( metaTriangleHash == NULL ) {
+			metaTriangleHash = safe_malloc( META_HASH_SIZE * sizeof( *metaTriangleHash ) );
+			memset( metaTriangleHash, 0, META_HASH_SIZE * sizeof( *metaTriangleHash ) );
+		}
+		hash = HashMetaTriangle( src );
+		if ( metaTriangleHash[ hash ].epoch != metaHashEpoch ) {
+			metaTriangleHash[ hash ].head = -1;
+			metaTriangleHash[ hash ].epoch = metaHashEpoch;
+		}
 
-		for ( i = 0, tri = metaTriangles; i < numMetaTriangles; i++, tri++ )
+		for ( i = metaTriangleHash[ hash ].head; i >= 0; i = metaTriangleHashNext[ i ] )
 		{
-			if ( memcmp( src, tri, sizeof( metaTriangle_t ) ) == 0 ) {
+			if ( memcmp( src, &metaTriangles[ i ], sizeof( metaTriangle_t ) ) == 0 ) {
 				return i;
 			}
 		}
-	}
-	#endif
 
+		/* get a new triangle */
+		triIndex = AddMetaTriangle();
+
+		/* chain it */
+		if ( triIndex >= maxMetaTriangleHashNext ) {
+			tempNext = safe_malloc( maxMetaTriangles * sizeof( int ) );
+			if ( metaTriangleHashNext != NULL ) {
+				memcpy( tempNext, metaTriangleHashNext, maxMetaTriangleHashNext * sizeof( int ) );
+				free( metaTriangleHashNext );
+			}
+			metaTriangleHashNext = tempNext;
+			maxMetaTriangleHashNext = maxMetaTriangles;
+		}
+		metaTriangleHashNext[ triIndex ] = metaTriangleHash[ hash ].head;
+		metaTriangleHash[ hash ].head = triIndex;
+	}
+	#else
 	/* get a new triangle */
 	triIndex = AddMetaTriangle();
+	#endif
 
 	/* add the triangle */
 	memcpy( &metaTriangles[ triIndex ], src, sizeof( metaTriangle_t ) );
@@ -857,6 +978,11 @@ void EmitMetaStats(){
 	Sys_Printf( "%9d patch meta surfaces\n", numPatchMetaSurfaces );
 	Sys_Printf( "%9d meta verts\n", numMetaVerts );
 	Sys_Printf( "%9d meta triangles\n", numMetaTriangles );
+	Sys_Printf( "%9d meta vert lookups\n", numMetaVertLookups );
+	if ( numMetaVertLookups > 0 ) {
+		Sys_Printf( "%9.2f%% meta vert hash hit rate\n", 100.0 * numMetaVertHashHits / numMetaVertLookups );
+		Sys_Printf( "%9.2f meta vert hash probes per lookup\n", (double) numMetaVertHashProbes / numMetaVertLookups );
+	}
 }
 
 
@@ -873,6 +999,7 @@ void MakeEntityMetaTriangles( entity_t *e ){
 
 	/* note it */
 	Sys_FPrintf( SYS_VRB, "--- MakeEntityMetaTriangles ---\n" );
+	ProfileBegin( "MakeEntityMetaTriangles" );
 
 	/* init pacifier */
 	fOld = -1;
@@ -951,6 +1078,8 @@ void MakeEntityMetaTriangles( entity_t *e ){
 
 	/* tidy things up */
 	TidyEntitySurfaces( e );
+	ProfileAddWork( numMetaTriangles );
+	ProfileEnd();
 }
 
 
@@ -1919,6 +2048,8 @@ void MergeMetaTriangles( void ){
 
 	/* note it */
 	Sys_FPrintf( SYS_VRB, "--- MergeMetaTriangles ---\n" );
+	ProfileBegin( "MergeMetaTriangles" );
+	ProfileAddWork( numMetaTriangles );
 
 	/* sort the triangles by shader major, fognum minor */
 	qsort( metaTriangles, numMetaTriangles, sizeof( metaTriangle_t ), CompareMetaTriangles );
@@ -1966,4 +2097,5 @@ void MergeMetaTriangles( void ){
 	/* emit some stats */
 	Sys_FPrintf( SYS_VRB, "%9d surfaces merged\n", numMergedSurfaces );
 	Sys_FPrintf( SYS_VRB, "%9d vertexes merged\n", numMergedVerts );
+	ProfileEnd();
 }
@@ -55,6 +55,10 @@ typedef struct edgeLine_s {
 	vec3_t origin;
 	vec3_t dir;
 
+	// axis the line runs along, -1 if it isn't exactly axial
+	int axis;
+	int hashNext;
+
 	// unused element of doubly linked list
 	edgePoint_t *chain;
 } edgeLine_t;
@@ -72,6 +76,17 @@ edgeLine_t *edgeLines = NULL;
 int numEdgeLines;
 int allocatedEdgeLines = 0;
 
+// axial edge lines are hashed by axis and the cell of their perpendicular
+// coordinates, everything else is kept in a short list that is scanned
+#define EDGE_HASH_SIZE          65536   // power of two
+int edgeLineHash[ EDGE_HASH_SIZE ];
+
+int *nonAxialEdgeLines = NULL;
+int numNonAxialEdgeLines;
+int allocatedNonAxialEdgeLines = 0;
+
+int c_edgeLineProbes;
+
 int c_degenerateEdges;
 int c_addedVerts;
 int c_totalVerts;
@@ -132,13 +147,156 @@ void InsertPointOnEdge( vec3_t v, edgeLine_t *e ) {
 }
 
 
+/*
+   ====================
+   EdgeLineHash
+   ====================
+ */
+static int EdgeLineHash( int axis, int c1, int c2 ) {
+	return ( ( axis * 73856093u ) ^ ( c1 * 19349663u ) ^ ( c2 * 83492791u ) ) & ( EDGE_HASH_SIZE - 1 );
+}
+
+
+/*
+   ====================
+   EdgeLineAxis
+
+   returns the axis of a line if its direction and both
+   normals are exact axis vectors, so that plane distance
+   tests against it are exact coordinate compares
+   ====================
+ */
+static int EdgeLineAxis( edgeLine_t *e ) {
+	int i, axis;
+	vec_t   *v;
+
+	axis = -1;
+	for ( i = 0; i < 3; i++ ) {
+		v = ( i == 0 ? e->dir : i == 1 ? e->normal1 : e->normal2 );
+		if ( fabs( v[0] ) == 1.0f && v[1] == 0.0f && v[2] == 0.0f ) {
+			if ( i == 0 ) {
+				axis = 0;
+			}
+		}
+		else if ( v[0] == 0.0f && fabs( v[1] ) == 1.0f && v[2] == 0.0f ) {
+			if ( i == 0 ) {
+				axis = 1;
+			}
+		}
+		else if ( v[0] == 0.0f && v[1] == 0.0f && fabs( v[2] ) == 1.0f ) {
+			if ( i == 0 ) {
+				axis = 2;
+			}
+		}
+		else{
+			return -1;
+		}
+	}
+
+	return axis;
+}
+
+
+/*
+   ====================
+   EdgeLineContains
+   ====================
+ */
+static qboolean EdgeLineContains( edgeLine_t *e, vec3_t v1, vec3_t v2 ) {
+	float d;
+
+	c_edgeLineProbes++;
+
+	d = DotProduct( v1, e->normal1 ) - e->dist1;
+	if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
+		return qfalse;
+	}
+	d = DotProduct( v1, e->normal2 ) - e->dist2;
+	if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
+		return qfalse;
+	}
+
+	d = DotProduct( v2, e->normal1 ) - e->dist1;
+	if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
+		return qfalse;
+	}
+	d = DotProduct( v2, e->normal2 ) - e->dist2;
+	if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
+		return qfalse;
+	}
+
+	return qtrue;
+}
+
+
+/*
+   ====================
+   FindEdgeLine
+
+   returns the lowest numbered edge line containing both points,
+   same as a linear scan of all edge lines would
+   ====================
+ */
+static int FindEdgeLine( vec3_t v1, vec3_t v2 ) {
+	int i, a, k1, k2, c1, c2, best;
+	int cells1[ 2 ], cells2[ 2 ];
+	edgeLine_t  *e;
+
+	best = -1;
+
+	// an axial line can only contain v1 if v1 is within epsilon of
+	// it on both perpendicular axes, so check the neighbouring cells
+	for ( a = 0; a < 3; a++ ) {
+		k1 = ( a + 1 ) % 3;
+		k2 = ( a + 2 ) % 3;
+		cells1[0] = (int) floor( v1[k1] - 0.5f );
+		cells1[1] = (int) floor( v1[k1] + 0.5f );
+		cells2[0] = (int) floor( v1[k2] - 0.5f );
+		cells2[1] = (int) floor( v1[k2] + 0.5f );
+
+		for ( c1 = 0; c1 < 2; c1++ ) {
+			if ( c1 == 1 && cells1[1] == cells1[0] ) {
+				continue;
+			}
+			for ( c2 = 0; c2 < 2; c2++ ) {
+				if ( c2 == 1 && cells2[1] == cells2[0] ) {
+					continue;
+				}
+				for ( i = edgeLineHash[ EdgeLineHash( a, cells1[c1], cells2[c2] ) ]; i >= 0; i = e->hashNext ) {
+					e = &edgeLines[i];
+					if ( e->axis != a || ( best >= 0 && i > best ) ) {
+						continue;
+					}
+					if ( EdgeLineContains( e, v1, v2 ) ) {
+						best = i;
+					}
+				}
+			}
+		}
+	}
+
+	// the rest are in creation order
+	for ( i = 0; i < numNonAxialEdgeLines; i++ ) {
+		if ( best >= 0 && nonAxialEdgeLines[i] > best ) {
+			break;
+		}
+		if ( EdgeLineContains( &edgeLines[ nonAxialEdgeLines[i] ], v1, v2 ) ) {
+			best = nonAxialEdgeLines[i];
+			break;
+		}
+	}
+
+	return best;
+}
+
+
 /*
    ====================
    AddEdge
    ====================
  */
 int AddEdge( vec3_t v1, vec3_t v2, qboolean createNonAxial ) {
-	int i;
+	int i, hash;
 	edgeLine_t  *e;
 	float d;
 	vec3_t dir;
@@ -162,28 +320,10 @@ int AddEdge( vec3_t v1, vec3_t v2, qboolean createNonAxial ) {
 		}
 	}
 
-	for ( i = 0; i < numEdgeLines; i++ ) {
-		e = &edgeLines[i];
-
-		d = DotProduct( v1, e->normal1 ) - e->dist1;
-		if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
-			continue;
-		}
-		d = DotProduct( v1, e->normal2 ) - e->dist2;
-		if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
-			continue;
-		}
-
-		d = DotProduct( v2, e->normal1 ) - e->dist1;
-		if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
-			continue;
-		}
-		d = DotProduct( v2, e->normal2 ) - e->dist2;
-		if ( d < -POINT_ON_LINE_EPSILON || d > POINT_ON_LINE_EPSILON ) {
-			continue;
-		}
-
+	i = FindEdgeLine( v1, v2 );
+	if ( i >= 0 ) {
 		// this is the edge
+		e = &edgeLines[i];
 		InsertPointOnEdge( v1, e );
 		InsertPointOnEdge( v2, e );
 		return i;
@@ -205,6 +345,19 @@ int AddEdge( vec3_t v1, vec3_t v2, qboolean createNonAxial ) {
 	e->dist1 = DotProduct( e->origin, e->normal1 );
 	e->dist2 = DotProduct( e->origin, e->normal2 );
 
+	// index it
+	e->axis = EdgeLineAxis( e );
+	if ( e->axis >= 0 ) {
+		hash = EdgeLineHash( e->axis, (int) floor( e->origin[ ( e->axis + 1 ) % 3 ] ), (int) floor( e->origin[ ( e->axis + 2 ) % 3 ] ) );
+		e->hashNext = edgeLineHash[ hash ];
+		edgeLineHash[ hash ] = numEdgeLines - 1;
+	}
+	else{
+		e->hashNext = -1;
+		AUTOEXPAND_BY_REALLOC( nonAxialEdgeLines, numNonAxialEdgeLines, allocatedNonAxialEdgeLines, 1024 );
+		nonAxialEdgeLines[ numNonAxialEdgeLines++ ] = numEdgeLines - 1;
+	}
+
 	InsertPointOnEdge( v1, e );
 	InsertPointOnEdge( v2, e );
 
@@ -623,6 +776,8 @@ void FixTJunctions( entity_t *ent ){
 	int axialEdgeLines;
 	originalEdge_t      *e;
 	bspDrawVert_t   *dv;
+	clock_t start;
+	double edgeTime;
 
 	/* meta mode has its own t-junction code (currently not as good as this code) */
 	//%	if( meta )
@@ -630,8 +785,13 @@ void FixTJunctions( entity_t *ent ){
 
 	/* note it */
 	Sys_FPrintf( SYS_VRB, "--- FixTJunctions ---\n" );
+	ProfileBegin( "FixTJunctions" );
+	start = clock();
 	numEdgeLines = 0;
 	numOriginalEdges = 0;
+	numNonAxialEdgeLines = 0;
+	c_edgeLineProbes = 0;
+	memset( edgeLineHash, -1, sizeof( edgeLineHash ) );
 
 	// add all the edges
 	// this actually creates axial edges, but it
@@ -681,6 +841,8 @@ void FixTJunctions( entity_t *ent ){
 	Sys_FPrintf( SYS_VRB, "%9d axial edge lines\n", axialEdgeLines );
 	Sys_FPrintf( SYS_VRB, "%9d non-axial edge lines\n", numEdgeLines - axialEdgeLines );
 	Sys_FPrintf( SYS_VRB, "%9d degenerate edges\n", c_degenerateEdges );
+	Sys_FPrintf( SYS_VRB, "%9d edge line probes\n", c_edgeLineProbes );
+	edgeTime = (double) ( clock() - start ) / CLOCKS_PER_SEC;
 
 	// insert any needed vertexes
 	for ( i = ent->firstDrawSurf; i < numMapDrawSurfs; i++ )
@@ -717,4 +879,8 @@ void FixTJunctions( entity_t *ent ){
 	Sys_FPrintf( SYS_VRB, "%9d rotated orders\n", c_rotate );
 	Sys_FPrintf( SYS_VRB, "%9d can't order\n", c_cant );
 	Sys_FPrintf( SYS_VRB, "%9d broken (degenerate) surfaces removed\n", c_broken );
+	Sys_FPrintf( SYS_VRB, "%9.3f seconds adding edge lines\n", edgeTime );
+	Sys_FPrintf( SYS_VRB, "%9.3f seconds fixing T-junctions\n", (double) ( clock() - start ) / CLOCKS_PER_SEC );
+	ProfileAddWork( c_totalVerts );
+	ProfileEnd();
 }
@@ -229,7 +229,9 @@ void CalcPortalVis( void ){
 	//get rid of the counter
 	RunThreadsOnIndividual( numportals * 2, qfalse, PortalFlow );
 #else
+	ProfileBegin( "PortalFlow" );
 	RunThreadsOnIndividual( numportals * 2, qtrue, PortalFlow );
+	ProfileEnd();
 #endif
 
 }
@@ -251,10 +253,14 @@ void CalcPassageVis( void ){
 	_printf( "\n" );
 #else
 	Sys_Printf( "\n--- CreatePassages (%d) ---\n", numportals * 2 );
+	ProfileBegin( "CreatePassages" );
 	RunThreadsOnIndividual( numportals * 2, qtrue, CreatePassages );
+	ProfileEnd();
 
 	Sys_Printf( "\n--- PassageFlow (%d) ---\n", numportals * 2 );
+	ProfileBegin( "PassageFlow" );
 	RunThreadsOnIndividual( numportals * 2, qtrue, PassageFlow );
+	ProfileEnd();
 #endif
 }
 
@@ -275,10 +281,14 @@ void CalcPassagePortalVis( void ){
 	Sys_Printf( "\n" );
 #else
 	Sys_Printf( "\n--- CreatePassages (%d) ---\n", numportals * 2 );
+	ProfileBegin( "CreatePassages" );
 	RunThreadsOnIndividual( numportals * 2, qtrue, CreatePassages );
+	ProfileEnd();
 
 	Sys_Printf( "\n--- PassagePortalFlow (%d) ---\n", numportals * 2 );
+	ProfileBegin( "PassagePortalFlow" );
 	RunThreadsOnIndividual( numportals * 2, qtrue, PassagePortalFlow );
+	ProfileEnd();
 #endif
 }
 
@@ -331,12 +341,22 @@ void CalcVis( void ){
 
 
 	Sys_Printf( "\n--- BasePortalVis (%d) ---\n", numportals * 2 );
+	ProfileBegin( "BasePortalVis" );
 	RunThreadsOnIndividual( numportals * 2, qtrue, BasePortalVis );
+	ProfileEnd();
+
+	/* restore the portals an earlier compile already flowed */
+	if ( incrementalVis && !fastvis ) {
+		ProfileBegin( "LoadVisCache" );
+		LoadVisCache( visCachePath );
+		ProfileEnd();
+	}
 
 //	RunThreadsOnIndividual (numportals*2, qtrue, BetterPortalVis);
 
 	SortPortals();
 
+	AllocVisStackPools();
 	if ( fastvis ) {
 		CalcFastVis();
 	}
@@ -349,12 +369,20 @@ void CalcVis( void ){
 	else {
 		CalcPassagePortalVis();
 	}
+	FreeVisStackPools();
+
+	if ( incrementalVis && !fastvis ) {
+		WriteVisCache( visCachePath );
+	}
 	//
 	// assemble the leaf vis lists by oring and compressing the portal lists
 	//
 	Sys_Printf( "creating leaf vis...\n" );
+	ProfileBegin( "ClusterMerge" );
 	for ( i = 0; i < portalclusters; i++ )
 		ClusterMerge( i );
+	ProfileAddWork( portalclusters );
+	ProfileEnd();
 
 	totalvis = 0;
 	totalvis2 = 0;
@@ -934,6 +962,7 @@ void LoadPortals( char *name ){
 
 	portalbytes = ( ( numportals * 2 + 63 ) & ~63 ) >> 3;
 	portallongs = portalbytes / sizeof( long );
+	portalwords = portalbytes / sizeof( uint64_t );
 
 	// each file portal is split into two memory portals
 	portals = safe_malloc( 2 * numportals * sizeof( vportal_t ) );
@@ -1140,6 +1169,10 @@ int VisMain( int argc, char **argv ){
 			Sys_Printf( "saveprt = true\n" );
 			saveprt = qtrue;
 		}
+		else if ( !strcmp( argv[i],"-incremental" ) ) {
+			Sys_Printf( "incremental = true\n" );
+			incrementalVis = qtrue;
+		}
 		else if ( !strcmp( argv[ i ], "-v" ) ) {
 			debugCluster = qtrue;
 			Sys_Printf( "Extra verbous mode enabled\n" );
@@ -1188,7 +1221,13 @@ int VisMain( int argc, char **argv ){
 		strcat( portalFilePath, ".prt" );
 	}
 	Sys_Printf( "Loading %s\n", portalFilePath );
+	strcpy( visCachePath, portalFilePath );
+	StripExtension( visCachePath );
+	strcat( visCachePath, ".viscache" );
+	ProfileBegin( "LoadPortals" );
 	LoadPortals( portalFilePath );
+	ProfileAddWork( numportals );
+	ProfileEnd();
 
 	/* ydnar: exit if no portals, hence no vis */
 	if ( numportals == 0 ) {
@@ -1225,7 +1264,9 @@ int VisMain( int argc, char **argv ){
 
 	/* write the bsp file */
 	Sys_Printf( "Writing %s\n", source );
+	ProfileBegin( "WriteBSPFile" );
 	WriteBSPFile( source );
+	ProfileEnd();
 
 	return 0;
 }
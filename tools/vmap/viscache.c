@@ -0,0 +1,412 @@
+/* -------------------------------------------------------------------------------
+
+   Copyright (C) 1999-2007 id Software, Inc. and contributors.
+   For a list of contributors, see the accompanying CONTRIBUTORS file.
+
+   This file is part of GtkRadiant.
+
+   GtkRadiant is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   GtkRadiant is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with GtkRadiant; if not, write to the Free Software
+   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+
+   ----------------------------------------------------------------------------------
+
+   This code has been altered significantly from its original form, to support
+   several games based on the Quake III Arena engine, in the form of "Q3Map2."
+
+   ------------------------------------------------------------------------------- */
+
+
+
+/* marker */
+#define VISCACHE_C
+
+
+
+/* dependencies */
+#include "vmap.h"
+
+
+
+/*
+   incremental vis cache
+
+   -vis -incremental keeps each portal's flood and vis vectors next to the .prt.
+   portals are matched between compiles by a key hashed from the portal winding
+   and the windings of every portal in the leaf it leads into, so renumbering
+   does not matter. a portal keeps its old vis only if it matched, its new flood
+   names exactly the portals its old one did and every one of those matched too:
+   then every leaf its flow can reach is unchanged.
+ */
+
+#define VISCACHE_IDENT      ( ( 'C' << 24 ) + ( 'F' << 16 ) + ( 'V' << 8 ) + 'P' )
+#define VISCACHE_VERSION    1
+
+typedef struct visCacheHeader_s
+{
+	int ident;
+	int version;
+	int mode;                           /* which flow made the vis vectors */
+	int numPortals;                     /* memory portals, twice the file portals */
+	int portalBytes;
+}
+visCacheHeader_t;
+
+typedef struct visCacheKey_s
+{
+	uint64_t key;
+	int num;
+}
+visCacheKey_t;
+
+static uint64_t *portalKeys;
+static byte *passageNeeded;             /* portals some recomputed flow may pass through */
+
+
+
+/*
+   HashBytes()
+   64-bit FNV-1a
+ */
+
+static uint64_t HashBytes( uint64_t hash, const void *data, int size ){
+	const byte *b = data;
+	int i;
+
+	for ( i = 0; i < size; i++ )
+	{
+		hash ^= b[ i ];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+
+
+/*
+   WindingKey()
+   hashes a portal's own geometry, the two sides of a portal differ by plane
+ */
+
+static uint64_t WindingKey( vportal_t *p ){
+	uint64_t hash;
+
+	hash = 0xcbf29ce484222325ULL;
+	hash = HashBytes( hash, &p->winding->numpoints, sizeof( p->winding->numpoints ) );
+	hash = HashBytes( hash, p->winding->points, p->winding->numpoints * sizeof( vec3_t ) );
+	hash = HashBytes( hash, &p->plane.normal, sizeof( p->plane.normal ) );
+	hash = HashBytes( hash, &p->plane.dist, sizeof( p->plane.dist ) );
+	return hash;
+}
+
+
+
+/*
+   HashPortals()
+   keys every portal by its winding and the portals of the leaf it leads into
+ */
+
+static void HashPortals( void ){
+	int i, j;
+	uint64_t *windingKeys, *leafKeys;
+	vportal_t *p;
+	leaf_t *leaf;
+
+
+	windingKeys = safe_malloc( numportals * 2 * sizeof( *windingKeys ) );
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+		windingKeys[ i ] = p->removed ? 0 : WindingKey( p );
+
+	/* summed, so the order of the leaf's portal list does not matter */
+	leafKeys = safe_malloc( portalclusters * sizeof( *leafKeys ) );
+	for ( i = 0, leaf = leafs; i < portalclusters; i++, leaf++ )
+	{
+		leafKeys[ i ] = 0;
+		for ( j = 0; j < leaf->numportals; j++ )
+		{
+			if ( !leaf->portals[ j ]->removed ) {
+				leafKeys[ i ] += windingKeys[ leaf->portals[ j ] - portals ];
+			}
+		}
+	}
+
+	portalKeys = safe_malloc( numportals * 2 * sizeof( *portalKeys ) );
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+		portalKeys[ i ] = p->removed ? 0 : HashBytes( windingKeys[ i ], &leafKeys[ p->leaf ], sizeof( leafKeys[ p->leaf ] ) );
+
+	free( windingKeys );
+	free( leafKeys );
+}
+
+
+
+/*
+   VisCacheMode()
+   old vis vectors are only reused by the flow that made them
+ */
+
+static int VisCacheMode( void ){
+	if ( noPassageVis ) {
+		return 1;
+	}
+	if ( passageVisOnly ) {
+		return 2;
+	}
+	return 3;
+}
+
+
+
+/*
+   TranslatePortalBits()
+   renumbers an old portal vector, returns qfalse if it names a portal that did not survive
+ */
+
+static qboolean TranslatePortalBits( const byte *from, int fromBytes, const int *oldToNew, byte *to ){
+	int i, j, n;
+
+
+	memset( to, 0, portalbytes );
+	for ( i = 0; i < fromBytes; i++ )
+	{
+		if ( !from[ i ] ) {
+			continue;
+		}
+		for ( j = 0; j < 8; j++ )
+		{
+			if ( !( from[ i ] & ( 1 << j ) ) ) {
+				continue;
+			}
+			n = oldToNew[ i * 8 + j ];
+			if ( n < 0 ) {
+				return qfalse;
+			}
+			to[ n >> 3 ] |= 1 << ( n & 7 );
+		}
+	}
+	return qtrue;
+}
+
+
+
+static int CompareVisCacheKeys( const void *a, const void *b ){
+	const visCacheKey_t *ka = a, *kb = b;
+
+	if ( ka->key < kb->key ) {
+		return -1;
+	}
+	if ( ka->key > kb->key ) {
+		return 1;
+	}
+	return ka->num - kb->num;
+}
+
+
+
+/*
+   LoadVisCache()
+   restores the vis of every unchanged portal and marks it done
+   needs the portalflood vectors of this compile, so it runs after BasePortalVis
+ */
+
+void LoadVisCache( const char *path ){
+	int i, j, k, size, numOld, numKeys, reused, recomputed;
+	byte *buffer, *oldFlood, *oldVis, *flood;
+	uint64_t *oldKeys;
+	int *oldToNew, *newToOld;
+	visCacheHeader_t header;
+	visCacheKey_t *keys, find, *found;
+	vportal_t *p;
+
+
+	HashPortals();
+
+	/* until a portal is proven unchanged, every portal may be passed through */
+	passageNeeded = safe_malloc( portalbytes );
+	memset( passageNeeded, 0xFF, portalbytes );
+
+	size = TryLoadFile( path, (void**) &buffer );
+	if ( size < 0 ) {
+		Sys_Printf( "No vis cache %s, computing all portals\n", path );
+		return;
+	}
+	if ( size < (int) sizeof( header ) ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: %s is truncated, ignoring it\n", path );
+		free( buffer );
+		return;
+	}
+	memcpy( &header, buffer, sizeof( header ) );
+	if ( header.ident != VISCACHE_IDENT || header.version != VISCACHE_VERSION ||
+		 header.numPortals < 0 || header.portalBytes * 8 < header.numPortals ||
+		 size != (int) sizeof( header ) + header.numPortals * ( (int) sizeof( uint64_t ) + 2 * header.portalBytes ) ) {
+		Sys_FPrintf( SYS_WRN, "WARNING: %s is not a vis cache of this version, ignoring it\n", path );
+		free( buffer );
+		return;
+	}
+	if ( header.mode != VisCacheMode() ) {
+		Sys_Printf( "Vis cache %s was made by another vis mode, computing all portals\n", path );
+		free( buffer );
+		return;
+	}
+
+	numOld = header.numPortals;
+	oldKeys = (uint64_t *) ( buffer + sizeof( header ) );
+	oldFlood = (byte *) ( oldKeys + numOld );
+	oldVis = oldFlood + numOld * header.portalBytes;
+
+	/* match old portals to new ones by key, a key seen twice matches nothing */
+	keys = safe_malloc( ( numOld > 0 ? numOld : 1 ) * sizeof( *keys ) );
+	for ( i = numKeys = 0; i < numOld; i++ )
+	{
+		if ( oldKeys[ i ] ) {
+			keys[ numKeys ].key = oldKeys[ i ];
+			keys[ numKeys ].num = i;
+			numKeys++;
+		}
+	}
+	qsort( keys, numKeys, sizeof( *keys ), CompareVisCacheKeys );
+	for ( i = 0; i + 1 < numKeys; i++ )
+	{
+		if ( keys[ i ].key == keys[ i + 1 ].key ) {
+			keys[ i ].num = keys[ i + 1 ].num = -1;
+		}
+	}
+
+	/* covers the padding bits of the old vectors too, which are never set */
+	oldToNew = safe_malloc( ( header.portalBytes * 8 + 1 ) * sizeof( *oldToNew ) );
+	newToOld = safe_malloc( numportals * 2 * sizeof( *newToOld ) );
+	for ( i = 0; i < header.portalBytes * 8; i++ )
+		oldToNew[ i ] = -1;
+	for ( i = 0; i < numportals * 2; i++ )
+	{
+		newToOld[ i ] = -1;
+		if ( !portalKeys[ i ] ) {
+			continue;
+		}
+		find.key = portalKeys[ i ];
+		find.num = 0;
+		for ( j = 0, k = numKeys; j < k; )
+		{
+			int mid = ( j + k ) / 2;
+			if ( keys[ mid ].key < find.key ) {
+				j = mid + 1;
+			}
+			else{
+				k = mid;
+			}
+		}
+		found = ( j < numKeys && keys[ j ].key == find.key ) ? &keys[ j ] : NULL;
+		if ( found && found->num >= 0 && oldToNew[ found->num ] < 0 ) {
+			newToOld[ i ] = found->num;
+			oldToNew[ found->num ] = i;
+		}
+	}
+
+	/* a portal is unchanged if its flood is the translation of the old one */
+	flood = safe_malloc( portalbytes );
+	reused = recomputed = 0;
+	memset( passageNeeded, 0, portalbytes );
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+	{
+		if ( p->removed ) {
+			continue;
+		}
+
+		j = newToOld[ i ];
+		if ( j >= 0 &&
+			 TranslatePortalBits( oldFlood + j * header.portalBytes, header.portalBytes, oldToNew, flood ) &&
+			 !memcmp( flood, p->portalflood, portalbytes ) ) {
+			TranslatePortalBits( oldVis + j * header.portalBytes, header.portalBytes, oldToNew, p->portalvis );
+			p->status = stat_done;
+			reused++;
+			continue;
+		}
+
+		/* recomputed, its flow may pass through itself and anything it floods */
+		recomputed++;
+		passageNeeded[ i >> 3 ] |= 1 << ( i & 7 );
+		for ( k = 0; k < portalbytes; k++ )
+			passageNeeded[ k ] |= p->portalflood[ k ];
+	}
+
+	Sys_Printf( "%9d portals reused from %s\n", reused, path );
+	Sys_Printf( "%9d portals to compute\n", recomputed );
+
+	free( flood );
+	free( oldToNew );
+	free( newToOld );
+	free( keys );
+	free( buffer );
+}
+
+
+
+/*
+   VisCachePassageNeeded()
+   returns qfalse if no flow of this compile can pass through the portal
+ */
+
+qboolean VisCachePassageNeeded( vportal_t *p ){
+	int num;
+
+	if ( !passageNeeded ) {
+		return qtrue;
+	}
+	num = p - portals;
+	return ( passageNeeded[ num >> 3 ] & ( 1 << ( num & 7 ) ) ) ? qtrue : qfalse;
+}
+
+
+
+/*
+   WriteVisCache()
+   stores the keys, flood and vis vectors of this compile for the next one
+ */
+
+void WriteVisCache( const char *path ){
+	int i;
+	FILE *f;
+	visCacheHeader_t header;
+	vportal_t *p;
+	byte *empty;
+
+
+	if ( !portalKeys ) {
+		HashPortals();
+	}
+
+	header.ident = VISCACHE_IDENT;
+	header.version = VISCACHE_VERSION;
+	header.mode = VisCacheMode();
+	header.numPortals = numportals * 2;
+	header.portalBytes = portalbytes;
+
+	Sys_Printf( "Writing %s\n", path );
+	f = SafeOpenWrite( path );
+	SafeWrite( f, &header, sizeof( header ) );
+	SafeWrite( f, portalKeys, numportals * 2 * sizeof( *portalKeys ) );
+	/* removed portals never got vectors */
+	empty = safe_malloc( portalbytes );
+	memset( empty, 0, portalbytes );
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+		SafeWrite( f, p->portalflood ? p->portalflood : empty, portalbytes );
+	for ( i = 0, p = portals; i < numportals * 2; i++, p++ )
+		SafeWrite( f, p->portalvis ? p->portalvis : empty, portalbytes );
+	fclose( f );
+	free( empty );
+
+	free( portalKeys );
+	free( passageNeeded );
+	portalKeys = NULL;
+	passageNeeded = NULL;
+}
@@ -71,6 +71,102 @@ int CountBits( byte *bits, int numbits ){
 	return c;
 }
 
+/*
+   mightsee stacks
+
+   every recursion level of the flow needs its own mightsee vector. they come from a
+   per-thread pool holding one portalbytes-sized row per depth, grown on demand and
+   reused by every portal the thread flows.
+ */
+
+static visStackPool_t *visStackPools;
+static int numVisStackPools;
+
+void AllocVisStackPools( void ){
+	numVisStackPools = numthreads > 1 ? numthreads : 1;
+	visStackPools = safe_malloc( numVisStackPools * sizeof( *visStackPools ) );
+	memset( visStackPools, 0, numVisStackPools * sizeof( *visStackPools ) );
+}
+
+void FreeVisStackPools( void ){
+	int i, j;
+
+	for ( i = 0; i < numVisStackPools; i++ )
+	{
+		for ( j = 0; j < visStackPools[ i ].maxRows; j++ )
+			free( visStackPools[ i ].rows[ j ] );
+		free( visStackPools[ i ].rows );
+	}
+	free( visStackPools );
+	visStackPools = NULL;
+	numVisStackPools = 0;
+}
+
+static visStackPool_t *ThreadVisStackPool( void ){
+	int i = ThreadNum();
+
+	if ( i < 0 || i >= numVisStackPools ) {
+		Error( "ThreadVisStackPool: thread %d has no pool", i );
+	}
+	return &visStackPools[ i ];
+}
+
+static byte *MightSeeForDepth( visStackPool_t *pool, int depth ){
+	int maxRows;
+
+	/* the rows themselves never move, only the table of them grows */
+	if ( depth >= pool->maxRows ) {
+		maxRows = pool->maxRows ? pool->maxRows : 64;
+		while ( depth >= maxRows )
+			maxRows *= 2;
+		pool->rows = realloc( pool->rows, maxRows * sizeof( *pool->rows ) );
+		if ( !pool->rows ) {
+			Error( "MightSeeForDepth: out of memory" );
+		}
+		memset( pool->rows + pool->maxRows, 0, ( maxRows - pool->maxRows ) * sizeof( *pool->rows ) );
+		pool->maxRows = maxRows;
+	}
+	if ( !pool->rows[ depth ] ) {
+		pool->rows[ depth ] = safe_malloc( portalbytes );
+	}
+	return pool->rows[ depth ];
+}
+
+/*
+   bitset kernels
+
+   portalbytes is padded to 64 bits, so the vectors are walked a word at a time.
+   each returns the bits of the result that the base portal cannot see yet.
+ */
+
+static inline uint64_t MightSeeAnd( byte *out, const byte *a, const byte *b, const byte *vis ){
+	uint64_t *o = (uint64_t *) out;
+	const uint64_t *x = (const uint64_t *) a, *y = (const uint64_t *) b, *v = (const uint64_t *) vis;
+	uint64_t more = 0;
+	int j;
+
+	for ( j = 0; j < portalwords; j++ )
+	{
+		o[ j ] = x[ j ] & y[ j ];
+		more |= o[ j ] & ~v[ j ];
+	}
+	return more;
+}
+
+static inline uint64_t MightSeeAnd3( byte *out, const byte *a, const byte *b, const byte *c, const byte *vis ){
+	uint64_t *o = (uint64_t *) out;
+	const uint64_t *x = (const uint64_t *) a, *y = (const uint64_t *) b, *z = (const uint64_t *) c, *v = (const uint64_t *) vis;
+	uint64_t more = 0;
+	int j;
+
+	for ( j = 0; j < portalwords; j++ )
+	{
+		o[ j ] = x[ j ] & y[ j ] & z[ j ];
+		more |= o[ j ] & ~v[ j ];
+	}
+	return more;
+}
+
 int c_fullskip;
 
 int c_chop, c_nochop;
@@ -425,8 +521,8 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 	vportal_t   *p;
 	visPlane_t backplane;
 	leaf_t      *leaf;
-	int i, j, n;
-	long        *test, *might, *prevmight, *vis, more;
+	int i, n;
+	byte        *test;
 	int pnum;
 
 	thread->c_chains++;
@@ -440,15 +536,13 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 	stack.leaf = leaf;
 	stack.portal = NULL;
 	stack.depth = prevstack->depth + 1;
+	stack.mightsee = MightSeeForDepth( thread->pool, stack.depth );
 
 #ifdef SEPERATORCACHE
 	stack.numseperators[0] = 0;
 	stack.numseperators[1] = 0;
 #endif
 
-	might = (long *)stack.mightsee;
-	vis = (long *)thread->base->portalvis;
-
 	// check all portals for flowing into other leafs
 	for ( i = 0; i < leaf->numportals; i++ )
 	{
@@ -483,22 +577,14 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
 
 		// if the portal can't see anything we haven't allready seen, skip it
 		if ( p->status == stat_done ) {
-			test = (long *)p->portalvis;
+			test = p->portalvis;
 		}
 		else
 		{
-			test = (long *)p->portalflood;
-		}
-
-		more = 0;
-		prevmight = (long *)prevstack->mightsee;
-		for ( j = 0; j < portallongs; j++ )
-		{
-			might[j] = prevmight[j] & test[j];
-			more |= ( might[j] & ~vis[j] );
+			test = p->portalflood;
 		}
 
-		if ( !more &&
+		if ( !MightSeeAnd( stack.mightsee, prevstack->mightsee, test, thread->base->portalvis ) &&
 		     ( thread->base->portalvis[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) {     // can't see anything new
 			continue;
 		}
@@ -649,7 +735,6 @@ void RecursiveLeafFlow( int leafnum, threaddata_t *thread, pstack_t *prevstack )
  */
 void PortalFlow( int portalnum ){
 	threaddata_t data;
-	int i;
 	vportal_t       *p;
 	int c_might, c_can;
 
@@ -664,6 +749,11 @@ void PortalFlow( int portalnum ){
 		return;
 	}
 
+	/* restored from the incremental vis cache */
+	if ( p->status == stat_done ) {
+		return;
+	}
+
 	p->status = stat_working;
 
 	c_might = CountBits( p->portalflood, numportals * 2 );
@@ -675,8 +765,8 @@ void PortalFlow( int portalnum ){
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
 	data.pstack_head.depth = 0;
-	for ( i = 0; i < portallongs; i++ )
-		( (long *)data.pstack_head.mightsee )[i] = ( (long *)p->portalflood )[i];
+	data.pstack_head.mightsee = p->portalflood;   /* only ever read */
+	data.pool = ThreadVisStackPool();
 
 	RecursiveLeafFlow( p->leaf, &data, &data.pstack_head );
 
@@ -698,8 +788,9 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
 	vportal_t   *p;
 	leaf_t      *leaf;
 	passage_t   *passage, *nextpassage;
-	int i, j;
-	long        *might, *vis, *prevmight, *cansee, *portalvis, more;
+	int i;
+	byte        *portalvis;
+	uint64_t more;
 	int pnum;
 
 	leaf = &leafs[portal->leaf];
@@ -708,8 +799,7 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
 
 	stack.next = NULL;
 	stack.depth = prevstack->depth + 1;
-
-	vis = (long *)thread->base->portalvis;
+	stack.mightsee = MightSeeForDepth( thread->pool, stack.depth );
 
 	passage = portal->passages;
 	nextpassage = passage;
@@ -730,30 +820,13 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
 		// mark the portal as visible
 		thread->base->portalvis[pnum >> 3] |= ( 1 << ( pnum & 7 ) );
 
-		prevmight = (long *)prevstack->mightsee;
-		cansee = (long *)passage->cansee;
-		might = (long *)stack.mightsee;
-		memcpy( might, prevmight, portalbytes );
 		if ( p->status == stat_done ) {
-			portalvis = (long *) p->portalvis;
+			portalvis = p->portalvis;
 		}
 		else{
-			portalvis = (long *) p->portalflood;
-		}
-		more = 0;
-		for ( j = 0; j < portallongs; j++ )
-		{
-			if ( *might ) {
-				*might &= *cansee++ & *portalvis++;
-				more |= ( *might & ~vis[j] );
-			}
-			else
-			{
-				cansee++;
-				portalvis++;
-			}
-			might++;
+			portalvis = p->portalflood;
 		}
+		more = MightSeeAnd3( stack.mightsee, prevstack->mightsee, passage->cansee, portalvis, thread->base->portalvis );
 
 		if ( !more ) {
 			// can't see anything new
@@ -774,7 +847,6 @@ void RecursivePassageFlow( vportal_t *portal, threaddata_t *thread, pstack_t *pr
  */
 void PassageFlow( int portalnum ){
 	threaddata_t data;
-	int i;
 	vportal_t       *p;
 //	int				c_might, c_can;
 
@@ -789,6 +861,11 @@ void PassageFlow( int portalnum ){
 		return;
 	}
 
+	/* restored from the incremental vis cache */
+	if ( p->status == stat_done ) {
+		return;
+	}
+
 	p->status = stat_working;
 
 //	c_might = CountBits (p->portalflood, numportals*2);
@@ -800,8 +877,8 @@ void PassageFlow( int portalnum ){
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
 	data.pstack_head.depth = 0;
-	for ( i = 0; i < portallongs; i++ )
-		( (long *)data.pstack_head.mightsee )[i] = ( (long *)p->portalflood )[i];
+	data.pstack_head.mightsee = p->portalflood;   /* only ever read */
+	data.pool = ThreadVisStackPool();
 
 	RecursivePassageFlow( p, &data, &data.pstack_head );
 
@@ -826,8 +903,9 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 	leaf_t      *leaf;
 	visPlane_t backplane;
 	passage_t   *passage, *nextpassage;
-	int i, j, n;
-	long        *might, *vis, *prevmight, *cansee, *portalvis, more;
+	int i, n;
+	byte        *portalvis;
+	uint64_t more;
 	int pnum;
 
 //	thread->c_chains++;
@@ -841,14 +919,13 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 	stack.leaf = leaf;
 	stack.portal = NULL;
 	stack.depth = prevstack->depth + 1;
+	stack.mightsee = MightSeeForDepth( thread->pool, stack.depth );
 
 #ifdef SEPERATORCACHE
 	stack.numseperators[0] = 0;
 	stack.numseperators[1] = 0;
 #endif
 
-	vis = (long *)thread->base->portalvis;
-
 	passage = portal->passages;
 	nextpassage = passage;
 	// check all portals for flowing into other leafs
@@ -865,30 +942,13 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
 			continue;   // can't possibly see it
 
 		}
-		prevmight = (long *)prevstack->mightsee;
-		cansee = (long *)passage->cansee;
-		might = (long *)stack.mightsee;
-		memcpy( might, prevmight, portalbytes );
 		if ( p->status == stat_done ) {
-			portalvis = (long *) p->portalvis;
+			portalvis = p->portalvis;
 		}
 		else{
-			portalvis = (long *) p->portalflood;
-		}
-		more = 0;
-		for ( j = 0; j < portallongs; j++ )
-		{
-			if ( *might ) {
-				*might &= *cansee++ & *portalvis++;
-				more |= ( *might & ~vis[j] );
-			}
-			else
-			{
-				cansee++;
-				portalvis++;
-			}
-			might++;
+			portalvis = p->portalflood;
 		}
+		more = MightSeeAnd3( stack.mightsee, prevstack->mightsee, passage->cansee, portalvis, thread->base->portalvis );
 
 		if ( !more && ( thread->base->portalvis[pnum >> 3] & ( 1 << ( pnum & 7 ) ) ) ) { // can't see anything new
 			continue;
@@ -1038,7 +1098,6 @@ void RecursivePassagePortalFlow( vportal_t *portal, threaddata_t *thread, pstack
  */
 void PassagePortalFlow( int portalnum ){
 	threaddata_t data;
-	int i;
 	vportal_t       *p;
 //	int				c_might, c_can;
 
@@ -1053,6 +1112,11 @@ void PassagePortalFlow( int portalnum ){
 		return;
 	}
 
+	/* restored from the incremental vis cache */
+	if ( p->status == stat_done ) {
+		return;
+	}
+
 	p->status = stat_working;
 
 //	c_might = CountBits (p->portalflood, numportals*2);
@@ -1064,8 +1128,8 @@ void PassagePortalFlow( int portalnum ){
 	data.pstack_head.source = p->winding;
 	data.pstack_head.portalplane = p->plane;
 	data.pstack_head.depth = 0;
-	for ( i = 0; i < portallongs; i++ )
-		( (long *)data.pstack_head.mightsee )[i] = ( (long *)p->portalflood )[i];
+	data.pstack_head.mightsee = p->portalflood;   /* only ever read */
+	data.pool = ThreadVisStackPool();
 
 	RecursivePassagePortalFlow( p, &data, &data.pstack_head );
 
@@ -1353,6 +1417,11 @@ void CreatePassages( int portalnum ){
 		return;
 	}
 
+	/* -incremental: no flow of this compile passes through it */
+	if ( !VisCachePassageNeeded( portal ) ) {
+		return;
+	}
+
 	lastpassage = NULL;
 	leaf = &leafs[portal->leaf];
 	for ( i = 0; i < leaf->numportals; i++ )
@@ -73,7 +73,10 @@
 #include "vfs.h"
 #include "png.h"
 #include "md4.h"
+#include "strhash.h"
+#include "profile.h"
 #include <stdlib.h>
+#include <stdint.h>
 
 
 /* -------------------------------------------------------------------------------
@@ -128,11 +131,8 @@
 /* general */
 #define MAX_QPATH               64
 
-#define MAX_IMAGES              512
 #define DEFAULT_IMAGE           "*default"
 
-#define MAX_MODELS              512
-
 #define DEF_BACKSPLASH_FRACTION 0.05f   /* 5% backsplash by default */
 #define DEF_BACKSPLASH_DISTANCE 23
 
@@ -248,6 +248,8 @@
 #define LIGHT_Q3A_DEFAULT       ( LIGHT_ATTEN_ANGLE | LIGHT_ATTEN_DISTANCE | LIGHT_GRID | LIGHT_SURFACES | LIGHT_FAST )
 
 #define MAX_TRACE_TEST_NODES    256
+#define MAX_TRACE_PACKET        8       /* max rays traced together by TraceLinePacket() */
+#define LIGHT_TRACE_PENDING     2       /* PrepareLightContribution(): occlusion still needs tracing */
 #define DEFAULT_INHIBIT_RADIUS  1.5f
 
 #define LUXEL_EPSILON           0.125f
@@ -1264,7 +1266,7 @@ leaf_t;
 
 typedef struct pstack_s
 {
-	byte mightsee[ MAX_PORTALS / 8 ];
+	byte                *mightsee;      /* [portalbytes], from the thread's visStackPool_t */
 	struct pstack_s     *next;
 	leaf_t              *leaf;
 	vportal_t           *portal;        /* portal exiting */
@@ -1284,10 +1286,19 @@ typedef struct pstack_s
 pstack_t;
 
 
+typedef struct visStackPool_s
+{
+	byte                **rows;         /* one mightsee vector per recursion depth */
+	int maxRows;
+}
+visStackPool_t;
+
+
 typedef struct
 {
 	vportal_t           *base;
 	int c_chains;
+	visStackPool_t      *pool;
 	pstack_t pstack_head;
 }
 threaddata_t;
@@ -1326,6 +1337,7 @@ typedef struct light_s
 	float envelope2;                    /* ydnar: envelope squared (tiny optimization) */
 	vec3_t mins, maxs;                  /* ydnar: pvs envelope */
 	int cluster;                        /* ydnar: cluster light falls into */
+	int treeNode;                       /* leaf in the light tree, -1 if not clustered */
 
 	winding_t           *w;
 	vec3_t emitColor;                   /* full out-of-gamut value */
@@ -1336,12 +1348,17 @@ typedef struct light_s
 light_t;
 
 
+typedef struct shadowCache_s shadowCache_t;
+
 typedef struct
 {
 	/* constant input */
 	qboolean testOcclusion, forceSunlight, testAll;
 	int recvShadows;
 
+	shadowCache_t       *shadowCache;   /* last occluders of this thread, NULL traces from scratch */
+	int shadowTile;                     /* traces in the same tile share cached occluders */
+
 	int numSurfaces;
 	int                 *surfaces;
 
@@ -1376,12 +1393,24 @@ typedef struct
 	vec_t forceSubsampling;           /* needs subsampling (alphashadow), value = max color contribution possible from it */
 
 	/* working data */
+	vec_t pendingAdd;                   /* light contribution waiting on the occlusion trace */
 	int numTestNodes;
 	int testNodes[ MAX_TRACE_TEST_NODES ];
 }
 trace_t;
 
 
+/* a raw lightmap's cuts through the light tree */
+typedef struct lightCut_s
+{
+	int first;                          /* first tree light in the trace light list */
+	int blocksWide, numBlocks, rowBytes;
+	byte                *masks;         /* per cut light, a bit for every block it lights */
+	light_t             *nodeLights;    /* lights standing in for tree nodes */
+}
+lightCut_t;
+
+
 
 /* must be identical to bspDrawVert_t except for float color! */
 typedef struct
@@ -1411,6 +1440,13 @@ typedef struct
 }
 clipWork_t;
 
+/* skyline segment of an output lightmap (everything below y is taken) */
+typedef struct skylineNode_s
+{
+	int x, y, width;
+}
+skylineNode_t;
+
 /* ydnar: new lightmap handling code */
 typedef struct outLightmap_s
 {
@@ -1421,6 +1457,8 @@ typedef struct outLightmap_s
 	int numShaders;
 	shaderInfo_t        *shaders[ MAX_LIGHTMAP_SHADERS ];
 	byte                *lightBits;
+	int numSkylineNodes;
+	skylineNode_t       *skyline;
 #ifdef LIGHTMAP_HDR
 	float               *bspLightHDR;
 #else
@@ -1513,9 +1551,16 @@ surfaceInfo_t;
 
 /* main.c */
 vec_t                       Random( void );
+void                        SeedRandom( int seed );
 char                        *Q_strncpyz( char *dst, const char *src, size_t len );
 char                        *Q_strcat( char *dst, size_t dlen, const char *src );
 char                        *Q_strncat( char *dst, size_t dlen, const char *src, size_t slen );
+qboolean                    ReadGeneralOptions( int argc, char **argv );
+int                         VMapMain( int argc, char **argv, double start );
+
+/* daemon.c */
+int                         DaemonMain( int argc, char **argv );
+int                         DaemonClient( int argc, char **argv );
 
 /* help.c */
 void                        HelpMain(const char* arg);
@@ -1693,6 +1738,7 @@ void                        PicoPrintFunc( int level, const char *str );
 void                        PicoLoadFileFunc( const char *name, byte **buffer, int *bufSize );
 picoModel_t                 *FindModel( const char *name, int frame );
 picoModel_t                 *LoadModel( const char *name, int frame );
+void                        UnloadModel( picoModel_t *model );
 void                        InsertModel( const char *name, int skin, int frame, m4x4_t transform, remap_t *remap, shaderInfo_t *celShader, int eNum, int castShadows, int recvShadows, int spawnFlags, float lightmapScale, int lightmapSampleSize, float shadeAngle );
 void                        AddTriangleModels( entity_t *e );
 
@@ -1787,23 +1833,64 @@ void                        BasePortalVis( int portalnum );
 void                        BetterPortalVis( int portalnum );
 void                        PortalFlow( int portalnum );
 void                        PassagePortalFlow( int portalnum );
+void                        AllocVisStackPools( void );
+void                        FreeVisStackPools( void );
+
+/* viscache.c */
+void                        LoadVisCache( const char *path );
+void                        WriteVisCache( const char *path );
+qboolean                    VisCachePassageNeeded( vportal_t *p );
 
 
 
 /* light.c  */
 float                       PointToPolygonFormFactor( const vec3_t point, const vec3_t normal, const winding_t *w );
+int                         PrepareLightContribution( trace_t *trace );
+int                         FinishLightContribution( trace_t *trace );
 int                         LightContributionToSample( trace_t *trace );
 void LightingAtSample( trace_t * trace, byte styles[ MAX_LIGHTMAPS ], vec3_t colors[ MAX_LIGHTMAPS ] );
 int                         LightContributionToPoint( trace_t *trace );
+qboolean                    GridPointTraced( int num );
+void                        SetGridPointTraced( int num );
 int                         LightMain( int argc, char **argv );
 
 
 /* light_trace.c */
 void                        SetupTraceNodes( void );
 void                        TraceLine( trace_t *trace );
+void                        TraceLinePacket( trace_t **traces, int numTraces );
+shadowCache_t               *ThreadShadowCache( void );
+void                        ShadowCacheStats( void );
 float                       SetupTrace( trace_t *trace );
 
 
+/* light_tree.c */
+void                        SetupLightTree( void );
+lightCut_t                  *CutLightTree( rawLightmap_t *lm, trace_t *trace );
+qboolean                    LightCutSkips( const lightCut_t *lc, int light, int x, int y );
+void                        FreeLightCut( lightCut_t *lc );
+void                        LightTreeStats( void );
+
+
+/* light_shard.c */
+void                        SetupLightShards( const char *BSPFilePath );
+qboolean                    ShardOwnsRawLightmap( int num );
+qboolean                    ShardOwnsGridPoint( int num );
+void                        WriteLightShard( qboolean finished );
+void                        ReadLightState( void );
+qboolean                    MergeLightShards( qboolean fastAllocate );
+void                        SetupLightCheckpoint( const char *BSPFilePath );
+int                         ResumeLightCheckpoint( void );
+void                        StartLightCheckpointPass( int pass );
+void                        BeginLightCheckpointStage( void );
+void                        EndLightCheckpointStage( void );
+void                        CheckpointRawLightmap( int num );
+void                        CheckpointGridPoint( int num );
+const byte                  *CheckpointedRawLightmaps( void );
+const byte                  *CheckpointedGridPoints( void );
+void                        RemoveLightCheckpoint( void );
+
+
 /* light_bounce.c */
 qboolean RadSampleImage( byte * pixels, int width, int height, float st[ 2 ], float color[ 4 ] );
 void                        RadLightForTriangles( int num, int lightmapNum, rawLightmap_t *lm, shaderInfo_t *si, float scale, float subdivide, clipWork_t *cw );
@@ -1817,6 +1904,8 @@ void                        ColorToBytes( const float *color, byte *colorBytes,
 void                        ColorToHDR( const float *color, float *colorBytes );
 void                        SmoothNormals( void );
 
+int                         RawLightmapCost( int num );
+int                         DrawSurfaceCost( int num );
 void                        MapRawLightmap( int num );
 
 void                        SetupDirt();
@@ -1830,6 +1919,7 @@ float                       FloodLightForSample( trace_t *trace, float floodLigh
 void                        FloodLightRawLightmap( int num );
 
 void                        IlluminateRawLightmap( int num );
+void                        AdaptiveSampleStats( void );
 void                        IlluminateVertexes( int num );
 
 void                        SetupBrushesFlags( unsigned int mask_any, unsigned int test_any, unsigned int mask_all, unsigned int test_all );
@@ -1842,6 +1932,7 @@ int                         ClusterForPointExt( vec3_t point, float epsilon );
 int                         ClusterForPointExtFilter( vec3_t point, float epsilon, int numClusters, int *clusters );
 int                         ShaderForPointInLeaf( vec3_t point, int leafNum, float epsilon, int wantContentFlags, int wantSurfaceFlags, int *contentFlags, int *surfaceFlags );
 void                        SetupEnvelopes( qboolean forGrid, qboolean fastFlag );
+void                        SetupClusterLights( qboolean forGrid );
 void                        FreeTraceLights( trace_t *trace );
 void                        CreateTraceLightsForBounds( vec3_t mins, vec3_t maxs, vec3_t normal, int numClusters, int *clusters, int flags, trace_t *trace );
 void                        CreateTraceLightsForSurface( int num, trace_t *trace );
@@ -1856,6 +1947,9 @@ int                         ImportLightmapsMain( int argc, char **argv );
 void                        SetupSurfaceLightmaps( void );
 void                        StitchSurfaceLightmaps( void );
 void                        StoreSurfaceLightmaps( qboolean fastAllocate );
+void                        AllocRawLightmapSamples( rawLightmap_t *lm );
+void                        FreeRawLightmapSamples( rawLightmap_t *lm );
+void                        SubsampleRawLightmap( rawLightmap_t *lm );
 
 
 /* exportents.c */
@@ -1867,6 +1961,7 @@ int                         ExportEntitiesMain( int argc, char **argv );
 void                        ImageFree( image_t *image );
 image_t                     *ImageFind( const char *filename );
 image_t                     *ImageLoad( const char *filename );
+time_t                      ImageFileTime( const char *name, char *filename );
 
 
 /* shaders.c */
@@ -1887,6 +1982,8 @@ shaderInfo_t                *CustomShader( shaderInfo_t *si, char *find, char *r
 void                        EmitVertexRemapShader( char *from, char *to );
 
 void                        LoadShaderInfo( void );
+qboolean                    ShaderInfoChanged( void );
+void                        ClearShaderInfo( void );
 shaderInfo_t                *ShaderInfoForShader( const char *shader, int force );
 shaderInfo_t                *ShaderInfoForShaderNull( const char *shader );
 
@@ -1966,10 +2063,14 @@ Q_EXTERN game_t             *game Q_ASSIGN( &games[ 0 ] );
 
 /* general */
 Q_EXTERN int numImages Q_ASSIGN( 0 );
-Q_EXTERN image_t images[ MAX_IMAGES ];
+Q_EXTERN int numImageSlots Q_ASSIGN( 0 );
+Q_EXTERN int allocatedImageSlots Q_ASSIGN( 0 );
+Q_EXTERN image_t            **images Q_ASSIGN( NULL );
 
 Q_EXTERN int numPicoModels Q_ASSIGN( 0 );
-Q_EXTERN picoModel_t        *picoModels[ MAX_MODELS ];
+Q_EXTERN int numPicoModelSlots Q_ASSIGN( 0 );
+Q_EXTERN int allocatedPicoModelSlots Q_ASSIGN( 0 );
+Q_EXTERN picoModel_t        **picoModels Q_ASSIGN( NULL );
 
 Q_EXTERN shaderInfo_t       *shaderInfo Q_ASSIGN( NULL );
 Q_EXTERN int numShaderInfo Q_ASSIGN( 0 );
@@ -1989,6 +2090,7 @@ Q_EXTERN float jitters[ MAX_JITTERS ];
 /* commandline arguments */
 Q_EXTERN qboolean verboseEntities Q_ASSIGN( qfalse );
 Q_EXTERN qboolean force Q_ASSIGN( qfalse );
+Q_EXTERN qboolean daemonJob Q_ASSIGN( qfalse );                     /* running a client's compile inside the daemon */
 Q_EXTERN qboolean infoMode Q_ASSIGN( qfalse );
 Q_EXTERN qboolean useCustomInfoParms Q_ASSIGN( qfalse );
 Q_EXTERN qboolean noprune Q_ASSIGN( qfalse );
@@ -2153,6 +2255,8 @@ Q_EXTERN qboolean mergevis;
 Q_EXTERN qboolean mergevisportals;
 Q_EXTERN qboolean nosort;
 Q_EXTERN qboolean saveprt;
+Q_EXTERN qboolean incrementalVis;
+Q_EXTERN char visCachePath[ 1024 ];
 Q_EXTERN qboolean hint;             /* ydnar */
 Q_EXTERN char inbase[ MAX_QPATH ];
 Q_EXTERN char globalCelShader[ MAX_QPATH ];
@@ -2182,7 +2286,7 @@ Q_EXTERN int testlevel;
 Q_EXTERN byte               *uncompressed;
 
 Q_EXTERN int leafbytes, leaflongs;
-Q_EXTERN int portalbytes, portallongs;
+Q_EXTERN int portalbytes, portallongs, portalwords;
 
 Q_EXTERN vportal_t          *sorted_portals[ MAX_MAP_PORTALS * 2 ];
 
@@ -2207,6 +2311,13 @@ Q_EXTERN qboolean noGridLighting Q_ASSIGN( qfalse );
 
 Q_EXTERN qboolean noTrace Q_ASSIGN( qfalse );
 Q_EXTERN qboolean noSurfaces Q_ASSIGN( qfalse );
+Q_EXTERN qboolean noPacketTrace Q_ASSIGN( qfalse );
+Q_EXTERN qboolean useShadowCache Q_ASSIGN( qfalse );
+Q_EXTERN qboolean noClusterLights Q_ASSIGN( qfalse );
+Q_EXTERN qboolean lightTree Q_ASSIGN( qfalse );
+Q_EXTERN float lightTreeError Q_ASSIGN( 0.002f );           /* largest node bound left in a light cut, relative to the estimated total */
+Q_EXTERN qboolean traceBVH Q_ASSIGN( qfalse );
+Q_EXTERN qboolean traceBenchmark Q_ASSIGN( qfalse );      /* compare ray throughput of the trace nodes and the bvh */
 Q_EXTERN qboolean patchShadows Q_ASSIGN( qfalse );
 
 Q_EXTERN qboolean deluxemap Q_ASSIGN( qfalse );
@@ -2220,10 +2331,21 @@ Q_EXTERN qboolean fastgrid Q_ASSIGN( qfalse );
 Q_EXTERN qboolean fastbounce Q_ASSIGN( qfalse );
 Q_EXTERN qboolean cheap Q_ASSIGN( qfalse );
 Q_EXTERN qboolean cheapgrid Q_ASSIGN( qfalse );
+Q_EXTERN qboolean adaptiveGrid Q_ASSIGN( qfalse );         /* trace a coarse grid and refine it where lighting changes */
+Q_EXTERN int adaptiveGridStep Q_ASSIGN( 8 );                /* grid points between coarse samples, a power of two */
+Q_EXTERN float adaptiveGridThreshold Q_ASSIGN( 4.0f );      /* largest byte error inside a cell that is still interpolated */
 Q_EXTERN int bounce Q_ASSIGN( 0 );
 Q_EXTERN qboolean bounceOnly Q_ASSIGN( qfalse );
 Q_EXTERN qboolean bouncing Q_ASSIGN( qfalse );
 Q_EXTERN qboolean bouncegrid Q_ASSIGN( qfalse );
+Q_EXTERN qboolean bounceCheckpoint Q_ASSIGN( qfalse );    /* write the bsp after every radiosity bounce */
+Q_EXTERN qboolean streamLightmaps Q_ASSIGN( qfalse );     /* light raw lightmaps one at a time, keeping only their bsp luxels */
+Q_EXTERN int lightShard Q_ASSIGN( -1 );                   /* shard of the raw lightmaps and grid points this process lights, -1 lights them all */
+Q_EXTERN int numLightShards Q_ASSIGN( 0 );
+Q_EXTERN int lightShardPass Q_ASSIGN( 0 );               /* radiosity bounce a shard lights, 0 is the direct light */
+Q_EXTERN qboolean lightShardMerge Q_ASSIGN( qfalse );    /* combine the shard files instead of lighting */
+Q_EXTERN int lightCheckpoint Q_ASSIGN( 0 );               /* seconds between light checkpoint writes, 0 disables them */
+Q_EXTERN qboolean lightResume Q_ASSIGN( qfalse );         /* pick up an interrupted compile from its checkpoint */
 Q_EXTERN qboolean normalmap Q_ASSIGN( qfalse );
 Q_EXTERN qboolean trisoup Q_ASSIGN( qfalse );
 Q_EXTERN qboolean shade Q_ASSIGN( qfalse );
@@ -2231,6 +2353,9 @@ Q_EXTERN float shadeAngleDegrees Q_ASSIGN( 0.0f );
 Q_EXTERN int superSample Q_ASSIGN( 0 );
 Q_EXTERN int lightSamples Q_ASSIGN( 1 );
 Q_EXTERN qboolean lightRandomSamples Q_ASSIGN( qfalse );
+Q_EXTERN qboolean lightAdaptiveSamples Q_ASSIGN( qfalse );
+Q_EXTERN float adaptiveThreshold Q_ASSIGN( 2.0f );          /* standard error of a luxel's brightness to stop sampling at */
+Q_EXTERN float adaptiveRayBudget Q_ASSIGN( 1.0f );          /* fraction of the uniform ray count -adaptivesamples may spend */
 Q_EXTERN int lightSamplesSearchBoxSize Q_ASSIGN( 1 );
 Q_EXTERN qboolean filter Q_ASSIGN( qfalse );
 Q_EXTERN qboolean dark Q_ASSIGN( qfalse );
@@ -2238,6 +2363,7 @@ Q_EXTERN qboolean sunOnly Q_ASSIGN( qfalse );
 Q_EXTERN int approximateTolerance Q_ASSIGN( 0 );
 Q_EXTERN qboolean noCollapse Q_ASSIGN( qfalse );
 Q_EXTERN int lightmapSearchBlockSize Q_ASSIGN( 0 );
+Q_EXTERN qboolean skylineAllocate Q_ASSIGN( qfalse );
 Q_EXTERN qboolean exportLightmaps Q_ASSIGN( qfalse );
 Q_EXTERN qboolean externalLightmaps Q_ASSIGN( qfalse );
 Q_EXTERN qboolean externalHDRLightmaps Q_ASSIGN( qfalse );
@@ -2362,6 +2488,13 @@ Q_EXTERN byte               *opaqueBrushes;
 Q_EXTERN int numLights;
 Q_EXTERN int numCulledLights;
 
+/* lights each pvs cluster can see, as light numbers in light list order */
+Q_EXTERN light_t            **lightsByNum Q_ASSIGN( NULL );
+Q_EXTERN int numLightClusters Q_ASSIGN( 0 );
+Q_EXTERN int                *clusterNumLights Q_ASSIGN( NULL );
+Q_EXTERN int                **clusterLights Q_ASSIGN( NULL );
+Q_EXTERN qboolean clusterLightsForGrid Q_ASSIGN( qfalse );
+
 Q_EXTERN int gridBoundsCulled;
 Q_EXTERN int gridEnvelopeCulled;
 
@@ -38,6 +38,30 @@
 
 
 
+/*
+   HashBSPShaders()
+   brings the bsp shader name hash up to date, rebuilding it if the shader lump was replaced
+ */
+
+static strHash_t *bspShaderHash = NULL;
+static bspShader_t *hashedBSPShaders = NULL;
+static int numHashedBSPShaders = 0;
+
+static void HashBSPShaders( void ){
+	if ( bspShaderHash == NULL ) {
+		bspShaderHash = StrHashNew( 1024, qfalse );
+	}
+	if ( hashedBSPShaders != bspShaders || numHashedBSPShaders > numBSPShaders ) {
+		StrHashClear( bspShaderHash );
+		hashedBSPShaders = bspShaders;
+		numHashedBSPShaders = 0;
+	}
+	for ( ; numHashedBSPShaders < numBSPShaders; numHashedBSPShaders++ )
+		StrHashAdd( bspShaderHash, bspShaders[ numHashedBSPShaders ].shader, (void*) (size_t) numHashedBSPShaders );
+}
+
+
+
 /*
    EmitShader()
    emits a bsp shader entry
@@ -46,6 +70,7 @@
 int EmitShader( const char *shader, int *contentFlags, int *surfaceFlags ){
 	int i;
 	shaderInfo_t    *si;
+	strHashNode_t   *node;
 
 
 	/* handle special cases */
@@ -53,9 +78,12 @@ int EmitShader( const char *shader, int *contentFlags, int *surfaceFlags ){
 		shader = "noshader";
 	}
 
-	/* try to find an existing shader */
-	for ( i = 0; i < numBSPShaders; i++ )
+	/* try to find an existing shader (in emit order) */
+	HashBSPShaders();
+	for ( node = StrHashFirst( bspShaderHash, shader ); node != NULL; node = StrHashNext( bspShaderHash, node ) )
 	{
+		i = (int) (size_t) node->value;
+
 		/* ydnar: handle custom surface/content flags */
 		if ( surfaceFlags != NULL && bspShaders[ i ].surfaceFlags != *surfaceFlags ) {
 			continue;
@@ -74,6 +102,7 @@ int EmitShader( const char *shader, int *contentFlags, int *surfaceFlags ){
 	si = ShaderInfoForShader( shader, 0 );
 
 	/* emit a new shader */
+	i = numBSPShaders;
 	AUTOEXPAND_BY_REALLOC_BSP( Shaders, 1024 );
 
 	numBSPShaders++;
@@ -404,6 +433,7 @@ void BeginBSPFile( void ){
 void EndBSPFile( qboolean do_write, const char *BSPFilePath, const char *surfaceFilePath ){
 
 	Sys_FPrintf( SYS_VRB, "--- EndBSPFile ---\n" );
+	ProfileBegin( "EndBSPFile" );
 
 	EmitPlanes();
 
@@ -418,6 +448,8 @@ void EndBSPFile( qboolean do_write, const char *BSPFilePath, const char *surface
 		Sys_Printf( "Writing %s\n", BSPFilePath );
 		WriteBSPFile( BSPFilePath );
 	}
+
+	ProfileEnd();
 }
 
 